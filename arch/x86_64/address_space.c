@@ -0,0 +1,327 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mm/pmm.h>
+#include <mm/slab.h>
+#include <printk.h>
+#include <smp.h>
+
+#include <arch/address_space.h>
+#include <arch/cpu.h>
+#include <arch/paging.h>
+#include <arch/tlb.h>
+#include <arch/tsc.h>
+
+/**
+ * @brief ASID allocator of a single CPU. ASIDs are handed out in order; when they run out the
+ *        generation moves on, the whole TLB is flushed once, and every space has to take a new
+ *        ASID the next time it runs here.
+ */
+struct asid_cpu {
+    uint64_t generation;
+    uint32_t next;                                                                  /* next free ASID of this generation */
+    uint32_t reserved;
+    struct address_space *current;
+    uint64_t rollovers;
+} __cacheline_aligned;
+
+struct address_space kernel_address_space;
+int pcid_supported = 0, invpcid_supported = 0;
+
+static int pcid_enabled = 0;
+static struct asid_cpu asid_cpus[SMP_MAX_CPUS];
+
+/**
+ * @brief Detects PCID and INVPCID, wraps the kernel tables into `kernel_address_space` and
+ *        enables PCID on the boot CPU. Must run after `paging_init()`.
+ */
+void address_space_init(void) {
+    uint32_t eax, ebx, ecx, edx, max_leaf, cpu;
+
+    cpuid(0, 0, max_leaf, ebx, ecx, edx);
+    cpuid(CPUID_FEATURES, 0, eax, ebx, ecx, edx);
+    pcid_supported = !!(ecx & CPUID_FEATURES_ECX_PCID);
+    if (max_leaf >= CPUID_STRUCTURED_FEATURES) {
+        cpuid(CPUID_STRUCTURED_FEATURES, 0, eax, ebx, ecx, edx);
+        invpcid_supported = !!(ebx & CPUID_STRUCTURED_EBX_INVPCID);
+    }
+
+    kernel_address_space.pml4 = kernel_pml4;
+    kernel_address_space.cr3 = kernel_cr3;
+    kernel_address_space.tlb_generation = 0;
+    for (cpu = 0; cpu < SMP_MAX_CPUS; ++cpu) {                                      /* every CPU boots on ASID 0 of generation 1 */
+        asid_cpus[cpu].generation = 1;
+        asid_cpus[cpu].next = 1;
+        asid_cpus[cpu].current = &kernel_address_space;
+        kernel_address_space.contexts[cpu] = 1ULL << ASID_BITS;
+        kernel_address_space.flushed[cpu] = 0;
+    }
+
+    pcid_enabled = pcid_supported;
+    address_space_cpu_init();
+    printk("address_space: pcid %s, invpcid %s\n",
+           pcid_supported ? "on" : "off", invpcid_supported ? "on" : "off");
+}
+
+/**
+ * @brief Sets CR4.PCIDE on the calling CPU if the CPU supports it. Every AP calls this before
+ *        it switches address spaces.
+ */
+void address_space_cpu_init(void) {
+    if (pcid_supported) {
+        write_cr4(read_cr4() | CR4_PCIDE);                                          /* needs CR3[11:0] == 0, which the kernel CR3 has */
+    }
+}
+
+/**
+ * @brief Creates an address space with an empty user half.
+ *
+ * @return The new address space, or `NULL` if memory is exhausted.
+ */
+struct address_space *address_space_create(void) {
+    struct address_space *space;
+    uint32_t i;
+
+    space = kmalloc(sizeof(*space));
+    if (space == NULL) {
+        return NULL;
+    }
+
+    space->cr3 = paging_alloc_table();
+    if (space->cr3 == 0) {
+        kfree(space);
+        return NULL;
+    }
+
+    space->pml4 = phys_to_virt(space->cr3);
+    for (i = 0; i < PAGING_ENTRIES; ++i) {                                          /* kernel slots were all created by `paging_init()` */
+        space->pml4[i] = kernel_pml4[i];
+    }
+    for (i = 0; i < SMP_MAX_CPUS / 64; ++i) {
+        space->active.bits[i] = 0;
+    }
+    for (i = 0; i < SMP_MAX_CPUS; ++i) {
+        space->contexts[i] = 0;                                                     /* generation 0 never matches */
+        space->flushed[i] = 0;
+    }
+    space->tlb_generation = 0;
+    return space;
+}
+
+/**
+ * @brief Frees the tables of the user half and the space itself. The space must not be active
+ *        on any CPU.
+ */
+void address_space_destroy(struct address_space *space) {
+    uint32_t i;
+
+    if (space == NULL || space == &kernel_address_space) {
+        return;
+    }
+
+    for (i = 0; i < PAGING_ENTRIES; ++i) {
+        if ((space->pml4[i] & PTE_PRESENT) && space->pml4[i] != kernel_pml4[i]) {
+            paging_free_tables(space->pml4[i] & PTE_ADDRESS_MASK, PAGING_LEVELS - 1);
+        }
+    }
+    pmm_free(space->cr3, 0);
+    kfree(space);
+}
+
+/**
+ * @brief Drops the non-global TLB entries of every ASID on the calling CPU.
+ */
+void address_space_flush_all(void) {
+    uint64_t cr4;
+
+    if (invpcid_supported) {
+        invpcid(INVPCID_ALL_NON_GLOBAL, 0, 0);
+    } else if (pcid_supported) {
+        cr4 = read_cr4();                                                           /* toggling PGE flushes all PCIDs */
+        write_cr4(cr4 & ~CR4_PGE);
+        write_cr4(cr4);
+    } else {
+        write_cr3(read_cr3());
+    }
+}
+
+/**
+ * @brief Loads `next` on the calling CPU. If the CPU still holds an ASID of the current
+ *        generation for it, the switch keeps its TLB entries; otherwise a fresh ASID is taken,
+ *        and running out of them starts a new generation with a single full flush.
+ */
+void address_space_switch(struct address_space *next) {
+    struct address_space *prev;
+    struct asid_cpu *state;
+    uint64_t flags, context, generation;
+    uint32_t cpu;
+
+    flags = arch_irq_save();
+    cpu = smp_processor_id();
+    state = &asid_cpus[cpu];
+    prev = state->current;
+    if (prev == next) {
+        arch_irq_restore(flags);
+        return;
+    }
+
+    cpumask_set(&next->active, cpu);                                                /* seen by shootdowns from here on */
+    generation = __atomic_load_n(&next->tlb_generation, __ATOMIC_SEQ_CST);
+    if (!pcid_enabled) {
+        write_cr3(next->cr3);                                                       /* flushes everything but global pages */
+    } else {
+        context = next->contexts[cpu];
+        if ((context >> ASID_BITS) != state->generation || next->flushed[cpu] != generation) {
+            if (state->next == ASID_COUNT) {
+                ++state->generation;
+                ++state->rollovers;
+                state->next = 1;
+                address_space_flush_all();                                          /* ASIDs of the old generation may be reused now */
+            }
+            context = (state->generation << ASID_BITS) | state->next++;
+            next->contexts[cpu] = context;
+        }
+        write_cr3(next->cr3 | (context & ASID_MASK) | CR3_NO_FLUSH);                /* an ASID is never reused within a generation */
+    }
+    next->flushed[cpu] = generation;
+    cpumask_clear(&prev->active, cpu);
+    state->current = next;
+    arch_irq_restore(flags);
+}
+
+/**
+ * @brief Drops the non-global TLB entries of the address space loaded on the calling CPU.
+ */
+void address_space_flush_local(void) {
+    struct asid_cpu *state;
+    uint64_t flags, asid;
+
+    flags = arch_irq_save();
+    state = &asid_cpus[smp_processor_id()];
+    asid = state->current->contexts[smp_processor_id()] & ASID_MASK;
+    if (!pcid_enabled) {
+        write_cr3(read_cr3());
+    } else if (invpcid_supported) {
+        invpcid(INVPCID_SINGLE, asid, 0);
+    } else {
+        write_cr3(state->current->cr3 | asid);                                      /* without the no-flush bit */
+    }
+    arch_irq_restore(flags);
+}
+
+/**
+ * @brief Unmaps `[virt, virt + size)` from `space` and shoots the range down on every CPU that
+ *        has the space loaded.
+ */
+int32_t address_space_unmap(struct address_space *space, uint64_t virt, uint64_t size) {
+    int32_t ret;
+
+    ret = paging_unmap(space->pml4, virt, size);
+    if (ret == PAGING_SUCCESS) {
+        tlb_flush_range(space, virt, virt + size);
+    }
+    return ret;
+}
+
+/**
+ * @brief Gets the address space loaded on the calling CPU.
+ */
+struct address_space *address_space_current(void) {
+    return asid_cpus[smp_processor_id()].current;
+}
+
+#if defined(NICKEL_BENCH)
+#define ADDRESS_SPACE_BENCH_BASE        0x0000008000000000ULL                       /* PML4 slot 1, not used by the kernel */
+#define ADDRESS_SPACE_BENCH_PAGES       256                                         /* more than the L1 DTLB, less than the STLB */
+#define ADDRESS_SPACE_BENCH_ROUNDS      2000
+
+static uint64_t bench_frames[2][ADDRESS_SPACE_BENCH_PAGES];
+
+/**
+ * @brief Turns PCID use on or off on the calling CPU. Entries tagged while it was off could
+ *        outlive an unmap, so the generation moves on either way.
+ */
+static void address_space_bench_set_pcid(int enable) {
+    struct asid_cpu *state = &asid_cpus[smp_processor_id()];
+
+    address_space_switch(&kernel_address_space);
+    pcid_enabled = enable && pcid_supported;
+    state->next = ASID_COUNT;                                                       /* the next switch starts a new generation */
+    address_space_flush_all();
+}
+
+static void address_space_bench_run(struct address_space *spaces[2], const char *name) {
+    uint64_t start, switched, switch_cycles = 0, touch_cycles = 0;
+    uint32_t round, s, i;
+
+    for (round = 0; round < ADDRESS_SPACE_BENCH_ROUNDS; ++round) {
+        for (s = 0; s < 2; ++s) {
+            start = rdtsc();
+            address_space_switch(spaces[s]);
+            switched = rdtsc();
+            for (i = 0; i < ADDRESS_SPACE_BENCH_PAGES; ++i) {
+                (void)*(volatile uint64_t *)(ADDRESS_SPACE_BENCH_BASE + i * PAGE_SIZE);
+            }
+            touch_cycles += rdtsc() - switched;
+            switch_cycles += switched - start;
+        }
+    }
+    address_space_switch(&kernel_address_space);
+
+    printk("address_space: pcid %-3s switch %5lu ns, %4lu ns per page touched after it\n", name,
+           tsc_to_ns(switch_cycles) / (2 * ADDRESS_SPACE_BENCH_ROUNDS),
+           tsc_to_ns(touch_cycles / ADDRESS_SPACE_BENCH_PAGES) / (2 * ADDRESS_SPACE_BENCH_ROUNDS));
+}
+
+/**
+ * @brief Ping-pongs between two address spaces that touch a working set of their own and
+ *        prints the switch cost and the post-switch access cost with PCID on and off.
+ */
+void address_space_bench(void) {
+    struct address_space *spaces[2] = { NULL, NULL };
+    uint32_t s, i, mapped[2] = { 0, 0 };
+    int32_t ret = PAGING_SUCCESS;
+
+    for (s = 0; s < 2 && ret == PAGING_SUCCESS; ++s) {
+        spaces[s] = address_space_create();
+        if (spaces[s] == NULL) {
+            ret = PAGING_NO_MEMORY;
+            break;
+        }
+        for (i = 0; i < ADDRESS_SPACE_BENCH_PAGES; ++i, ++mapped[s]) {
+            bench_frames[s][i] = pmm_alloc(0);
+            if (bench_frames[s][i] == 0) {
+                ret = PAGING_NO_MEMORY;
+                break;
+            }
+            ret = paging_map(spaces[s]->pml4, ADDRESS_SPACE_BENCH_BASE + i * PAGE_SIZE, bench_frames[s][i],
+                             PAGE_SIZE, PTE_WRITE | PTE_NO_EXECUTE, PAGING_SIZE_4K);
+            if (ret < 0) {
+                pmm_free(bench_frames[s][i], 0);
+                break;
+            }
+        }
+    }
+
+    if (ret == PAGING_SUCCESS) {
+        printk("address_space: bench %u rounds, %u pages per space\n",
+               ADDRESS_SPACE_BENCH_ROUNDS, ADDRESS_SPACE_BENCH_PAGES);
+        if (pcid_supported) {
+            address_space_bench_set_pcid(1);
+            address_space_bench_run(spaces, "on");
+        }
+        address_space_bench_set_pcid(0);
+        address_space_bench_run(spaces, "off");
+        address_space_bench_set_pcid(1);
+    } else {
+        printk("address_space: bench setup failed (0x%x)\n", ret);
+    }
+
+    for (s = 0; s < 2; ++s) {
+        for (i = 0; i < mapped[s]; ++i) {
+            pmm_free(bench_frames[s][i], 0);
+        }
+        address_space_destroy(spaces[s]);
+    }
+}
+#endif
@@ -1,73 +1,115 @@
-
+// Application processor trampoline. `ap_startup .. ap_startup_end` is copied to
+// AP_TRAMPOLINE by `smp_boot_aps()`, so everything it touches before long mode is addressed
+// relative to that copy. The SIPI starts the AP in real mode at AP_TRAMPOLINE:0.
+// AP_TRAMPOLINE must match SMP_TRAMPOLINE_ADDRESS.
+.set AP_TRAMPOLINE, 0x8000
 
 .code16
-.globl ap_startup, ap_startup_end
+.globl ap_startup, ap_startup_end, ap_trampoline_data
 
-// .org 0x8000
 ap_startup:
-    // int3
     cli
+    cld
     xorw %ax, %ax
     movw %ax, %ds
     movw %ax, %es
-    movw %ax, %fs
-    movw %ax, %gs
-
-    movw $0x8000, %bp
-    movw %bp, %sp
-
-    movl $0xECEBCAFE, %eax
-
-    // cli
-    // pushfw
-    // popw %ax
-    // andw $0xFEFF, %ax
-    // pushw %ax
-    // popfw
-
-    // jmp ap_startup_halt
-
-// // enable protected mode
-//     movl %cr0, %eax
-//     orl $0x80000000, %eax
-//     movl %eax, %cr0
-
-//     lgdt ap_gdt32_reg
-
-// // setup stacks & prepare for lret
-//     // movw $0x7C00, %bp
-//     // movw %bp, %sp
-//     ljmpl $0x10, $ap_startup_32
-
-// .code32
-// ap_startup_32:
-//     cli
-//     movl $0x10, %eax
-//     movl %eax, %ds
-//     movl %eax, %es
-//     movl %eax, %fs
-//     movl %eax, %gs
-
-//     movl $0x8000, %ebp
-//     movl %ebp, %esp
-
-ap_startup_halt:
-    hlt
-    jmp ap_startup_halt
-
+    movw %ax, %ss
+
+// enable protected mode on the temporary GDT
+    lgdtl ap_gdt_reg - ap_startup + AP_TRAMPOLINE
+    movl %cr0, %eax
+    orl $0x1, %eax
+    movl %eax, %cr0
+    ljmpl $0x08, $(ap_startup_32 - ap_startup + AP_TRAMPOLINE)
+
+.code32
+ap_startup_32:
+    movw $0x10, %ax
+    movw %ax, %ds
+    movw %ax, %es
+    movw %ax, %ss
+
+// the boot CPU's CR4 (PAE, PGE, SSE), the trampoline PML4, EFER.LME/NXE, then paging
+    movl ap_trampoline_cr4 - ap_startup + AP_TRAMPOLINE, %eax
+    movl %eax, %cr4
+    movl ap_trampoline_pml4 - ap_startup + AP_TRAMPOLINE, %eax
+    movl %eax, %cr3
+    movl $0xC0000080, %ecx
+    movl ap_trampoline_efer - ap_startup + AP_TRAMPOLINE, %eax
+    xorl %edx, %edx
+    wrmsr
+    movl ap_trampoline_cr0 - ap_startup + AP_TRAMPOLINE, %eax
+    movl %eax, %cr0
+    ljmpl $0x18, $(ap_startup_64 - ap_startup + AP_TRAMPOLINE)
+
+.code64
+// the kernel image is mapped by the trampoline PML4 as well
+ap_startup_64:
+    movabsq $ap_long_mode, %rax
+    jmp *%rax
+
+// 0x08 is 32-bit code, 0x10 32-bit data and 0x18 64-bit code
 .align 16
-ap_gdt32_desc:
+ap_gdt:
     .quad 0
     .quad 0x00CF9A000000FFFF
     .quad 0x00CF92000000FFFF
-    .quad 0x00CFFA000000FFFF
-    .quad 0x00CFF2000000FFFF
-ap_gdt32_desc_end:
+    .quad 0x00AF9A000000FFFF
+ap_gdt_end:
 
 .align 4
     .word 0
-ap_gdt32_reg:
-    .word ap_gdt32_desc_end - ap_gdt32_desc - 1
-    .long ap_gdt32_desc
+ap_gdt_reg:
+    .word ap_gdt_end - ap_gdt - 1
+    .long ap_gdt - ap_startup + AP_TRAMPOLINE
+
+// filled in by `smp_boot_aps()`, see `struct ap_trampoline_data`
+.align 8
+ap_trampoline_data:
+ap_trampoline_pml4:
+    .long 0
+ap_trampoline_cr0:
+    .long 0
+ap_trampoline_cr4:
+    .long 0
+ap_trampoline_efer:
+    .long 0
 
 ap_startup_end:
+
+// Runs from the kernel image on the trampoline PML4: switches to the kernel CR3, GDT and IDT,
+// takes the next free stack and calls `ap_main()`. APs arrive here in parallel.
+.text
+.globl ap_long_mode
+ap_long_mode:
+    movq kernel_cr3(%rip), %rax
+    movq %rax, %cr3
+    lgdt gdtr(%rip)
+    lidt idtr(%rip)
+    movw $0x20, %ax
+    movw %ax, %ds
+    movw %ax, %es
+    movw %ax, %ss
+    movw %ax, %fs
+    movw %ax, %gs
+
+    movl $1, %eax
+    lock xaddl %eax, ap_next_stack(%rip)
+    cmpl ap_stack_count(%rip), %eax
+    jae ap_halt
+    leaq ap_stack_tops(%rip), %rcx
+    movq (%rcx, %rax, 8), %rsp
+    xorl %ebp, %ebp
+
+    pushq $0x10
+    leaq ap_reload_cs(%rip), %rax
+    pushq %rax
+    lretq
+
+ap_reload_cs:
+    call ap_main
+
+ap_halt:
+    cli
+    hlt
+    jmp ap_halt
@@ -0,0 +1,214 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include <acpi.h>
+#include <printk.h>
+#include <smp.h>
+
+#include <arch/clock.h>
+#include <arch/cpu.h>
+#include <arch/default_idt.h>
+#include <arch/paging.h>
+#include <arch/tsc.h>
+#include <arch/apic/apic.h>
+#include <arch/apic/ipi.h>
+#include <arch/apic/registers.h>
+
+extern void apic_spurious_entry(void);
+extern void apic_ping_entry(void);
+
+uint64_t apic_base = 0;
+int x2apic_supported = 0, x2apic_enabled = 0;
+
+static volatile uint32_t apic_ping_origin;                                          /* APIC ID of the CPU timing the round trip */
+static volatile uint64_t apic_pongs = 0;
+
+/**
+ * @brief Enables the APIC of the boot CPU, in x2APIC mode if the CPU has it, and maps the
+ *        xAPIC registers. Must run after `paging_init()`.
+ */
+void apic_init(void) {
+    union apic_base_msr base_msr;
+    uint32_t eax, ebx, ecx, edx;
+
+    cpuid(CPUID_FEATURES, 0, eax, ebx, ecx, edx);
+    x2apic_supported = !!(ecx & CPUID_FEATURES_ECX_X2APIC);
+
+    apic_read_base_msr(base_msr);
+    apic_base = (uint64_t)paging_map_mmio(base_msr.apic_base << 12, PAGE_SIZE);     /* unused in x2APIC mode, but cheap */
+    x2apic_enabled = x2apic_supported;
+
+    idt_set_gate(APIC_VECTOR_SPURIOUS, apic_spurious_entry);
+    idt_set_gate(APIC_VECTOR_PING, apic_ping_entry);
+    apic_cpu_init();
+    printk("apic: base 0x%lx, %s mode, id %u\n", (uint64_t)(base_msr.apic_base << 12),
+           x2apic_enabled ? "x2apic" : "xapic", apic_id());
+}
+
+/**
+ * @brief Puts the APIC of the calling CPU in the mode of the boot CPU, software-enables it
+ *        and accepts interrupts of any priority.
+ */
+void apic_cpu_init(void) {
+    union apic_base_msr base_msr;
+
+    apic_read_base_msr(base_msr);
+    if (base_msr.x2apic_enable && !x2apic_enabled) {
+        base_msr.apic_enable = 0;                                                   /* x2APIC can only be left through the disabled state */
+        base_msr.x2apic_enable = 0;
+        apic_write_base_msr(base_msr);
+    }
+    base_msr.apic_enable = 1;
+    base_msr.x2apic_enable = x2apic_enabled ? 1 : 0;
+    apic_write_base_msr(base_msr);
+
+    apic_write(APIC_REG_TASK_PRIORITY, 0);
+    apic_write(APIC_REG_SPURIOUS_VECTOR,
+        APIC_SPURIOUS_ENABLE
+        | APIC_VECTOR(APIC_VECTOR_SPURIOUS)
+    );
+}
+
+/**
+ * @brief Handler of `APIC_VECTOR_PING`. A CPU pinged by another one pings it back, so that
+ *        the CPU that started it can time the round trip.
+ */
+void apic_ping_interrupt(void) {
+    uint32_t origin = apic_ping_origin;
+
+    if (apic_id() != origin) {
+        apic_send_ipi(origin, APIC_VECTOR_PING);
+    } else {
+        __atomic_add_fetch(&apic_pongs, 1, __ATOMIC_RELEASE);
+    }
+    apic_eoi();
+}
+
+#if defined(NICKEL_BENCH)
+#define APIC_BENCH_ROUNDS               10000
+
+static struct {
+    uint32_t initiator;
+    uint32_t responder;                                                             /* CPU answering the pings, the initiator if alone */
+    uint32_t cpus;
+    volatile uint32_t target;                                                       /* APIC ID of the CPU answering the pings */
+    volatile uint32_t arrived;
+    volatile uint32_t phase;
+    volatile uint32_t stop;
+} apic_bench_state;
+
+static void apic_bench_barrier(void) {
+    uint32_t phase = __atomic_load_n(&apic_bench_state.phase, __ATOMIC_ACQUIRE);
+
+    if (__atomic_add_fetch(&apic_bench_state.arrived, 1, __ATOMIC_ACQ_REL) == apic_bench_state.cpus) {
+        apic_bench_state.arrived = 0;
+        __atomic_store_n(&apic_bench_state.phase, phase + 1, __ATOMIC_RELEASE);
+        return;
+    }
+    while (__atomic_load_n(&apic_bench_state.phase, __ATOMIC_ACQUIRE) == phase) {
+        cpu_relax();
+    }
+}
+
+/**
+ * @brief Switches the APICs of all online CPUs to `x2apic` mode. `x2apic_enabled` is global,
+ *        so every CPU takes part, and nobody touches the APIC between the barriers but to
+ *        reprogram its own. The switch resets the LVTs, so the timer is set up again with the
+ *        deadline it had.
+ */
+static void apic_bench_switch(int x2apic) {
+    uint32_t cpu = smp_processor_id();
+
+    apic_bench_barrier();
+    if (cpu == apic_bench_state.initiator) {
+        x2apic_enabled = x2apic;
+        apic_bench_state.stop = 0;
+    }
+    apic_bench_barrier();
+    apic_cpu_init();
+    clock_cpu_init();
+    if (cpu == apic_bench_state.responder) {
+        apic_bench_state.target = apic_id();
+    }
+    apic_bench_barrier();
+}
+
+static void apic_bench_run(const char *mode) {
+    uint64_t start, sent, pongs, send_cycles = 0, total_cycles = 0;
+    uint32_t round, target = apic_bench_state.target;
+
+    apic_ping_origin = apic_id();
+    arch_irq_enable();
+    for (round = 0; round < APIC_BENCH_ROUNDS; ++round) {
+        pongs = __atomic_load_n(&apic_pongs, __ATOMIC_ACQUIRE);
+        start = rdtsc();
+        apic_send_ipi(target, APIC_VECTOR_PING);
+        sent = rdtsc();
+        while (__atomic_load_n(&apic_pongs, __ATOMIC_ACQUIRE) == pongs) {
+            cpu_relax();
+        }
+        total_cycles += rdtsc() - start;
+        send_cycles += sent - start;
+    }
+    arch_irq_disable();
+
+    printk("apic: %-6s send %5lu ns, round trip %6lu ns (%s)\n", mode,
+           tsc_to_ns(send_cycles) / APIC_BENCH_ROUNDS, tsc_to_ns(total_cycles) / APIC_BENCH_ROUNDS,
+           apic_bench_state.responder != apic_bench_state.initiator ? "remote" : "self");
+}
+
+static void apic_bench_cpu(void *arg) {
+    int xapic_possible = *(int *)arg, original = x2apic_enabled, x2apic;
+    uint64_t flags;
+
+    flags = arch_irq_save();
+    for (x2apic = 0; x2apic < 2; ++x2apic) {
+        if ((!x2apic && !xapic_possible) || (x2apic && !x2apic_supported)) {
+            continue;
+        }
+
+        apic_bench_switch(x2apic);
+        if (smp_processor_id() == apic_bench_state.initiator) {
+            apic_bench_run(x2apic ? "x2apic" : "xapic");
+            __atomic_store_n(&apic_bench_state.stop, 1, __ATOMIC_RELEASE);
+        } else {
+            arch_irq_enable();                                                      /* the responder answers the pings */
+            while (!__atomic_load_n(&apic_bench_state.stop, __ATOMIC_ACQUIRE)) {
+                cpu_relax();
+            }
+            arch_irq_disable();
+        }
+    }
+    apic_bench_switch(original);
+    arch_irq_restore(flags);
+}
+
+/**
+ * @brief Measures the cost of sending an IPI and of an IPI round trip, to another CPU if one
+ *        is online and to the calling CPU otherwise, in xAPIC and in x2APIC mode. Every online
+ *        CPU switches modes with the calling one and is back in its mode on return.
+ */
+void apic_bench(void) {
+    int xapic_possible = 1;
+    uint32_t i;
+
+    for (i = 0; i < smp_cpu_count; ++i) {
+        if (processors[i].apic_id >= 0xFF) {
+            xapic_possible = 0;                                                     /* 8-bit IDs only, 0xFF is the broadcast */
+        }
+    }
+
+    apic_bench_state.initiator = smp_processor_id();
+    apic_bench_state.responder = apic_bench_state.initiator;                        /* alone, the CPU pings itself */
+    for (i = 0; i < smp_cpu_count; ++i) {
+        if (i != apic_bench_state.initiator && cpumask_test(&smp_online_mask, i)) {
+            apic_bench_state.responder = i;
+            break;
+        }
+    }
+    apic_bench_state.cpus = smp_online_count;
+    apic_bench_state.arrived = 0;
+    printk("apic: bench %u rounds, %s\n", APIC_BENCH_ROUNDS, xapic_possible ? "both modes" : "x2apic only");
+    smp_run_on_cpus(apic_bench_cpu, &xapic_possible, apic_bench_state.cpus);
+}
+#endif
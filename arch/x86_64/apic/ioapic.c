@@ -0,0 +1,162 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include <acpi.h>
+#include <printk.h>
+#include <spinlock.h>
+
+#include <arch/io.h>
+#include <arch/paging.h>
+#include <arch/apic/ioapic.h>
+
+/**
+ * @brief A mapped I/O APIC. Its registers are reached through a select/window pair, so every
+ *        access holds `ioapic_lock`.
+ */
+struct ioapic {
+    volatile uint32_t *base;
+    uint32_t gsi_base;
+    uint32_t entries;
+};
+
+static struct ioapic ioapics[ACPI_MAX_IO_APICS];
+static uint32_t ioapic_count = 0;
+static struct spinlock ioapic_lock = SPINLOCK_INIT;
+
+static uint32_t ioapic_read(const struct ioapic *ioapic, uint32_t reg) {
+    ioapic->base[IOAPIC_REG_SELECT / sizeof(uint32_t)] = reg;
+    return ioapic->base[IOAPIC_REG_WINDOW / sizeof(uint32_t)];
+}
+
+static void ioapic_write(const struct ioapic *ioapic, uint32_t reg, uint32_t value) {
+    ioapic->base[IOAPIC_REG_SELECT / sizeof(uint32_t)] = reg;
+    ioapic->base[IOAPIC_REG_WINDOW / sizeof(uint32_t)] = value;
+}
+
+/**
+ * @brief Finds the I/O APIC `gsi` is an input of.
+ *
+ * @param pin Receives the input number.
+ */
+static struct ioapic *ioapic_find(uint32_t gsi, uint32_t *pin) {
+    uint32_t i;
+
+    for (i = 0; i < ioapic_count; ++i) {
+        if (gsi >= ioapics[i].gsi_base && gsi < ioapics[i].gsi_base + ioapics[i].entries) {
+            *pin = gsi - ioapics[i].gsi_base;
+            return &ioapics[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Maps every I/O APIC in the MADT, masks all of their inputs and masks the legacy PICs,
+ *        so that nothing arrives until a driver routes it. Must run after `acpi_init()`.
+ *
+ * @return `IOAPIC_SUCCESS` on success, `IOAPIC_NOT_PRESENT` if the MADT lists none.
+ */
+int32_t ioapic_init(void) {
+    struct ioapic *ioapic;
+    uint32_t i, pin;
+    uint8_t *base;
+
+    outb(PIC_MASTER_DATA, 0xFF);                                                    /* the I/O APICs take over from here */
+    outb(PIC_SLAVE_DATA, 0xFF);
+
+    for (i = 0; i < acpi_ioapic_count; ++i) {
+        base = paging_map_mmio(acpi_ioapics[i].address & PAGE_MASK, PAGE_SIZE);
+        if (base == NULL) {
+            continue;
+        }
+
+        ioapic = &ioapics[ioapic_count++];
+        ioapic->base = (volatile uint32_t *)(base + (acpi_ioapics[i].address & ~PAGE_MASK));
+        ioapic->gsi_base = acpi_ioapics[i].gsi_base;
+        ioapic->entries = ((ioapic_read(ioapic, IOAPIC_VERSION) >> IOAPIC_VERSION_ENTRIES_SHIFT) & 0xFF) + 1;
+        for (pin = 0; pin < ioapic->entries; ++pin) {
+            ioapic_write(ioapic, IOAPIC_REDIRECTION(pin), IOAPIC_MASKED);
+            ioapic_write(ioapic, IOAPIC_REDIRECTION(pin) + 1, 0);
+        }
+        printk("ioapic: id %u at 0x%x, gsi %u-%u\n", acpi_ioapics[i].id, acpi_ioapics[i].address, ioapic->gsi_base,
+               ioapic->gsi_base + ioapic->entries - 1);
+    }
+    return ioapic_count ? IOAPIC_SUCCESS : IOAPIC_NOT_PRESENT;
+}
+
+/**
+ * @brief Translates an ISA IRQ into its GSI and input flags, applying the interrupt source
+ *        overrides of the MADT.
+ */
+uint32_t ioapic_isa_to_gsi(uint8_t irq, uint32_t *flags) {
+    uint32_t i, polarity, trigger;
+
+    *flags = IOAPIC_FLAGS_ISA;
+    for (i = 0; i < acpi_override_count; ++i) {
+        if (acpi_overrides[i].source != irq) {
+            continue;
+        }
+
+        polarity = acpi_overrides[i].flags & ACPI_MPS_INTI_FLAG_POLARITY_MASK;
+        trigger = acpi_overrides[i].flags & ACPI_MPS_INTI_FLAG_TRIGGER_MASK;
+        if (polarity == ACPI_MPS_INTI_FLAG_POLARITY_ACTIVE_LOW) {                   /* "conforms" means the ISA default */
+            *flags |= IOAPIC_POLARITY_LOW;
+        }
+        if (trigger == ACPI_MPS_INTI_FLAG_TRIGGER_LEVEL) {
+            *flags |= IOAPIC_TRIGGER_LEVEL;
+        }
+        return acpi_overrides[i].gsi;
+    }
+    return irq;                                                                     /* identity mapped unless overridden */
+}
+
+/**
+ * @brief Programs the redirection entry of `gsi` to deliver `vector` to the CPU with
+ *        `apic_id` in fixed, physical mode. The entry is left masked.
+ *
+ * @param flags `IOAPIC_POLARITY_LOW` and `IOAPIC_TRIGGER_LEVEL` bits.
+ * @return `IOAPIC_SUCCESS` on success, one of `IOAPIC_*` errors otherwise.
+ */
+int32_t ioapic_route(uint32_t gsi, uint8_t vector, uint32_t apic_id, uint32_t flags) {
+    struct ioapic *ioapic;
+    uint64_t irq_flags;
+    uint32_t pin;
+
+    if ((ioapic = ioapic_find(gsi, &pin)) == NULL) {
+        return IOAPIC_INVALID_GSI;
+    } else if (apic_id > IOAPIC_MAX_DESTINATION) {
+        return IOAPIC_UNREACHABLE;
+    }
+
+    spin_lock_irqsave(&ioapic_lock, irq_flags);
+    ioapic_write(ioapic, IOAPIC_REDIRECTION(pin), IOAPIC_MASKED);                   /* never half programmed while unmasked */
+    ioapic_write(ioapic, IOAPIC_REDIRECTION(pin) + 1, apic_id << IOAPIC_DESTINATION_SHIFT);
+    ioapic_write(ioapic, IOAPIC_REDIRECTION(pin), IOAPIC_MASKED | vector |
+                 (flags & (IOAPIC_POLARITY_LOW | IOAPIC_TRIGGER_LEVEL)));
+    spin_unlock_irqrestore(&ioapic_lock, irq_flags);
+    return IOAPIC_SUCCESS;
+}
+
+static void ioapic_set_mask(uint32_t gsi, int masked) {
+    struct ioapic *ioapic;
+    uint32_t pin, value;
+    uint64_t flags;
+
+    if ((ioapic = ioapic_find(gsi, &pin)) == NULL) {
+        return;
+    }
+
+    spin_lock_irqsave(&ioapic_lock, flags);
+    value = ioapic_read(ioapic, IOAPIC_REDIRECTION(pin));
+    value = masked ? value | IOAPIC_MASKED : value & ~IOAPIC_MASKED;
+    ioapic_write(ioapic, IOAPIC_REDIRECTION(pin), value);
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+}
+
+void ioapic_mask(uint32_t gsi) {
+    ioapic_set_mask(gsi, 1);
+}
+
+void ioapic_unmask(uint32_t gsi) {
+    ioapic_set_mask(gsi, 0);
+}
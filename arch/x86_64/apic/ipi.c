@@ -1,7 +1,38 @@
+#include <arch/cpu.h>
+#include <arch/apic/apic.h>
 #include <arch/apic/ipi.h>
 #include <arch/apic/registers.h>
 
-extern uint64_t apic_base;
+/**
+ * @brief Writes the ICR, which sends the IPI.
+ *
+ * In x2APIC mode the ICR is a single MSR, so destination and command go out in one `wrmsr`
+ * and there is no delivery status to wait for. That `wrmsr` is not serializing, so it is
+ * fenced to make the stores the target is about to look at visible first.
+ *
+ * In xAPIC mode the previous IPI must have left the APIC before the next one is written,
+ * which on current processors is always true by the time we get here, so the check is done
+ * up front rather than after every send.
+ */
+static void apic_write_icr(uint32_t destination, uint32_t command) {
+    uint64_t flags;
+    uint32_t status;
+
+    if (x2apic_enabled) {
+        asm volatile ("mfence\n" "lfence\n" : : : "memory");
+        wrmsr(X2APIC_MSR_INTERRUPT_COMMAND, APIC_DESTINATION_QWORD(destination) | command);
+        return;
+    }
+
+    flags = arch_irq_save();                                                        /* the two halves must not interleave with another send */
+    do {
+        apic_read_reg(apic_base, APIC_REG_INTERRUPT_COMMAND_LOW, uint32_t, status);
+    } while (status & APIC_DELIVERY_STATUS_PENDING);
+
+    apic_write_reg(apic_base, APIC_REG_INTERRUPT_COMMAND_HIGH, uint32_t, APIC_DESTINATION_DWORD(destination));
+    apic_write_reg(apic_base, APIC_REG_INTERRUPT_COMMAND_LOW, uint32_t, command);
+    arch_irq_restore(flags);
+}
 
 /**
  * @brief Sends an INIT Inter-Processor Interrupt (IPI) to the specified APIC ID. An INIT IPI
@@ -11,14 +42,8 @@ extern uint64_t apic_base;
  * @todo  Older processor needs level-triggered INIT IPI with an explicit deassert. Check
  *        processor type and implement accordingly.
  */
-inline void apic_send_init_ipi(uint8_t apic_id) {
-    uint32_t ret;
-
-    apic_write_reg(apic_base, APIC_REG_INTERRUPT_COMMAND_HIGH, uint32_t,
-        APIC_DESTINATION_DWORD(apic_id)
-    );
-
-    apic_write_reg(apic_base, APIC_REG_INTERRUPT_COMMAND_LOW, uint32_t,             /* Write behavior of ICR LOW triggers delivery of the IPI. */
+inline void apic_send_init_ipi(uint32_t apic_id) {
+    apic_write_icr(apic_id,
         APIC_DESTINATION_SHORTHAND_NONE
         | APIC_TRIGGER_MODE_EDGE
         | APIC_LEVEL_ASSERT
@@ -27,10 +52,6 @@ inline void apic_send_init_ipi(uint8_t apic_id) {
         | APIC_DELIVERY_MODE_INIT
         // | APIC_VECTOR(0)                                                         /* not used, reserved */
     );
-
-    do {
-        apic_read_reg(apic_base, APIC_REG_INTERRUPT_COMMAND_LOW, uint32_t, ret);
-    } while (ret & APIC_DELIVERY_STATUS_PENDING);                                   /* Waits for IPI delivery to complete */
 }
 
 /**
@@ -42,31 +63,71 @@ inline void apic_send_init_ipi(uint8_t apic_id) {
  * @param startup_ip The startup instruction pointer for the target CPU.
  * 
  * @note The `startup_ip` should be a **page-aligned** address, and the CPU will start executing
- *       from this address after receiving the IPI.
+ *       from this address after receiving the IPI. The caller waits between the INIT and the
+ *       SIPIs, so that a batch of CPUs shares one wait.
  */
-inline void apic_send_startup_ipi(uint8_t apic_id, uint8_t *startup_ip) {
-    uint32_t ret, i, j;
+inline void apic_send_startup_ipi(uint32_t apic_id, uint8_t *startup_ip) {
+    apic_write_icr(apic_id,
+        APIC_DESTINATION_SHORTHAND_NONE
+        | APIC_TRIGGER_MODE_EDGE
+        | APIC_LEVEL_ASSERT
+        | APIC_DESTINATION_MODE_PHYSICAL
+        | APIC_DELIVERY_MODE_STARTUP
+        | APIC_VECTOR((uint64_t)startup_ip >> 12)
+    );
+}
 
-    for (i = 0; i < 2; ++i) {
-        apic_write_reg(apic_base, APIC_REG_INTERRUPT_COMMAND_HIGH, uint32_t,
-            APIC_DESTINATION_DWORD(apic_id)
-        );
+/**
+ * @brief Sends an INIT IPI to every CPU but the caller with a single ICR write.
+ */
+void apic_send_init_ipi_all_but_self(void) {
+    apic_write_icr(0,
+        APIC_DESTINATION_SHORTHAND_ALL_EXCLUDING_SELF
+        | APIC_TRIGGER_MODE_EDGE
+        | APIC_LEVEL_ASSERT
+        | APIC_DELIVERY_MODE_INIT
+    );
+}
 
-        apic_write_reg(apic_base, APIC_REG_INTERRUPT_COMMAND_LOW, uint32_t,
-            APIC_DESTINATION_SHORTHAND_NONE
-            | APIC_TRIGGER_MODE_EDGE
-            | APIC_LEVEL_ASSERT
-            | APIC_DESTINATION_MODE_PHYSICAL
-            | APIC_DELIVERY_MODE_STARTUP
-            | APIC_VECTOR((uint64_t)startup_ip >> 12)
-        );
+/**
+ * @brief Sends a Startup IPI to every CPU but the caller with a single ICR write. CPUs that
+ *        are not waiting for one ignore it.
+ */
+void apic_send_startup_ipi_all_but_self(uint8_t *startup_ip) {
+    apic_write_icr(0,
+        APIC_DESTINATION_SHORTHAND_ALL_EXCLUDING_SELF
+        | APIC_TRIGGER_MODE_EDGE
+        | APIC_LEVEL_ASSERT
+        | APIC_DELIVERY_MODE_STARTUP
+        | APIC_VECTOR((uint64_t)startup_ip >> 12)
+    );
+}
 
-        do {                                                                        /* TODO: verify if we need for SIPI */
-            apic_read_reg(apic_base, APIC_REG_INTERRUPT_COMMAND_LOW, uint32_t, ret);
-        } while (ret & APIC_DELIVERY_STATUS_PENDING);
+/**
+ * @brief Sends a fixed IPI with `vector` to the CPU with `apic_id`. It returns as soon as the
+ *        IPI is handed to the APIC; whoever needs to know that the target handled it must
+ *        have the handler acknowledge it.
+ */
+void apic_send_ipi(uint32_t apic_id, uint8_t vector) {
+    apic_write_icr(apic_id,
+        APIC_DESTINATION_SHORTHAND_NONE
+        | APIC_TRIGGER_MODE_EDGE
+        | APIC_LEVEL_ASSERT
+        | APIC_DESTINATION_MODE_PHYSICAL
+        | APIC_DELIVERY_MODE_FIXED
+        | APIC_VECTOR(vector)
+    );
+}
 
-        for (j = 0; j < 100000000; ++j) {
-            __asm__ volatile("pause");
-        }
-    }
+/**
+ * @brief Sends a fixed IPI with `vector` to every CPU but the caller with a single ICR write.
+ */
+void apic_send_ipi_all_but_self(uint8_t vector) {
+    apic_write_icr(0,
+        APIC_DESTINATION_SHORTHAND_ALL_EXCLUDING_SELF
+        | APIC_TRIGGER_MODE_EDGE
+        | APIC_LEVEL_ASSERT
+        | APIC_DELIVERY_MODE_FIXED
+        | APIC_VECTOR(vector)
+    );
 }
@@ -0,0 +1,382 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include <acpi.h>
+#include <printk.h>
+#include <smp.h>
+
+#include <arch/clock.h>
+#include <arch/cpu.h>
+#include <arch/default_idt.h>
+#include <arch/hpet.h>
+#include <arch/io.h>
+#include <arch/tsc.h>
+#include <arch/apic/apic.h>
+#include <arch/apic/registers.h>
+
+extern void apic_timer_entry(void);
+
+/**
+ * @brief A free-running counter of known frequency the TSC and the APIC timer are measured
+ *        against.
+ */
+struct clock_reference {
+    const char *name;
+    uint64_t frequency;
+    uint64_t mask;                                                                  /* valid bits, the counter wraps past them */
+    uint64_t (*read)(void);
+};
+
+/**
+ * @brief Timer state of one CPU. `deadline` is 0 while nothing is armed.
+ */
+struct clock_event {
+    volatile uint64_t deadline;
+    volatile uint64_t fired;
+} __cacheline_aligned;
+
+int clock_source = CLOCK_SOURCE_TSC;
+uint64_t clock_base = 0;
+uint64_t clock_mult = 0;
+
+int tsc_invariant = 0, tsc_deadline_supported = 0;
+uint64_t apic_timer_frequency = 0;
+
+static uint64_t clock_tsc_base;                                                     /* TSC at `clock_base`, to place deadlines */
+static uint64_t clock_tsc_inverse;                                                  /* TSC ticks per ns, `CLOCK_INVERSE_SHIFT` fixed point */
+static uint64_t clock_apic_inverse;                                                 /* APIC timer ticks per ns, same */
+static struct clock_event clock_events[SMP_MAX_CPUS];
+static void (*clock_event_handler)(void) = NULL;
+
+static uint64_t clock_read_hpet(void) {
+    return hpet_read();
+}
+
+static uint64_t clock_read_pm_timer(void) {
+    return inl(acpi_pm_timer_port);
+}
+
+static uint64_t clock_read_tsc(void) {
+    return rdtsc();
+}
+
+/**
+ * @brief Picks the most precise reference the firmware describes. The PIT was only good
+ *        enough for `tsc_init()`; without anything better the TSC is taken as calibrated.
+ */
+static void clock_pick_reference(struct clock_reference *reference) {
+    if (hpet_init(acpi_hpet_address) == HPET_SUCCESS) {
+        reference->name = "hpet";
+        reference->frequency = hpet_frequency;
+        reference->mask = hpet_mask;
+        reference->read = clock_read_hpet;
+    } else if (acpi_pm_timer_port != 0) {
+        reference->name = "pm timer";
+        reference->frequency = ACPI_PM_TIMER_FREQUENCY;
+        reference->mask = acpi_pm_timer_32bit ? 0xFFFFFFFFULL : 0xFFFFFFULL;
+        reference->read = clock_read_pm_timer;
+    } else {
+        reference->name = "pit";
+        reference->frequency = tsc_frequency;
+        reference->mask = ~0ULL;
+        reference->read = clock_read_tsc;
+    }
+}
+
+/**
+ * @brief Counts the TSC and the APIC timer over `CLOCK_CALIBRATE_MS` of the reference. The
+ *        window starts on a tick of the reference so that the partial first tick is not
+ *        counted.
+ */
+static void clock_calibrate_once(const struct clock_reference *reference, uint64_t *tsc_hz, uint64_t *apic_hz) {
+    uint64_t ticks = reference->frequency * CLOCK_CALIBRATE_MS / 1000, first, start, now, elapsed;
+    uint64_t tsc_start, tsc_end;
+    uint32_t apic_start, apic_end;
+
+    apic_write(APIC_REG_TIMER_INITIAL_COUNT, 0xFFFFFFFF);
+    first = reference->read();
+    while ((start = reference->read()) == first) {
+        cpu_relax();
+    }
+    tsc_start = rdtsc();
+    apic_start = apic_read(APIC_REG_TIMER_CURRENT_COUNT);
+
+    do {
+        now = reference->read();
+        elapsed = (now - start) & reference->mask;
+    } while (elapsed < ticks);
+    tsc_end = rdtsc();
+    apic_end = apic_read(APIC_REG_TIMER_CURRENT_COUNT);                             /* counts down */
+
+    *tsc_hz = (tsc_end - tsc_start) * reference->frequency / elapsed;
+    *apic_hz = (uint64_t)(apic_start - apic_end) * reference->frequency / elapsed;
+}
+
+static uint64_t clock_median(uint64_t *values, uint32_t count) {
+    uint64_t value;
+    uint32_t i, j;
+
+    for (i = 1; i < count; ++i) {
+        value = values[i];
+        for (j = i; j > 0 && values[j - 1] > value; --j) {
+            values[j] = values[j - 1];
+        }
+        values[j] = value;
+    }
+    return values[count / 2];
+}
+
+/**
+ * @brief Calibrates the TSC and the APIC timer against the HPET or, without one, the ACPI PM
+ *        timer, picks the source of the monotonic clock and sets up the timer of the boot CPU.
+ *        Without either reference the PIT-calibrated TSC from `tsc_init()` is trusted. Must
+ *        run after `acpi_init()` and `apic_init()`.
+ */
+void clock_init(void) {
+    struct clock_reference reference;
+    uint64_t tsc_hz[CLOCK_CALIBRATE_ROUNDS], apic_hz[CLOCK_CALIBRATE_ROUNDS], flags;
+    uint32_t eax, ebx, ecx, edx, i;
+
+    cpuid(CPUID_FEATURES, 0, eax, ebx, ecx, edx);
+    tsc_deadline_supported = !!(ecx & CPUID_FEATURES_ECX_TSC_DEADLINE);
+    cpuid(CPUID_EXT_MAX, 0, eax, ebx, ecx, edx);
+    if (eax >= CPUID_EXT_POWER_MANAGEMENT) {
+        cpuid(CPUID_EXT_POWER_MANAGEMENT, 0, eax, ebx, ecx, edx);
+        tsc_invariant = !!(edx & CPUID_EXT_POWER_EDX_INVARIANT_TSC);
+    }
+
+    clock_pick_reference(&reference);
+    flags = arch_irq_save();
+    apic_write(APIC_REG_LVT_TIMER, APIC_MASK_MASKED | APIC_TIMER_MODE_ONE_SHOT);
+    apic_write(APIC_REG_TIMER_DIVIDE_CONFIG, APIC_DIVIDE_CONFIG_1);
+    for (i = 0; i < CLOCK_CALIBRATE_ROUNDS; ++i) {
+        clock_calibrate_once(&reference, &tsc_hz[i], &apic_hz[i]);
+    }
+    apic_write(APIC_REG_TIMER_INITIAL_COUNT, 0);
+    arch_irq_restore(flags);
+
+    tsc_frequency = clock_median(tsc_hz, CLOCK_CALIBRATE_ROUNDS);
+    apic_timer_frequency = clock_median(apic_hz, CLOCK_CALIBRATE_ROUNDS);
+    clock_tsc_inverse = (tsc_frequency << CLOCK_INVERSE_SHIFT) / CLOCK_NS_PER_SECOND;
+    clock_apic_inverse = (apic_timer_frequency << CLOCK_INVERSE_SHIFT) / CLOCK_NS_PER_SECOND;
+
+    if (!tsc_invariant && hpet_base != NULL && hpet_mask == ~0ULL) {                /* a 32-bit HPET wraps in minutes */
+        clock_source = CLOCK_SOURCE_HPET;
+        clock_mult = (CLOCK_NS_PER_SECOND << CLOCK_SHIFT) / hpet_frequency;
+        clock_tsc_base = rdtsc();
+        clock_base = hpet_read();
+    } else {
+        clock_source = CLOCK_SOURCE_TSC;
+        clock_mult = (CLOCK_NS_PER_SECOND << CLOCK_SHIFT) / tsc_frequency;
+        clock_tsc_base = rdtsc();
+        clock_base = clock_tsc_base;
+    }
+
+    idt_set_gate(APIC_VECTOR_TIMER, apic_timer_entry);
+    clock_cpu_init();
+    printk("clock: %s reference, tsc %lu kHz%s, apic timer %lu kHz, %s events, %s clock\n",
+           reference.name, tsc_frequency / 1000, tsc_invariant ? " invariant" : "",
+           apic_timer_frequency / 1000, tsc_deadline_supported ? "tsc-deadline" : "one-shot",
+           clock_source == CLOCK_SOURCE_HPET ? "hpet" : "tsc");
+}
+
+/**
+ * @brief Loads `deadline` into the APIC timer of the calling CPU. In one-shot mode the count
+ *        is clamped: a past deadline fires right away and a far one fires early and is
+ *        re-armed by `clock_event_interrupt()`.
+ */
+static void clock_event_arm(uint64_t deadline) {
+    uint64_t now, count;
+
+    if (tsc_deadline_supported) {
+        wrmsr(MSR_TSC_DEADLINE, clock_tsc_base
+              + (uint64_t)(((unsigned __int128)deadline * clock_tsc_inverse) >> CLOCK_INVERSE_SHIFT));
+        return;
+    }
+
+    now = clock_monotonic_ns();
+    count = 1;
+    if (deadline > now) {
+        count = (uint64_t)(((unsigned __int128)(deadline - now) * clock_apic_inverse) >> CLOCK_INVERSE_SHIFT);
+        if (count == 0) {
+            count = 1;
+        } else if (count > 0xFFFFFFFF) {
+            count = 0xFFFFFFFF;
+        }
+    }
+    apic_write(APIC_REG_TIMER_INITIAL_COUNT, (uint32_t)count);
+}
+
+/**
+ * @brief Puts the APIC timer of the calling CPU in TSC-deadline mode if the CPU has it and in
+ *        one-shot mode otherwise. No interrupt fires until `clock_event_program()`, unless a
+ *        deadline was armed before: an APIC that was reset under it gets it back.
+ */
+void clock_cpu_init(void) {
+    uint64_t deadline = clock_events[smp_processor_id()].deadline;
+
+    if (tsc_deadline_supported) {
+        apic_write(APIC_REG_LVT_TIMER,
+            APIC_VECTOR(APIC_VECTOR_TIMER)
+            | APIC_MASK_UNMASKED
+            | APIC_TIMER_MODE_TSC_DEADLINE
+        );
+        asm volatile ("mfence" : : : "memory");                                     /* the LVT write must land before the MSR */
+        wrmsr(MSR_TSC_DEADLINE, 0);
+    } else {
+        apic_write(APIC_REG_LVT_TIMER,
+            APIC_VECTOR(APIC_VECTOR_TIMER)
+            | APIC_MASK_UNMASKED
+            | APIC_TIMER_MODE_ONE_SHOT
+        );
+        apic_write(APIC_REG_TIMER_DIVIDE_CONFIG, APIC_DIVIDE_CONFIG_1);
+        apic_write(APIC_REG_TIMER_INITIAL_COUNT, 0);
+    }
+    if (deadline != 0) {
+        clock_event_arm(deadline);
+    }
+}
+
+/**
+ * @brief Gets the nanoseconds since `clock_init()`. It never goes backwards and is consistent
+ *        across CPUs as long as their TSCs are synchronized, which invariant TSCs are.
+ */
+uint64_t clock_monotonic_ns(void) {
+    uint64_t counter;
+
+    if (clock_source == CLOCK_SOURCE_HPET) {
+        counter = hpet_read();
+    } else {
+        counter = rdtsc();
+    }
+    return (uint64_t)(((unsigned __int128)(counter - clock_base) * clock_mult) >> CLOCK_SHIFT);
+}
+
+/**
+ * @brief Sets the function called from the timer interrupt once a deadline has passed. It
+ *        runs with interrupts disabled and may program the next deadline.
+ */
+void clock_event_set_handler(void (*handler)(void)) {
+    clock_event_handler = handler;
+}
+
+/**
+ * @brief Arms the timer of the calling CPU to fire once at `deadline`, in
+ *        `clock_monotonic_ns()` time, replacing the previous deadline. There is no periodic
+ *        tick: a CPU with nothing armed takes no timer interrupts.
+ */
+void clock_event_program(uint64_t deadline) {
+    uint64_t flags = arch_irq_save();
+
+    clock_events[smp_processor_id()].deadline = deadline == 0 ? 1 : deadline;       /* 0 means disarmed */
+    clock_event_arm(deadline);
+    arch_irq_restore(flags);
+}
+
+/**
+ * @brief Disarms the timer of the calling CPU.
+ */
+void clock_event_cancel(void) {
+    uint64_t flags = arch_irq_save();
+
+    clock_events[smp_processor_id()].deadline = 0;
+    if (tsc_deadline_supported) {
+        wrmsr(MSR_TSC_DEADLINE, 0);
+    } else {
+        apic_write(APIC_REG_TIMER_INITIAL_COUNT, 0);
+    }
+    arch_irq_restore(flags);
+}
+
+/**
+ * @brief Handler of `APIC_VECTOR_TIMER`, entered through `apic_timer_entry`.
+ */
+void clock_event_interrupt(void) {
+    struct clock_event *event = &clock_events[smp_processor_id()];
+    uint64_t deadline = event->deadline;
+
+    if (deadline == 0) {
+        apic_eoi();                                                                 /* cancelled after it was raised */
+        return;
+    }
+    if (clock_monotonic_ns() < deadline) {
+        clock_event_arm(deadline);                                                  /* a clamped one-shot count or rounding */
+        apic_eoi();
+        return;
+    }
+
+    event->deadline = 0;
+    ++event->fired;
+    apic_eoi();
+    if (clock_event_handler != NULL) {
+        clock_event_handler();
+    }
+}
+
+#if defined(NICKEL_BENCH)
+#define CLOCK_BENCH_READS               100000
+#define CLOCK_BENCH_EVENTS              100
+#define CLOCK_BENCH_EVENT_NS            1000000UL
+
+static volatile uint64_t clock_bench_fired_at;
+
+static void clock_bench_handler(void) {
+    clock_bench_fired_at = clock_monotonic_ns();
+}
+
+static void clock_bench_read(const char *name, uint64_t (*read)(void)) {
+    uint64_t start;
+    uint32_t i;
+
+    start = rdtsc();
+    for (i = 0; i < CLOCK_BENCH_READS; ++i) {
+        read();
+    }
+    printk("clock: read %-8s %6lu ns\n", name, tsc_to_ns(rdtsc() - start) / CLOCK_BENCH_READS);
+}
+
+/**
+ * @brief Measures the cost of reading every clock and how late one-shot timers fire.
+ */
+void clock_bench(void) {
+    struct clock_event *event = &clock_events[smp_processor_id()];
+    uint64_t deadline, fired, late, late_min = ~0ULL, late_max = 0, late_total = 0, flags;
+    void (*handler)(void) = clock_event_handler;
+    uint32_t i;
+
+    clock_bench_read("tsc", clock_read_tsc);
+    clock_bench_read("clock", clock_monotonic_ns);
+    if (hpet_base != NULL) {
+        clock_bench_read("hpet", clock_read_hpet);
+    }
+    if (acpi_pm_timer_port != 0) {
+        clock_bench_read("pm timer", clock_read_pm_timer);
+    }
+
+    flags = arch_irq_save();
+    clock_event_set_handler(clock_bench_handler);
+    arch_irq_enable();
+    for (i = 0; i < CLOCK_BENCH_EVENTS; ++i) {
+        fired = event->fired;
+        deadline = clock_monotonic_ns() + CLOCK_BENCH_EVENT_NS;
+        clock_event_program(deadline);
+        while (event->fired == fired) {
+            cpu_relax();
+        }
+        late = clock_bench_fired_at - deadline;
+        late_total += late;
+        if (late < late_min) {
+            late_min = late;
+        }
+        if (late > late_max) {
+            late_max = late;
+        }
+    }
+    arch_irq_restore(flags);
+    clock_event_set_handler(handler);
+
+    printk("clock: %u %s events of %lu us late by min %lu avg %lu max %lu ns\n", CLOCK_BENCH_EVENTS,
+           tsc_deadline_supported ? "tsc-deadline" : "one-shot", CLOCK_BENCH_EVENT_NS / 1000,
+           late_min, late_total / CLOCK_BENCH_EVENTS, late_max);
+}
+#endif
@@ -1,6 +1,6 @@
 #include <arch/flat_gdt.h>
 
-union gdt_entry gdt_entries[] = {
+union gdt_entry gdt_entries[GDT_ENTRIES] = {
     {{0}},
     {   /* Kernel Code Segment */
         .limit_15_00 = 0xFFFF,
@@ -0,0 +1,455 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <percpu.h>
+#include <printk.h>
+#include <sched.h>
+#include <smp.h>
+#include <mm/slab.h>
+
+#include <arch/cpu.h>
+#include <arch/default_idt.h>
+#include <arch/fpu.h>
+#include <arch/interrupt.h>
+#include <arch/tsc.h>
+
+extern void fpu_trap_entry(void);
+
+DEFINE_PER_CPU(struct fpu *, fpu_current);
+DEFINE_PER_CPU(struct fpu *, fpu_owner);
+DEFINE_PER_CPU(uint64_t, fpu_traps);
+
+uint32_t fpu_save_mode = FPU_SAVE_FXSAVE;
+int fpu_lazy = 1;
+
+static uint64_t fpu_xcr0 = 0;                                                       /* 0 without `xsave` */
+static uint32_t fpu_xsave_features = 0;                                             /* CPUID.(0xD,1).EAX */
+static uint32_t fpu_area_size = FPU_LEGACY_SIZE;
+static struct kmem_cache *fpu_cache = NULL;
+static uint8_t fpu_init_state[FPU_AREA_MAX] __attribute__((aligned(64)));           /* zero header: every component initial */
+
+static const char *const fpu_save_names[] = { "fxsave", "xsave", "xsaveopt", "xsaves" };
+
+/**
+ * @brief Saves the registers into `fpu` with the instruction of `fpu_save_mode`. An all-ones
+ *        mask requests every component XCR0 enables.
+ */
+static inline void fpu_save(struct fpu *fpu) {
+    switch (fpu_save_mode) {
+    case FPU_SAVE_XSAVES:
+        asm volatile ("xsaves64 (%0)\n" : : "r"(fpu->area), "a"(~0U), "d"(~0U) : "memory");
+        break;
+    case FPU_SAVE_XSAVEOPT:
+        asm volatile ("xsaveopt64 (%0)\n" : : "r"(fpu->area), "a"(~0U), "d"(~0U) : "memory");
+        break;
+    case FPU_SAVE_XSAVE:
+        asm volatile ("xsave64 (%0)\n" : : "r"(fpu->area), "a"(~0U), "d"(~0U) : "memory");
+        break;
+    default:
+        asm volatile ("fxsave64 (%0)\n" : : "r"(fpu->area) : "memory");
+        break;
+    }
+}
+
+/**
+ * @brief Loads the registers from `area` in whichever format it was saved, so that areas stay
+ *        valid when the benchmark changes `fpu_save_mode`.
+ */
+static inline void fpu_restore(const uint8_t *area) {
+    if (fpu_xcr0 == 0) {
+        asm volatile ("fxrstor64 (%0)\n" : : "r"(area) : "memory");
+    } else if (*(const uint64_t *)(area + FPU_XCOMP_BV_OFFSET) & FPU_XCOMP_COMPACTED) {
+        asm volatile ("xrstors64 (%0)\n" : : "r"(area), "a"(~0U), "d"(~0U) : "memory");
+    } else {
+        asm volatile ("xrstor64 (%0)\n" : : "r"(area), "a"(~0U), "d"(~0U) : "memory");
+    }
+}
+
+/**
+ * @brief Sets or clears CR0.TS, writing CR0 only if it changes, since the write serializes.
+ */
+static inline void fpu_set_ts(int ts) {
+    uint64_t cr0 = read_cr0();
+
+    if (ts && !(cr0 & CR0_TS)) {
+        write_cr0(cr0 | CR0_TS);
+    } else if (!ts && (cr0 & CR0_TS)) {
+        clts();
+    }
+}
+
+/**
+ * @brief Enables SSE, `xsave` and the components `fpu_early_init()` picked on the calling
+ *        CPU. APs call it before anything runs on them.
+ */
+void fpu_cpu_init(void) {
+    uint64_t cr4 = read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT;
+
+    write_cr0((read_cr0() | CR0_MP | CR0_NE) & ~(CR0_EM | CR0_TS));                 /* the trampoline copied the boot CPU's CR0 */
+    if (fpu_xcr0 == 0) {
+        write_cr4(cr4);
+        return;
+    }
+    write_cr4(cr4 | CR4_OSXSAVE);
+    xsetbv(0, fpu_xcr0);
+    if (fpu_xsave_features & CPUID_XSAVE_EAX_XSAVES) {
+        wrmsr(MSR_XSS, 0);                                                          /* no supervisor components */
+    }
+}
+
+/**
+ * @brief Picks the components for XCR0 from CPUID leaf 0xD, enables them on the boot CPU and
+ *        sizes the save area for them. Must run before `string_init()`, which only picks the
+ *        AVX2 variants when XCR0 enables the YMM state.
+ */
+void fpu_early_init(void) {
+    uint32_t eax, ebx, ecx, edx, max_leaf, features;
+    uint64_t supported;
+
+    cpuid(0, 0, max_leaf, ebx, ecx, edx);
+    cpuid(CPUID_FEATURES, 0, eax, ebx, features, edx);
+    if (max_leaf >= CPUID_XSAVE && (features & CPUID_FEATURES_ECX_XSAVE)) {
+        cpuid(CPUID_XSAVE, 0, eax, ebx, ecx, edx);
+        supported = ((uint64_t)edx << 32) | eax;
+        fpu_xcr0 = XCR0_X87 | XCR0_SSE;
+        if ((features & CPUID_FEATURES_ECX_AVX) && (supported & XCR0_AVX)) {
+            fpu_xcr0 |= XCR0_AVX;
+            if ((supported & XCR0_AVX512) == XCR0_AVX512) {
+                fpu_xcr0 |= XCR0_AVX512;                                            /* all three or none */
+            }
+        }
+        cpuid(CPUID_XSAVE, 1, fpu_xsave_features, ebx, ecx, edx);
+        if (fpu_xsave_features & CPUID_XSAVE_EAX_XSAVES) {
+            fpu_save_mode = FPU_SAVE_XSAVES;
+        } else if (fpu_xsave_features & CPUID_XSAVE_EAX_XSAVEOPT) {
+            fpu_save_mode = FPU_SAVE_XSAVEOPT;
+        } else {
+            fpu_save_mode = FPU_SAVE_XSAVE;
+        }
+    }
+    fpu_cpu_init();
+
+    if (fpu_xcr0 != 0) {
+        cpuid(CPUID_XSAVE, 0, eax, ebx, ecx, edx);                                  /* EBX now sizes the components XCR0 enables */
+        fpu_area_size = ebx;
+        if (fpu_xsave_features & CPUID_XSAVE_EAX_XSAVES) {
+            cpuid(CPUID_XSAVE, 1, eax, ebx, ecx, edx);                              /* the compacted format, for XCR0 | XSS */
+            fpu_area_size = ebx > fpu_area_size ? ebx : fpu_area_size;
+        }
+    }
+    *(uint16_t *)(fpu_init_state + FPU_FCW_OFFSET) = FPU_FCW_DEFAULT;
+    *(uint32_t *)(fpu_init_state + FPU_MXCSR_OFFSET) = FPU_MXCSR_DEFAULT;            /* loaded even for an initial SSE component */
+}
+
+/**
+ * @brief Creates the cache of `struct fpu` and installs the #NM handler. Must run after
+ *        `slab_init()`.
+ *
+ * @return `FPU_SUCCESS` on success, `FPU_NO_MEMORY` otherwise.
+ */
+int32_t fpu_init(void) {
+    fpu_cache = kmem_cache_create("fpu", sizeof(struct fpu) + fpu_area_size, __alignof__(struct fpu));
+    if (fpu_cache == NULL) {
+        return FPU_NO_MEMORY;
+    }
+    idt_set_gate(EXCEPTION_DEVICE_NOT_AVAILABLE, fpu_trap_entry);
+    printk("fpu: %s, xcr0 0x%lx, %u byte areas, %s restore\n", fpu_save_names[fpu_save_mode], fpu_xcr0,
+           fpu_area_size, fpu_lazy ? "lazy" : "eager");
+    return FPU_SUCCESS;
+}
+
+/**
+ * @brief Called by `schedule()` with interrupts disabled right before the context switch. Saves
+ *        the live state of the thread switched out and either restores that of `next` or,
+ *        with `fpu_lazy`, sets CR0.TS so that its first vector instruction does.
+ */
+void fpu_switch(struct fpu *next) {
+    struct fpu *owner = this_cpu_read(fpu_owner), *in = next != NULL && next->depth != 0 ? next : NULL;
+    uint32_t cpu = smp_processor_id();
+
+    if (owner != NULL && owner == this_cpu_read(fpu_current) && !(read_cr0() & CR0_TS)) {
+        fpu_save(owner);                                                            /* always, it may run elsewhere next */
+    }
+    this_cpu_write(fpu_current, in);
+
+    if (!fpu_lazy) {
+        if (in != NULL) {
+            fpu_restore(in->area);
+            in->cpu = cpu;
+        }
+        this_cpu_write(fpu_owner, in);
+        fpu_set_ts(0);
+    } else if (in == owner && (in == NULL || in->cpu == cpu)) {
+        fpu_set_ts(0);                                                              /* nobody touched the registers since */
+    } else {
+        fpu_set_ts(1);
+    }
+}
+
+/**
+ * @brief Handler of #NM, entered through `fpu_trap_entry`. Restores the state of the running
+ *        thread, or hands the registers to a thread without any.
+ */
+void fpu_trap(void) {
+    struct fpu *fpu = this_cpu_read(fpu_current);
+    uint32_t cpu = smp_processor_id();
+
+    this_cpu_inc(fpu_traps);
+    if (fpu != NULL && (this_cpu_read(fpu_owner) != fpu || fpu->cpu != cpu)) {
+        fpu_restore(fpu->area);                                                     /* nothing may touch a vector register after it */
+        fpu->cpu = cpu;
+    }
+    this_cpu_write(fpu_owner, fpu);                                                 /* the state switched out was saved by `fpu_switch()` */
+}
+
+/**
+ * @brief Returns the state of an exited thread to the cache.
+ */
+void fpu_free(struct fpu *fpu) {
+    if (this_cpu_read(fpu_owner) == fpu) {
+        this_cpu_write(fpu_owner, NULL);
+    }
+    kmem_cache_free(fpu_cache, fpu);
+}
+
+/**
+ * @brief Starts a section in which the calling thread may keep any vector register live,
+ *        including the YMM and ZMM upper halves and the AVX-512 masks, across preemption
+ *        and migration. The registers start out in their initial state. Sections nest; only
+ *        threads may open them, not interrupt handlers.
+ *
+ * @return `FPU_SUCCESS` on success, `FPU_NO_MEMORY` if the state cannot be allocated.
+ */
+int32_t kernel_fpu_begin(void) {
+    struct thread *thread = thread_current();
+    struct fpu *fpu = thread->fpu;
+    uint64_t flags;
+
+    if (fpu == NULL) {
+        if (fpu_cache == NULL || (fpu = kmem_cache_alloc(fpu_cache)) == NULL) {
+            return FPU_NO_MEMORY;
+        }
+        fpu->depth = 0;
+        fpu->cpu = FPU_NO_CPU;
+        memcpy(fpu->area, fpu_init_state, fpu_area_size);                           /* restorable should it be preempted below */
+        thread->fpu = fpu;
+    }
+    if (fpu->depth++ != 0) {
+        return FPU_SUCCESS;
+    }
+
+    flags = arch_irq_save();
+    fpu_set_ts(0);                                                                  /* whatever the registers held is saved already */
+    fpu_restore(fpu_init_state);
+    fpu->cpu = smp_processor_id();
+    this_cpu_write(fpu_owner, fpu);
+    this_cpu_write(fpu_current, fpu);
+    arch_irq_restore(flags);
+    return FPU_SUCCESS;
+}
+
+/**
+ * @brief Ends the section of the matching `kernel_fpu_begin()`. The outermost one gives the
+ *        registers back to the scratch use of the rest of the kernel.
+ */
+void kernel_fpu_end(void) {
+    struct fpu *fpu = thread_current()->fpu;
+    uint64_t flags;
+
+    flags = arch_irq_save();
+    if (--fpu->depth == 0) {
+        if ((fpu_xcr0 & XCR0_AVX) && !(read_cr0() & CR0_TS)) {
+            asm volatile ("vzeroupper\n");                                          /* spares the SSE code after it the AVX transition */
+        }
+        this_cpu_write(fpu_current, NULL);
+        if (this_cpu_read(fpu_owner) == fpu) {
+            this_cpu_write(fpu_owner, NULL);
+        }
+    }
+    arch_irq_restore(flags);
+}
+
+#if defined(NICKEL_BENCH)
+#define FPU_BENCH_YIELDS                20000
+#define FPU_BENCH_WORKLOADS             3
+#define FPU_BENCH_LABEL                 23                                          /* width of the configuration column */
+
+enum fpu_bench_workload {
+    FPU_BENCH_NONE,                                                                 /* no section, no state to switch */
+    FPU_BENCH_HELD,                                                                 /* in a section, registers left alone */
+    FPU_BENCH_DIRTY,                                                                /* in a section, vector registers written every round */
+};
+
+/**
+ * @brief A way of switching the state. Rows the CPU cannot run are skipped.
+ */
+struct fpu_bench_config {
+    const char *name;
+    uint32_t mode;
+    int lazy;
+};
+
+static const struct fpu_bench_config fpu_bench_configs[] = {
+    { "fxsave, eager", FPU_SAVE_FXSAVE, 0 },
+    { "fxsave, lazy", FPU_SAVE_FXSAVE, 1 },
+    { "xsave, eager", FPU_SAVE_XSAVE, 0 },
+    { "xsave, lazy", FPU_SAVE_XSAVE, 1 },
+    { "xsaveopt, lazy", FPU_SAVE_XSAVEOPT, 1 },
+    { "xsaves, lazy", FPU_SAVE_XSAVES, 1 },
+};
+
+static const char *const fpu_bench_workload_names[FPU_BENCH_WORKLOADS] = { "none", "held", "dirty" };
+
+static struct {
+    struct thread *waiter;
+    volatile uint32_t done;
+    uint32_t workload;
+} fpu_bench_state;
+
+static int fpu_bench_supported(const struct fpu_bench_config *config) {
+    switch (config->mode) {
+    case FPU_SAVE_FXSAVE:
+        return fpu_xcr0 == 0;                                                       /* it would miss the YMM state */
+    case FPU_SAVE_XSAVE:
+        return fpu_xcr0 != 0;
+    case FPU_SAVE_XSAVEOPT:
+        return (fpu_xsave_features & CPUID_XSAVE_EAX_XSAVEOPT) != 0;
+    default:
+        return (fpu_xsave_features & CPUID_XSAVE_EAX_XSAVES) != 0;
+    }
+}
+
+/**
+ * @brief Makes every vector register XCR0 enables non-initial: %ymm0-15 with AVX, %xmm0-15
+ *        otherwise, plus a mask and %zmm16 with AVX-512.
+ */
+static void fpu_bench_dirty(void) {
+    if (fpu_xcr0 & XCR0_AVX512) {
+        asm volatile ("kxnorw %%k1, %%k1, %%k1\n" "vpternlogd $0xFF, %%zmm16, %%zmm16, %%zmm16\n" : : : "memory");
+    }
+    if (fpu_xcr0 & XCR0_AVX) {
+        asm volatile (
+            "vpcmpeqd %%ymm0, %%ymm0, %%ymm0\n" "vpcmpeqd %%ymm1, %%ymm1, %%ymm1\n"
+            "vpcmpeqd %%ymm2, %%ymm2, %%ymm2\n" "vpcmpeqd %%ymm3, %%ymm3, %%ymm3\n"
+            "vpcmpeqd %%ymm4, %%ymm4, %%ymm4\n" "vpcmpeqd %%ymm5, %%ymm5, %%ymm5\n"
+            "vpcmpeqd %%ymm6, %%ymm6, %%ymm6\n" "vpcmpeqd %%ymm7, %%ymm7, %%ymm7\n"
+            "vpcmpeqd %%ymm8, %%ymm8, %%ymm8\n" "vpcmpeqd %%ymm9, %%ymm9, %%ymm9\n"
+            "vpcmpeqd %%ymm10, %%ymm10, %%ymm10\n" "vpcmpeqd %%ymm11, %%ymm11, %%ymm11\n"
+            "vpcmpeqd %%ymm12, %%ymm12, %%ymm12\n" "vpcmpeqd %%ymm13, %%ymm13, %%ymm13\n"
+            "vpcmpeqd %%ymm14, %%ymm14, %%ymm14\n" "vpcmpeqd %%ymm15, %%ymm15, %%ymm15\n"
+            : : : "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",
+                  "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15"
+        );
+    } else {
+        asm volatile (
+            "pcmpeqd %%xmm0, %%xmm0\n" "pcmpeqd %%xmm1, %%xmm1\n" "pcmpeqd %%xmm2, %%xmm2\n"
+            "pcmpeqd %%xmm3, %%xmm3\n" "pcmpeqd %%xmm4, %%xmm4\n" "pcmpeqd %%xmm5, %%xmm5\n"
+            "pcmpeqd %%xmm6, %%xmm6\n" "pcmpeqd %%xmm7, %%xmm7\n" "pcmpeqd %%xmm8, %%xmm8\n"
+            "pcmpeqd %%xmm9, %%xmm9\n" "pcmpeqd %%xmm10, %%xmm10\n" "pcmpeqd %%xmm11, %%xmm11\n"
+            "pcmpeqd %%xmm12, %%xmm12\n" "pcmpeqd %%xmm13, %%xmm13\n" "pcmpeqd %%xmm14, %%xmm14\n"
+            "pcmpeqd %%xmm15, %%xmm15\n"
+            : : : "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",
+                  "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15"
+        );
+    }
+}
+
+static void fpu_bench_yielder(void *arg) {
+    uint32_t workload = fpu_bench_state.workload, i;
+    int section = workload != FPU_BENCH_NONE && kernel_fpu_begin() == FPU_SUCCESS;
+
+    for (i = 0; i < FPU_BENCH_YIELDS; ++i) {
+        if (workload == FPU_BENCH_DIRTY) {
+            fpu_bench_dirty();
+        }
+        sched_yield();
+    }
+    if (section) {
+        kernel_fpu_end();
+    }
+    if (__atomic_add_fetch(&fpu_bench_state.done, 1, __ATOMIC_ACQ_REL) == 2) {
+        thread_wake(fpu_bench_state.waiter);
+    }
+}
+
+/**
+ * @brief Runs two yielders pinned to the calling CPU with `workload` and blocks until both
+ *        are done.
+ *
+ * @return Nanoseconds per switch, or 0 if the threads cannot be created.
+ */
+static uint64_t fpu_bench_run(uint32_t workload, uint64_t *traps) {
+    struct thread *self = thread_current();
+    uint64_t start, elapsed, traps_before = this_cpu_read(fpu_traps);
+
+    *traps = 0;
+    fpu_bench_state.waiter = self;
+    fpu_bench_state.done = 0;
+    fpu_bench_state.workload = workload;
+    start = rdtsc();
+    if (thread_create("fpu_bench0", fpu_bench_yielder, NULL, THREAD_PINNED) == NULL
+        || thread_create("fpu_bench1", fpu_bench_yielder, NULL, THREAD_PINNED) == NULL) {
+        return 0;                                                                   /* a single one would never be woken */
+    }
+    while (1) {
+        self->state = THREAD_BLOCKED;                                               /* before the check, so no wakeup is lost */
+        if (__atomic_load_n(&fpu_bench_state.done, __ATOMIC_ACQUIRE) == 2) {
+            self->state = THREAD_RUNNING;
+            break;
+        }
+        schedule();
+    }
+    elapsed = tsc_to_ns(rdtsc() - start);
+    *traps = this_cpu_read(fpu_traps) - traps_before;
+    return elapsed / (2 * FPU_BENCH_YIELDS);
+}
+
+static void fpu_bench_thread(void *arg) {
+    const struct fpu_bench_config *config;
+    uint32_t mode = fpu_save_mode, c, w;
+    int lazy = fpu_lazy, length;
+    char line[PRINTK_BUFFER_SIZE];
+    uint64_t ns, traps;
+
+    thread_current()->flags |= THREAD_PINNED;                                       /* the yielders and `fpu_traps` are per CPU */
+    length = snprintf(line, sizeof(line), "fpu: ns per switch");
+    while (length < FPU_BENCH_LABEL) {
+        line[length++] = ' ';
+    }
+    for (w = 0; w < FPU_BENCH_WORKLOADS; ++w) {
+        length += snprintf(line + length, sizeof(line) - length, "%8s  traps", fpu_bench_workload_names[w]);
+    }
+    printk("%s\n", line);
+
+    for (c = 0; c < sizeof(fpu_bench_configs) / sizeof(fpu_bench_configs[0]); ++c) {
+        config = &fpu_bench_configs[c];
+        if (!fpu_bench_supported(config)) {
+            continue;
+        }
+        fpu_save_mode = config->mode;
+        fpu_lazy = config->lazy;
+        length = snprintf(line, sizeof(line), "fpu:   %-16s", config->name);
+        for (w = 0; w < FPU_BENCH_WORKLOADS; ++w) {
+            ns = fpu_bench_run(w, &traps);
+            length += snprintf(line + length, sizeof(line) - length, " %7lu %6lu", ns, traps);
+        }
+        printk("%s\n", line);
+    }
+    fpu_save_mode = mode;
+    fpu_lazy = lazy;
+    printk("fpu: bench done\n");
+}
+
+/**
+ * @brief Measures the cost of a switch between two threads without vector state, with state
+ *        they leave alone and with state they dirty on every switch, saving it eagerly with
+ *        `xsave` and lazily with each variant the CPU has. Runs in a thread of its own and
+ *        prints when it is done.
+ */
+void fpu_bench(void) {
+    if (thread_create("fpu_bench", fpu_bench_thread, NULL, 0) == NULL) {            /* on an idle CPU if there is one */
+        printk("fpu: bench skipped, no memory\n");
+    }
+}
+#endif
@@ -0,0 +1,41 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include <arch/hpet.h>
+#include <arch/paging.h>
+
+uint64_t hpet_frequency = 0;
+uint64_t hpet_mask = 0;
+volatile uint64_t *hpet_base = NULL;
+
+/**
+ * @brief Maps the HPET registers and starts the main counter. Only the counter is used; the
+ *        comparators are left alone.
+ *
+ * @param phys Physical address of the registers from the ACPI HPET table.
+ * @return `HPET_SUCCESS` on success, one of `HPET_*` errors otherwise.
+ */
+int32_t hpet_init(uint64_t phys) {
+    uint64_t capabilities, period;
+
+    if (phys == 0) {
+        return HPET_NOT_PRESENT;
+    }
+
+    hpet_base = paging_map_mmio(phys, PAGE_SIZE);
+    if (hpet_base == NULL) {
+        return HPET_NO_MEMORY;
+    }
+
+    capabilities = hpet_base[HPET_REG_CAPABILITIES / sizeof(uint64_t)];
+    period = capabilities >> HPET_CAPABILITIES_PERIOD_SHIFT;
+    if (period == 0 || period > HPET_MAX_PERIOD) {
+        hpet_base = NULL;
+        return HPET_INVALID_PERIOD;
+    }
+
+    hpet_frequency = HPET_FEMTOSECONDS_PER_SECOND / period;
+    hpet_mask = (capabilities & HPET_CAPABILITIES_COUNTER_64) ? ~0ULL : 0xFFFFFFFFULL;
+    hpet_base[HPET_REG_CONFIG / sizeof(uint64_t)] |= HPET_CONFIG_ENABLE;           /* the counter only runs while enabled */
+    return HPET_SUCCESS;
+}
@@ -0,0 +1,113 @@
+#ifndef __NICKEL_X86_64_ADDRESS_SPACE_H__
+#define __NICKEL_X86_64_ADDRESS_SPACE_H__
+
+#include <stdint.h>
+
+#include <smp.h>
+
+#define ASID_BITS                       12                                          /* width of a PCID */
+#define ASID_COUNT                      (1U << ASID_BITS)
+#define ASID_MASK                       (ASID_COUNT - 1)
+
+#define CR3_NO_FLUSH                    (1ULL << 63)                                /* keep the new PCID's TLB entries */
+
+#define INVPCID_ADDRESS                 0                                           /* one address in one PCID */
+#define INVPCID_SINGLE                  1                                           /* all of one PCID, except globals */
+#define INVPCID_ALL                     2                                           /* everything, globals included */
+#define INVPCID_ALL_NON_GLOBAL          3
+
+/**
+ * @brief A set of page tables a CPU can run on. The kernel half of its PML4 is shared with the
+ *        kernel tables.
+ *
+ * With PCID, every CPU tags the TLB entries of a space with an ASID from its own allocator.
+ * `contexts[cpu]` holds `(generation << ASID_BITS) | asid` of the last ASID the CPU gave the
+ * space; it is only valid while the generation matches the CPU's current one.
+ *
+ * Shootdowns only interrupt the CPUs in `active`. Every shootdown bumps `tlb_generation`; a
+ * CPU that switches back in with an older `flushed[cpu]` may hold stale entries under its old
+ * ASID, so it takes a fresh one instead.
+ */
+struct address_space {
+    uint64_t *pml4;
+    uint64_t cr3;                                                                   /* physical address of `pml4` */
+    struct cpumask active;                                                          /* CPUs that have the space loaded */
+    volatile uint64_t tlb_generation;
+    uint64_t contexts[SMP_MAX_CPUS];
+    uint64_t flushed[SMP_MAX_CPUS];                                                 /* `tlb_generation` each CPU caught up with */
+};
+
+extern struct address_space kernel_address_space;
+extern int pcid_supported, invpcid_supported;
+
+static inline void invpcid(uint64_t type, uint64_t pcid, uint64_t address) {
+    struct {
+        uint64_t pcid;
+        uint64_t address;
+    } descriptor = { pcid, address };
+
+    asm volatile ("invpcid %0, %1\n" : : "m"(descriptor), "r"(type) : "memory");
+}
+
+/**
+ * @brief Detects PCID and INVPCID, wraps the kernel tables into `kernel_address_space` and
+ *        enables PCID on the boot CPU. Must run after `paging_init()`.
+ */
+void address_space_init(void);
+
+/**
+ * @brief Sets CR4.PCIDE on the calling CPU if the CPU supports it. Every AP calls this before
+ *        it switches address spaces.
+ */
+void address_space_cpu_init(void);
+
+/**
+ * @brief Creates an address space with an empty user half.
+ *
+ * @return The new address space, or `NULL` if memory is exhausted.
+ */
+struct address_space *address_space_create(void);
+
+/**
+ * @brief Frees the tables of the user half and the space itself. The space must not be active
+ *        on any CPU.
+ */
+void address_space_destroy(struct address_space *space);
+
+/**
+ * @brief Loads `next` on the calling CPU. If the CPU still holds an ASID of the current
+ *        generation for it, the switch keeps its TLB entries; otherwise a fresh ASID is taken,
+ *        and running out of them starts a new generation with a single full flush.
+ */
+void address_space_switch(struct address_space *next);
+
+/**
+ * @brief Gets the address space loaded on the calling CPU.
+ */
+struct address_space *address_space_current(void);
+
+/**
+ * @brief Drops the non-global TLB entries of every ASID on the calling CPU.
+ */
+void address_space_flush_all(void);
+
+/**
+ * @brief Drops the non-global TLB entries of the address space loaded on the calling CPU.
+ */
+void address_space_flush_local(void);
+
+/**
+ * @brief Unmaps `[virt, virt + size)` from `space` and shoots the range down on every CPU that
+ *        has the space loaded.
+ */
+int32_t address_space_unmap(struct address_space *space, uint64_t virt, uint64_t size);
+
+#if defined(NICKEL_BENCH)
+/**
+ * @brief Ping-pongs between two address spaces that touch a working set of their own and
+ *        prints the switch cost and the post-switch access cost with PCID on and off.
+ */
+void address_space_bench(void);
+#endif
+
+#endif
@@ -3,4 +3,95 @@
 
 #include <stdint.h>
 
+#include <arch/cpu.h>
+#include <arch/apic/registers.h>
+
+#define APIC_SPURIOUS_ENABLE            (1U << 8)                                   /* software enable in the spurious vector register */
+#define APIC_VECTOR_SPURIOUS            0xFF
+#define APIC_VECTOR_PING                0xF1
+#define APIC_VECTOR_TIMER_KICK          0xF2
+#define APIC_VECTOR_RESCHEDULE          0xF3
+#define APIC_VECTOR_TLB_SHOOTDOWN       0xF0
+#define APIC_VECTOR_TIMER               0xEF
+
+/**
+ * @brief Virtual address of the local APIC registers, the same on every CPU. Only used while
+ *        the APIC is in xAPIC mode.
+ */
+extern uint64_t apic_base;
+
+/**
+ * @brief Whether the CPU has x2APIC mode and whether the local APICs run in it. In x2APIC
+ *        mode registers are MSRs, the ICR is written at once and APIC IDs are 32 bits wide.
+ */
+extern int x2apic_supported, x2apic_enabled;
+
+/**
+ * @brief Enables the APIC of the boot CPU, in x2APIC mode if the CPU has it, and maps the
+ *        xAPIC registers. Must run after `paging_init()`.
+ */
+void apic_init(void);
+
+/**
+ * @brief Puts the APIC of the calling CPU in the mode of the boot CPU, software-enables it
+ *        and accepts interrupts of any priority.
+ */
+void apic_cpu_init(void);
+
+/**
+ * @brief Reads a 32-bit APIC register, given as its xAPIC offset, in the current mode.
+ */
+static inline __attribute__((always_inline)) uint32_t apic_read(uint32_t reg) {
+    uint32_t value;
+
+    if (x2apic_enabled) {
+        return (uint32_t)rdmsr(X2APIC_MSR(reg));
+    }
+    apic_read_reg(apic_base, reg, uint32_t, value);
+    return value;
+}
+
+/**
+ * @brief Writes a 32-bit APIC register, given as its xAPIC offset, in the current mode.
+ */
+static inline __attribute__((always_inline)) void apic_write(uint32_t reg, uint32_t value) {
+    if (x2apic_enabled) {
+        wrmsr(X2APIC_MSR(reg), value);
+        return;
+    }
+    apic_write_reg(apic_base, reg, uint32_t, value);
+}
+
+/**
+ * @brief Gets the APIC ID of the calling CPU, 32 bits wide in x2APIC mode and 8 otherwise.
+ */
+static inline uint32_t apic_id(void) {
+    if (x2apic_enabled) {
+        return apic_read(APIC_REG_ID);
+    }
+    return apic_read(APIC_REG_ID) >> 24;
+}
+
+/**
+ * @brief Signals the end of the interrupt being serviced.
+ */
+static inline void apic_eoi(void) {
+    apic_write(APIC_REG_EOI, 0);
+}
+
+/**
+ * @brief Handler of `APIC_VECTOR_PING`. A CPU pinged by another one pings it back, so that
+ *        the CPU that started it can time the round trip.
+ */
+void apic_ping_interrupt(void);
+
+#if defined(NICKEL_BENCH)
+/**
+ * @brief Measures the cost of sending an IPI and of an IPI round trip, to another CPU if one
+ *        is online and to the calling CPU otherwise, in xAPIC and in x2APIC mode. Every online
+ *        CPU switches modes with the calling one and is back in its mode on return.
+ */
+void apic_bench(void);
+#endif
+
 #endif
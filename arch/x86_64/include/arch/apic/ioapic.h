@@ -0,0 +1,66 @@
+#ifndef __NICKEL_X86_64_IOAPIC_H__
+#define __NICKEL_X86_64_IOAPIC_H__
+
+#include <stdint.h>
+
+#define IOAPIC_REG_SELECT               0x00                                        /* index of the register `IOAPIC_REG_WINDOW` reaches */
+#define IOAPIC_REG_WINDOW               0x10
+
+#define IOAPIC_ID                       0x00
+#define IOAPIC_VERSION                  0x01
+#define IOAPIC_REDIRECTION(n)           (0x10 + 2 * (n))                            /* low half, the high half follows */
+
+#define IOAPIC_VERSION_ENTRIES_SHIFT    16                                          /* index of the last redirection entry */
+
+#define IOAPIC_POLARITY_LOW             (1U << 13)
+#define IOAPIC_TRIGGER_LEVEL            (1U << 15)
+#define IOAPIC_MASKED                   (1U << 16)
+#define IOAPIC_DESTINATION_SHIFT        24                                          /* in the high half, physical mode */
+
+#define IOAPIC_ISA_IRQS                 16
+#define IOAPIC_MAX_DESTINATION          0xFF                                        /* APIC IDs above need interrupt remapping */
+
+#define PIC_MASTER_DATA                 0x21
+#define PIC_SLAVE_DATA                  0xA1
+
+/**
+ * @brief Polarity and trigger mode of an I/O APIC input, as `IOAPIC_POLARITY_LOW` and
+ *        `IOAPIC_TRIGGER_LEVEL` bits.
+ */
+#define IOAPIC_FLAGS_ISA                0                                           /* edge triggered, active high */
+#define IOAPIC_FLAGS_PCI                (IOAPIC_POLARITY_LOW | IOAPIC_TRIGGER_LEVEL)
+
+#define IOAPIC_SUCCESS                  0
+#define IOAPIC_FAILURE                  0x80000000
+#define IOAPIC_NOT_PRESENT              (IOAPIC_FAILURE | 1)
+#define IOAPIC_INVALID_GSI              (IOAPIC_FAILURE | 2)
+#define IOAPIC_UNREACHABLE              (IOAPIC_FAILURE | 3)
+
+/**
+ * @brief Maps every I/O APIC in the MADT, masks all of their inputs and masks the legacy PICs,
+ *        so that nothing arrives until a driver routes it. Must run after `acpi_init()`.
+ *
+ * @return `IOAPIC_SUCCESS` on success, `IOAPIC_NOT_PRESENT` if the MADT lists none.
+ */
+int32_t ioapic_init(void);
+
+/**
+ * @brief Translates an ISA IRQ into its GSI and input flags, applying the interrupt source
+ *        overrides of the MADT.
+ */
+uint32_t ioapic_isa_to_gsi(uint8_t irq, uint32_t *flags);
+
+/**
+ * @brief Programs the redirection entry of `gsi` to deliver `vector` to the CPU with
+ *        `apic_id` in fixed, physical mode. The entry is left masked.
+ *
+ * @param flags `IOAPIC_POLARITY_LOW` and `IOAPIC_TRIGGER_LEVEL` bits.
+ * @return `IOAPIC_SUCCESS` on success, one of `IOAPIC_*` errors otherwise.
+ */
+int32_t ioapic_route(uint32_t gsi, uint8_t vector, uint32_t apic_id, uint32_t flags);
+
+void ioapic_mask(uint32_t gsi);
+
+void ioapic_unmask(uint32_t gsi);
+
+#endif
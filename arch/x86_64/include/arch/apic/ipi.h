@@ -11,7 +11,7 @@
  * @todo  Older processor needs level-triggered INIT IPI with an explicit deassert. Check
  *        processor type and implement accordingly.
  */
-extern void apic_send_init_ipi(uint8_t apic_id);
+extern void apic_send_init_ipi(uint32_t apic_id);
 
 /**
  * @brief Sends a Startup Inter-Processor Interrupt (IPI) to the specified APIC ID. An Startup
@@ -22,8 +22,32 @@ extern void apic_send_init_ipi(uint8_t apic_id);
  * @param startup_ip The startup instruction pointer for the target CPU.
  * 
  * @note The `startup_ip` should be a **page-aligned** address, and the CPU will start executing
- *       from this address after receiving the IPI.
+ *       from this address after receiving the IPI. The caller waits between the INIT and the
+ *       SIPIs, so that a batch of CPUs shares one wait.
  */
-extern void apic_send_startup_ipi(uint8_t apic_id, uint8_t *startup_ip);
+extern void apic_send_startup_ipi(uint32_t apic_id, uint8_t *startup_ip);
+
+/**
+ * @brief Sends an INIT IPI to every CPU but the caller with a single ICR write.
+ */
+void apic_send_init_ipi_all_but_self(void);
+
+/**
+ * @brief Sends a Startup IPI to every CPU but the caller with a single ICR write. CPUs that
+ *        are not waiting for one ignore it.
+ */
+void apic_send_startup_ipi_all_but_self(uint8_t *startup_ip);
+
+/**
+ * @brief Sends a fixed IPI with `vector` to the CPU with `apic_id`. It returns as soon as the
+ *        IPI is handed to the APIC; whoever needs to know that the target handled it must
+ *        have the handler acknowledge it.
+ */
+void apic_send_ipi(uint32_t apic_id, uint8_t vector);
+
+/**
+ * @brief Sends a fixed IPI with `vector` to every CPU but the caller with a single ICR write.
+ */
+void apic_send_ipi_all_but_self(uint8_t vector);
 
 #endif
@@ -32,6 +32,10 @@
 
 #define APIC_BASE_MSR                   0x1B
 
+#define X2APIC_MSR_BASE                 0x800
+#define X2APIC_MSR(reg)                 (X2APIC_MSR_BASE + ((uint32_t)(reg) >> 4))  /* MSR of an xAPIC register offset */
+#define X2APIC_MSR_INTERRUPT_COMMAND    X2APIC_MSR(APIC_REG_INTERRUPT_COMMAND_LOW)  /* the whole 64-bit ICR */
+
 #define APIC_CONSTANT(value, type)      ((type)(value))
 #define APIC_FIELD(value, shift, type)  ((type)((value) << (shift)))
 
@@ -76,10 +80,10 @@
 #define APIC_DESTINATION_SHORTHAND_ALL_EXCLUDING_SELF APIC_FIELD(0x3, APIC_DESTINATION_SHORTHAND_SHIFT, uint32_t)
 
 #define APIC_DESTINATION_SHIFT_DWORD    24
-// #define APIC_DESTINATION_SHIFT_QWORD    56
+#define APIC_DESTINATION_SHIFT_QWORD    32                                          /* x2APIC, in the single 64-bit ICR */
 #define APIC_DESTINATION_MASK           0xFF
 #define APIC_DESTINATION_DWORD(dest)    APIC_FIELD(dest, APIC_DESTINATION_SHIFT_DWORD, uint32_t)
-// #define APIC_DESTINATION_QWORD(dest)    APIC_FIELD(dest, APIC_DESTINATION_SHIFT_QWORD, uint64_t)
+#define APIC_DESTINATION_QWORD(dest)    APIC_FIELD((uint64_t)(dest), APIC_DESTINATION_SHIFT_QWORD, uint64_t)
 
 #define APIC_TIMER_MODE_SHIFT           17
 #define APIC_TIMER_MODE_MASK            0x3
@@ -125,12 +129,12 @@
 
 #define apic_read_reg(base, reg, type, dest) \
     do {                                \
-        dest = *((const type *)((uint64_t)(base) + (uint64_t)(reg))); \
+        dest = *((const volatile type *)((uint64_t)(base) + (uint64_t)(reg))); \
     } while (0)
 
 #define apic_write_reg(base, reg, type, src) \
     do {                                \
-        *((type *)((uint64_t)(base) + (uint64_t)(reg))) = (type)(src); \
+        *((volatile type *)((uint64_t)(base) + (uint64_t)(reg))) = (type)(src); \
     } while (0)
 
 union apic_base_msr {
@@ -144,7 +148,8 @@ union apic_base_msr {
     struct {
         uint8_t reserved1 : 8;
         uint8_t bootstrap : 1;
-        uint8_t reserved0 : 2;
+        uint8_t reserved0 : 1;
+        uint8_t x2apic_enable : 1;                                                  /* only together with `apic_enable` */
         uint8_t apic_enable : 1;
         uint64_t apic_base : 52;
     } __attribute__((packed));
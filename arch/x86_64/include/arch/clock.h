@@ -0,0 +1,83 @@
+#ifndef __NICKEL_X86_64_CLOCK_H__
+#define __NICKEL_X86_64_CLOCK_H__
+
+#include <stdint.h>
+
+#include <arch/cpu.h>
+
+#define CLOCK_SHIFT                     32                                          /* fixed point of `clock_mult` */
+#define CLOCK_INVERSE_SHIFT             24                                          /* fixed point of the ns to tick factors */
+#define CLOCK_CALIBRATE_MS              20
+#define CLOCK_CALIBRATE_ROUNDS          3                                           /* the median is kept */
+#define CLOCK_NS_PER_SECOND             1000000000ULL
+
+#define CLOCK_SOURCE_TSC                0
+#define CLOCK_SOURCE_HPET               1                                           /* only if the TSC is not invariant */
+
+/**
+ * @brief State of the monotonic clock. `clock_monotonic_ns()` is
+ *        `(counter - clock_base) * clock_mult >> CLOCK_SHIFT` of the selected counter.
+ */
+extern int clock_source;
+extern uint64_t clock_base;
+extern uint64_t clock_mult;
+
+/**
+ * @brief What `clock_init()` found: the TSC runs at a constant rate in every state, the APIC
+ *        timer can fire at a TSC value, and the APIC timer frequency in Hz (divide by 1).
+ */
+extern int tsc_invariant, tsc_deadline_supported;
+extern uint64_t apic_timer_frequency;
+
+/**
+ * @brief Calibrates the TSC and the APIC timer against the HPET or, without one, the ACPI PM
+ *        timer, picks the source of the monotonic clock and sets up the timer of the boot CPU.
+ *        Without either reference the PIT-calibrated TSC from `tsc_init()` is trusted. Must
+ *        run after `acpi_init()` and `apic_init()`.
+ */
+void clock_init(void);
+
+/**
+ * @brief Puts the APIC timer of the calling CPU in TSC-deadline mode if the CPU has it and in
+ *        one-shot mode otherwise. No interrupt fires until `clock_event_program()`, unless a
+ *        deadline was armed before: an APIC that was reset under it gets it back.
+ */
+void clock_cpu_init(void);
+
+/**
+ * @brief Gets the nanoseconds since `clock_init()`. It never goes backwards and is consistent
+ *        across CPUs as long as their TSCs are synchronized, which invariant TSCs are.
+ */
+uint64_t clock_monotonic_ns(void);
+
+/**
+ * @brief Sets the function called from the timer interrupt once a deadline has passed. It
+ *        runs with interrupts disabled and may program the next deadline.
+ */
+void clock_event_set_handler(void (*handler)(void));
+
+/**
+ * @brief Arms the timer of the calling CPU to fire once at `deadline`, in
+ *        `clock_monotonic_ns()` time, replacing the previous deadline. There is no periodic
+ *        tick: a CPU with nothing armed takes no timer interrupts.
+ */
+void clock_event_program(uint64_t deadline);
+
+/**
+ * @brief Disarms the timer of the calling CPU.
+ */
+void clock_event_cancel(void);
+
+/**
+ * @brief Handler of `APIC_VECTOR_TIMER`, entered through `apic_timer_entry`.
+ */
+void clock_event_interrupt(void);
+
+#if defined(NICKEL_BENCH)
+/**
+ * @brief Measures the cost of reading every clock and how late one-shot timers fire.
+ */
+void clock_bench(void);
+#endif
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef __NICKEL_X86_64_CONTEXT_H__
+#define __NICKEL_X86_64_CONTEXT_H__
+
+#include <stdint.h>
+
+#define ARCH_CONTEXT_REGISTERS          6                                           /* rbp, rbx, r12 .. r15 */
+
+/**
+ * @brief Saves the callee-saved registers of the caller, stores its stack pointer in
+ *        `*prev_sp` and resumes the context saved at `next_sp`.
+ */
+void arch_context_switch(uint64_t *prev_sp, uint64_t next_sp);
+
+void arch_thread_start(void);
+
+/**
+ * @brief Abandons the current stack and calls `fn(arg)` on the one ending at `top`.
+ */
+__attribute__((noreturn))
+void arch_call_on_stack(uint64_t top, void (*fn)(void *arg), void *arg);
+
+/**
+ * @brief Builds the first context of a thread at the top of its stack, so that switching to
+ *        it enters `sched_thread_start(thread)` on a 16-byte aligned stack.
+ *
+ * @return The stack pointer to hand to `arch_context_switch()`.
+ */
+static inline uint64_t arch_thread_stack_init(uint64_t top, void *thread) {
+    uint64_t *sp = (uint64_t *)(top & ~0xFULL);
+    uint32_t i;
+
+    *--sp = (uint64_t)arch_thread_start;
+    for (i = 0; i < ARCH_CONTEXT_REGISTERS; ++i) {
+        *--sp = 0;
+    }
+    sp[3] = (uint64_t)thread;                                                       /* popped into %r12 */
+    return (uint64_t)sp;
+}
+
+#endif
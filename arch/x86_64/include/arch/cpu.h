@@ -0,0 +1,197 @@
+#ifndef __NICKEL_X86_64_CPU_H__
+#define __NICKEL_X86_64_CPU_H__
+
+#include <stdint.h>
+
+#define CPU_RFLAGS_IF                   (1ULL << 9)                                 /* interrupt enable flag */
+
+#define CR0_MP                          (1ULL << 1)                                 /* `wait` honors TS too */
+#define CR0_EM                          (1ULL << 2)                                 /* x87 and SSE instructions raise #UD */
+#define CR0_TS                          (1ULL << 3)                                 /* the next FPU or SSE instruction raises #NM */
+#define CR0_NE                          (1ULL << 5)                                 /* x87 errors raise #MF, not an IRQ */
+#define CR0_WP                          (1ULL << 16)                                /* honor read-only pages in ring 0 */
+#define CR4_PGE                         (1ULL << 7)                                 /* global pages */
+#define CR4_OSFXSR                      (1ULL << 9)                                 /* `fxsave` covers the SSE state, SSE is usable */
+#define CR4_OSXMMEXCPT                  (1ULL << 10)                                /* unmasked SIMD exceptions raise #XM */
+#define CR4_PCIDE                       (1ULL << 17)                                /* CR3[11:0] tag TLB entries */
+#define CR4_OSXSAVE                     (1ULL << 18)                                /* `xsave` and XCR0 are usable */
+
+#define MSR_EFER                        0xC0000080
+#define EFER_LME                        (1ULL << 8)                                 /* long mode enable */
+#define EFER_LMA                        (1ULL << 10)                                /* long mode active, read-only */
+#define EFER_NXE                        (1ULL << 11)                                /* makes bit 63 of an entry the NX bit */
+
+#define MSR_TSC_DEADLINE                0x6E0                                       /* fires the APIC timer once the TSC reaches it */
+#define MSR_PAT                         0x277                                       /* memory type of each PAT/PCD/PWT combination */
+#define MSR_GS_BASE                     0xC0000101
+#define MSR_KERNEL_GS_BASE              0xC0000102                                  /* swapped with `MSR_GS_BASE` by swapgs */
+#define MSR_XSS                         0xDA0                                       /* supervisor state components of `xsaves` */
+
+#define CPUID_FEATURES                  0x1
+#define CPUID_FEATURES_EDX_PAT          (1U << 16)
+#define CPUID_FEATURES_ECX_PCID         (1U << 17)
+#define CPUID_FEATURES_ECX_X2APIC       (1U << 21)
+#define CPUID_FEATURES_ECX_TSC_DEADLINE (1U << 24)
+#define CPUID_FEATURES_ECX_XSAVE        (1U << 26)
+#define CPUID_FEATURES_ECX_OSXSAVE      (1U << 27)                                  /* CR4.OSXSAVE is set, `xgetbv` works */
+#define CPUID_FEATURES_ECX_AVX          (1U << 28)
+#define CPUID_STRUCTURED_FEATURES       0x7
+#define CPUID_STRUCTURED_EBX_AVX2       (1U << 5)
+#define CPUID_STRUCTURED_EBX_ERMS       (1U << 9)                                   /* enhanced `rep movsb` and `rep stosb` */
+#define CPUID_STRUCTURED_EBX_INVPCID    (1U << 10)
+#define CPUID_STRUCTURED_EDX_FSRM       (1U << 4)                                   /* fast short `rep movsb` */
+#define CPUID_XSAVE                     0xD                                         /* subleaf 0: components and sizes, 1: variants */
+#define CPUID_XSAVE_EAX_XSAVEOPT        (1U << 0)
+#define CPUID_XSAVE_EAX_XSAVES          (1U << 3)
+#define CPUID_TOPOLOGY                  0xB                                         /* EDX holds the 32-bit x2APIC ID */
+#define CPUID_EXT_MAX                   0x80000000                                  /* EAX holds the highest extended leaf */
+#define CPUID_EXT_FEATURES              0x80000001
+#define CPUID_EXT_FEATURES_EDX_NX       (1U << 20)
+#define CPUID_EXT_FEATURES_EDX_PDPE1GB  (1U << 26)
+#define CPUID_EXT_POWER_MANAGEMENT      0x80000007
+#define CPUID_EXT_POWER_EDX_INVARIANT_TSC (1U << 8)                                 /* constant rate, keeps running in deep C-states */
+
+/**
+ * @brief Executes `cpuid` with the given leaf and subleaf.
+ */
+#define cpuid(leaf, subleaf, eax, ebx, ecx, edx) \
+    do {                                \
+        asm volatile (                  \
+            "cpuid\n"                   \
+            : "=a" (eax), "=b" (ebx),   \
+              "=c" (ecx), "=d" (edx)    \
+            : "a" (leaf), "c" (subleaf) \
+        );                              \
+    } while (0)
+
+#define XCR0_X87                        (1ULL << 0)                                 /* state components `xsave` manages */
+#define XCR0_SSE                        (1ULL << 1)
+#define XCR0_AVX                        (1ULL << 2)                                 /* upper halves of the YMM registers */
+#define XCR0_OPMASK                     (1ULL << 5)                                 /* AVX-512 k0-k7 */
+#define XCR0_ZMM_HI256                  (1ULL << 6)                                 /* upper halves of ZMM0-15 */
+#define XCR0_HI16_ZMM                   (1ULL << 7)                                 /* ZMM16-31 */
+#define XCR0_AVX512                     (XCR0_OPMASK | XCR0_ZMM_HI256 | XCR0_HI16_ZMM)
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t low, high;
+    asm volatile ("rdmsr\n" : "=a"(low), "=d"(high) : "c"(msr));
+    return ((uint64_t)high << 32) | low;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    asm volatile ("wrmsr\n" : : "a"((uint32_t)value), "d"((uint32_t)(value >> 32)), "c"(msr) : "memory");
+}
+
+/**
+ * @brief Reads an extended control register. Requires CR4.OSXSAVE.
+ */
+static inline uint64_t xgetbv(uint32_t xcr) {
+    uint32_t low, high;
+    asm volatile ("xgetbv\n" : "=a"(low), "=d"(high) : "c"(xcr));
+    return ((uint64_t)high << 32) | low;
+}
+
+/**
+ * @brief Writes an extended control register. Requires CR4.OSXSAVE.
+ */
+static inline void xsetbv(uint32_t xcr, uint64_t value) {
+    asm volatile ("xsetbv\n" : : "a"((uint32_t)value), "d"((uint32_t)(value >> 32)), "c"(xcr) : "memory");
+}
+
+/**
+ * @brief Reads the time stamp counter. `rdtsc` is not serializing, so the caller should not
+ *        expect it to be ordered against the surrounding loads and stores.
+ */
+static inline uint64_t rdtsc(void) {
+    uint32_t low, high;
+    asm volatile ("rdtsc\n" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+static inline uint64_t read_cr3(void) {
+    uint64_t value;
+    asm volatile ("movq %%cr3, %0\n" : "=r"(value) : : "memory");
+    return value;
+}
+
+static inline uint64_t read_cr2(void) {
+    uint64_t value;
+    asm volatile ("movq %%cr2, %0\n" : "=r"(value));
+    return value;
+}
+
+static inline uint64_t read_cr0(void) {
+    uint64_t value;
+    asm volatile ("movq %%cr0, %0\n" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr0(uint64_t value) {
+    asm volatile ("movq %0, %%cr0\n" : : "r"(value) : "memory");
+}
+
+static inline uint64_t read_cr4(void) {
+    uint64_t value;
+    asm volatile ("movq %%cr4, %0\n" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr4(uint64_t value) {
+    asm volatile ("movq %0, %%cr4\n" : : "r"(value) : "memory");
+}
+
+static inline void clts(void) {
+    asm volatile ("clts\n" : : : "memory");
+}
+
+static inline void write_cr3(uint64_t value) {
+    asm volatile ("movq %0, %%cr3\n" : : "r"(value) : "memory");
+}
+
+static inline uint64_t read_rsp(void) {
+    uint64_t value;
+    asm volatile ("movq %%rsp, %0\n" : "=r"(value));
+    return value;
+}
+
+/**
+ * @brief Hints the processor that we are in a spin-wait loop.
+ */
+static inline void cpu_relax(void) {
+    asm volatile ("pause\n" : : : "memory");
+}
+
+/**
+ * @brief Enables interrupts and halts until the next one. `sti` takes effect only after the
+ *        following instruction, so an interrupt that became pending while the caller checked
+ *        for work with interrupts disabled still ends the `hlt`.
+ */
+static inline void arch_irq_enable_and_halt(void) {
+    asm volatile ("sti\n" "hlt\n" : : : "memory");
+}
+
+/**
+ * @brief Disables interrupts on the current CPU and returns the previous RFLAGS, which should
+ *        be handed back to `arch_irq_restore()`.
+ */
+static inline uint64_t arch_irq_save(void) {
+    uint64_t flags;
+    asm volatile ("pushfq\n" "popq %0\n" "cli\n" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void arch_irq_enable(void) {
+    asm volatile ("sti\n" : : : "memory");
+}
+
+static inline void arch_irq_disable(void) {
+    asm volatile ("cli\n" : : : "memory");
+}
+
+static inline void arch_irq_restore(uint64_t flags) {
+    if (flags & CPU_RFLAGS_IF) {
+        asm volatile ("sti\n" : : : "memory");
+    }
+}
+
+#endif
@@ -21,6 +21,21 @@
 extern union idt_entry idt_entries[256];
 extern struct idtr idtr;
 
+/**
+ * @brief Points every vector at its stub in `isr_stubs`, so that anything not registered
+ *        later ends up in the default handler of `interrupt_dispatch()`.
+ */
 void init_idt(void);
 
+/**
+ * @brief Installs `handler` as the interrupt gate of `vector`. The IST index it had is kept.
+ */
+void idt_set_gate(uint8_t vector, void (*handler)(void));
+
+/**
+ * @brief Makes `vector` switch to the stack in slot `ist` of the TSS, 0 to stay on the
+ *        interrupted one.
+ */
+void idt_set_ist(uint8_t vector, uint8_t ist);
+
 #endif
\ No newline at end of file
@@ -1,9 +1,15 @@
 #ifndef ARCH_X86_64_FLAT_GDT_H
 #define ARCH_X86_64_FLAT_GDT_H
 
+#include <smp.h>
+
 #include <arch/desc.h>
 
-extern union gdt_entry gdt_entries[];
+#define GDT_TSS_FIRST                   5                                           /* one TSS descriptor per CPU follows the flat segments */
+#define GDT_ENTRIES                     (GDT_TSS_FIRST + SMP_MAX_CPUS)
+#define GDT_TSS_SELECTOR(cpu)           ((GDT_TSS_FIRST + (cpu)) * sizeof(union gdt_entry))
+
+extern union gdt_entry gdt_entries[GDT_ENTRIES];
 extern struct gdtr gdtr;
 
 #endif // ARCH_X86_64_FLAT_GDT_H
\ No newline at end of file
@@ -0,0 +1,122 @@
+#ifndef __NICKEL_X86_64_FPU_H__
+#define __NICKEL_X86_64_FPU_H__
+
+#include <stdint.h>
+
+#include <percpu.h>
+
+#define FPU_AREA_MAX                    4096                                        /* x87 through AVX-512 take 2688 bytes */
+#define FPU_LEGACY_SIZE                 512                                         /* the `fxsave` image */
+#define FPU_FCW_OFFSET                  0
+#define FPU_MXCSR_OFFSET                24
+#define FPU_XCOMP_BV_OFFSET             520                                         /* in the header after the legacy image */
+#define FPU_FCW_DEFAULT                 0x037F                                      /* all x87 exceptions masked */
+#define FPU_MXCSR_DEFAULT               0x1F80                                      /* all SIMD exceptions masked */
+#define FPU_XCOMP_COMPACTED             (1ULL << 63)                                /* written by `xsaves`, needs `xrstors` */
+#define FPU_NO_CPU                      0xFFFFFFFF
+
+/**
+ * @brief Instruction saving the state of a thread when it is switched out. All but
+ *        `FPU_SAVE_XSAVE` skip components in their initial state; `FPU_SAVE_XSAVEOPT` and
+ *        `FPU_SAVE_XSAVES` also skip those not modified since the area was last restored.
+ */
+#define FPU_SAVE_FXSAVE                 0                                           /* CPUs without `xsave`, x87 and SSE only */
+#define FPU_SAVE_XSAVE                  1
+#define FPU_SAVE_XSAVEOPT               2
+#define FPU_SAVE_XSAVES                 3                                           /* compacted, smallest area */
+
+#define FPU_SUCCESS                     0
+#define FPU_FAILURE                     0x80000000
+#define FPU_NO_MEMORY                   (FPU_FAILURE | 1)
+
+/**
+ * @brief Vector state of a thread, allocated from the fpu cache by its first
+ *        `kernel_fpu_begin()`. Only sections between `kernel_fpu_begin()` and
+ *        `kernel_fpu_end()` have state that lives across a switch: elsewhere the kernel uses
+ *        %xmm0-15 as scratch the C calling convention does not preserve across the call to
+ *        `schedule()`, and which the interrupt stubs save themselves.
+ */
+struct fpu {
+    uint32_t depth;                                                                 /* nesting of sections, the state is live while non-zero */
+    uint32_t cpu;                                                                   /* whose registers it was last restored to */
+    uint8_t reserved[56];
+    uint8_t area[] __attribute__((aligned(64)));                                    /* `xsave` image, 64-byte aligned */
+};
+
+/**
+ * @brief `fpu_current` is the state the running thread keeps in the registers, `NULL` outside
+ *        sections. `fpu_owner` is the state the registers hold, which may still be that of
+ *        the thread switched out while CR0.TS defers the restore of the next one.
+ */
+DECLARE_PER_CPU(struct fpu *, fpu_current);
+DECLARE_PER_CPU(struct fpu *, fpu_owner);
+
+extern uint32_t fpu_save_mode;                                                      /* one of `FPU_SAVE_*` */
+extern int fpu_lazy;                                                                /* restore on #NM rather than on switch */
+
+/**
+ * @brief Picks the components for XCR0 from CPUID leaf 0xD, enables them on the boot CPU and
+ *        sizes the save area for them. Must run before `string_init()`, which only picks the
+ *        AVX2 variants when XCR0 enables the YMM state.
+ */
+void fpu_early_init(void);
+
+/**
+ * @brief Creates the cache of `struct fpu` and installs the #NM handler. Must run after
+ *        `slab_init()`.
+ *
+ * @return `FPU_SUCCESS` on success, `FPU_NO_MEMORY` otherwise.
+ */
+int32_t fpu_init(void);
+
+/**
+ * @brief Enables SSE, `xsave` and the components `fpu_early_init()` picked on the calling
+ *        CPU. APs call it before anything runs on them.
+ */
+void fpu_cpu_init(void);
+
+/**
+ * @brief Called by `schedule()` with interrupts disabled right before the context switch. Saves
+ *        the live state of the thread switched out and either restores that of `next` or,
+ *        with `fpu_lazy`, sets CR0.TS so that its first vector instruction does.
+ */
+void fpu_switch(struct fpu *next);
+
+/**
+ * @brief Handler of #NM, entered through `fpu_trap_entry`. Restores the state of the running
+ *        thread, or hands the registers to a thread without any.
+ */
+void fpu_trap(void);
+
+/**
+ * @brief Returns the state of an exited thread to the cache.
+ */
+void fpu_free(struct fpu *fpu);
+
+/**
+ * @brief Starts a section in which the calling thread may keep any vector register live,
+ *        including the YMM and ZMM upper halves and the AVX-512 masks, across preemption
+ *        and migration. The registers start out in their initial state. Sections nest; only
+ *        threads may open them, not interrupt handlers.
+ *
+ * @return `FPU_SUCCESS` on success, `FPU_NO_MEMORY` if the state cannot be allocated.
+ */
+int32_t kernel_fpu_begin(void);
+
+/**
+ * @brief Ends the section of the matching `kernel_fpu_begin()`. The outermost one gives the
+ *        registers back to the scratch use of the rest of the kernel.
+ */
+void kernel_fpu_end(void);
+
+#if defined(NICKEL_BENCH)
+/**
+ * @brief Measures the cost of a switch between two threads without vector state, with state
+ *        they leave alone and with state they dirty on every switch, saving it eagerly with
+ *        `xsave` and lazily with each variant the CPU has. Runs in a thread of its own and
+ *        prints when it is done.
+ */
+void fpu_bench(void);
+#endif
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef __NICKEL_X86_64_HPET_H__
+#define __NICKEL_X86_64_HPET_H__
+
+#include <stdint.h>
+
+#define HPET_REG_CAPABILITIES           0x000
+#define HPET_REG_CONFIG                 0x010
+#define HPET_REG_COUNTER                0x0F0
+
+#define HPET_CAPABILITIES_COUNTER_64    (1ULL << 13)
+#define HPET_CAPABILITIES_PERIOD_SHIFT  32                                          /* counter period in femtoseconds */
+#define HPET_CONFIG_ENABLE              (1ULL << 0)
+
+#define HPET_FEMTOSECONDS_PER_SECOND    1000000000000000ULL
+#define HPET_MAX_PERIOD                 100000000ULL                                /* 100ns, the specification's upper bound */
+
+#define HPET_SUCCESS                    0
+#define HPET_FAILURE                    0x80000000
+#define HPET_NOT_PRESENT                (HPET_FAILURE | 1)
+#define HPET_INVALID_PERIOD             (HPET_FAILURE | 2)
+#define HPET_NO_MEMORY                  (HPET_FAILURE | 3)
+
+/**
+ * @brief Counter frequency in Hz and the mask of its valid bits, valid after `hpet_init()`.
+ */
+extern uint64_t hpet_frequency;
+extern uint64_t hpet_mask;
+extern volatile uint64_t *hpet_base;
+
+/**
+ * @brief Maps the HPET registers and starts the main counter. Only the counter is used; the
+ *        comparators are left alone.
+ *
+ * @param phys Physical address of the registers from the ACPI HPET table.
+ * @return `HPET_SUCCESS` on success, one of `HPET_*` errors otherwise.
+ */
+int32_t hpet_init(uint64_t phys);
+
+/**
+ * @brief Reads the main counter.
+ */
+static inline uint64_t hpet_read(void) {
+    return hpet_base[HPET_REG_COUNTER / sizeof(uint64_t)];
+}
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef __NICKEL_X86_64_INTERRUPT_H__
+#define __NICKEL_X86_64_INTERRUPT_H__
+
+#include <stdint.h>
+
+#define INTERRUPT_VECTORS               256
+#define INTERRUPT_EXCEPTIONS            32                                          /* vectors reserved for CPU exceptions */
+#define ISR_STUB_SIZE                   16                                          /* distance between two stubs in `isr_stubs` */
+
+#define EXCEPTION_DIVIDE_ERROR          0
+#define EXCEPTION_DEBUG                 1
+#define EXCEPTION_NMI                   2
+#define EXCEPTION_BREAKPOINT            3
+#define EXCEPTION_OVERFLOW              4
+#define EXCEPTION_INVALID_OPCODE        6
+#define EXCEPTION_DEVICE_NOT_AVAILABLE  7
+#define EXCEPTION_DOUBLE_FAULT          8
+#define EXCEPTION_GENERAL_PROTECTION    13
+#define EXCEPTION_PAGE_FAULT            14
+#define EXCEPTION_MACHINE_CHECK         18
+
+/**
+ * @brief Registers as `isr_common` leaves them on the stack. `vector` and `error_code` are
+ *        pushed by the stub, the error code being 0 for vectors without one; the rest above
+ *        them is the frame the CPU pushed.
+ */
+struct trap_frame {
+    uint64_t r15, r14, r13, r12, r11, r10, r9, r8;
+    uint64_t rbp, rdi, rsi, rdx, rcx, rbx, rax;
+    uint64_t vector;
+    uint64_t error_code;
+    uint64_t rip, cs, rflags, rsp, ss;
+};
+
+/**
+ * @brief Handler of a vector on the generic path. Handlers of APIC interrupts send the EOI.
+ */
+typedef void (*interrupt_handler_t)(struct trap_frame *frame);
+
+/**
+ * @brief Entry stubs of all vectors, `ISR_STUB_SIZE` bytes apart, defined in irq_entry.s.
+ */
+extern uint8_t isr_stubs[];
+
+/**
+ * @brief Routes `vector` through the dispatch table to `handler`. Passing `NULL` restores the
+ *        default, which reports exceptions and unexpected interrupts. Hot vectors should use
+ *        an `IRQ_ENTRY` stub installed with `idt_set_gate()` instead.
+ */
+void interrupt_register(uint8_t vector, interrupt_handler_t handler);
+
+/**
+ * @brief Common C entry of every vector that goes through `isr_stubs`.
+ */
+void interrupt_dispatch(struct trap_frame *frame);
+
+/**
+ * @brief Prints `frame` over serial.
+ */
+void interrupt_dump_frame(const struct trap_frame *frame);
+
+/**
+ * @brief Handler of `interrupt_nop_entry`, a fast-path stub that does nothing.
+ */
+void interrupt_nop(void);
+
+#if defined(NICKEL_BENCH)
+/**
+ * @brief Measures the cycles of a software interrupt round trip through the generic and the
+ *        fast entry path.
+ */
+void interrupt_bench(void);
+#endif
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef __NICKEL_X86_64_IO_H__
+#define __NICKEL_X86_64_IO_H__
+
+#include <stdint.h>
+
+static inline void outb(uint16_t port, uint8_t value) {
+    asm volatile ("outb %0, %1\n" : : "a"(value), "Nd"(port) : "memory");
+}
+
+static inline uint8_t inb(uint16_t port) {
+    uint8_t value;
+    asm volatile ("inb %1, %0\n" : "=a"(value) : "Nd"(port) : "memory");
+    return value;
+}
+
+static inline void outw(uint16_t port, uint16_t value) {
+    asm volatile ("outw %0, %1\n" : : "a"(value), "Nd"(port) : "memory");
+}
+
+static inline uint16_t inw(uint16_t port) {
+    uint16_t value;
+    asm volatile ("inw %1, %0\n" : "=a"(value) : "Nd"(port) : "memory");
+    return value;
+}
+
+static inline void outl(uint16_t port, uint32_t value) {
+    asm volatile ("outl %0, %1\n" : : "a"(value), "Nd"(port) : "memory");
+}
+
+static inline uint32_t inl(uint16_t port) {
+    uint32_t value;
+    asm volatile ("inl %1, %0\n" : "=a"(value) : "Nd"(port) : "memory");
+    return value;
+}
+
+#endif
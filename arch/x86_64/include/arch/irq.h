@@ -0,0 +1,120 @@
+#ifndef __NICKEL_X86_64_IRQ_H__
+#define __NICKEL_X86_64_IRQ_H__
+
+#include <stdint.h>
+
+#include <arch/interrupt.h>
+
+#define IRQ_VECTOR_FIRST                0x30                                        /* device vectors, every CPU has its own pool */
+#define IRQ_VECTOR_LAST                 0x7F
+#define IRQ_VECTOR_WORDS                (INTERRUPT_VECTORS / 64)
+#define IRQ_MAX                         64
+#define IRQ_CPU_ANY                     0xFFFFFFFFU                                 /* the online CPU with the fewest device vectors */
+
+#define MSI_ADDRESS_BASE                0xFEE00000U
+#define MSI_ADDRESS_DESTINATION_SHIFT   12
+#define MSI_MAX_DESTINATION             0xFF                                        /* APIC IDs above need interrupt remapping */
+
+#define IRQ_SUCCESS                     0
+#define IRQ_FAILURE                     0x80000000
+#define IRQ_INVALID_PARAMETER           (IRQ_FAILURE | 1)
+#define IRQ_NO_DESCRIPTOR               (IRQ_FAILURE | 2)
+#define IRQ_NO_VECTOR                   (IRQ_FAILURE | 3)
+#define IRQ_UNREACHABLE                 (IRQ_FAILURE | 4)
+
+enum irq_type {
+    IRQ_TYPE_NONE,
+    IRQ_TYPE_IOAPIC,
+    IRQ_TYPE_MSI,
+};
+
+/**
+ * @brief An MSI message as a device sends it: a write of `data` to `address`. The same
+ *        format fills an MSI capability and an MSI-X table entry.
+ */
+struct msi_msg {
+    uint32_t address_lo;
+    uint32_t address_hi;
+    uint32_t data;
+};
+
+/**
+ * @brief Writes `msg` to the MSI capability or MSI-X table entry `device` stands for. Called
+ *        when the IRQ is requested and whenever its affinity changes.
+ */
+typedef void (*msi_write_t)(void *device, const struct msi_msg *msg);
+
+/**
+ * @brief Sets up the I/O APICs and routes the device vectors of every CPU to `irq_interrupt()`.
+ *        Must run after `acpi_init()` and `percpu_init()`.
+ */
+void irq_init(void);
+
+/**
+ * @brief Routes the ISA IRQ `isa_irq`, with the polarity and trigger mode the MADT gives it,
+ *        to `handler(arg)` on `cpu` and unmasks it.
+ *
+ * @param cpu A CPU index, or `IRQ_CPU_ANY`.
+ * @return The IRQ number on success, one of `IRQ_*` errors otherwise.
+ */
+int32_t irq_request_isa(uint8_t isa_irq, void (*handler)(void *arg), void *arg, const char *name, uint32_t cpu);
+
+/**
+ * @brief Routes the I/O APIC input `gsi` to `handler(arg)` on `cpu` and unmasks it.
+ *
+ * @param flags `IOAPIC_POLARITY_LOW` and `IOAPIC_TRIGGER_LEVEL` bits, e.g. `IOAPIC_FLAGS_PCI`.
+ * @return The IRQ number on success, one of `IRQ_*` errors otherwise.
+ */
+int32_t irq_request_gsi(uint32_t gsi, uint32_t flags, void (*handler)(void *arg), void *arg, const char *name,
+                        uint32_t cpu);
+
+/**
+ * @brief Allocates a vector on `cpu` for an MSI or one MSI-X entry and hands the message that
+ *        targets it to `write(device, msg)`. A device with several MSI-X entries requests one
+ *        IRQ per entry, so each queue can interrupt the CPU that consumes it.
+ *
+ * @return The IRQ number on success, one of `IRQ_*` errors otherwise.
+ */
+int32_t irq_request_msi(msi_write_t write, void *device, void (*handler)(void *arg), void *arg, const char *name,
+                        uint32_t cpu);
+
+/**
+ * @brief Moves `irq` to a vector of `cpu`. The old vector is released only after a grace
+ *        period, so an interrupt already on its way to the old CPU is still handled. Must be
+ *        called from a thread.
+ *
+ * @return `IRQ_SUCCESS` on success, one of `IRQ_*` errors otherwise; the IRQ then stays where
+ *         it was.
+ */
+int32_t irq_set_affinity(uint32_t irq, uint32_t cpu);
+
+/**
+ * @brief Gets the CPU `irq` is delivered to.
+ */
+uint32_t irq_get_affinity(uint32_t irq);
+
+/**
+ * @brief Masks `irq` and releases its vector and descriptor. Must be called from a thread.
+ */
+void irq_free(uint32_t irq);
+
+/**
+ * @brief Common handler of all device vectors. Looks the vector up in the table of the calling
+ *        CPU, counts the interrupt for it and runs the handler of the IRQ.
+ */
+void irq_interrupt(struct trap_frame *frame);
+
+/**
+ * @brief Prints how often every requested IRQ arrived on every CPU.
+ */
+void irq_print_stats(void);
+
+#if defined(NICKEL_BENCH)
+/**
+ * @brief Spreads MSI-style IRQs over the online CPUs, raises each one on its CPU, steers all
+ *        of them to the boot CPU and raises them again, printing the per-CPU counts.
+ */
+void irq_bench(void);
+#endif
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef __NICKEL_X86_64_PAGING_H__
+#define __NICKEL_X86_64_PAGING_H__
+
+#include <stdint.h>
+
+#include <bootproto/bootinfo.h>
+
+#define PAGE_SHIFT                      12
+#define PAGE_SIZE                       (1ULL << PAGE_SHIFT)
+#define PAGE_MASK                       (~(PAGE_SIZE - 1))
+
+#define PAGING_LEVELS                   4
+#define PAGING_ENTRIES                  512                                         /* entries per table at every level */
+
+#define PAGING_SIZE_4K                  (1ULL << 12)                                /* mapped by a PT entry */
+#define PAGING_SIZE_2M                  (1ULL << 21)                                /* mapped by a PD entry */
+#define PAGING_SIZE_1G                  (1ULL << 30)                                /* mapped by a PDPT entry, needs pdpe1gb */
+
+#define PAGING_DIRECT_MAP_BASE          0xFFFF888000000000ULL                       /* all of RAM, PML4 slot 273 */
+#define PAGING_MMIO_BASE                0xFFFFC90000000000ULL                       /* device registers, PML4 slot 402 */
+#define PAGING_MMIO_SIZE                (1ULL << 39)
+#define PAGING_STACK_BASE               0xFFFFC98000000000ULL                       /* guarded kernel stacks, PML4 slot 403 */
+#define PAGING_STACK_SIZE               (1ULL << 39)
+#define PAGING_KERNEL_BASE              0xFFFFFFFF80000000ULL                       /* higher-half alias of the kernel image */
+
+#define PTE_PRESENT                     (1ULL << 0)
+#define PTE_WRITE                       (1ULL << 1)
+#define PTE_USER                        (1ULL << 2)
+#define PTE_WRITE_THROUGH               (1ULL << 3)
+#define PTE_CACHE_DISABLE               (1ULL << 4)
+#define PTE_ACCESSED                    (1ULL << 5)
+#define PTE_DIRTY                       (1ULL << 6)
+#define PTE_HUGE                        (1ULL << 7)                                 /* 1GB in PDPT, 2MB in PD */
+#define PTE_GLOBAL                      (1ULL << 8)
+#define PTE_NO_EXECUTE                  (1ULL << 63)
+#define PTE_CACHE_WRITE_COMBINING       PTE_WRITE_THROUGH                           /* PAT entry 1, see `PAGING_PAT` */
+#define PTE_CACHE_UNCACHED              (PTE_CACHE_DISABLE | PTE_WRITE_THROUGH)     /* PAT entry 3 */
+#define PTE_ADDRESS_MASK                0x000FFFFFFFFFF000ULL
+#define PTE_FLAGS_MASK                  (~PTE_ADDRESS_MASK)
+
+#define CR3_ADDRESS_MASK                PTE_ADDRESS_MASK
+
+#define PAT_UNCACHEABLE                 0x00
+#define PAT_WRITE_COMBINING             0x01
+#define PAT_WRITE_BACK                  0x06
+#define PAT_UNCACHED                    0x07                                        /* UC-, an MTRR may still make it WC */
+#define PAT_ENTRY(index, type)          ((uint64_t)(type) << (8 * (index)))
+
+/**
+ * @brief PAT the kernel programs on every CPU: the power-on layout with write-through in entry 1
+ *        (PWT alone) replaced by write-combining. Nothing maps write-through, and entries 0 and
+ *        3 keep meaning write-back and uncacheable as before.
+ */
+#define PAGING_PAT                      (PAT_ENTRY(0, PAT_WRITE_BACK) | PAT_ENTRY(1, PAT_WRITE_COMBINING) |     \
+                                         PAT_ENTRY(2, PAT_UNCACHED) | PAT_ENTRY(3, PAT_UNCACHEABLE) |           \
+                                         PAT_ENTRY(4, PAT_WRITE_BACK) | PAT_ENTRY(5, PAT_WRITE_COMBINING) |     \
+                                         PAT_ENTRY(6, PAT_UNCACHED) | PAT_ENTRY(7, PAT_UNCACHEABLE))
+
+#define PAGING_INVALID_ADDRESS          (~0ULL)
+
+#define PAGING_SUCCESS                  0
+#define PAGING_FAILURE                  0x80000000
+#define PAGING_INVALID_PARAMETER        (PAGING_FAILURE | 1)
+#define PAGING_NO_MEMORY                (PAGING_FAILURE | 2)
+#define PAGING_ALREADY_MAPPED           (PAGING_FAILURE | 3)
+#define PAGING_NOT_MAPPED               (PAGING_FAILURE | 4)
+
+/**
+ * @brief Offset at which all physical memory is visible. It is 0 while the firmware identity
+ *        map is live and `PAGING_DIRECT_MAP_BASE` once `paging_init()` switched to the kernel
+ *        tables.
+ */
+extern uint64_t paging_phys_offset;
+
+extern uint64_t *kernel_pml4;                                                       /* direct-map pointer to the kernel PML4 */
+extern uint64_t kernel_cr3;
+
+/**
+ * @brief Flags the CPU supports, masked into every flag set handed to the mapping functions
+ *        so that callers can ask for NX and global pages unconditionally.
+ */
+extern uint64_t paging_supported_flags;
+extern int paging_has_1g_pages;
+
+static inline void *phys_to_virt(uint64_t phys) {
+    return (void *)(phys + paging_phys_offset);
+}
+
+/**
+ * @brief Translates a kernel pointer back to its physical address. Besides the direct map,
+ *        this covers the higher-half kernel alias and the identity-mapped image and boot stack.
+ */
+static inline uint64_t virt_to_phys(const void *virt) {
+    uint64_t address = (uint64_t)virt;
+
+    if (address >= PAGING_KERNEL_BASE) {
+        return address - PAGING_KERNEL_BASE + KERNEL_ADDRESS;
+    } else if (address >= PAGING_DIRECT_MAP_BASE && address < PAGING_MMIO_BASE) {
+        return address - PAGING_DIRECT_MAP_BASE;
+    }
+    return address;
+}
+
+static inline void paging_invalidate(uint64_t virt) {
+    asm volatile ("invlpg (%0)\n" : : "r"(virt) : "memory");
+}
+
+/**
+ * @brief Builds the kernel page tables and switches CR3 to them. The new tables contain:
+ *        - the direct map of every RAM region at `PAGING_DIRECT_MAP_BASE`, with 1GB pages if
+ *          the CPU has pdpe1gb and 2MB pages otherwise, global and non-executable;
+ *        - the kernel image at its link address and at `PAGING_KERNEL_BASE`, text read-only
+ *          and executable, rodata read-only, data and bss writable;
+ *        - an identity map of the low megabyte (except page 0) for the AP trampoline and of
+ *          the firmware stack we are still running on.
+ *        Tables are carved from the firmware memory map, so this runs before `pmm_init()`.
+ *
+ * @param boot_info Boot information passed from the bootloader. The memory map is shrunk by
+ *        the pages taken for tables.
+ * @return `PAGING_SUCCESS` on success, one of `PAGING_*` errors otherwise.
+ */
+int32_t paging_init(struct nickel_boot_info *boot_info);
+
+/**
+ * @brief Maps `[virt, virt + size)` to `[phys, phys + size)` with pages of exactly
+ *        `page_size`. A large page already covering part of the range is split first.
+ *
+ * @param root PML4 of the address space.
+ * @param page_size One of `PAGING_SIZE_4K`, `PAGING_SIZE_2M` or `PAGING_SIZE_1G`. `virt`,
+ *        `phys` and `size` must be multiples of it.
+ * @param flags `PTE_*` bits; `PTE_PRESENT` and `PTE_HUGE` are implied.
+ * @return `PAGING_SUCCESS` on success, `PAGING_ALREADY_MAPPED` if a page in the range is in
+ *         use, or another `PAGING_*` error.
+ */
+int32_t paging_map(uint64_t *root, uint64_t virt, uint64_t phys, uint64_t size, uint64_t flags, uint64_t page_size);
+
+/**
+ * @brief Maps a range with the largest pages its alignment allows.
+ */
+int32_t paging_map_range(uint64_t *root, uint64_t virt, uint64_t phys, uint64_t size, uint64_t flags);
+
+/**
+ * @brief Removes every mapping in `[virt, virt + size)` and invalidates it in the local TLB.
+ *        Large pages straddling either end are split so the rest of them stays mapped.
+ *        Holes in the range are skipped.
+ */
+int32_t paging_unmap(uint64_t *root, uint64_t virt, uint64_t size);
+
+/**
+ * @brief Replaces the `PTE_*` flags of every mapped page in `[virt, virt + size)`, splitting
+ *        large pages straddling either end.
+ */
+int32_t paging_protect(uint64_t *root, uint64_t virt, uint64_t size, uint64_t flags);
+
+/**
+ * @brief Gets the physical address `virt` maps to, or `PAGING_INVALID_ADDRESS`.
+ */
+uint64_t paging_translate(const uint64_t *root, uint64_t virt);
+
+/**
+ * @brief Maps device registers uncached into the MMIO window of the kernel address space.
+ *
+ * @return The virtual address of `phys`, or `NULL` if the window or memory is exhausted.
+ */
+void *paging_map_mmio(uint64_t phys, uint64_t size);
+
+/**
+ * @brief Maps memory such as a framebuffer write-combining into the MMIO window. Stores are
+ *        buffered and burst to the device, reads are uncached. Falls back to uncached on a CPU
+ *        without PAT.
+ *
+ * @return The virtual address of `phys`, or `NULL` if the window or memory is exhausted.
+ */
+void *paging_map_wc(uint64_t phys, uint64_t size);
+
+/**
+ * @brief Programs `PAGING_PAT` on the calling CPU. The boot CPU does so in `paging_init()`,
+ *        every AP before it maps anything.
+ */
+void paging_cpu_init(void);
+
+/**
+ * @brief Allocates a zeroed page-table page.
+ *
+ * @return Its physical address, or 0 if memory is exhausted.
+ */
+uint64_t paging_alloc_table(void);
+
+/**
+ * @brief Frees `table` and every table below it. The pages they map are left alone.
+ *
+ * @param table Physical address of the table.
+ * @param level Level of `table`, `PAGING_LEVELS` for a PML4.
+ */
+void paging_free_tables(uint64_t table, uint32_t level);
+
+/**
+ * @brief Visits every page-table page reachable from `root`, including `root` itself. Large
+ *        pages terminate the walk of their branch.
+ *
+ * @param root Physical address of the PML4, as found in CR3.
+ * @param visit Callback receiving the physical address of each table.
+ */
+void paging_walk_tables(uint64_t root, void (*visit)(uint64_t table));
+
+#if defined(NICKEL_BENCH)
+/**
+ * @brief Builds a 4GB direct map in scratch tables with 1GB, 2MB and 4KB pages and prints how
+ *        many page-table pages each one takes.
+ */
+void paging_bench(void);
+#endif
+
+#endif
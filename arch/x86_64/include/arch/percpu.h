@@ -0,0 +1,32 @@
+#ifndef __NICKEL_X86_64_PERCPU_H__
+#define __NICKEL_X86_64_PERCPU_H__
+
+#include <stdint.h>
+
+#include <arch/cpu.h>
+
+/**
+ * @brief Per-CPU variables are linked at their offset into the per-CPU area and GS points at
+ *        the area of the running CPU, so `%gs:var` is the copy of this CPU. Each accessor is a
+ *        single instruction, so an interrupt cannot split it; it can still be preempted and
+ *        migrated between two of them.
+ */
+#define this_cpu_gs(var)                ((volatile __seg_gs __typeof__(var) *)(uint64_t)&(var))
+
+#define this_cpu_read(var)              (*this_cpu_gs(var))
+#define this_cpu_write(var, value)      (*this_cpu_gs(var) = (value))
+#define this_cpu_add(var, value)        \
+    asm volatile ("add%z0 %1, %0\n" : "+m"(*this_cpu_gs(var)) : "er"((__typeof__(var))(value)))
+#define this_cpu_inc(var)               this_cpu_add(var, 1)
+#define this_cpu_dec(var)               this_cpu_add(var, -1)
+
+/**
+ * @brief Points GS at `base`. `MSR_KERNEL_GS_BASE` gets the same value, so a swapgs without
+ *        a user GS to swap in is harmless.
+ */
+static inline void arch_percpu_set_base(uint64_t base) {
+    wrmsr(MSR_GS_BASE, base);
+    wrmsr(MSR_KERNEL_GS_BASE, base);
+}
+
+#endif
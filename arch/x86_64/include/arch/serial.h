@@ -0,0 +1,40 @@
+#ifndef __NICKEL_X86_64_SERIAL_H__
+#define __NICKEL_X86_64_SERIAL_H__
+
+#include <stdint.h>
+
+#define SERIAL_COM1                     0x3F8
+
+#define SERIAL_REG_DATA                 0                                           /* receive/transmit buffer (DLAB = 0) */
+#define SERIAL_REG_INTERRUPT_ENABLE     1
+#define SERIAL_REG_DIVISOR_LOW          0                                           /* DLAB = 1 */
+#define SERIAL_REG_DIVISOR_HIGH         1                                           /* DLAB = 1 */
+#define SERIAL_REG_FIFO_CONTROL         2
+#define SERIAL_REG_LINE_CONTROL         3
+#define SERIAL_REG_MODEM_CONTROL        4
+#define SERIAL_REG_LINE_STATUS          5
+
+#define SERIAL_LINE_CONTROL_8N1         0x03
+#define SERIAL_LINE_CONTROL_DLAB        0x80
+#define SERIAL_FIFO_ENABLE_CLEAR_14     0xC7                                        /* enable and clear FIFOs, 14-byte threshold */
+#define SERIAL_MODEM_DTR_RTS_OUT2       0x0B
+#define SERIAL_LINE_STATUS_THR_EMPTY    0x20
+
+#define SERIAL_BAUD_BASE                115200
+
+/**
+ * @brief Initializes the 16550 UART at COM1 as 115200 8N1 with FIFOs enabled.
+ */
+void serial_init(void);
+
+/**
+ * @brief Writes one character, spinning until the transmitter holding register is empty.
+ */
+void serial_putc(char c);
+
+/**
+ * @brief Writes `length` characters, translating `\n` to `\r\n`.
+ */
+void serial_write(const char *buffer, uint64_t length);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef __NICKEL_X86_64_SMPBOOT_H__
+#define __NICKEL_X86_64_SMPBOOT_H__
+
+#include <stdint.h>
+
+#include <smp.h>
+
+#define SMP_TRAMPOLINE_ADDRESS          0x8000                                      /* SIPI vector 0x08, must match AP_TRAMPOLINE */
+#define SMP_TRAMPOLINE_PML4             0x9000                                      /* CR3 is loaded in 32-bit mode, so below 4GB */
+#define SMP_AP_STACK_ORDER              2                                           /* 16KB per AP */
+
+#define SMP_INIT_DELAY_US               10000                                       /* INIT to SIPI, once per batch */
+#define SMP_SIPI_DELAY_US               200                                         /* between the two SIPIs */
+#define SMP_BOOT_TIMEOUT_US             100000
+
+/**
+ * @brief Values the trampoline loads before it enters long mode, at `ap_trampoline_data` in
+ *        the copy. Every field is 32 bits since it is read in protected mode.
+ */
+struct ap_trampoline_data {
+    uint32_t pml4;                                                                  /* `SMP_TRAMPOLINE_PML4` */
+    uint32_t cr0;
+    uint32_t cr4;
+    uint32_t efer;
+};
+
+/**
+ * @brief Tops of the AP stacks. APs take them in the order they reach long mode.
+ */
+extern uint64_t ap_stack_tops[SMP_MAX_CPUS];
+extern uint32_t ap_stack_count;
+extern volatile uint32_t ap_next_stack;
+
+/**
+ * @brief Starts every enabled AP listed in the MADT and waits until they are online or
+ *        `SMP_BOOT_TIMEOUT_US` passed. All APs are released by one INIT-SIPI-SIPI sequence,
+ *        broadcast when the MADT covers every CPU, and share its waits.
+ *
+ * @return The number of online CPUs, the boot CPU included.
+ */
+uint32_t smp_boot_aps(void);
+
+/**
+ * @brief C entry of an AP, called by the trampoline on the kernel tables and its own stack.
+ */
+__attribute__((noreturn))
+void ap_main(void);
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef __NICKEL_X86_64_STACK_H__
+#define __NICKEL_X86_64_STACK_H__
+
+#include <stdint.h>
+
+#include <arch/paging.h>
+
+#define STACK_SLOT_SHIFT                16                                          /* 64KB of address space per stack */
+#define STACK_SLOT_SIZE                 (1ULL << STACK_SLOT_SHIFT)
+#define STACK_MAX_ORDER                 3                                           /* 32KB, so at least as much stays unmapped */
+
+/**
+ * @brief Allocates a kernel stack of `PAGE_SIZE << order` bytes in the stack window. It sits
+ *        at the top of a `STACK_SLOT_SIZE` slot whose rest is never mapped, so an overflow
+ *        faults on the guard instead of overwriting whatever lies below.
+ *
+ * @return The top of the stack, or 0 if `order` is too large or memory is exhausted.
+ */
+uint64_t stack_alloc(uint32_t order);
+
+/**
+ * @brief Returns a stack from `stack_alloc()`. It stays mapped and is handed out again for
+ *        the same order, so no TLB shootdown is needed.
+ */
+void stack_free(uint64_t top, uint32_t order);
+
+/**
+ * @brief Tells whether `address` is in the guard of a stack slot, which makes a fault there
+ *        a stack overflow.
+ */
+int stack_is_guard(uint64_t address);
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef __NICKEL_X86_64_STRING_H__
+#define __NICKEL_X86_64_STRING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <arch/paging.h>
+
+#define STRING_AVX2_MIN                 512                                         /* smaller blocks take the SSE2 path, see memory.s */
+#define STRING_REP_THRESHOLD            2048                                        /* from here on `rep movsb` wins on ERMS CPUs */
+
+/**
+ * @brief Variants `memcpy`, `memset` and `memcmp` jump through. They start out as the SSE2
+ *        variants, which every x86-64 CPU runs, until `string_init()` picks better ones.
+ */
+extern void *(*string_memcpy)(void *dst, const void *src, size_t size);
+extern void *(*string_memset)(void *dst, int value, size_t size);
+extern int (*string_memcmp)(const void *a, const void *b, size_t size);
+extern uint64_t string_rep_threshold;                                               /* `~0` without ERMS */
+
+void *memcpy_generic(void *dst, const void *src, size_t size);
+void *memcpy_erms(void *dst, const void *src, size_t size);
+void *memcpy_sse2(void *dst, const void *src, size_t size);
+void *memcpy_avx2(void *dst, const void *src, size_t size);
+
+void *memset_generic(void *dst, int value, size_t size);
+void *memset_erms(void *dst, int value, size_t size);
+void *memset_sse2(void *dst, int value, size_t size);
+void *memset_avx2(void *dst, int value, size_t size);
+
+int memcmp_generic(const void *a, const void *b, size_t size);
+int memcmp_sse2(const void *a, const void *b, size_t size);
+int memcmp_avx2(const void *a, const void *b, size_t size);
+
+/**
+ * @brief Picks the variants from CPUID: AVX2 when the CPU has it and XCR0 enables the YMM
+ *        state, SSE2 otherwise, both handing large blocks to `rep movsb` and `rep stosb` if
+ *        the CPU has ERMS. Runs once on the boot CPU; the APs share its features.
+ */
+void string_init(void);
+
+static inline void clear_page(void *page) {
+    memset(page, 0, PAGE_SIZE);
+}
+
+static inline void copy_page(void *dst, const void *src) {
+    memcpy(dst, src, PAGE_SIZE);
+}
+
+#if defined(NICKEL_BENCH)
+/**
+ * @brief Measures every variant the CPU can run at sizes from a cache line to beyond the L2
+ *        and prints the bandwidth in GB/s.
+ */
+void string_bench(void);
+#endif
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef __NICKEL_X86_64_TLB_H__
+#define __NICKEL_X86_64_TLB_H__
+
+#include <stdint.h>
+
+#include <arch/address_space.h>
+
+#define TLB_FLUSH_THRESHOLD             32                                          /* pages; above it one full flush is cheaper */
+#define TLB_QUEUE_SIZE                  16                                          /* pending ranges per target CPU */
+
+/**
+ * @brief Installs the shootdown IPI handler. Must run after `apic_init()`.
+ */
+void tlb_init(void);
+
+/**
+ * @brief Invalidates `[start, end)` of `space` on every CPU that has it loaded, the caller
+ *        included, and returns once all of them did. Ranges above `TLB_FLUSH_THRESHOLD` pages
+ *        flush the whole space instead. Callers update the page tables first.
+ *
+ * @param space The address space, or `NULL` for kernel mappings, which are global and are
+ *        invalidated on every online CPU.
+ */
+void tlb_flush_range(struct address_space *space, uint64_t start, uint64_t end);
+
+/**
+ * @brief Services the shootdown ranges queued for the calling CPU. Called from the IPI handler
+ *        and by initiators while they wait, so that two CPUs shooting down at each other with
+ *        interrupts off cannot deadlock.
+ */
+void tlb_process_queue(void);
+
+/**
+ * @brief Handler of `APIC_VECTOR_TLB_SHOOTDOWN`, entered through `tlb_shootdown_entry`.
+ */
+void tlb_shootdown_interrupt(void);
+
+#if defined(NICKEL_BENCH)
+/**
+ * @brief Measures munmap-style shootdowns of a small and a large range with the address space
+ *        loaded on 1 to 8 CPUs.
+ */
+void tlb_bench(void);
+#endif
+
+#endif
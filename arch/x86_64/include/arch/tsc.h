@@ -0,0 +1,41 @@
+#ifndef __NICKEL_X86_64_TSC_H__
+#define __NICKEL_X86_64_TSC_H__
+
+#include <stdint.h>
+
+#define PIT_FREQUENCY                   1193182                                     /* input clock of the 8254 in Hz */
+#define PIT_PORT_CHANNEL2               0x42
+#define PIT_PORT_COMMAND                0x43
+#define PIT_PORT_GATE                   0x61                                        /* NMI status and control, gates channel 2 */
+
+#define PIT_GATE_CHANNEL2               0x01
+#define PIT_GATE_SPEAKER                0x02
+#define PIT_GATE_OUTPUT2                0x20
+#define PIT_COMMAND_CHANNEL2_ONESHOT    0xB0                                        /* channel 2, lobyte/hibyte, mode 0, binary */
+
+#define TSC_CALIBRATE_MS                10
+
+/**
+ * @brief Frequency of the time stamp counter in Hz, valid after `tsc_init()`.
+ */
+extern uint64_t tsc_frequency;
+
+/**
+ * @brief Measures the TSC frequency against channel 2 of the PIT, which is free-running and
+ *        does not need an interrupt.
+ * 
+ * @return The measured frequency in Hz.
+ */
+uint64_t tsc_init(void);
+
+/**
+ * @brief Converts a TSC delta into nanoseconds.
+ */
+uint64_t tsc_to_ns(uint64_t cycles);
+
+/**
+ * @brief Spins for at least `us` microseconds.
+ */
+void tsc_delay_us(uint64_t us);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef __NICKEL_X86_64_TSS_H__
+#define __NICKEL_X86_64_TSS_H__
+
+#include <stdint.h>
+
+#include <arch/desc.h>
+
+#define TSS_IST_DOUBLE_FAULT            1                                           /* IST slots, 0 keeps the interrupted stack */
+#define TSS_IST_NMI                     2
+#define TSS_IST_MACHINE_CHECK           3
+#define TSS_IST_DEBUG                   4
+#define TSS_IST_STACKS                  4
+#define TSS_IST_STACK_ORDER             1                                           /* 8KB each */
+
+#define TSS_SUCCESS                     0
+#define TSS_FAILURE                     0x80000000
+#define TSS_NO_MEMORY                   (TSS_FAILURE | 1)
+
+/**
+ * @brief Routes #DF, NMI, #MC and #DB to their IST stacks and loads the TSS of the boot CPU.
+ *        These can hit at any point, also on an overflowed stack, so they never run on the
+ *        interrupted one. Must run after `smp_init()` and `pmm_init()`.
+ *
+ * @return `TSS_SUCCESS` on success, `TSS_NO_MEMORY` if the IST stacks cannot be allocated.
+ */
+int32_t tss_init(void);
+
+/**
+ * @brief Allocates the IST stacks of the calling CPU, installs its TSS descriptor and loads
+ *        the task register.
+ *
+ * @return `TSS_SUCCESS` on success, `TSS_NO_MEMORY` if the IST stacks cannot be allocated.
+ */
+int32_t tss_cpu_init(void);
+
+#endif
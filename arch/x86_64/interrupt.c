@@ -0,0 +1,130 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include <printk.h>
+#include <rcu.h>
+#include <smp.h>
+
+#include <arch/cpu.h>
+#include <arch/default_idt.h>
+#include <arch/interrupt.h>
+#include <arch/stack.h>
+#include <arch/tsc.h>
+#include <arch/apic/apic.h>
+
+static interrupt_handler_t interrupt_handlers[INTERRUPT_VECTORS];
+
+static const char *const exception_names[INTERRUPT_EXCEPTIONS] = {
+    "divide error", "debug", "nmi", "breakpoint", "overflow", "bound range exceeded",
+    "invalid opcode", "device not available", "double fault", "coprocessor segment overrun",
+    "invalid tss", "segment not present", "stack fault", "general protection", "page fault",
+    "reserved", "x87 floating point", "alignment check", "machine check", "simd floating point",
+    "virtualization", "control protection", "reserved", "reserved", "reserved", "reserved",
+    "reserved", "reserved", "hypervisor injection", "vmm communication", "security", "reserved"
+};
+
+/**
+ * @brief Prints `frame` over serial.
+ */
+void interrupt_dump_frame(const struct trap_frame *frame) {
+    printk("  rip %016lx cs %04lx rflags %016lx rsp %016lx ss %04lx\n",
+           frame->rip, frame->cs, frame->rflags, frame->rsp, frame->ss);
+    printk("  rax %016lx rbx %016lx rcx %016lx rdx %016lx\n", frame->rax, frame->rbx, frame->rcx, frame->rdx);
+    printk("  rsi %016lx rdi %016lx rbp %016lx r8  %016lx\n", frame->rsi, frame->rdi, frame->rbp, frame->r8);
+    printk("  r9  %016lx r10 %016lx r11 %016lx r12 %016lx\n", frame->r9, frame->r10, frame->r11, frame->r12);
+    printk("  r13 %016lx r14 %016lx r15 %016lx cr2 %016lx\n", frame->r13, frame->r14, frame->r15, read_cr2());
+}
+
+/**
+ * @brief Default handler. An exception nobody handles is fatal and dumps the frame over
+ *        serial without waiting for the `printk()` lock, since #DF, NMI and #MC may interrupt
+ *        its holder; an interrupt nobody expects is reported and acknowledged, in case the
+ *        APIC delivered it.
+ */
+static void interrupt_unhandled(struct trap_frame *frame) {
+    uint64_t cr2;
+
+    if (frame->vector < INTERRUPT_EXCEPTIONS) {
+        printk_emergency();
+        printk("interrupt: %s on cpu %u (vector %lu, error 0x%lx)\n", exception_names[frame->vector],
+               smp_processor_id(), frame->vector, frame->error_code);
+        cr2 = read_cr2();
+        if ((frame->vector == EXCEPTION_PAGE_FAULT || frame->vector == EXCEPTION_DOUBLE_FAULT) && stack_is_guard(cr2)) {
+            printk("interrupt: kernel stack overflow into the guard at 0x%lx\n", cr2);
+        }
+        interrupt_dump_frame(frame);
+        while (1) {
+            asm volatile ("cli\n" "hlt\n");
+        }
+    }
+    printk("interrupt: unexpected vector %lu\n", frame->vector);
+    apic_eoi();
+}
+
+/**
+ * @brief Routes `vector` through the dispatch table to `handler`. Passing `NULL` restores the
+ *        default, which reports exceptions and unexpected interrupts. Hot vectors should use
+ *        an `IRQ_ENTRY` stub installed with `idt_set_gate()` instead.
+ */
+void interrupt_register(uint8_t vector, interrupt_handler_t handler) {
+    rcu_assign_pointer(interrupt_handlers[vector], handler);
+    idt_set_gate(vector, (void (*)(void))(isr_stubs + (uint64_t)vector * ISR_STUB_SIZE));
+}
+
+/**
+ * @brief Common C entry of every vector that goes through `isr_stubs`.
+ */
+void interrupt_dispatch(struct trap_frame *frame) {
+    interrupt_handler_t handler = rcu_dereference(interrupt_handlers[frame->vector & 0xFF]); /* interrupts are off */
+
+    if (handler == NULL) {
+        handler = interrupt_unhandled;
+    }
+    handler(frame);
+}
+
+/**
+ * @brief Handler of `interrupt_nop_entry`, a fast-path stub that does nothing.
+ */
+void interrupt_nop(void) {
+}
+
+#if defined(NICKEL_BENCH)
+#define INTERRUPT_BENCH_ROUNDS          100000
+#define INTERRUPT_BENCH_VECTOR          0x80
+
+extern void interrupt_nop_entry(void);
+
+static void interrupt_bench_handler(struct trap_frame *frame) {
+}
+
+/**
+ * @brief Measures the cycles of a software interrupt round trip through the generic and the
+ *        fast entry path.
+ */
+void interrupt_bench(void) {
+    uint64_t start, generic, fast, flags;
+    uint32_t i;
+
+    flags = arch_irq_save();
+    interrupt_register(INTERRUPT_BENCH_VECTOR, interrupt_bench_handler);
+    start = rdtsc();
+    for (i = 0; i < INTERRUPT_BENCH_ROUNDS; ++i) {
+        asm volatile ("int %0\n" : : "i"(INTERRUPT_BENCH_VECTOR) : "memory");
+    }
+    generic = rdtsc() - start;
+
+    idt_set_gate(INTERRUPT_BENCH_VECTOR, interrupt_nop_entry);
+    start = rdtsc();
+    for (i = 0; i < INTERRUPT_BENCH_ROUNDS; ++i) {
+        asm volatile ("int %0\n" : : "i"(INTERRUPT_BENCH_VECTOR) : "memory");
+    }
+    fast = rdtsc() - start;
+    interrupt_register(INTERRUPT_BENCH_VECTOR, NULL);
+    arch_irq_restore(flags);
+
+    printk("interrupt: generic %lu cycles (%lu ns), fast %lu cycles (%lu ns) per round trip\n",
+           generic / INTERRUPT_BENCH_ROUNDS, tsc_to_ns(generic) / INTERRUPT_BENCH_ROUNDS,
+           fast / INTERRUPT_BENCH_ROUNDS, tsc_to_ns(fast) / INTERRUPT_BENCH_ROUNDS);
+}
+#endif
@@ -0,0 +1,456 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include <acpi.h>
+#include <percpu.h>
+#include <printk.h>
+#include <rcu.h>
+#include <smp.h>
+#include <spinlock.h>
+
+#include <arch/cpu.h>
+#include <arch/interrupt.h>
+#include <arch/irq.h>
+#include <arch/tsc.h>
+#include <arch/apic/apic.h>
+#include <arch/apic/ioapic.h>
+#include <arch/apic/ipi.h>
+
+/**
+ * @brief A requested IRQ. It owns one vector of the CPU it is delivered to; the table of that
+ *        CPU maps the vector back to it.
+ */
+struct irq_desc {
+    enum irq_type type;
+    const char *name;
+    void (*handler)(void *arg);
+    void *arg;
+    uint32_t cpu;
+    uint8_t vector;
+    uint32_t gsi;                                                                   /* `IRQ_TYPE_IOAPIC` */
+    uint32_t flags;
+    msi_write_t write;                                                              /* `IRQ_TYPE_MSI` */
+    void *device;
+};
+
+static struct irq_desc irq_descs[IRQ_MAX];
+static struct spinlock irq_lock = SPINLOCK_INIT;
+static uint32_t irq_vector_counts[SMP_MAX_CPUS];                                    /* device vectors in use per CPU */
+
+static DEFINE_PER_CPU(struct irq_desc *, irq_vector_descs[INTERRUPT_VECTORS]);
+static DEFINE_PER_CPU(uint64_t, irq_vector_pool[IRQ_VECTOR_WORDS]);                 /* bit n is set iff vector n is taken */
+static DEFINE_PER_CPU(uint64_t, irq_counts[IRQ_MAX]);
+static DEFINE_PER_CPU(uint64_t, irq_spurious);
+
+/**
+ * @brief Resolves `IRQ_CPU_ANY` to the online CPU with the fewest device vectors, so IRQs
+ *        requested without a preference spread over all of them. Holds `irq_lock`.
+ *
+ * @return The CPU, or `IRQ_CPU_ANY` if `cpu` cannot take interrupts.
+ */
+static uint32_t irq_pick_cpu(uint32_t cpu) {
+    uint32_t i;
+
+    if (cpu != IRQ_CPU_ANY) {
+        return cpu < smp_cpu_count && cpumask_test(&smp_online_mask, cpu) ? cpu : IRQ_CPU_ANY;
+    }
+    for (i = 0; i < smp_cpu_count; ++i) {
+        if (cpumask_test(&smp_online_mask, i) && (cpu == IRQ_CPU_ANY || irq_vector_counts[i] < irq_vector_counts[cpu])) {
+            cpu = i;
+        }
+    }
+    return cpu;
+}
+
+/**
+ * @brief Takes a free device vector of `cpu` and points it at `desc`. Holds `irq_lock`.
+ *
+ * @return The vector, or 0 if the pool of `cpu` is empty.
+ */
+static uint8_t irq_vector_alloc(uint32_t cpu, struct irq_desc *desc) {
+    uint64_t *pool = per_cpu(irq_vector_pool, cpu);
+    uint32_t vector;
+
+    for (vector = IRQ_VECTOR_FIRST; vector <= IRQ_VECTOR_LAST; ++vector) {
+        if (!(pool[vector / 64] & (1ULL << (vector % 64)))) {
+            pool[vector / 64] |= 1ULL << (vector % 64);
+            ++irq_vector_counts[cpu];
+            __atomic_store_n(&per_cpu(irq_vector_descs, cpu)[vector], desc, __ATOMIC_RELEASE);
+            return (uint8_t)vector;
+        }
+    }
+    return 0;
+}
+
+static void irq_vector_free(uint32_t cpu, uint8_t vector) {
+    __atomic_store_n(&per_cpu(irq_vector_descs, cpu)[vector], NULL, __ATOMIC_RELEASE);
+    per_cpu(irq_vector_pool, cpu)[vector / 64] &= ~(1ULL << (vector % 64));
+    --irq_vector_counts[cpu];
+}
+
+/**
+ * @brief Points the source of `desc` at its current CPU and vector. Holds `irq_lock`.
+ */
+static int32_t irq_program(struct irq_desc *desc) {
+    uint32_t apic_id = processors[desc->cpu].apic_id;
+    struct msi_msg msg;
+
+    if (desc->type == IRQ_TYPE_IOAPIC) {
+        if (ioapic_route(desc->gsi, desc->vector, apic_id, desc->flags) != IOAPIC_SUCCESS) {
+            return IRQ_UNREACHABLE;
+        }
+        ioapic_unmask(desc->gsi);
+        return IRQ_SUCCESS;
+    }
+
+    if (apic_id > MSI_MAX_DESTINATION) {
+        return IRQ_UNREACHABLE;
+    }
+    msg.address_lo = MSI_ADDRESS_BASE | (apic_id << MSI_ADDRESS_DESTINATION_SHIFT); /* physical destination mode */
+    msg.address_hi = 0;
+    msg.data = desc->vector;                                                        /* fixed delivery, edge triggered */
+    desc->write(desc->device, &msg);
+    return IRQ_SUCCESS;
+}
+
+/**
+ * @brief Fills a free descriptor from `template`, gives it a vector of `cpu` and programs its
+ *        source.
+ */
+static int32_t irq_request(const struct irq_desc *template, uint32_t cpu) {
+    struct irq_desc *desc = NULL;
+    uint64_t flags;
+    int32_t ret;
+    uint32_t irq, i;
+
+    if (template->handler == NULL) {
+        return IRQ_INVALID_PARAMETER;
+    }
+
+    spin_lock_irqsave(&irq_lock, flags);
+    for (irq = 0; irq < IRQ_MAX; ++irq) {
+        if (irq_descs[irq].type == IRQ_TYPE_NONE) {
+            desc = &irq_descs[irq];
+            break;
+        }
+    }
+    if (desc == NULL) {
+        spin_unlock_irqrestore(&irq_lock, flags);
+        return IRQ_NO_DESCRIPTOR;
+    } else if ((cpu = irq_pick_cpu(cpu)) == IRQ_CPU_ANY) {
+        spin_unlock_irqrestore(&irq_lock, flags);
+        return IRQ_INVALID_PARAMETER;
+    }
+
+    *desc = *template;
+    desc->cpu = cpu;
+    for (i = 0; i < smp_cpu_count; ++i) {
+        if (percpu_bases[i] != 0) {
+            per_cpu(irq_counts, i)[irq] = 0;
+        }
+    }
+    if ((desc->vector = irq_vector_alloc(cpu, desc)) == 0) {
+        desc->type = IRQ_TYPE_NONE;
+        spin_unlock_irqrestore(&irq_lock, flags);
+        return IRQ_NO_VECTOR;
+    }
+    if ((ret = irq_program(desc)) != IRQ_SUCCESS) {
+        irq_vector_free(cpu, desc->vector);                                         /* nothing can have arrived on it yet */
+        desc->type = IRQ_TYPE_NONE;
+        spin_unlock_irqrestore(&irq_lock, flags);
+        return ret;
+    }
+    spin_unlock_irqrestore(&irq_lock, flags);
+    return (int32_t)irq;
+}
+
+/**
+ * @brief Sets up the I/O APICs and routes the device vectors of every CPU to `irq_interrupt()`.
+ *        Must run after `acpi_init()` and `percpu_init()`.
+ */
+void irq_init(void) {
+    uint32_t vector;
+
+    ioapic_init();
+    for (vector = IRQ_VECTOR_FIRST; vector <= IRQ_VECTOR_LAST; ++vector) {
+        interrupt_register((uint8_t)vector, irq_interrupt);
+    }
+    printk("irq: %u device vectors per cpu, %u ioapics, %u overrides\n", IRQ_VECTOR_LAST - IRQ_VECTOR_FIRST + 1,
+           acpi_ioapic_count, acpi_override_count);
+}
+
+/**
+ * @brief Routes the ISA IRQ `isa_irq`, with the polarity and trigger mode the MADT gives it,
+ *        to `handler(arg)` on `cpu` and unmasks it.
+ *
+ * @param cpu A CPU index, or `IRQ_CPU_ANY`.
+ * @return The IRQ number on success, one of `IRQ_*` errors otherwise.
+ */
+int32_t irq_request_isa(uint8_t isa_irq, void (*handler)(void *arg), void *arg, const char *name, uint32_t cpu) {
+    uint32_t flags, gsi;
+
+    if (isa_irq >= IOAPIC_ISA_IRQS) {
+        return IRQ_INVALID_PARAMETER;
+    }
+    gsi = ioapic_isa_to_gsi(isa_irq, &flags);
+    return irq_request_gsi(gsi, flags, handler, arg, name, cpu);
+}
+
+/**
+ * @brief Routes the I/O APIC input `gsi` to `handler(arg)` on `cpu` and unmasks it.
+ *
+ * @param flags `IOAPIC_POLARITY_LOW` and `IOAPIC_TRIGGER_LEVEL` bits, e.g. `IOAPIC_FLAGS_PCI`.
+ * @return The IRQ number on success, one of `IRQ_*` errors otherwise.
+ */
+int32_t irq_request_gsi(uint32_t gsi, uint32_t flags, void (*handler)(void *arg), void *arg, const char *name,
+                        uint32_t cpu) {
+    struct irq_desc template = {
+        .type = IRQ_TYPE_IOAPIC,
+        .name = name,
+        .handler = handler,
+        .arg = arg,
+        .gsi = gsi,
+        .flags = flags,
+    };
+
+    return irq_request(&template, cpu);
+}
+
+/**
+ * @brief Allocates a vector on `cpu` for an MSI or one MSI-X entry and hands the message that
+ *        targets it to `write(device, msg)`. A device with several MSI-X entries requests one
+ *        IRQ per entry, so each queue can interrupt the CPU that consumes it.
+ *
+ * @return The IRQ number on success, one of `IRQ_*` errors otherwise.
+ */
+int32_t irq_request_msi(msi_write_t write, void *device, void (*handler)(void *arg), void *arg, const char *name,
+                        uint32_t cpu) {
+    struct irq_desc template = {
+        .type = IRQ_TYPE_MSI,
+        .name = name,
+        .handler = handler,
+        .arg = arg,
+        .write = write,
+        .device = device,
+    };
+
+    if (write == NULL) {
+        return IRQ_INVALID_PARAMETER;
+    }
+    return irq_request(&template, cpu);
+}
+
+/**
+ * @brief Moves `irq` to a vector of `cpu`. The old vector is released only after a grace
+ *        period, so an interrupt already on its way to the old CPU is still handled. Must be
+ *        called from a thread.
+ *
+ * @return `IRQ_SUCCESS` on success, one of `IRQ_*` errors otherwise; the IRQ then stays where
+ *         it was.
+ */
+int32_t irq_set_affinity(uint32_t irq, uint32_t cpu) {
+    struct irq_desc *desc;
+    uint32_t old_cpu;
+    uint8_t old_vector, vector;
+    uint64_t flags;
+    int32_t ret;
+
+    if (irq >= IRQ_MAX) {
+        return IRQ_INVALID_PARAMETER;
+    }
+    desc = &irq_descs[irq];
+
+    spin_lock_irqsave(&irq_lock, flags);
+    if (desc->type == IRQ_TYPE_NONE || (cpu = irq_pick_cpu(cpu)) == IRQ_CPU_ANY) {
+        spin_unlock_irqrestore(&irq_lock, flags);
+        return IRQ_INVALID_PARAMETER;
+    } else if (cpu == desc->cpu) {
+        spin_unlock_irqrestore(&irq_lock, flags);
+        return IRQ_SUCCESS;
+    } else if ((vector = irq_vector_alloc(cpu, desc)) == 0) {
+        spin_unlock_irqrestore(&irq_lock, flags);
+        return IRQ_NO_VECTOR;
+    }
+
+    old_cpu = desc->cpu;
+    old_vector = desc->vector;
+    desc->cpu = cpu;
+    desc->vector = vector;
+    if ((ret = irq_program(desc)) != IRQ_SUCCESS) {
+        desc->cpu = old_cpu;
+        desc->vector = old_vector;
+        irq_vector_free(cpu, vector);
+        irq_program(desc);                                                          /* an I/O APIC entry is masked by now */
+        spin_unlock_irqrestore(&irq_lock, flags);
+        return ret;
+    }
+    spin_unlock_irqrestore(&irq_lock, flags);
+
+    synchronize_rcu();                                                              /* handlers run with interrupts off */
+    spin_lock_irqsave(&irq_lock, flags);
+    irq_vector_free(old_cpu, old_vector);
+    spin_unlock_irqrestore(&irq_lock, flags);
+    return IRQ_SUCCESS;
+}
+
+/**
+ * @brief Gets the CPU `irq` is delivered to.
+ */
+uint32_t irq_get_affinity(uint32_t irq) {
+    return irq < IRQ_MAX ? __atomic_load_n(&irq_descs[irq].cpu, __ATOMIC_RELAXED) : IRQ_CPU_ANY;
+}
+
+/**
+ * @brief Masks `irq` and releases its vector and descriptor. Must be called from a thread.
+ */
+void irq_free(uint32_t irq) {
+    struct irq_desc *desc;
+    uint64_t flags;
+
+    if (irq >= IRQ_MAX) {
+        return;
+    }
+    desc = &irq_descs[irq];
+
+    spin_lock_irqsave(&irq_lock, flags);
+    if (desc->type == IRQ_TYPE_NONE) {
+        spin_unlock_irqrestore(&irq_lock, flags);
+        return;
+    } else if (desc->type == IRQ_TYPE_IOAPIC) {
+        ioapic_mask(desc->gsi);                                                     /* a device must stop its own MSIs first */
+    }
+    spin_unlock_irqrestore(&irq_lock, flags);
+
+    synchronize_rcu();
+    spin_lock_irqsave(&irq_lock, flags);
+    irq_vector_free(desc->cpu, desc->vector);
+    desc->type = IRQ_TYPE_NONE;
+    spin_unlock_irqrestore(&irq_lock, flags);
+}
+
+/**
+ * @brief Common handler of all device vectors. Looks the vector up in the table of the calling
+ *        CPU, counts the interrupt for it and runs the handler of the IRQ.
+ */
+void irq_interrupt(struct trap_frame *frame) {
+    struct irq_desc *desc = this_cpu_read(irq_vector_descs[frame->vector & 0xFF]);
+
+    if (desc != NULL) {
+        this_cpu_inc(irq_counts[desc - irq_descs]);
+        desc->handler(desc->arg);
+    } else {
+        this_cpu_inc(irq_spurious);                                                 /* e.g. raised while it was being freed */
+    }
+    apic_eoi();
+}
+
+/**
+ * @brief Prints how often every requested IRQ arrived on every CPU.
+ */
+void irq_print_stats(void) {
+    uint32_t irq, cpu;
+
+    for (irq = 0; irq < IRQ_MAX; ++irq) {
+        if (irq_descs[irq].type == IRQ_TYPE_NONE) {
+            continue;
+        }
+        printk("irq: %2u %-12s cpu %u vector 0x%x:", irq, irq_descs[irq].name, irq_descs[irq].cpu,
+               irq_descs[irq].vector);
+        for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+            if (cpumask_test(&smp_online_mask, cpu)) {
+                printk(" %lu", per_cpu(irq_counts, cpu)[irq]);
+            }
+        }
+        printk("\n");
+    }
+    for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+        if (cpumask_test(&smp_online_mask, cpu) && per_cpu(irq_spurious, cpu) != 0) {
+            printk("irq: cpu %u, %lu spurious\n", cpu, per_cpu(irq_spurious, cpu));
+        }
+    }
+}
+
+#if defined(NICKEL_BENCH)
+#define IRQ_BENCH_PER_CPU               2
+#define IRQ_BENCH_ROUNDS                1000
+#define IRQ_BENCH_TIMEOUT_MS            10
+
+static struct msi_msg irq_bench_msgs[IRQ_MAX];                                      /* stands in for an MSI-X table */
+static volatile uint64_t irq_bench_handled;
+
+static void irq_bench_write(void *device, const struct msi_msg *msg) {
+    *(struct msi_msg *)device = *msg;
+}
+
+static void irq_bench_handler(void *arg) {
+    __atomic_add_fetch(&irq_bench_handled, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Raises the first `count` bench IRQs the way their devices would, as the IPI their
+ *        message describes, and waits for each one to be handled.
+ *
+ * @return The average cycles from sending to handling, 0 if nothing arrived.
+ */
+static uint64_t irq_bench_raise(uint32_t count, uint32_t *lost) {
+    const struct msi_msg *msg;
+    uint64_t start, total = 0, expected, deadline, handled = 0;
+    uint32_t round, i;
+
+    for (round = 0; round < IRQ_BENCH_ROUNDS; ++round) {
+        for (i = 0; i < count; ++i) {
+            msg = &irq_bench_msgs[i];
+            expected = irq_bench_handled + 1;
+            start = rdtsc();
+            deadline = start + tsc_frequency / 1000 * IRQ_BENCH_TIMEOUT_MS;
+            apic_send_ipi((msg->address_lo >> MSI_ADDRESS_DESTINATION_SHIFT) & MSI_MAX_DESTINATION, (uint8_t)msg->data);
+            while (__atomic_load_n(&irq_bench_handled, __ATOMIC_ACQUIRE) < expected && rdtsc() < deadline) {
+                cpu_relax();
+            }
+            if (irq_bench_handled < expected) {
+                ++*lost;
+                irq_bench_handled = expected;
+                continue;
+            }
+            total += rdtsc() - start;
+            ++handled;
+        }
+    }
+    return handled ? total / handled : 0;
+}
+
+/**
+ * @brief Spreads MSI-style IRQs over the online CPUs, raises each one on its CPU, steers all
+ *        of them to the boot CPU and raises them again, printing the per-CPU counts.
+ */
+void irq_bench(void) {
+    int32_t irqs[IRQ_MAX];
+    uint32_t count, i, lost = 0;
+    uint64_t spread, steered;
+
+    count = smp_online_count * IRQ_BENCH_PER_CPU;
+    count = count > IRQ_MAX ? IRQ_MAX : count;
+    for (i = 0; i < count; ++i) {
+        irqs[i] = irq_request_msi(irq_bench_write, &irq_bench_msgs[i], irq_bench_handler, NULL, "bench", IRQ_CPU_ANY);
+        if (irqs[i] < 0) {
+            printk("irq: bench request failed (0x%x)\n", irqs[i]);
+            count = i;
+            break;
+        }
+    }
+
+    spread = irq_bench_raise(count, &lost);
+    irq_print_stats();
+    for (i = 0; i < count; ++i) {
+        irq_set_affinity(irqs[i], smp_processor_id());
+    }
+    steered = irq_bench_raise(count, &lost);
+    irq_print_stats();
+    for (i = 0; i < count; ++i) {
+        irq_free(irqs[i]);
+    }
+
+    printk("irq: %u irqs, spread %lu ns, steered to cpu %u %lu ns per interrupt, %u lost\n", count,
+           tsc_to_ns(spread), smp_processor_id(), tsc_to_ns(steered), lost);
+}
+#endif
@@ -0,0 +1,193 @@
+.code64
+.text
+
+// Entry of a hot interrupt without an error code that is serviced by a C function directly,
+// without a trap frame or the dispatch table. It saves the registers a C function may clobber
+// and calls `handler` with interrupts still disabled. Of the SSE state only %xmm0-15 are
+// saved: kernel code never touches x87 or MMX state and leaves MXCSR alone, so fxsave would
+// save twice as much for nothing. The handler sends the EOI. On the way out the interrupted
+// thread may be preempted; it resumes here later.
+.macro IRQ_ENTRY name, handler
+.globl \name
+\name:
+    pushq %rax
+    pushq %rcx
+    pushq %rdx
+    pushq %rsi
+    pushq %rdi
+    pushq %r8
+    pushq %r9
+    pushq %r10
+    pushq %r11
+    pushq %rbp
+    movq %rsp, %rbp
+
+    subq $256, %rsp
+    andq $-16, %rsp
+    call irq_save_xmm
+    cld
+    call \handler
+    call sched_irq_exit
+    call irq_restore_xmm
+
+    movq %rbp, %rsp
+    popq %rbp
+    popq %r11
+    popq %r10
+    popq %r9
+    popq %r8
+    popq %rdi
+    popq %rsi
+    popq %rdx
+    popq %rcx
+    popq %rax
+    iretq
+.endm
+
+// Save area of the fast entries, at 8(%rsp) since the caller's return address is on top.
+irq_save_xmm:
+    movdqa %xmm0, 8(%rsp)
+    movdqa %xmm1, 24(%rsp)
+    movdqa %xmm2, 40(%rsp)
+    movdqa %xmm3, 56(%rsp)
+    movdqa %xmm4, 72(%rsp)
+    movdqa %xmm5, 88(%rsp)
+    movdqa %xmm6, 104(%rsp)
+    movdqa %xmm7, 120(%rsp)
+    movdqa %xmm8, 136(%rsp)
+    movdqa %xmm9, 152(%rsp)
+    movdqa %xmm10, 168(%rsp)
+    movdqa %xmm11, 184(%rsp)
+    movdqa %xmm12, 200(%rsp)
+    movdqa %xmm13, 216(%rsp)
+    movdqa %xmm14, 232(%rsp)
+    movdqa %xmm15, 248(%rsp)
+    ret
+
+irq_restore_xmm:
+    movdqa 8(%rsp), %xmm0
+    movdqa 24(%rsp), %xmm1
+    movdqa 40(%rsp), %xmm2
+    movdqa 56(%rsp), %xmm3
+    movdqa 72(%rsp), %xmm4
+    movdqa 88(%rsp), %xmm5
+    movdqa 104(%rsp), %xmm6
+    movdqa 120(%rsp), %xmm7
+    movdqa 136(%rsp), %xmm8
+    movdqa 152(%rsp), %xmm9
+    movdqa 168(%rsp), %xmm10
+    movdqa 184(%rsp), %xmm11
+    movdqa 200(%rsp), %xmm12
+    movdqa 216(%rsp), %xmm13
+    movdqa 232(%rsp), %xmm14
+    movdqa 248(%rsp), %xmm15
+    ret
+
+IRQ_ENTRY tlb_shootdown_entry, tlb_shootdown_interrupt
+IRQ_ENTRY apic_ping_entry, apic_ping_interrupt
+IRQ_ENTRY apic_timer_entry, clock_event_interrupt
+IRQ_ENTRY timer_kick_entry, timer_kick_interrupt
+IRQ_ENTRY sched_resched_entry, sched_resched_interrupt
+IRQ_ENTRY interrupt_nop_entry, interrupt_nop
+
+// Entry of #NM, raised by the first vector instruction after `fpu_switch()` set CR0.TS. No
+// vector register is saved: the interrupted thread has no live value in them yet, since that
+// instruction is the first since it was switched in, and `fpu_trap()` replaces them anyway.
+// CR0.TS is cleared before any C code runs, as the compiler may use %xmm registers.
+.globl fpu_trap_entry
+fpu_trap_entry:
+    clts
+    pushq %rax
+    pushq %rcx
+    pushq %rdx
+    pushq %rsi
+    pushq %rdi
+    pushq %r8
+    pushq %r9
+    pushq %r10
+    pushq %r11
+    cld
+    call fpu_trap
+    popq %r11
+    popq %r10
+    popq %r9
+    popq %r8
+    popq %rdi
+    popq %rsi
+    popq %rdx
+    popq %rcx
+    popq %rax
+    iretq
+
+// A spurious interrupt is not in service, so it must not be acknowledged.
+.globl apic_spurious_entry
+apic_spurious_entry:
+    iretq
+
+// One stub per vector, ISR_STUB_SIZE bytes apart from `isr_stubs`. Each pushes the vector
+// and, where the CPU does not push an error code, a zero in its place, so that every vector
+// reaches `isr_common` with the same frame.
+.globl isr_stubs
+.balign 16
+isr_stubs:
+.set vector, 0
+.rept 256
+    .balign 16
+    .if (vector == 8) || (vector >= 10 && vector <= 14) || (vector == 17) || (vector == 21) || (vector == 29) || (vector == 30)
+    .else
+    pushq $0
+    .endif
+    pushq $vector
+    jmp isr_common
+    .set vector, vector + 1
+.endr
+
+// Completes `struct trap_frame` with the general purpose registers, saves the whole FPU and
+// SSE state and hands the frame to `interrupt_dispatch()`. Handlers may change the frame.
+isr_common:
+    pushq %rax
+    pushq %rbx
+    pushq %rcx
+    pushq %rdx
+    pushq %rsi
+    pushq %rdi
+    pushq %rbp
+    pushq %r8
+    pushq %r9
+    pushq %r10
+    pushq %r11
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+    movq %rsp, %rbx
+
+    // fxsave needs a 16-byte aligned area
+    subq $512, %rsp
+    andq $-16, %rsp
+    fxsave64 (%rsp)
+    cld
+    movq %rbx, %rdi
+    call interrupt_dispatch
+    call sched_irq_exit
+    fxrstor64 (%rsp)
+
+    movq %rbx, %rsp
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %r11
+    popq %r10
+    popq %r9
+    popq %r8
+    popq %rbp
+    popq %rdi
+    popq %rsi
+    popq %rdx
+    popq %rcx
+    popq %rbx
+    popq %rax
+    // vector and error code
+    addq $16, %rsp
+    iretq
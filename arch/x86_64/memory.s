@@ -0,0 +1,452 @@
+.code64
+.text
+
+// Memory functions of the kernel. `memcpy`, `memset` and `memcmp` jump through the pointers
+// `string_init()` points at the best variant for the CPU; every variant handles every size.
+//
+// Vector registers: %xmm0-15 are saved by every interrupt entry and are dead across the call
+// of a context switch, so the SSE2 variants use them freely. Interrupt entries do not save
+// the upper halves of %ymm, so the AVX2 variants run with interrupts disabled, which keeps
+// an interrupt handler from using them meanwhile, and clear them with vzeroupper. Inside a
+// `kernel_fpu_begin()` section the upper halves belong to the section, so there, and in
+// the interrupt handlers that preempt it, the AVX2 variants fall back to SSE2.
+//
+// The SSE2 and AVX2 variants hand sizes from `string_rep_threshold` on to `rep movsb` and
+// `rep stosb`, which are faster for large blocks on CPUs with ERMS.
+
+.globl memcpy, memset, memmove, memcmp
+memcpy:
+    jmp *string_memcpy(%rip)
+
+memset:
+    jmp *string_memset(%rip)
+
+memcmp:
+    jmp *string_memcmp(%rip)
+
+// void *memmove(void *dst, const void *src, size_t size)
+// Disjoint blocks go to `memcpy`. With `dst` below `src` a forward `rep movsb` reads every
+// byte before it is overwritten; with `dst` above `src` the block is copied from its end.
+memmove:
+    movq %rdi, %rax
+    movq %rdi, %rcx
+    subq %rsi, %rcx
+    cmpq %rdx, %rcx
+    // dst in (src, src + size)
+    jb memmove_backward
+    movq %rsi, %rcx
+    subq %rdi, %rcx
+    cmpq %rdx, %rcx
+    // disjoint
+    jae memcpy
+    movq %rdx, %rcx
+    rep movsb
+    ret
+memmove_backward:
+    movq %rdx, %rcx
+1:
+    cmpq $8, %rcx
+    jb 2f
+    subq $8, %rcx
+    movq (%rsi,%rcx), %r8
+    movq %r8, (%rdi,%rcx)
+    jmp 1b
+2:
+    testq %rcx, %rcx
+    jz 3f
+    decq %rcx
+    movb (%rsi,%rcx), %r8b
+    movb %r8b, (%rdi,%rcx)
+    jmp 2b
+3:
+    ret
+
+// void *memcpy_generic(void *dst, const void *src, size_t size)
+// Quadwords, then the remaining bytes. Fast strings make this decent on any x86-64.
+.globl memcpy_generic
+memcpy_generic:
+    movq %rdi, %rax
+    movq %rdx, %rcx
+    shrq $3, %rcx
+    rep movsq
+    movl %edx, %ecx
+    andl $7, %ecx
+    rep movsb
+    ret
+
+.globl memcpy_erms
+memcpy_erms:
+    movq %rdi, %rax
+    movq %rdx, %rcx
+    rep movsb
+    ret
+
+// Up to 16 bytes as two possibly overlapping loads and stores of the head and the tail.
+memcpy_small:
+    cmpq $8, %rdx
+    jb 1f
+    movq (%rsi), %r8
+    movq -8(%rsi,%rdx), %r9
+    movq %r8, (%rdi)
+    movq %r9, -8(%rdi,%rdx)
+    ret
+1:
+    cmpq $4, %rdx
+    jb 2f
+    movl (%rsi), %r8d
+    movl -4(%rsi,%rdx), %r9d
+    movl %r8d, (%rdi)
+    movl %r9d, -4(%rdi,%rdx)
+    ret
+2:
+    cmpq $2, %rdx
+    jb 3f
+    movzwl (%rsi), %r8d
+    movzwl -2(%rsi,%rdx), %r9d
+    movw %r8w, (%rdi)
+    movw %r9w, -2(%rdi,%rdx)
+    ret
+3:
+    testq %rdx, %rdx
+    jz 4f
+    movb (%rsi), %r8b
+    movb %r8b, (%rdi)
+4:
+    ret
+
+.globl memcpy_sse2
+memcpy_sse2:
+    movq %rdi, %rax
+    cmpq $16, %rdx
+    jbe memcpy_small
+    cmpq $32, %rdx
+    ja 1f
+    movdqu (%rsi), %xmm0
+    movdqu -16(%rsi,%rdx), %xmm1
+    movdqu %xmm0, (%rdi)
+    movdqu %xmm1, -16(%rdi,%rdx)
+    ret
+1:
+    cmpq $64, %rdx
+    ja 2f
+    movdqu (%rsi), %xmm0
+    movdqu 16(%rsi), %xmm1
+    movdqu -32(%rsi,%rdx), %xmm2
+    movdqu -16(%rsi,%rdx), %xmm3
+    movdqu %xmm0, (%rdi)
+    movdqu %xmm1, 16(%rdi)
+    movdqu %xmm2, -32(%rdi,%rdx)
+    movdqu %xmm3, -16(%rdi,%rdx)
+    ret
+2:
+    cmpq string_rep_threshold(%rip), %rdx
+    jae memcpy_erms
+    // the tail, stored last and overlapping
+    movdqu -64(%rsi,%rdx), %xmm4
+    movdqu -48(%rsi,%rdx), %xmm5
+    movdqu -32(%rsi,%rdx), %xmm6
+    movdqu -16(%rsi,%rdx), %xmm7
+    leaq -64(%rdi,%rdx), %r8
+3:
+    movdqu (%rsi), %xmm0
+    movdqu 16(%rsi), %xmm1
+    movdqu 32(%rsi), %xmm2
+    movdqu 48(%rsi), %xmm3
+    movdqu %xmm0, (%rdi)
+    movdqu %xmm1, 16(%rdi)
+    movdqu %xmm2, 32(%rdi)
+    movdqu %xmm3, 48(%rdi)
+    addq $64, %rsi
+    addq $64, %rdi
+    subq $64, %rdx
+    cmpq $64, %rdx
+    ja 3b
+    movdqu %xmm4, (%r8)
+    movdqu %xmm5, 16(%r8)
+    movdqu %xmm6, 32(%r8)
+    movdqu %xmm7, 48(%r8)
+    ret
+
+.globl memcpy_avx2
+memcpy_avx2:
+    // below `STRING_AVX2_MIN` bytes, toggling interrupts costs more than wider stores gain
+    cmpq $512, %rdx
+    jb memcpy_sse2
+    cmpq string_rep_threshold(%rip), %rdx
+    jae memcpy_erms
+    cmpq $0, %gs:fpu_current
+    jne memcpy_sse2
+    movq %rdi, %rax
+    pushfq
+    cli
+    vmovdqu -128(%rsi,%rdx), %ymm4
+    vmovdqu -96(%rsi,%rdx), %ymm5
+    vmovdqu -64(%rsi,%rdx), %ymm6
+    vmovdqu -32(%rsi,%rdx), %ymm7
+    leaq -128(%rdi,%rdx), %r8
+1:
+    vmovdqu (%rsi), %ymm0
+    vmovdqu 32(%rsi), %ymm1
+    vmovdqu 64(%rsi), %ymm2
+    vmovdqu 96(%rsi), %ymm3
+    vmovdqu %ymm0, (%rdi)
+    vmovdqu %ymm1, 32(%rdi)
+    vmovdqu %ymm2, 64(%rdi)
+    vmovdqu %ymm3, 96(%rdi)
+    subq $-128, %rsi
+    subq $-128, %rdi
+    addq $-128, %rdx
+    cmpq $128, %rdx
+    ja 1b
+    vmovdqu %ymm4, (%r8)
+    vmovdqu %ymm5, 32(%r8)
+    vmovdqu %ymm6, 64(%r8)
+    vmovdqu %ymm7, 96(%r8)
+    vzeroupper
+    popfq
+    ret
+
+// void *memset_generic(void *dst, int value, size_t size)
+.globl memset_generic
+memset_generic:
+    movq %rdi, %r9
+    movzbl %sil, %eax
+    movabsq $0x0101010101010101, %r8
+    imulq %r8, %rax
+    movq %rdx, %rcx
+    shrq $3, %rcx
+    rep stosq
+    movl %edx, %ecx
+    andl $7, %ecx
+    rep stosb
+    movq %r9, %rax
+    ret
+
+.globl memset_erms
+memset_erms:
+    movq %rdi, %r9
+    movl %esi, %eax
+    movq %rdx, %rcx
+    rep stosb
+    movq %r9, %rax
+    ret
+
+.globl memset_sse2
+memset_sse2:
+    movzbl %sil, %eax
+    movabsq $0x0101010101010101, %r8
+    imulq %r8, %rax
+    cmpq $16, %rdx
+    ja 4f
+    cmpq $8, %rdx
+    jb 1f
+    movq %rax, (%rdi)
+    movq %rax, -8(%rdi,%rdx)
+    movq %rdi, %rax
+    ret
+1:
+    cmpq $4, %rdx
+    jb 2f
+    movl %eax, (%rdi)
+    movl %eax, -4(%rdi,%rdx)
+    movq %rdi, %rax
+    ret
+2:
+    cmpq $2, %rdx
+    jb 3f
+    movw %ax, (%rdi)
+    movw %ax, -2(%rdi,%rdx)
+    movq %rdi, %rax
+    ret
+3:
+    testq %rdx, %rdx
+    jz 9f
+    movb %al, (%rdi)
+9:
+    movq %rdi, %rax
+    ret
+4:
+    movq %rax, %xmm0
+    punpcklqdq %xmm0, %xmm0
+    movq %rdi, %rax
+    cmpq $32, %rdx
+    ja 5f
+    movdqu %xmm0, (%rdi)
+    movdqu %xmm0, -16(%rdi,%rdx)
+    ret
+5:
+    cmpq $64, %rdx
+    ja 6f
+    movdqu %xmm0, (%rdi)
+    movdqu %xmm0, 16(%rdi)
+    movdqu %xmm0, -32(%rdi,%rdx)
+    movdqu %xmm0, -16(%rdi,%rdx)
+    ret
+6:
+    cmpq string_rep_threshold(%rip), %rdx
+    jae memset_erms
+    leaq -64(%rdi,%rdx), %r8
+7:
+    movdqu %xmm0, (%rdi)
+    movdqu %xmm0, 16(%rdi)
+    movdqu %xmm0, 32(%rdi)
+    movdqu %xmm0, 48(%rdi)
+    addq $64, %rdi
+    subq $64, %rdx
+    cmpq $64, %rdx
+    ja 7b
+    movdqu %xmm0, (%r8)
+    movdqu %xmm0, 16(%r8)
+    movdqu %xmm0, 32(%r8)
+    movdqu %xmm0, 48(%r8)
+    ret
+
+.globl memset_avx2
+memset_avx2:
+    cmpq $512, %rdx
+    jb memset_sse2
+    cmpq string_rep_threshold(%rip), %rdx
+    jae memset_erms
+    cmpq $0, %gs:fpu_current
+    jne memset_sse2
+    movq %rdi, %rax
+    pushfq
+    cli
+    vmovd %esi, %xmm0
+    vpbroadcastb %xmm0, %ymm0
+    leaq -128(%rdi,%rdx), %r8
+1:
+    vmovdqu %ymm0, (%rdi)
+    vmovdqu %ymm0, 32(%rdi)
+    vmovdqu %ymm0, 64(%rdi)
+    vmovdqu %ymm0, 96(%rdi)
+    subq $-128, %rdi
+    addq $-128, %rdx
+    cmpq $128, %rdx
+    ja 1b
+    vmovdqu %ymm0, (%r8)
+    vmovdqu %ymm0, 32(%r8)
+    vmovdqu %ymm0, 64(%r8)
+    vmovdqu %ymm0, 96(%r8)
+    vzeroupper
+    popfq
+    ret
+
+// int memcmp_generic(const void *a, const void *b, size_t size)
+// Quadwords until one differs; byte swapped, their unsigned order is that of the first
+// differing byte.
+.globl memcmp_generic
+memcmp_generic:
+1:
+    cmpq $8, %rdx
+    jb 3f
+    movq (%rdi), %rax
+    movq (%rsi), %rcx
+    cmpq %rcx, %rax
+    jne 2f
+    addq $8, %rdi
+    addq $8, %rsi
+    subq $8, %rdx
+    jmp 1b
+2:
+    bswapq %rax
+    bswapq %rcx
+    cmpq %rcx, %rax
+    // -1 if below, 0 otherwise
+    sbbl %eax, %eax
+    orl $1, %eax
+    ret
+3:
+    xorl %eax, %eax
+    testq %rdx, %rdx
+    jz 5f
+4:
+    movzbl (%rdi), %eax
+    movzbl (%rsi), %ecx
+    subl %ecx, %eax
+    jnz 5f
+    incq %rdi
+    incq %rsi
+    decq %rdx
+    jnz 4b
+5:
+    ret
+
+.globl memcmp_sse2
+memcmp_sse2:
+    cmpq $16, %rdx
+    jb memcmp_generic
+1:
+    cmpq $16, %rdx
+    jbe 2f
+    movdqu (%rdi), %xmm0
+    movdqu (%rsi), %xmm1
+    pcmpeqb %xmm1, %xmm0
+    pmovmskb %xmm0, %ecx
+    xorl $0xFFFF, %ecx
+    jnz 3f
+    addq $16, %rdi
+    addq $16, %rsi
+    subq $16, %rdx
+    jmp 1b
+2:
+    // the last 16, overlapping bytes known to be equal
+    leaq -16(%rdi,%rdx), %rdi
+    leaq -16(%rsi,%rdx), %rsi
+    movdqu (%rdi), %xmm0
+    movdqu (%rsi), %xmm1
+    pcmpeqb %xmm1, %xmm0
+    pmovmskb %xmm0, %ecx
+    xorl $0xFFFF, %ecx
+    jnz 3f
+    xorl %eax, %eax
+    ret
+3:
+    bsfl %ecx, %ecx
+    movzbl (%rdi,%rcx), %eax
+    movzbl (%rsi,%rcx), %edx
+    subl %edx, %eax
+    ret
+
+.globl memcmp_avx2
+memcmp_avx2:
+    cmpq $512, %rdx
+    jb memcmp_sse2
+    cmpq $0, %gs:fpu_current
+    jne memcmp_sse2
+    pushfq
+    cli
+1:
+    cmpq $32, %rdx
+    jbe 2f
+    vmovdqu (%rdi), %ymm0
+    vpcmpeqb (%rsi), %ymm0, %ymm0
+    vpmovmskb %ymm0, %ecx
+    notl %ecx
+    testl %ecx, %ecx
+    jnz 3f
+    addq $32, %rdi
+    addq $32, %rsi
+    subq $32, %rdx
+    jmp 1b
+2:
+    leaq -32(%rdi,%rdx), %rdi
+    leaq -32(%rsi,%rdx), %rsi
+    vmovdqu (%rdi), %ymm0
+    vpcmpeqb (%rsi), %ymm0, %ymm0
+    vpmovmskb %ymm0, %ecx
+    notl %ecx
+    testl %ecx, %ecx
+    jnz 3f
+    vzeroupper
+    popfq
+    xorl %eax, %eax
+    ret
+3:
+    vzeroupper
+    popfq
+    bsfl %ecx, %ecx
+    movzbl (%rdi,%rcx), %eax
+    movzbl (%rsi,%rcx), %edx
+    subl %edx, %eax
+    ret
@@ -0,0 +1,695 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mm/pmm.h>
+#include <printk.h>
+#include <spinlock.h>
+
+#include <arch/cpu.h>
+#include <arch/paging.h>
+#include <arch/string.h>
+#include <arch/tsc.h>
+
+#define PAGING_LEVEL_SHIFT(level)       (PAGE_SHIFT + 9 * ((level) - 1))
+#define PAGING_LEVEL_SIZE(level)        (1ULL << PAGING_LEVEL_SHIFT(level))
+#define PAGING_INDEX(virt, level)       (((virt) >> PAGING_LEVEL_SHIFT(level)) & (PAGING_ENTRIES - 1))
+
+/**
+ * @brief A run of physically contiguous RAM, merged from adjacent memory map descriptors.
+ */
+struct paging_range {
+    uint64_t start;
+    uint64_t end;
+};
+
+uint64_t paging_phys_offset = 0;
+uint64_t *kernel_pml4 = NULL;
+uint64_t kernel_cr3 = 0;
+uint64_t paging_supported_flags = PTE_FLAGS_MASK & ~PTE_NO_EXECUTE;
+int paging_has_1g_pages = 0;
+static int paging_has_pat = 0;
+
+static struct lock_class paging_lock_class = LOCK_CLASS_INIT("paging");
+static struct spinlock paging_lock = SPINLOCK_INIT_CLASS(paging_lock_class);
+static uint64_t paging_table_pages = 0;
+static uint64_t paging_mmio_next = PAGING_MMIO_BASE;
+
+static struct nickel_boot_info *early_boot_info = NULL;
+static struct nickel_memory_descriptor *early_descriptor = NULL;
+static struct paging_range ranges[PMM_MAX_MEMORY_DESCRIPTORS];
+
+extern uint8_t __kernel_start[], __text_end[], __rodata_end[], __kernel_end[];
+
+/**
+ * @brief Memory the direct map covers. Reserved and MMIO regions are left out, so a large page
+ *        never spans device registers with a write-back mapping.
+ */
+static inline int paging_is_ram(uint32_t type) {
+    switch (type) {
+    case NICKEL_MEMORY_LOADER_CODE:
+    case NICKEL_MEMORY_LOADER_DATA:
+    case NICKEL_MEMORY_BOOT_SERVICES_CODE:
+    case NICKEL_MEMORY_BOOT_SERVICES_DATA:
+    case NICKEL_MEMORY_RUNTIME_SERVICES_CODE:
+    case NICKEL_MEMORY_RUNTIME_SERVICES_DATA:
+    case NICKEL_MEMORY_CONVENTIONAL:
+    case NICKEL_MEMORY_ACPI_RECLAIM:
+    case NICKEL_MEMORY_ACPI_NVS:
+    case NICKEL_MEMORY_PERSISTENT:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static inline struct nickel_memory_descriptor *paging_descriptor(struct nickel_boot_info *boot_info, uint64_t i) {
+    return phys_to_virt(boot_info->memory_map + i * boot_info->descriptor_size);
+}
+
+/**
+ * @brief Takes a page from the end of the largest conventional region of the firmware map,
+ *        before the physical allocator exists. The region shrinks, so `pmm_init()` never sees
+ *        the page.
+ */
+static uint64_t paging_early_alloc(void) {
+    struct nickel_memory_descriptor *desc;
+    uint64_t i, count;
+
+    if (early_boot_info == NULL) {
+        return 0;
+    }
+
+    if (early_descriptor == NULL || early_descriptor->number_of_pages == 0) {
+        early_descriptor = NULL;
+        count = early_boot_info->memory_map_size / early_boot_info->descriptor_size;
+        for (i = 0; i < count; ++i) {
+            desc = paging_descriptor(early_boot_info, i);
+            if (desc->type != NICKEL_MEMORY_CONVENTIONAL || desc->physical_start < PMM_LOW_MEMORY_LIMIT) {
+                continue;
+            } else if (early_descriptor == NULL || desc->number_of_pages > early_descriptor->number_of_pages) {
+                early_descriptor = desc;
+            }
+        }
+        if (early_descriptor == NULL || early_descriptor->number_of_pages == 0) {
+            return 0;
+        }
+    }
+
+    --early_descriptor->number_of_pages;
+    return early_descriptor->physical_start + early_descriptor->number_of_pages * NICKEL_MEMORY_PAGE_SIZE;
+}
+
+/**
+ * @brief Allocates a zeroed page-table page.
+ *
+ * @return Its physical address, or 0 if memory is exhausted.
+ */
+uint64_t paging_alloc_table(void) {
+    uint64_t table;
+
+    table = mem_map != NULL ? pmm_alloc(0) : paging_early_alloc();
+    if (table == 0) {
+        return 0;
+    }
+
+    clear_page(phys_to_virt(table));
+    ++paging_table_pages;
+    return table;
+}
+
+static inline uint32_t paging_size_level(uint64_t page_size) {
+    switch (page_size) {
+    case PAGING_SIZE_4K:
+        return 1;
+    case PAGING_SIZE_2M:
+        return 2;
+    case PAGING_SIZE_1G:
+        return paging_has_1g_pages ? 3 : 0;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Replaces the large page in `entry` with a table of the next level mapping the same
+ *        range with the same flags.
+ */
+static int32_t paging_split(uint64_t *entry, uint32_t level, uint64_t virt) {
+    uint64_t table, *entries, phys, flags;
+    uint32_t i;
+
+    table = paging_alloc_table();
+    if (table == 0) {
+        return PAGING_NO_MEMORY;
+    }
+
+    entries = phys_to_virt(table);
+    phys = *entry & PTE_ADDRESS_MASK & ~(PAGING_LEVEL_SIZE(level) - 1);
+    flags = *entry & PTE_FLAGS_MASK;
+    if (level == 2) {
+        flags &= ~PTE_HUGE;                                                         /* bit 7 of a PT entry is PAT */
+    }
+    for (i = 0; i < PAGING_ENTRIES; ++i) {
+        entries[i] = (phys + i * PAGING_LEVEL_SIZE(level - 1)) | flags;
+    }
+
+    *entry = table | PTE_PRESENT | PTE_WRITE | (flags & PTE_USER);
+    paging_invalidate(virt & ~(PAGING_LEVEL_SIZE(level) - 1));                      /* drops the large TLB entry */
+    return PAGING_SUCCESS;
+}
+
+/**
+ * @brief Finds the entry that maps `virt` at `level`, creating missing tables and splitting
+ *        large pages on the way down.
+ */
+static int32_t paging_walk_create(uint64_t *root, uint64_t virt, uint32_t level, uint64_t flags, uint64_t **result) {
+    uint64_t *table = root, *entry, next;
+    uint32_t current;
+    int32_t ret;
+
+    for (current = PAGING_LEVELS; current > level; --current) {
+        entry = &table[PAGING_INDEX(virt, current)];
+        if (!(*entry & PTE_PRESENT)) {
+            next = paging_alloc_table();
+            if (next == 0) {
+                return PAGING_NO_MEMORY;
+            }
+            *entry = next | PTE_PRESENT | PTE_WRITE;
+        } else if (current != PAGING_LEVELS && (*entry & PTE_HUGE)) {
+            ret = paging_split(entry, current, virt);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+        *entry |= flags & PTE_USER;                                                 /* user leaves need user tables above them */
+        table = phys_to_virt(*entry & PTE_ADDRESS_MASK);
+    }
+
+    *result = &table[PAGING_INDEX(virt, level)];
+    return PAGING_SUCCESS;
+}
+
+/**
+ * @brief Finds the leaf entry mapping `virt`, or the first non-present entry on the way.
+ *
+ * @param level Receives the level of the returned entry, so that its span is known.
+ */
+static uint64_t *paging_lookup(const uint64_t *root, uint64_t virt, uint32_t *level) {
+    const uint64_t *table = root;
+    uint64_t *entry;
+
+    for (*level = PAGING_LEVELS; ; --*level) {
+        entry = (uint64_t *)&table[PAGING_INDEX(virt, *level)];
+        if (!(*entry & PTE_PRESENT) || *level == 1) {
+            return entry;
+        } else if (*level != PAGING_LEVELS && (*entry & PTE_HUGE)) {
+            return entry;
+        }
+        table = phys_to_virt(*entry & PTE_ADDRESS_MASK);
+    }
+}
+
+static int32_t __paging_map(uint64_t *root, uint64_t virt, uint64_t phys, uint64_t size, uint64_t flags, uint32_t level) {
+    uint64_t *entry, page_size = PAGING_LEVEL_SIZE(level);
+    int32_t ret;
+
+    flags = (flags & paging_supported_flags & PTE_FLAGS_MASK) | PTE_PRESENT;
+    flags = level > 1 ? flags | PTE_HUGE : flags & ~PTE_HUGE;
+    for (; size > 0; virt += page_size, phys += page_size, size -= page_size) {
+        ret = paging_walk_create(root, virt, level, flags, &entry);
+        if (ret < 0) {
+            return ret;
+        } else if (*entry & PTE_PRESENT) {
+            return PAGING_ALREADY_MAPPED;
+        }
+        *entry = phys | flags;
+    }
+    return PAGING_SUCCESS;
+}
+
+/**
+ * @brief Maps a range with the largest pages up to `max_size` that alignment allows.
+ *
+ * @param pages Optional, receives the number of pages used of each level, indexed by level.
+ */
+static int32_t paging_map_largest(uint64_t *root, uint64_t virt, uint64_t phys, uint64_t size, uint64_t flags,
+                                  uint64_t max_size, uint64_t *pages) {
+    uint64_t page_size;
+    uint32_t level, max_level;
+    int32_t ret;
+
+    if ((virt | phys | size) & (PAGE_SIZE - 1)) {
+        return PAGING_INVALID_PARAMETER;
+    }
+
+    max_level = paging_size_level(max_size);
+    max_level = max_level == 0 ? 2 : max_level;                                     /* 1GB pages without pdpe1gb */
+    while (size > 0) {
+        for (level = max_level; level > 1; --level) {
+            page_size = PAGING_LEVEL_SIZE(level);
+            if (!((virt | phys) & (page_size - 1)) && size >= page_size) {
+                break;
+            }
+        }
+        page_size = PAGING_LEVEL_SIZE(level);
+
+        ret = __paging_map(root, virt, phys, page_size, flags, level);
+        if (ret < 0) {
+            return ret;
+        } else if (pages != NULL) {
+            ++pages[level];
+        }
+        virt += page_size;
+        phys += page_size;
+        size -= page_size;
+    }
+    return PAGING_SUCCESS;
+}
+
+/**
+ * @brief Unmaps or reprotects `[virt, virt + size)`. Walks leaf by leaf, so a 1GB page costs a
+ *        single entry update unless the range ends inside it.
+ */
+static int32_t paging_update(uint64_t *root, uint64_t virt, uint64_t size, uint64_t flags, int unmap) {
+    uint64_t *entry, span, step;
+    uint32_t level;
+    int32_t ret;
+
+    if (size == 0 || ((virt | size) & (PAGE_SIZE - 1))) {
+        return PAGING_INVALID_PARAMETER;
+    }
+
+    flags = (flags & paging_supported_flags & PTE_FLAGS_MASK) | PTE_PRESENT;
+    while (size > 0) {
+        entry = paging_lookup(root, virt, &level);
+        span = PAGING_LEVEL_SIZE(level);
+        step = span - (virt & (span - 1));
+        if (!(*entry & PTE_PRESENT)) {
+            if (step >= size) {
+                break;
+            }
+            virt += step;
+            size -= step;
+            continue;
+        } else if (step != span || size < span) {
+            ret = paging_split(entry, level, virt);                                 /* the range ends inside a large page */
+            if (ret < 0) {
+                return ret;
+            }
+            continue;
+        }
+
+        if (unmap) {
+            *entry = 0;
+        } else {
+            *entry = (*entry & PTE_ADDRESS_MASK) | (level > 1 ? flags | PTE_HUGE : flags & ~PTE_HUGE);
+        }
+        paging_invalidate(virt);
+        virt += span;
+        size -= span;
+    }
+    return PAGING_SUCCESS;
+}
+
+/**
+ * @brief Maps `[virt, virt + size)` to `[phys, phys + size)` with pages of exactly
+ *        `page_size`. A large page already covering part of the range is split first.
+ *
+ * @param root PML4 of the address space.
+ * @param page_size One of `PAGING_SIZE_4K`, `PAGING_SIZE_2M` or `PAGING_SIZE_1G`. `virt`,
+ *        `phys` and `size` must be multiples of it.
+ * @param flags `PTE_*` bits; `PTE_PRESENT` and `PTE_HUGE` are implied.
+ * @return `PAGING_SUCCESS` on success, `PAGING_ALREADY_MAPPED` if a page in the range is in
+ *         use, or another `PAGING_*` error.
+ */
+int32_t paging_map(uint64_t *root, uint64_t virt, uint64_t phys, uint64_t size, uint64_t flags, uint64_t page_size) {
+    uint64_t irq;
+    uint32_t level;
+    int32_t ret;
+
+    level = paging_size_level(page_size);
+    if (root == NULL || level == 0 || size == 0 || ((virt | phys | size) & (page_size - 1))) {
+        return PAGING_INVALID_PARAMETER;
+    }
+
+    spin_lock_irqsave(&paging_lock, irq);
+    ret = __paging_map(root, virt, phys, size, flags, level);
+    spin_unlock_irqrestore(&paging_lock, irq);
+    return ret;
+}
+
+/**
+ * @brief Maps a range with the largest pages its alignment allows.
+ */
+int32_t paging_map_range(uint64_t *root, uint64_t virt, uint64_t phys, uint64_t size, uint64_t flags) {
+    uint64_t irq;
+    int32_t ret;
+
+    if (root == NULL || size == 0) {
+        return PAGING_INVALID_PARAMETER;
+    }
+
+    spin_lock_irqsave(&paging_lock, irq);
+    ret = paging_map_largest(root, virt, phys, size, flags, paging_has_1g_pages ? PAGING_SIZE_1G : PAGING_SIZE_2M, NULL);
+    spin_unlock_irqrestore(&paging_lock, irq);
+    return ret;
+}
+
+/**
+ * @brief Removes every mapping in `[virt, virt + size)` and invalidates it in the local TLB.
+ *        Large pages straddling either end are split so the rest of them stays mapped.
+ *        Holes in the range are skipped.
+ */
+int32_t paging_unmap(uint64_t *root, uint64_t virt, uint64_t size) {
+    uint64_t irq;
+    int32_t ret;
+
+    spin_lock_irqsave(&paging_lock, irq);
+    ret = paging_update(root, virt, size, 0, 1);
+    spin_unlock_irqrestore(&paging_lock, irq);
+    return ret;
+}
+
+/**
+ * @brief Replaces the `PTE_*` flags of every mapped page in `[virt, virt + size)`, splitting
+ *        large pages straddling either end.
+ */
+int32_t paging_protect(uint64_t *root, uint64_t virt, uint64_t size, uint64_t flags) {
+    uint64_t irq;
+    int32_t ret;
+
+    spin_lock_irqsave(&paging_lock, irq);
+    ret = paging_update(root, virt, size, flags, 0);
+    spin_unlock_irqrestore(&paging_lock, irq);
+    return ret;
+}
+
+/**
+ * @brief Gets the physical address `virt` maps to, or `PAGING_INVALID_ADDRESS`.
+ */
+uint64_t paging_translate(const uint64_t *root, uint64_t virt) {
+    const uint64_t *entry;
+    uint64_t span;
+    uint32_t level;
+
+    entry = paging_lookup(root, virt, &level);
+    if (!(*entry & PTE_PRESENT)) {
+        return PAGING_INVALID_ADDRESS;
+    }
+
+    span = PAGING_LEVEL_SIZE(level);
+    return (*entry & PTE_ADDRESS_MASK & ~(span - 1)) | (virt & (span - 1));
+}
+
+/**
+ * @brief Takes the next `size` bytes of the MMIO window and maps `phys` there with `cache`.
+ */
+static void *paging_map_device(uint64_t phys, uint64_t size, uint64_t cache) {
+    uint64_t offset = phys & (PAGE_SIZE - 1), virt;
+
+    phys -= offset;
+    size = (size + offset + PAGE_SIZE - 1) & PAGE_MASK;
+    virt = __atomic_fetch_add(&paging_mmio_next, size, __ATOMIC_RELAXED);
+    if (size == 0 || virt + size > PAGING_MMIO_BASE + PAGING_MMIO_SIZE) {
+        return NULL;
+    }
+
+    if (paging_map(kernel_pml4, virt, phys, size, PTE_WRITE | cache | PTE_NO_EXECUTE | PTE_GLOBAL,
+                   PAGING_SIZE_4K) < 0) {
+        return NULL;
+    }
+    return (void *)(virt + offset);
+}
+
+/**
+ * @brief Maps device registers uncached into the MMIO window of the kernel address space.
+ *
+ * @return The virtual address of `phys`, or `NULL` if the window or memory is exhausted.
+ */
+void *paging_map_mmio(uint64_t phys, uint64_t size) {
+    return paging_map_device(phys, size, PTE_CACHE_UNCACHED);
+}
+
+/**
+ * @brief Maps memory such as a framebuffer write-combining into the MMIO window. Stores are
+ *        buffered and burst to the device, reads are uncached. Falls back to uncached on a CPU
+ *        without PAT.
+ *
+ * @return The virtual address of `phys`, or `NULL` if the window or memory is exhausted.
+ */
+void *paging_map_wc(uint64_t phys, uint64_t size) {
+    return paging_map_device(phys, size, paging_has_pat ? PTE_CACHE_WRITE_COMBINING : PTE_CACHE_UNCACHED);
+}
+
+/**
+ * @brief Programs `PAGING_PAT` on the calling CPU. The boot CPU does so in `paging_init()`,
+ *        every AP before it maps anything.
+ */
+void paging_cpu_init(void) {
+    if (paging_has_pat) {
+        wrmsr(MSR_PAT, PAGING_PAT);                                                 /* no mapping used entry 1 yet, nothing to flush */
+    }
+}
+
+/**
+ * @brief Maps a part of the kernel image at its link address and at the higher-half alias.
+ */
+static int32_t paging_map_kernel(uint64_t *root, const uint8_t *start, const uint8_t *end, uint64_t flags) {
+    uint64_t phys = (uint64_t)start, size = (uint64_t)(end - start);
+    int32_t ret;
+
+    if (size == 0) {
+        return PAGING_SUCCESS;
+    }
+
+    ret = paging_map_largest(root, phys, phys, size, flags, PAGING_SIZE_2M, NULL);
+    if (ret < 0) {
+        return ret;
+    }
+    return paging_map_largest(root, PAGING_KERNEL_BASE + phys - KERNEL_ADDRESS, phys, size, flags, PAGING_SIZE_2M, NULL);
+}
+
+/**
+ * @brief Builds the kernel page tables and switches CR3 to them. The new tables contain:
+ *        - the direct map of every RAM region at `PAGING_DIRECT_MAP_BASE`, with 1GB pages if
+ *          the CPU has pdpe1gb and 2MB pages otherwise, global and non-executable;
+ *        - the kernel image at its link address and at `PAGING_KERNEL_BASE`, text read-only
+ *          and executable, rodata read-only, data and bss writable;
+ *        - an identity map of the low megabyte (except page 0) for the AP trampoline and of
+ *          the firmware stack we are still running on.
+ *        Tables are carved from the firmware memory map, so this runs before `pmm_init()`.
+ *
+ * @param boot_info Boot information passed from the bootloader. The memory map is shrunk by
+ *        the pages taken for tables.
+ * @return `PAGING_SUCCESS` on success, one of `PAGING_*` errors otherwise.
+ */
+int32_t paging_init(struct nickel_boot_info *boot_info) {
+    struct nickel_memory_descriptor *desc;
+    uint64_t i, count, range_count = 0, root, *pml4, *entry, rsp, start, end, direct = 0, pages[PAGING_LEVELS] = { 0 };
+    uint32_t eax, ebx, ecx, edx;
+    int32_t ret;
+
+    if (boot_info->memory_map == 0 || boot_info->descriptor_size < sizeof(struct nickel_memory_descriptor)) {
+        return PAGING_INVALID_PARAMETER;
+    }
+
+    count = boot_info->memory_map_size / boot_info->descriptor_size;
+    if (count > PMM_MAX_MEMORY_DESCRIPTORS) {
+        return PAGING_INVALID_PARAMETER;
+    }
+
+    cpuid(CPUID_EXT_FEATURES, 0, eax, ebx, ecx, edx);
+    paging_has_1g_pages = !!(edx & CPUID_EXT_FEATURES_EDX_PDPE1GB);
+    if (edx & CPUID_EXT_FEATURES_EDX_NX) {
+        paging_supported_flags |= PTE_NO_EXECUTE;
+    }
+    cpuid(CPUID_FEATURES, 0, eax, ebx, ecx, edx);
+    paging_has_pat = !!(edx & CPUID_FEATURES_EDX_PAT);
+
+    for (i = 0; i < count; ++i) {                                                   /* snapshot before tables are carved out */
+        desc = paging_descriptor(boot_info, i);
+        if (!paging_is_ram(desc->type) || desc->number_of_pages == 0) {
+            continue;
+        }
+
+        start = desc->physical_start;
+        end = start + desc->number_of_pages * NICKEL_MEMORY_PAGE_SIZE;
+        if (range_count > 0 && ranges[range_count - 1].end == start) {
+            ranges[range_count - 1].end = end;
+        } else {
+            ranges[range_count].start = start;
+            ranges[range_count++].end = end;
+        }
+    }
+
+    early_boot_info = boot_info;
+    root = paging_alloc_table();
+    if (root == 0) {
+        return PAGING_NO_MEMORY;
+    }
+    pml4 = phys_to_virt(root);
+
+    for (i = 0; i < range_count; ++i) {
+        ret = paging_map_largest(pml4, PAGING_DIRECT_MAP_BASE + ranges[i].start, ranges[i].start,
+                                 ranges[i].end - ranges[i].start, PTE_WRITE | PTE_NO_EXECUTE | PTE_GLOBAL,
+                                 PAGING_SIZE_1G, pages);
+        if (ret < 0) {
+            return ret;
+        }
+        direct += ranges[i].end - ranges[i].start;
+    }
+
+    ret = paging_walk_create(pml4, PAGING_MMIO_BASE, PAGING_LEVELS - 1, 0, &entry);  /* address spaces copy the kernel PML4 once */
+    if (ret == PAGING_SUCCESS) {
+        ret = paging_walk_create(pml4, PAGING_STACK_BASE, PAGING_LEVELS - 1, 0, &entry);
+    }
+    if (ret == PAGING_SUCCESS) {
+        ret = paging_map_kernel(pml4, __kernel_start, __text_end, PTE_GLOBAL);
+    }
+    if (ret == PAGING_SUCCESS) {
+        ret = paging_map_kernel(pml4, __text_end, __rodata_end, PTE_GLOBAL | PTE_NO_EXECUTE);
+    }
+    if (ret == PAGING_SUCCESS) {
+        ret = paging_map_kernel(pml4, __rodata_end, __kernel_end, PTE_WRITE | PTE_GLOBAL | PTE_NO_EXECUTE);
+    }
+    if (ret == PAGING_SUCCESS) {                                                    /* AP trampoline and real-mode data */
+        ret = paging_map_largest(pml4, PAGE_SIZE, PAGE_SIZE, PMM_LOW_MEMORY_LIMIT - PAGE_SIZE, PTE_WRITE | PTE_GLOBAL,
+                                 PAGING_SIZE_4K, NULL);
+    }
+    if (ret < 0) {
+        return ret;
+    }
+
+    rsp = read_rsp();
+    for (i = 0; i < count; ++i) {                                                   /* we are still running on the firmware stack */
+        desc = paging_descriptor(boot_info, i);
+        start = desc->physical_start;
+        end = start + desc->number_of_pages * NICKEL_MEMORY_PAGE_SIZE;
+        start = start < PMM_LOW_MEMORY_LIMIT ? PMM_LOW_MEMORY_LIMIT : start;        /* the low megabyte is mapped already */
+        if (rsp >= start && rsp < end) {
+            ret = paging_map_largest(pml4, start, start, end - start, PTE_WRITE | PTE_NO_EXECUTE | PTE_GLOBAL,
+                                     PAGING_SIZE_2M, NULL);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+    }
+
+    if (paging_supported_flags & PTE_NO_EXECUTE) {
+        wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_NXE);
+    }
+    write_cr4(read_cr4() | CR4_PGE);
+    write_cr0(read_cr0() | CR0_WP);                                                 /* read-only pages apply to ring 0 as well */
+    paging_cpu_init();
+    write_cr3(root);
+
+    kernel_cr3 = root;
+    paging_phys_offset = PAGING_DIRECT_MAP_BASE;
+    kernel_pml4 = phys_to_virt(root);
+    early_descriptor = NULL;                                                        /* was an identity pointer, found again through the direct map */
+
+    printk("paging: direct map %lu MB with %lu 1G, %lu 2M and %lu 4K pages, %lu tables\n",
+           direct >> 20, pages[3], pages[2], pages[1], paging_table_pages);
+    return PAGING_SUCCESS;
+}
+
+/**
+ * @brief Frees `table` and every table below it. The pages they map are left alone.
+ *
+ * @param table Physical address of the table.
+ * @param level Level of `table`, `PAGING_LEVELS` for a PML4.
+ */
+void paging_free_tables(uint64_t table, uint32_t level) {
+    const uint64_t *entries = phys_to_virt(table);
+    uint32_t i;
+
+    for (i = 0; level > 1 && i < PAGING_ENTRIES; ++i) {                             /* children first, the table is read until then */
+        if ((entries[i] & PTE_PRESENT) && (level == PAGING_LEVELS || !(entries[i] & PTE_HUGE))) {
+            paging_free_tables(entries[i] & PTE_ADDRESS_MASK, level - 1);
+        }
+    }
+    pmm_free(table, 0);
+    --paging_table_pages;
+}
+
+static void paging_walk_level(uint64_t table, uint32_t level, void (*visit)(uint64_t table)) {
+    const uint64_t *entries = phys_to_virt(table);
+    uint32_t i;
+
+    visit(table);
+    if (level == 1) {
+        return;                                                                     /* entries of a PT point to data pages */
+    }
+
+    for (i = 0; i < PAGING_ENTRIES; ++i) {
+        if (!(entries[i] & PTE_PRESENT)) {
+            continue;
+        } else if (level != PAGING_LEVELS && (entries[i] & PTE_HUGE)) {
+            continue;                                                               /* bit 7 is reserved in a PML4 entry */
+        }
+        paging_walk_level(entries[i] & PTE_ADDRESS_MASK, level - 1, visit);
+    }
+}
+
+/**
+ * @brief Visits every page-table page reachable from `root`, including `root` itself. Large
+ *        pages terminate the walk of their branch.
+ *
+ * @param root Physical address of the PML4, as found in CR3.
+ * @param visit Callback receiving the physical address of each table.
+ */
+void paging_walk_tables(uint64_t root, void (*visit)(uint64_t table)) {
+    paging_walk_level(root & CR3_ADDRESS_MASK, PAGING_LEVELS, visit);
+}
+
+#if defined(NICKEL_BENCH)
+#define PAGING_BENCH_SIZE               (4ULL << 30)
+
+static uint64_t paging_bench_tables;
+
+static void paging_bench_count(uint64_t table) {
+    ++paging_bench_tables;
+}
+
+/**
+ * @brief Builds a 4GB direct map in scratch tables with 1GB, 2MB and 4KB pages and prints how
+ *        many page-table pages each one takes.
+ */
+void paging_bench(void) {
+    static const uint64_t sizes[] = { PAGING_SIZE_1G, PAGING_SIZE_2M, PAGING_SIZE_4K };
+    static const char *names[] = { "1G", "2M", "4K" };
+    uint64_t root, start, cycles, irq;
+    uint32_t i;
+    int32_t ret;
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        if (paging_size_level(sizes[i]) == 0) {
+            printk("paging: 4G direct map with %s pages: not supported\n", names[i]);
+            continue;
+        }
+
+        spin_lock_irqsave(&paging_lock, irq);
+        root = paging_alloc_table();
+        start = rdtsc();
+        ret = PAGING_NO_MEMORY;
+        if (root != 0) {
+            ret = paging_map_largest(phys_to_virt(root), PAGING_DIRECT_MAP_BASE, 0, PAGING_BENCH_SIZE,
+                                     PTE_WRITE | PTE_NO_EXECUTE | PTE_GLOBAL, sizes[i], NULL);
+        }
+        cycles = rdtsc() - start;
+        spin_unlock_irqrestore(&paging_lock, irq);
+
+        if (root != 0) {
+            paging_bench_tables = 0;
+            paging_walk_tables(root, paging_bench_count);
+            paging_free_tables(root, PAGING_LEVELS);
+        }
+        if (ret < 0) {
+            printk("paging: 4G direct map with %s pages failed (0x%x)\n", names[i], ret);
+            continue;
+        }
+        printk("paging: 4G direct map with %s pages: %lu tables (%lu KB), built in %lu us\n",
+               names[i], paging_bench_tables, paging_bench_tables << (PAGE_SHIFT - 10), tsc_to_ns(cycles) / 1000);
+    }
+}
+#endif
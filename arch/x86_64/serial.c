@@ -0,0 +1,38 @@
+#include <arch/io.h>
+#include <arch/cpu.h>
+#include <arch/serial.h>
+
+/**
+ * @brief Initializes the 16550 UART at COM1 as 115200 8N1 with FIFOs enabled.
+ */
+void serial_init(void) {
+    outb(SERIAL_COM1 + SERIAL_REG_INTERRUPT_ENABLE, 0x00);                          /* polled mode */
+    outb(SERIAL_COM1 + SERIAL_REG_LINE_CONTROL, SERIAL_LINE_CONTROL_DLAB);
+    outb(SERIAL_COM1 + SERIAL_REG_DIVISOR_LOW, 0x01);                               /* 115200 / 1 */
+    outb(SERIAL_COM1 + SERIAL_REG_DIVISOR_HIGH, 0x00);
+    outb(SERIAL_COM1 + SERIAL_REG_LINE_CONTROL, SERIAL_LINE_CONTROL_8N1);
+    outb(SERIAL_COM1 + SERIAL_REG_FIFO_CONTROL, SERIAL_FIFO_ENABLE_CLEAR_14);
+    outb(SERIAL_COM1 + SERIAL_REG_MODEM_CONTROL, SERIAL_MODEM_DTR_RTS_OUT2);
+}
+
+/**
+ * @brief Writes one character, spinning until the transmitter holding register is empty.
+ */
+void serial_putc(char c) {
+    while (!(inb(SERIAL_COM1 + SERIAL_REG_LINE_STATUS) & SERIAL_LINE_STATUS_THR_EMPTY)) {
+        cpu_relax();
+    }
+    outb(SERIAL_COM1 + SERIAL_REG_DATA, (uint8_t)c);
+}
+
+/**
+ * @brief Writes `length` characters, translating `\n` to `\r\n`.
+ */
+void serial_write(const char *buffer, uint64_t length) {
+    for (; length > 0; --length, ++buffer) {
+        if (*buffer == '\n') {
+            serial_putc('\r');
+        }
+        serial_putc(*buffer);
+    }
+}
@@ -0,0 +1,145 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include <acpi.h>
+#include <percpu.h>
+#include <printk.h>
+#include <sched.h>
+#include <smp.h>
+#include <timer.h>
+
+#include <arch/address_space.h>
+#include <arch/clock.h>
+#include <arch/cpu.h>
+#include <arch/fpu.h>
+#include <arch/paging.h>
+#include <arch/smpboot.h>
+#include <arch/stack.h>
+#include <arch/string.h>
+#include <arch/tss.h>
+#include <arch/tsc.h>
+#include <arch/apic/apic.h>
+#include <arch/apic/ipi.h>
+
+extern uint8_t ap_startup[], ap_startup_end[], ap_trampoline_data[];
+
+uint64_t ap_stack_tops[SMP_MAX_CPUS];
+uint32_t ap_stack_count = 0;
+volatile uint32_t ap_next_stack = 0;
+
+static uint64_t ap_online_tsc[SMP_MAX_CPUS];
+
+/**
+ * @brief Copies the trampoline to `SMP_TRAMPOLINE_ADDRESS` and fills in what it loads. Its
+ *        PML4 is a copy of the kernel one that lives below 4GB; only the identity slot is
+ *        used before the AP switches to `kernel_cr3`.
+ */
+static void smp_prepare_trampoline(void) {
+    uint8_t *trampoline = (uint8_t *)SMP_TRAMPOLINE_ADDRESS;                        /* identity mapped by `paging_init()` */
+    uint64_t *pml4 = (uint64_t *)SMP_TRAMPOLINE_PML4;
+    struct ap_trampoline_data *data;
+
+    memcpy(trampoline, ap_startup, ap_startup_end - ap_startup);
+    copy_page(pml4, kernel_pml4);
+
+    data = (struct ap_trampoline_data *)(trampoline + (ap_trampoline_data - ap_startup));
+    data->pml4 = SMP_TRAMPOLINE_PML4;
+    data->cr0 = (uint32_t)read_cr0();
+    data->cr4 = (uint32_t)(read_cr4() & ~CR4_PCIDE);                                /* PCIDE can only be set in long mode */
+    data->efer = (uint32_t)((rdmsr(MSR_EFER) & ~EFER_LMA) | EFER_LME);
+}
+
+/**
+ * @brief Starts every enabled AP listed in the MADT and waits until they are online or
+ *        `SMP_BOOT_TIMEOUT_US` passed. All APs are released by one INIT-SIPI-SIPI sequence,
+ *        broadcast when the MADT covers every CPU, and share its waits.
+ *
+ * @return The number of online CPUs, the boot CPU included.
+ */
+uint32_t smp_boot_aps(void) {
+    static uint16_t targets[SMP_MAX_CPUS];
+    uint32_t cpu, i, count = 0, self = smp_processor_id();
+    uint64_t stack, sipi, start;
+    int broadcast;
+
+    for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+        if (cpu == self || !(processors[cpu].flags & ACPI_PROCESSOR_LOCAL_ENABLED) || percpu_bases[cpu] == 0) {
+            continue;
+        }
+        stack = stack_alloc(SMP_AP_STACK_ORDER);
+        if (stack == 0) {
+            break;                                                                  /* the rest stays offline */
+        }
+        ap_stack_tops[count] = stack;
+        targets[count++] = (uint16_t)cpu;
+    }
+    if (count == 0) {
+        return smp_online_count;
+    }
+
+    smp_prepare_trampoline();
+    ap_stack_count = count;
+    ap_next_stack = 0;
+    broadcast = cores < ACPI_MAX_PROCESSORS && count == cores - 1;                  /* the shorthand would also wake CPUs we do not know */
+
+    if (broadcast) {
+        apic_send_init_ipi_all_but_self();
+    } else {
+        for (i = 0; i < count; ++i) {
+            apic_send_init_ipi(processors[targets[i]].apic_id);
+        }
+    }
+    tsc_delay_us(SMP_INIT_DELAY_US);
+
+    sipi = rdtsc();
+    for (i = 0; i < 2 && smp_online_count < count + 1; ++i) {                       /* the second SIPI only if someone missed the first */
+        if (broadcast) {
+            apic_send_startup_ipi_all_but_self((uint8_t *)SMP_TRAMPOLINE_ADDRESS);
+        } else {
+            for (cpu = 0; cpu < count; ++cpu) {
+                apic_send_startup_ipi(processors[targets[cpu]].apic_id, (uint8_t *)SMP_TRAMPOLINE_ADDRESS);
+            }
+        }
+        tsc_delay_us(SMP_SIPI_DELAY_US);
+    }
+
+    start = rdtsc();
+    while (smp_online_count < count + 1 && tsc_to_ns(rdtsc() - start) < SMP_BOOT_TIMEOUT_US * 1000) {
+        cpu_relax();
+    }
+
+    for (i = 0; i < count; ++i) {
+        cpu = targets[i];
+        if (cpumask_test(&smp_online_mask, cpu)) {
+            printk("smp: cpu %u (apic %u) online %lu us after sipi\n", cpu, processors[cpu].apic_id,
+                   tsc_to_ns(ap_online_tsc[cpu] - sipi) / 1000);
+        } else {
+            printk("smp: cpu %u (apic %u) did not come up\n", cpu, processors[cpu].apic_id);
+        }
+    }
+    printk("smp: %u of %u cpus online, %s start\n", smp_online_count, smp_cpu_count,
+           broadcast ? "broadcast" : "unicast");
+    return smp_online_count;
+}
+
+/**
+ * @brief C entry of an AP, called by the trampoline on the kernel tables and its own stack.
+ */
+__attribute__((noreturn))
+void ap_main(void) {
+    fpu_cpu_init();                                                                 /* XCR0 before the AVX2 string variants run */
+    percpu_cpu_init();
+    paging_cpu_init();
+    if (tss_cpu_init() < 0) {
+        printk("smp: no IST stacks for cpu %u\n", smp_processor_id());
+    }
+    address_space_cpu_init();
+    apic_cpu_init();
+    clock_cpu_init();
+    ap_online_tsc[smp_processor_id()] = rdtsc();
+    sched_cpu_init();                                                               /* before others may place threads here */
+    smp_cpu_online();
+    timer_cpu_idle();                                                               /* nothing to run, hand timers to busy CPUs */
+
+    sched_idle();
+}
@@ -0,0 +1,76 @@
+#include <stdint.h>
+
+#include <mm/pmm.h>
+#include <spinlock.h>
+
+#include <arch/paging.h>
+#include <arch/stack.h>
+
+static struct spinlock stack_lock = SPINLOCK_INIT;
+static uint64_t stack_next = PAGING_STACK_BASE;                                     /* bottom of the next unused slot */
+static uint64_t stack_free_tops[STACK_MAX_ORDER + 1];                               /* freed stacks, linked through their top word */
+
+/**
+ * @brief Allocates a kernel stack of `PAGE_SIZE << order` bytes in the stack window. It sits
+ *        at the top of a `STACK_SLOT_SIZE` slot whose rest is never mapped, so an overflow
+ *        faults on the guard instead of overwriting whatever lies below.
+ *
+ * @return The top of the stack, or 0 if `order` is too large or memory is exhausted.
+ */
+uint64_t stack_alloc(uint32_t order) {
+    uint64_t top, slot, phys, size = PAGE_SIZE << order, flags;
+
+    if (order > STACK_MAX_ORDER) {
+        return 0;
+    }
+
+    spin_lock_irqsave(&stack_lock, flags);
+    top = stack_free_tops[order];
+    if (top != 0) {
+        stack_free_tops[order] = ((uint64_t *)top)[-1];
+        spin_unlock_irqrestore(&stack_lock, flags);
+        return top;
+    }
+    slot = stack_next;
+    if (slot + STACK_SLOT_SIZE > PAGING_STACK_BASE + PAGING_STACK_SIZE) {
+        spin_unlock_irqrestore(&stack_lock, flags);
+        return 0;
+    }
+    stack_next += STACK_SLOT_SIZE;
+    spin_unlock_irqrestore(&stack_lock, flags);
+
+    phys = pmm_alloc(order);
+    if (phys == 0) {
+        return 0;                                                                   /* the slot is lost, there are plenty */
+    }
+    top = slot + STACK_SLOT_SIZE;
+    if (paging_map(kernel_pml4, top - size, phys, size, PTE_WRITE | PTE_NO_EXECUTE | PTE_GLOBAL, PAGING_SIZE_4K) < 0) {
+        pmm_free(phys, order);
+        return 0;
+    }
+    return top;
+}
+
+/**
+ * @brief Returns a stack from `stack_alloc()`. It stays mapped and is handed out again for
+ *        the same order, so no TLB shootdown is needed.
+ */
+void stack_free(uint64_t top, uint32_t order) {
+    uint64_t flags;
+
+    spin_lock_irqsave(&stack_lock, flags);
+    ((uint64_t *)top)[-1] = stack_free_tops[order];
+    stack_free_tops[order] = top;
+    spin_unlock_irqrestore(&stack_lock, flags);
+}
+
+/**
+ * @brief Tells whether `address` is in the guard of a stack slot, which makes a fault there
+ *        a stack overflow.
+ */
+int stack_is_guard(uint64_t address) {
+    if (address < PAGING_STACK_BASE || address >= __atomic_load_n(&stack_next, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    return paging_translate(kernel_pml4, address) == PAGING_INVALID_ADDRESS;
+}
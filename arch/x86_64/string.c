@@ -0,0 +1,182 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <printk.h>
+#include <mm/pmm.h>
+
+#include <arch/cpu.h>
+#include <arch/paging.h>
+#include <arch/string.h>
+#include <arch/tsc.h>
+
+void *(*string_memcpy)(void *dst, const void *src, size_t size) = memcpy_sse2;
+void *(*string_memset)(void *dst, int value, size_t size) = memset_sse2;
+int (*string_memcmp)(const void *a, const void *b, size_t size) = memcmp_sse2;
+uint64_t string_rep_threshold = ~0ULL;
+
+static int string_has_erms = 0;
+static int string_has_avx2 = 0;
+
+/**
+ * @brief Picks the variants from CPUID: AVX2 when the CPU has it and XCR0 enables the YMM
+ *        state, SSE2 otherwise, both handing large blocks to `rep movsb` and `rep stosb` if
+ *        the CPU has ERMS. Runs once on the boot CPU; the APs share its features.
+ */
+void string_init(void) {
+    uint32_t eax, ebx, ecx, edx, max_leaf;
+    int avx = 0, fsrm = 0;
+
+    cpuid(0, 0, max_leaf, ebx, ecx, edx);
+    cpuid(CPUID_FEATURES, 0, eax, ebx, ecx, edx);
+    if ((ecx & CPUID_FEATURES_ECX_OSXSAVE) && (ecx & CPUID_FEATURES_ECX_AVX)) {
+        avx = (xgetbv(0) & (XCR0_SSE | XCR0_AVX)) == (XCR0_SSE | XCR0_AVX);        /* else AVX instructions fault with #UD */
+    }
+    if (max_leaf >= CPUID_STRUCTURED_FEATURES) {
+        cpuid(CPUID_STRUCTURED_FEATURES, 0, eax, ebx, ecx, edx);
+        string_has_erms = !!(ebx & CPUID_STRUCTURED_EBX_ERMS);
+        string_has_avx2 = avx && (ebx & CPUID_STRUCTURED_EBX_AVX2);
+        fsrm = !!(edx & CPUID_STRUCTURED_EDX_FSRM);
+    }
+
+    if (string_has_erms) {
+        string_rep_threshold = STRING_REP_THRESHOLD;
+    }
+    if (string_has_avx2) {
+        string_memcpy = memcpy_avx2;
+        string_memset = memset_avx2;
+        string_memcmp = memcmp_avx2;
+    }
+    printk("string: %s, %s%s\n", string_has_avx2 ? "avx2" : "sse2",
+           string_has_erms ? "erms" : "no erms", fsrm ? ", fsrm" : "");
+}
+
+#if defined(NICKEL_BENCH)
+#define STRING_BENCH_ORDER              9                                           /* 2MB per buffer */
+#define STRING_BENCH_BYTES              (16UL << 20)                                /* per measurement */
+#define STRING_BENCH_SIZES              6
+#define STRING_BENCH_LABEL              26                                          /* width of the variant column */
+
+enum string_bench_op {
+    STRING_BENCH_MEMCPY,
+    STRING_BENCH_MEMSET,
+    STRING_BENCH_MEMCMP,
+};
+
+/**
+ * @brief A variant as the benchmark runs it. SSE2 and AVX2 are measured without handing off
+ *        to `rep`, so the table shows where `STRING_REP_THRESHOLD` should lie.
+ */
+struct string_bench_variant {
+    const char *name;
+    void *(*copy)(void *dst, const void *src, size_t size);
+    void *(*set)(void *dst, int value, size_t size);
+    int (*compare)(const void *a, const void *b, size_t size);
+    const int *usable;
+};
+
+static const int string_bench_always = 1;
+
+static const struct string_bench_variant string_bench_variants[] = {
+    { "generic", memcpy_generic, memset_generic, memcmp_generic, &string_bench_always },
+    { "erms", memcpy_erms, memset_erms, NULL, &string_has_erms },
+    { "sse2", memcpy_sse2, memset_sse2, memcmp_sse2, &string_bench_always },
+    { "avx2", memcpy_avx2, memset_avx2, memcmp_avx2, &string_has_avx2 },
+};
+
+static const uint64_t string_bench_sizes[STRING_BENCH_SIZES] = { 64, 256, 1024, 4096, 65536, 1UL << 20 };
+static const char *const string_bench_labels[STRING_BENCH_SIZES] = { "64", "256", "1K", "4K", "64K", "1M" };
+static const char *const string_bench_names[] = { "memcpy", "memset", "memcmp" };
+
+static volatile uint64_t string_bench_sink;
+
+/**
+ * @brief Runs `op` of `variant` on `size` bytes until `STRING_BENCH_BYTES` are processed.
+ *
+ * @return The bandwidth in hundredths of GB/s.
+ */
+static uint64_t string_bench_run(const struct string_bench_variant *variant, enum string_bench_op op, uint8_t *dst,
+                                 const uint8_t *src, uint64_t size) {
+    uint64_t rounds = STRING_BENCH_BYTES / size, i, start, ns;
+
+    start = rdtsc();
+    for (i = 0; i < rounds; ++i) {
+        switch (op) {
+        case STRING_BENCH_MEMCPY:
+            variant->copy(dst, src, size);
+            break;
+        case STRING_BENCH_MEMSET:
+            variant->set(dst, (int)i, size);
+            break;
+        default:
+            string_bench_sink += variant->compare(dst, src, size);
+            break;
+        }
+    }
+    ns = tsc_to_ns(rdtsc() - start);
+    return rounds * size * 100 / (ns ? ns : 1);
+}
+
+/**
+ * @brief Measures every variant the CPU can run at sizes from a cache line to beyond the L2
+ *        and prints the bandwidth in GB/s.
+ */
+void string_bench(void) {
+    const struct string_bench_variant *variant;
+    uint64_t src_phys, dst_phys, threshold = string_rep_threshold, rate;
+    char line[PRINTK_BUFFER_SIZE];
+    uint32_t op, v, s;
+    uint8_t *src, *dst;
+    int length;
+
+    src_phys = pmm_alloc(STRING_BENCH_ORDER);
+    dst_phys = pmm_alloc(STRING_BENCH_ORDER);
+    if (src_phys == 0 || dst_phys == 0) {
+        printk("string: no memory for the benchmark\n");
+        goto out;
+    }
+    src = phys_to_virt(src_phys);
+    dst = phys_to_virt(dst_phys);
+    for (s = 0; s < (PAGE_SIZE << STRING_BENCH_ORDER); ++s) {
+        src[s] = (uint8_t)(s * 7);
+    }
+
+    string_rep_threshold = ~0ULL;
+    for (op = STRING_BENCH_MEMCPY; op <= STRING_BENCH_MEMCMP; ++op) {
+        if (op == STRING_BENCH_MEMCMP) {
+            memcpy(dst, src, PAGE_SIZE << STRING_BENCH_ORDER);                      /* equal buffers, so it scans all of them */
+        }
+
+        length = snprintf(line, sizeof(line), "string: %s GB/s", string_bench_names[op]);
+        while (length < STRING_BENCH_LABEL) {
+            line[length++] = ' ';
+        }
+        for (s = 0; s < STRING_BENCH_SIZES; ++s) {
+            length += snprintf(line + length, sizeof(line) - length, "%8s", string_bench_labels[s]);
+        }
+        printk("%s\n", line);
+        for (v = 0; v < sizeof(string_bench_variants) / sizeof(string_bench_variants[0]); ++v) {
+            variant = &string_bench_variants[v];
+            if (!*variant->usable || (op == STRING_BENCH_MEMCMP && variant->compare == NULL)) {
+                continue;
+            }
+
+            length = snprintf(line, sizeof(line), "string:   %-16s", variant->name);
+            for (s = 0; s < STRING_BENCH_SIZES; ++s) {
+                rate = string_bench_run(variant, op, dst, src, string_bench_sizes[s]);
+                length += snprintf(line + length, sizeof(line) - length, " %4lu.%02lu", rate / 100, rate % 100);
+            }
+            printk("%s\n", line);
+        }
+    }
+    string_rep_threshold = threshold;
+
+out:
+    if (src_phys != 0) {
+        pmm_free(src_phys, STRING_BENCH_ORDER);
+    }
+    if (dst_phys != 0) {
+        pmm_free(dst_phys, STRING_BENCH_ORDER);
+    }
+}
+#endif
@@ -0,0 +1,42 @@
+.code64
+.text
+
+// void arch_context_switch(uint64_t *prev_sp, uint64_t next_sp)
+// Saves the callee-saved registers of the caller on its stack, stores the stack pointer in
+// `*prev_sp` and resumes the context saved at `next_sp`. Everything else is either clobbered
+// by the call anyway or, for interrupted threads, saved by the interrupt stub.
+.globl arch_context_switch
+arch_context_switch:
+    pushq %rbp
+    pushq %rbx
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %rbx
+    popq %rbp
+    ret
+
+// First context of a new thread, see `arch_thread_stack_init()`. %r12 holds the thread.
+.globl arch_thread_start
+arch_thread_start:
+    movq %r12, %rdi
+    call sched_thread_start
+    ud2
+
+// void arch_call_on_stack(uint64_t top, void (*fn)(void *arg), void *arg)
+// Abandons the current stack and calls `fn(arg)` on the one ending at `top`. `fn` must not
+// return.
+.globl arch_call_on_stack
+arch_call_on_stack:
+    movq %rdi, %rsp
+    xorl %ebp, %ebp
+    movq %rdx, %rdi
+    call *%rsi
+    ud2
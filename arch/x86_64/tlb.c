@@ -0,0 +1,318 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include <acpi.h>
+#include <mm/pmm.h>
+#include <printk.h>
+#include <smp.h>
+#include <spinlock.h>
+
+#include <arch/address_space.h>
+#include <arch/cpu.h>
+#include <arch/default_idt.h>
+#include <arch/paging.h>
+#include <arch/tlb.h>
+#include <arch/tsc.h>
+#include <arch/apic/apic.h>
+#include <arch/apic/ipi.h>
+
+/**
+ * @brief A range queued for one target CPU. `pending` lives on the initiator's stack and is
+ *        decremented once the target is done with the range.
+ */
+struct tlb_entry {
+    struct address_space *space;                                                    /* `NULL` for kernel mappings */
+    uint64_t start;
+    uint64_t end;
+    uint64_t generation;                                                            /* `tlb_generation` of the shootdown */
+    volatile uint32_t *pending;
+};
+
+struct tlb_queue {
+    struct spinlock lock;
+    uint32_t count;
+    struct tlb_entry entries[TLB_QUEUE_SIZE];
+} __cacheline_aligned;
+
+extern void tlb_shootdown_entry(void);
+
+static struct tlb_queue tlb_queues[SMP_MAX_CPUS];
+static uint64_t tlb_shootdowns = 0, tlb_broadcasts = 0;
+
+/**
+ * @brief Drops every TLB entry of every ASID, global ones included.
+ */
+static void tlb_flush_global(void) {
+    uint64_t cr4;
+
+    if (invpcid_supported) {
+        invpcid(INVPCID_ALL, 0, 0);
+    } else {
+        cr4 = read_cr4();
+        write_cr4(cr4 & ~CR4_PGE);
+        write_cr4(cr4);
+    }
+}
+
+static void tlb_flush_local(const struct tlb_entry *entry) {
+    uint64_t address, cpu = smp_processor_id();
+
+    if (entry->space != NULL && entry->space != address_space_current()) {
+        return;                                                                     /* switching back in catches up through the generation */
+    }
+
+    if (((entry->end - entry->start) >> PAGE_SHIFT) > TLB_FLUSH_THRESHOLD) {
+        if (entry->space == NULL) {
+            tlb_flush_global();
+        } else {
+            address_space_flush_local();
+        }
+    } else {
+        for (address = entry->start; address < entry->end; address += PAGE_SIZE) {
+            paging_invalidate(address);                                             /* covers global entries under any ASID */
+        }
+    }
+
+    if (entry->space != NULL && entry->space->flushed[cpu] < entry->generation) {
+        entry->space->flushed[cpu] = entry->generation;
+    }
+}
+
+/**
+ * @brief Services the shootdown ranges queued for the calling CPU. Called from the IPI handler
+ *        and by initiators while they wait, so that two CPUs shooting down at each other with
+ *        interrupts off cannot deadlock.
+ */
+void tlb_process_queue(void) {
+    struct tlb_queue *queue = &tlb_queues[smp_processor_id()];
+    struct tlb_entry entries[TLB_QUEUE_SIZE];
+    uint32_t i, count;
+
+    if (__atomic_load_n(&queue->count, __ATOMIC_ACQUIRE) == 0) {
+        return;
+    }
+
+    spin_lock(&queue->lock);                                                        /* interrupts are off in both callers */
+    count = queue->count;
+    for (i = 0; i < count; ++i) {
+        entries[i] = queue->entries[i];
+    }
+    queue->count = 0;
+    spin_unlock(&queue->lock);
+
+    for (i = 0; i < count; ++i) {
+        tlb_flush_local(&entries[i]);
+        __atomic_fetch_sub(entries[i].pending, 1, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * @brief Handler of `APIC_VECTOR_TLB_SHOOTDOWN`, entered through `tlb_shootdown_entry`.
+ */
+void tlb_shootdown_interrupt(void) {
+    tlb_process_queue();
+    apic_eoi();
+}
+
+/**
+ * @brief Installs the shootdown IPI handler. Must run after `apic_init()`.
+ */
+void tlb_init(void) {
+    uint32_t cpu;
+
+    for (cpu = 0; cpu < SMP_MAX_CPUS; ++cpu) {
+        tlb_queues[cpu].lock = (struct spinlock)SPINLOCK_INIT;
+        tlb_queues[cpu].count = 0;
+    }
+    idt_set_gate(APIC_VECTOR_TLB_SHOOTDOWN, tlb_shootdown_entry);
+}
+
+static void tlb_queue_push(uint32_t cpu, const struct tlb_entry *entry) {
+    struct tlb_queue *queue = &tlb_queues[cpu];
+
+    while (1) {
+        spin_lock(&queue->lock);
+        if (queue->count < TLB_QUEUE_SIZE) {
+            queue->entries[queue->count++] = *entry;
+            spin_unlock(&queue->lock);
+            return;
+        }
+        spin_unlock(&queue->lock);
+
+        tlb_process_queue();                                                        /* the target may be waiting on us */
+        cpu_relax();
+    }
+}
+
+/**
+ * @brief Invalidates `[start, end)` of `space` on every CPU that has it loaded, the caller
+ *        included, and returns once all of them did. Ranges above `TLB_FLUSH_THRESHOLD` pages
+ *        flush the whole space instead. Callers update the page tables first.
+ *
+ * @param space The address space, or `NULL` for kernel mappings, which are global and are
+ *        invalidated on every online CPU.
+ */
+void tlb_flush_range(struct address_space *space, uint64_t start, uint64_t end) {
+    struct tlb_entry entry;
+    struct cpumask targets;
+    volatile uint32_t pending = 0;
+    uint32_t cpu, self, count = 0, i;
+    uint64_t flags;
+
+    if (space == &kernel_address_space) {
+        space = NULL;                                                               /* the kernel half is shared by every space */
+    }
+
+    entry.space = space;
+    entry.start = start & PAGE_MASK;
+    entry.end = (end + PAGE_SIZE - 1) & PAGE_MASK;
+    entry.generation = space ? __atomic_add_fetch(&space->tlb_generation, 1, __ATOMIC_SEQ_CST) : 0;
+    entry.pending = &pending;
+
+    flags = arch_irq_save();
+    self = smp_processor_id();
+    tlb_flush_local(&entry);
+
+    for (i = 0; i < SMP_MAX_CPUS / 64; ++i) {
+        targets.bits[i] = 0;
+    }
+    for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+        if (cpu == self) {
+            continue;
+        } else if (!cpumask_test(space ? &space->active : &smp_online_mask, cpu)) {
+            continue;
+        }
+
+        __atomic_fetch_add(&pending, 1, __ATOMIC_RELAXED);
+        tlb_queue_push(cpu, &entry);
+        targets.bits[cpu / 64] |= 1ULL << (cpu % 64);
+        ++count;
+    }
+
+    if (count > 0) {
+        ++tlb_shootdowns;
+        if (count * 2 > smp_online_count) {                                         /* one ICR write beats one per target */
+            ++tlb_broadcasts;
+            apic_send_ipi_all_but_self(APIC_VECTOR_TLB_SHOOTDOWN);
+        } else {
+            for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+                if (cpumask_test(&targets, cpu)) {
+                    apic_send_ipi(processors[cpu].apic_id, APIC_VECTOR_TLB_SHOOTDOWN);
+                }
+            }
+        }
+
+        while (__atomic_load_n(&pending, __ATOMIC_ACQUIRE) != 0) {
+            tlb_process_queue();
+            cpu_relax();
+        }
+    }
+    arch_irq_restore(flags);
+}
+
+#if defined(NICKEL_BENCH)
+#define TLB_BENCH_BASE                  0x0000008000000000ULL                       /* PML4 slot 1, not used by the kernel */
+#define TLB_BENCH_MAX_CPUS              8
+#define TLB_BENCH_ROUNDS                1000
+#define TLB_BENCH_SMALL_PAGES           4
+#define TLB_BENCH_LARGE_PAGES           64
+
+static struct {
+    struct address_space *space;
+    uint32_t initiator;
+    uint32_t cpus;
+    volatile uint32_t ready;
+    volatile uint32_t stop;
+    uint64_t frames[TLB_BENCH_LARGE_PAGES];
+} tlb_bench_state;
+
+/**
+ * @brief Maps and unmaps `pages` pages `TLB_BENCH_ROUNDS` times and gets the average cost of
+ *        the unmap and its shootdown in nanoseconds.
+ */
+static uint64_t tlb_bench_unmap(uint32_t pages) {
+    uint64_t start, cycles = 0;
+    uint32_t round, i;
+
+    for (round = 0; round < TLB_BENCH_ROUNDS; ++round) {
+        for (i = 0; i < pages; ++i) {
+            if (paging_map(tlb_bench_state.space->pml4, TLB_BENCH_BASE + i * PAGE_SIZE, tlb_bench_state.frames[i],
+                           PAGE_SIZE, PTE_WRITE | PTE_NO_EXECUTE, PAGING_SIZE_4K) < 0) {
+                return 0;
+            }
+            (void)*(volatile uint64_t *)(TLB_BENCH_BASE + i * PAGE_SIZE);             /* fills the local TLB */
+        }
+
+        start = rdtsc();
+        address_space_unmap(tlb_bench_state.space, TLB_BENCH_BASE, pages * PAGE_SIZE);
+        cycles += rdtsc() - start;
+    }
+    return tsc_to_ns(cycles) / TLB_BENCH_ROUNDS;
+}
+
+static void tlb_bench_cpu(void *arg) {
+    uint64_t flags, small, large, broadcasts;
+
+    address_space_switch(tlb_bench_state.space);
+    if (smp_processor_id() != tlb_bench_state.initiator) {
+        flags = arch_irq_save();
+        arch_irq_enable();                                                          /* takes the shootdown IPIs while it waits */
+        __atomic_fetch_add(&tlb_bench_state.ready, 1, __ATOMIC_RELEASE);
+        while (!__atomic_load_n(&tlb_bench_state.stop, __ATOMIC_ACQUIRE)) {
+            cpu_relax();
+        }
+        arch_irq_disable();
+        arch_irq_restore(flags);
+        address_space_switch(&kernel_address_space);
+        return;
+    }
+
+    while (__atomic_load_n(&tlb_bench_state.ready, __ATOMIC_ACQUIRE) != tlb_bench_state.cpus - 1) {
+        cpu_relax();
+    }
+
+    broadcasts = tlb_broadcasts;
+    small = tlb_bench_unmap(TLB_BENCH_SMALL_PAGES);
+    large = tlb_bench_unmap(TLB_BENCH_LARGE_PAGES);
+    printk("tlb: %4u %14lu %14lu %9s\n", tlb_bench_state.cpus, small, large,
+           tlb_bench_state.cpus == 1 ? "-" : tlb_broadcasts != broadcasts ? "broadcast" : "unicast");
+
+    __atomic_store_n(&tlb_bench_state.stop, 1, __ATOMIC_RELEASE);
+    address_space_switch(&kernel_address_space);
+}
+
+/**
+ * @brief Measures munmap-style shootdowns of a small and a large range with the address space
+ *        loaded on 1 to 8 CPUs.
+ */
+void tlb_bench(void) {
+    uint32_t i, cpus, allocated = 0;
+
+    tlb_bench_state.space = address_space_create();
+    for (i = 0; i < TLB_BENCH_LARGE_PAGES && tlb_bench_state.space != NULL; ++i, ++allocated) {
+        if ((tlb_bench_state.frames[i] = pmm_alloc(0)) == 0) {
+            break;
+        }
+    }
+    if (allocated != TLB_BENCH_LARGE_PAGES) {
+        printk("tlb: bench setup failed\n");
+        goto out;
+    }
+
+    printk("tlb: bench %u rounds, threshold %u pages\n", TLB_BENCH_ROUNDS, TLB_FLUSH_THRESHOLD);
+    printk("tlb: cpus %5u pages(ns) %5u pages(ns)       ipi\n", TLB_BENCH_SMALL_PAGES, TLB_BENCH_LARGE_PAGES);
+    for (cpus = 1; cpus <= TLB_BENCH_MAX_CPUS && cpus <= smp_online_count; ++cpus) {
+        tlb_bench_state.initiator = smp_processor_id();
+        tlb_bench_state.cpus = cpus;
+        tlb_bench_state.ready = 0;
+        tlb_bench_state.stop = 0;
+        smp_run_on_cpus(tlb_bench_cpu, NULL, cpus);
+    }
+
+out:
+    for (i = 0; i < allocated; ++i) {
+        pmm_free(tlb_bench_state.frames[i], 0);
+    }
+    address_space_destroy(tlb_bench_state.space);
+}
+#endif
@@ -0,0 +1,60 @@
+#include <arch/cpu.h>
+#include <arch/io.h>
+#include <arch/tsc.h>
+
+uint64_t tsc_frequency = 0;
+
+/**
+ * @brief Measures the TSC frequency against channel 2 of the PIT, which is free-running and
+ *        does not need an interrupt.
+ * 
+ * @return The measured frequency in Hz.
+ */
+uint64_t tsc_init(void) {
+    uint64_t start, end, flags;
+    uint16_t latch = PIT_FREQUENCY / (1000 / TSC_CALIBRATE_MS);
+    uint8_t gate;
+
+    flags = arch_irq_save();
+
+    gate = inb(PIT_PORT_GATE);
+    outb(PIT_PORT_GATE, (gate & ~PIT_GATE_SPEAKER) | PIT_GATE_CHANNEL2);            /* raise the gate, keep speaker silent */
+
+    outb(PIT_PORT_COMMAND, PIT_COMMAND_CHANNEL2_ONESHOT);
+    outb(PIT_PORT_CHANNEL2, latch & 0xFF);
+    outb(PIT_PORT_CHANNEL2, latch >> 8);                                            /* counting starts after the high byte */
+
+    start = rdtsc();
+    while (!(inb(PIT_PORT_GATE) & PIT_GATE_OUTPUT2)) {                              /* OUT2 goes high at terminal count */
+        cpu_relax();
+    }
+    end = rdtsc();
+
+    outb(PIT_PORT_GATE, gate);
+    arch_irq_restore(flags);
+
+    tsc_frequency = (end - start) * (1000 / TSC_CALIBRATE_MS);
+    return tsc_frequency;
+}
+
+/**
+ * @brief Converts a TSC delta into nanoseconds.
+ */
+uint64_t tsc_to_ns(uint64_t cycles) {
+    if (tsc_frequency == 0) {
+        return 0;
+    }
+    return (cycles / tsc_frequency) * 1000000000ULL                                 /* split to avoid overflowing 64 bits */
+           + (cycles % tsc_frequency) * 1000000000ULL / tsc_frequency;
+}
+
+/**
+ * @brief Spins for at least `us` microseconds.
+ */
+void tsc_delay_us(uint64_t us) {
+    uint64_t start = rdtsc(), cycles = tsc_frequency / 1000000 * us;
+
+    while (rdtsc() - start < cycles) {
+        cpu_relax();
+    }
+}
@@ -0,0 +1,75 @@
+#include <stdint.h>
+
+#include <smp.h>
+
+#include <arch/default_idt.h>
+#include <arch/flat_gdt.h>
+#include <arch/interrupt.h>
+#include <arch/stack.h>
+#include <arch/tss.h>
+
+static union tss tss_entries[SMP_MAX_CPUS];
+
+/**
+ * @brief Routes #DF, NMI, #MC and #DB to their IST stacks and loads the TSS of the boot CPU.
+ *        These can hit at any point, also on an overflowed stack, so they never run on the
+ *        interrupted one. Must run after `smp_init()` and `pmm_init()`.
+ *
+ * @return `TSS_SUCCESS` on success, `TSS_NO_MEMORY` if the IST stacks cannot be allocated.
+ */
+int32_t tss_init(void) {
+    int32_t ret;
+
+    ret = tss_cpu_init();
+    if (ret < 0) {
+        return ret;
+    }
+    idt_set_ist(EXCEPTION_DOUBLE_FAULT, TSS_IST_DOUBLE_FAULT);                      /* only after a TSS holding the stacks is loaded */
+    idt_set_ist(EXCEPTION_NMI, TSS_IST_NMI);
+    idt_set_ist(EXCEPTION_MACHINE_CHECK, TSS_IST_MACHINE_CHECK);
+    idt_set_ist(EXCEPTION_DEBUG, TSS_IST_DEBUG);
+    return TSS_SUCCESS;
+}
+
+/**
+ * @brief Allocates the IST stacks of the calling CPU, installs its TSS descriptor and loads
+ *        the task register.
+ *
+ * @return `TSS_SUCCESS` on success, `TSS_NO_MEMORY` if the IST stacks cannot be allocated.
+ */
+int32_t tss_cpu_init(void) {
+    uint32_t cpu = smp_processor_id(), i;
+    union tss *tss = &tss_entries[cpu];
+    uint64_t base = (uint64_t)tss, top;
+
+    for (i = 0; i < TSS_IST_STACKS; ++i) {
+        if (tss->ist[i] != 0) {
+            continue;
+        }
+        top = stack_alloc(TSS_IST_STACK_ORDER);
+        if (top == 0) {
+            return TSS_NO_MEMORY;
+        }
+        tss->ist[i] = top;
+    }
+    tss->io_map_base = sizeof(union tss);                                           /* beyond the limit, so no I/O bitmap */
+
+    gdt_entries[GDT_TSS_FIRST + cpu] = (union gdt_entry) {
+        .limit_15_00 = sizeof(union tss) - 1,
+        .base_15_00 = (uint16_t)base,
+        .base_23_16 = (uint8_t)(base >> 16),
+        .access_mode = 0x9,                                                         /* available 64-bit TSS */
+        .not_sys_seg = 0,
+        .dpl = 0,
+        .present = 1,
+        .limit_19_16 = 0,
+        .granularity = 0,
+        .size = 0,
+        .long_mode = 0,
+        .base_31_24 = (uint8_t)(base >> 24),
+        .base_63_32 = (uint32_t)(base >> 32),
+        .reserved = 0
+    };
+    asm volatile ("ltr %w0\n" : : "r"((uint16_t)GDT_TSS_SELECTOR(cpu)) : "memory");
+    return TSS_SUCCESS;
+}
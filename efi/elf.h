@@ -0,0 +1,57 @@
+#ifndef __NICKEL_EFI_ELF_H__
+#define __NICKEL_EFI_ELF_H__
+
+#include <stdint.h>
+
+#define ELF_MAGIC                       0x464C457F                                  /* "\x7FELF" read as a little-endian word */
+#define ELF_CLASS_64                    2
+#define ELF_DATA_LSB                    1
+#define ELF_TYPE_EXEC                   2
+#define ELF_MACHINE_X86_64              62
+#define ELF_MACHINE_AARCH64             183
+#define ELF_MACHINE_RISCV               243
+
+#define ELF_PT_LOAD                     1
+
+#define ELF_MAX_PROGRAM_HEADERS         16                                          /* the kernel has a handful */
+
+/**
+ * @brief ELF64 file header, as `Elf64_Ehdr`.
+ */
+struct elf64_header {
+    uint32_t magic;
+    uint8_t class;
+    uint8_t data;
+    uint8_t ident_version;
+    uint8_t ident_pad[9];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uint64_t entry;
+    uint64_t program_header_offset;
+    uint64_t section_header_offset;
+    uint32_t flags;
+    uint16_t header_size;
+    uint16_t program_header_size;
+    uint16_t program_header_count;
+    uint16_t section_header_size;
+    uint16_t section_header_count;
+    uint16_t section_name_index;
+} __attribute__((packed));
+
+/**
+ * @brief ELF64 program header, as `Elf64_Phdr`. The kernel is loaded at `physical_address`,
+ *        which differs from `virtual_address` for `.percpu`.
+ */
+struct elf64_program_header {
+    uint32_t type;
+    uint32_t flags;
+    uint64_t offset;
+    uint64_t virtual_address;
+    uint64_t physical_address;
+    uint64_t file_size;
+    uint64_t memory_size;                                                           /* the part above `file_size` is .bss */
+    uint64_t align;
+} __attribute__((packed));
+
+#endif
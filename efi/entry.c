@@ -3,6 +3,9 @@
 
 #include <bootinfo.h>
 
+#include "elf.h"
+#include "lz4.h"
+
 /**
  * @brief Checks if returned status is equal to the supposed status.
  * 
@@ -15,8 +18,17 @@ if (status != target) {                             \
     while (1);                                      \
 }
 
-/* the name of kernel executable in file system */
-#define KERNEL_FILE_NAME L"nickel.exe"
+/* the name of kernel executable in file system, the compressed one is preferred */
+#define KERNEL_COMPRESSED_FILE_NAME L"nickel.lz4"
+#define KERNEL_FILE_NAME L"nickel.elf"
+
+#if defined(NICKEL_X86_64)
+#define KERNEL_ELF_MACHINE ELF_MACHINE_X86_64
+#elif defined(NICKEL_AARCH64)
+#define KERNEL_ELF_MACHINE ELF_MACHINE_AARCH64
+#elif defined(NICKEL_RISCV64)
+#define KERNEL_ELF_MACHINE ELF_MACHINE_RISCV
+#endif
 
 /**
  * @brief Get amount of 4KB pages by size of executable
@@ -24,7 +36,263 @@ if (status != target) {                             \
  * @param size The size of executable
  * @return The amount of 4KB pages
  */
-#define KERNEL_PAGE_COUNT(size) (((size) / EFI_PAGE_SIZE) + 1)
+#define KERNEL_PAGE_COUNT(size) (((size) + EFI_PAGE_SIZE - 1) / EFI_PAGE_SIZE)
+
+/**
+ * @brief The kernel ELF as the loader reads it: straight from the file, or from the pages an
+ *        LZ4 frame was decompressed into.
+ */
+struct kernel_image {
+    EFI_FILE_PROTOCOL *file;
+    UINT8 *buffer;                                                                  /* NULL while reading `file` */
+    UINTN size;
+};
+
+/**
+ * @brief Reads the time stamp counter, so the kernel can tell where boot time went.
+ */
+static UINT64 efi_rdtsc(void) {
+#if defined(NICKEL_X86_64)
+    UINT32 low, high;
+    __asm__ __volatile__ ("rdtsc\n" : "=a"(low), "=d"(high));
+    return ((UINT64)high << 32) | low;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief Records the end of the boot phase `name`, unless the table is full.
+ */
+static VOID boot_stamp(struct nickel_boot_info *info, const char *name) {
+    struct nickel_boot_stamp *stamp;
+    UINTN i;
+
+    if (info->boot_stamp_count >= NICKEL_BOOT_MAX_STAMPS) {
+        return;
+    }
+    stamp = &info->boot_stamps[info->boot_stamp_count++];
+    stamp->tsc = efi_rdtsc();
+    for (i = 0; i + 1 < NICKEL_BOOT_STAMP_NAME && name[i] != '\0'; ++i) {
+        stamp->name[i] = name[i];
+    }
+    stamp->name[i] = '\0';
+}
+
+/**
+ * @brief Finds the linear framebuffer of the current graphics mode, which stays usable after
+ *        `ExitBootServices()`. Leaves `framebuffer_base` at 0 if there is no GOP or the mode
+ *        only supports `Blt()`.
+ */
+static VOID framebuffer_query(EFI_SYSTEM_TABLE *SystemTable, struct nickel_boot_info *info) {
+    EFI_GUID gop_guid = EFI_GRAPHICS_OUTPUT_PROTOCOL_GUID;
+    EFI_GRAPHICS_OUTPUT_PROTOCOL *gop = NULL;
+    EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *mode;
+    EFI_STATUS status;
+
+    info->framebuffer_base = 0;
+    info->framebuffer_format = NICKEL_PIXEL_BLT_ONLY;
+    status = uefi_call_wrapper(SystemTable->BootServices->LocateProtocol, 3, &gop_guid, NULL, (VOID **)&gop);
+    if (EFI_ERROR(status) || gop == NULL || gop->Mode == NULL || gop->Mode->Info == NULL) {
+        return;                                                                     /* headless, the serial port is all there is */
+    }
+
+    mode = gop->Mode->Info;
+    if (mode->PixelFormat >= PixelBltOnly) {
+        return;
+    }
+    info->framebuffer_base = gop->Mode->FrameBufferBase;
+    info->framebuffer_size = gop->Mode->FrameBufferSize;
+    info->framebuffer_width = mode->HorizontalResolution;
+    info->framebuffer_height = mode->VerticalResolution;
+    info->framebuffer_stride = mode->PixelsPerScanLine;
+    info->framebuffer_format = (UINT32)mode->PixelFormat;                           /* `NICKEL_PIXEL_*` share the numbering */
+    info->framebuffer_red_mask = mode->PixelInformation.RedMask;
+    info->framebuffer_green_mask = mode->PixelInformation.GreenMask;
+    info->framebuffer_blue_mask = mode->PixelInformation.BlueMask;
+}
+
+/**
+ * @brief Reads exactly `size` bytes at `offset` of the file.
+ */
+static EFI_STATUS file_read_at(EFI_FILE_PROTOCOL *file, UINT64 offset, VOID *buffer, UINTN size) {
+    EFI_STATUS status;
+    UINTN read = size;
+
+    status = uefi_call_wrapper(file->SetPosition, 2, file, offset);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+    status = uefi_call_wrapper(file->Read, 3, file, &read, buffer);
+    if (!EFI_ERROR(status) && read != size) {
+        status = EFI_LOAD_ERROR;                                                    /* truncated */
+    }
+    return status;
+}
+
+/**
+ * @brief Reads `size` bytes at `offset` of the kernel ELF.
+ */
+static EFI_STATUS kernel_read(struct kernel_image *image, UINT64 offset, VOID *buffer, UINTN size) {
+    if (image->buffer == NULL) {
+        return file_read_at(image->file, offset, buffer, size);
+    } else if (offset > image->size || size > image->size - offset) {
+        return EFI_LOAD_ERROR;
+    }
+    CopyMem(buffer, image->buffer + offset, size);
+    return EFI_SUCCESS;
+}
+
+/**
+ * @brief Reads an LZ4 frame one block at a time and decompresses each block as soon as it is
+ *        in, so the next read starts right away instead of after the whole file. The frame
+ *        must record its content size (`lz4 --content-size`).
+ */
+static EFI_STATUS kernel_decompress(EFI_SYSTEM_TABLE *SystemTable, EFI_FILE_PROTOCOL *file, struct kernel_image *image) {
+    EFI_STATUS status;
+    EFI_PHYSICAL_ADDRESS pages = 0;
+    struct lz4_frame frame;
+    UINT8 header[LZ4_FRAME_HEADER_MAX], *block = NULL;
+    UINT64 position, offset = 0;
+    UINT32 block_size;
+    INT64 produced;
+    UINTN size = sizeof(header);
+
+    status = uefi_call_wrapper(file->Read, 3, file, &size, header);
+    if (EFI_ERROR(status)) {
+        return status;
+    } else if (lz4_parse_frame(header, size, &frame) != LZ4_SUCCESS || frame.content_size == 0) {
+        return EFI_LOAD_ERROR;
+    }
+
+    status = uefi_call_wrapper(SystemTable->BootServices->AllocatePages, 4,
+                               AllocateAnyPages, EfiLoaderData, KERNEL_PAGE_COUNT(frame.content_size), &pages);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+    status = uefi_call_wrapper(SystemTable->BootServices->AllocatePool, 3,
+                               EfiLoaderData, frame.block_max_size, (VOID **)&block);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    position = frame.header_size;
+    while (1) {
+        status = file_read_at(file, position, &block_size, sizeof(block_size));
+        if (EFI_ERROR(status) || block_size == 0) {
+            break;                                                                  /* the end mark */
+        }
+        position += sizeof(block_size);
+
+        size = block_size & ~LZ4_BLOCK_UNCOMPRESSED;
+        if (size > frame.block_max_size) {
+            status = EFI_LOAD_ERROR;
+            break;
+        }
+        status = file_read_at(file, position, block, size);
+        if (EFI_ERROR(status)) {
+            break;
+        }
+        position += size + (frame.block_checksum ? 4 : 0);                          /* checksums are not verified */
+
+        if (block_size & LZ4_BLOCK_UNCOMPRESSED) {
+            produced = size <= frame.content_size - offset ? (INT64)size : -1;
+            if (produced >= 0) {
+                CopyMem((UINT8 *)pages + offset, block, size);
+            }
+        } else {
+            produced = lz4_decompress_block(block, size, (UINT8 *)pages, offset, frame.content_size);
+        }
+        if (produced < 0) {
+            status = EFI_LOAD_ERROR;
+            break;
+        }
+        offset += produced;
+    }
+
+    uefi_call_wrapper(SystemTable->BootServices->FreePool, 1, block);
+    if (!EFI_ERROR(status) && offset != frame.content_size) {
+        status = EFI_LOAD_ERROR;
+    }
+    image->buffer = (UINT8 *)pages;
+    image->size = offset;
+    return status;
+}
+
+/**
+ * @brief Checks the ELF header, allocates the pages all PT_LOAD segments cover at their load
+ *        addresses, reads the file part of each segment and zeroes the rest, which is .bss.
+ *
+ * @param base Receives the lowest load address.
+ * @param size Receives the size of the image from `base`, .bss included.
+ * @param entry Receives `e_entry`.
+ */
+static EFI_STATUS kernel_load_elf(EFI_SYSTEM_TABLE *SystemTable, struct kernel_image *image,
+                                  UINT64 *base, UINT64 *size, UINT64 *entry) {
+    EFI_STATUS status;
+    EFI_PHYSICAL_ADDRESS start = ~0ULL, end = 0;
+    struct elf64_header header;
+    struct elf64_program_header segments[ELF_MAX_PROGRAM_HEADERS], *segment;
+    UINTN i;
+
+    status = kernel_read(image, 0, &header, sizeof(header));
+    if (EFI_ERROR(status)) {
+        return status;
+    } else if (header.magic != ELF_MAGIC || header.class != ELF_CLASS_64 || header.data != ELF_DATA_LSB
+               || header.type != ELF_TYPE_EXEC || header.machine != KERNEL_ELF_MACHINE
+               || header.program_header_size != sizeof(*segments)
+               || header.program_header_count > ELF_MAX_PROGRAM_HEADERS) {
+        Print(L"Kernel is not an ELF64 executable for this machine!\n");
+        return EFI_LOAD_ERROR;
+    }
+
+    status = kernel_read(image, header.program_header_offset, segments,
+                         header.program_header_count * sizeof(*segments));
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    for (i = 0; i < header.program_header_count; ++i) {
+        segment = &segments[i];
+        if (segment->type != ELF_PT_LOAD || segment->memory_size == 0) {
+            continue;
+        } else if (segment->file_size > segment->memory_size) {
+            return EFI_LOAD_ERROR;
+        }
+        if (segment->physical_address < start) {
+            start = segment->physical_address & ~(EFI_PAGE_SIZE - 1);
+        }
+        if (segment->physical_address + segment->memory_size > end) {
+            end = segment->physical_address + segment->memory_size;
+        }
+    }
+    if (start >= end) {
+        return EFI_LOAD_ERROR;
+    }
+
+    status = uefi_call_wrapper(SystemTable->BootServices->AllocatePages, 4,
+                               AllocateAddress, EfiLoaderData, KERNEL_PAGE_COUNT(end - start), &start);
+    if (EFI_ERROR(status)) {
+        return status;                                                              /* the linked addresses are taken */
+    }
+
+    ZeroMem((VOID *)start, KERNEL_PAGE_COUNT(end - start) * EFI_PAGE_SIZE);         /* .bss and the padding between segments */
+    for (i = 0; i < header.program_header_count; ++i) {
+        segment = &segments[i];
+        if (segment->type != ELF_PT_LOAD || segment->file_size == 0) {
+            continue;
+        }
+        status = kernel_read(image, segment->offset, (VOID *)segment->physical_address, segment->file_size);
+        if (EFI_ERROR(status)) {
+            return status;
+        }
+    }
+
+    *base = start;
+    *size = KERNEL_PAGE_COUNT(end - start) * EFI_PAGE_SIZE;
+    *entry = header.entry;
+    return EFI_SUCCESS;
+}
 
 /**
  * @brief The entry point of the UEFI bootloader. It is the first snippet of customized
@@ -37,7 +305,9 @@ if (status != target) {                             \
  */
 EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable) {
     EFI_STATUS status = EFI_SUCCESS;
+    struct nickel_boot_info boot_info = { .boot_stamp_count = 0 };
 
+    boot_stamp(&boot_info, "firmware");                                             /* everything since reset */
     InitializeLib(ImageHandle, SystemTable);                                        /* must call this */
                                                
     /* **************************************************
@@ -49,17 +319,21 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable
     status = uefi_call_wrapper(SystemTable->ConOut->ClearScreen, 1, SystemTable->ConOut);
     EFI_CHECK_STATUS(status, EFI_SUCCESS);                                          /* clears the existing brand icon */
 
+    framebuffer_query(SystemTable, &boot_info);                                     /* the kernel console draws here */
+    boot_stamp(&boot_info, "efi setup");
+
     /* **************************************************
      * *         Get Memory Map and Descriptors         *
      * ************************************************** */
     EFI_MEMORY_DESCRIPTOR *memory_map = NULL;
-    UINTN memory_map_size = 0, map_key = 0, valid_map_key = 0, descriptor_size = 0;
+    UINTN memory_map_size = 0, memory_map_capacity = 0, map_key = 0, valid_map_key = 0, descriptor_size = 0;
     UINT32 descriptor_version = 0;
     status = uefi_call_wrapper(SystemTable->BootServices->GetMemoryMap, 5,
                                &memory_map_size, memory_map, &map_key,
                                &descriptor_size, &descriptor_version);
     EFI_CHECK_STATUS(status, EFI_BUFFER_TOO_SMALL);                                 /* must get this, because the first call is for buffer size */
-    memory_map_size += (4 * descriptor_size);
+    memory_map_size += (8 * descriptor_size);                                       /* later allocations may split a few more regions */
+    memory_map_capacity = memory_map_size;
     
     status = uefi_call_wrapper(SystemTable->BootServices->AllocatePool, 3, 
                                EfiLoaderData, memory_map_size, (VOID **)&memory_map);
@@ -69,6 +343,7 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable
                                &memory_map_size, memory_map, &map_key,
                                &descriptor_size, &descriptor_version);
     EFI_CHECK_STATUS(status, EFI_SUCCESS);                                          /* gets the memory map */
+    boot_stamp(&boot_info, "memory map");
 
     // for (UINTN i = 0; i < memory_map_size / descriptor_size; i++) {
     //     EFI_MEMORY_DESCRIPTOR *desc = (EFI_MEMORY_DESCRIPTOR *)((UINT8 *)memory_map + i * descriptor_size);
@@ -95,8 +370,14 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable
     status = uefi_call_wrapper(sfs->OpenVolume, 2, sfs, &root);
     EFI_CHECK_STATUS(status, EFI_SUCCESS);                                          /* file system protocol */
 
+    BOOLEAN compressed = TRUE;
     status = uefi_call_wrapper(root->Open, 5,
-                               root, &kernel, KERNEL_FILE_NAME, EFI_FILE_MODE_READ, 0);
+                               root, &kernel, KERNEL_COMPRESSED_FILE_NAME, EFI_FILE_MODE_READ, 0);
+    if (status == EFI_NOT_FOUND) {
+        compressed = FALSE;
+        status = uefi_call_wrapper(root->Open, 5,
+                                   root, &kernel, KERNEL_FILE_NAME, EFI_FILE_MODE_READ, 0);
+    }
     EFI_CHECK_STATUS(status, EFI_SUCCESS);                                          /* opens the kernel executable file */
 
     status = uefi_call_wrapper(kernel->GetInfo, 4,
@@ -110,15 +391,25 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable
     status = uefi_call_wrapper(kernel->GetInfo, 4,
                                kernel, &gEfiFileInfoGuid, &file_info_size, file_info);
     EFI_CHECK_STATUS(status, EFI_SUCCESS);
+    boot_stamp(&boot_info, "kernel open");
 
-    EFI_PHYSICAL_ADDRESS kernel_addr = KERNEL_ADDRESS;
-    status = uefi_call_wrapper(SystemTable->BootServices->AllocatePages, 4, 
-                               AllocateAddress, EfiLoaderData, KERNEL_PAGE_COUNT(file_info->FileSize), &kernel_addr);
-    EFI_CHECK_STATUS(status, EFI_SUCCESS);                                          /* allocates memory for kernel */
+    struct kernel_image image = { .file = kernel, .buffer = NULL, .size = file_info->FileSize };
+    if (compressed) {
+        status = kernel_decompress(SystemTable, kernel, &image);
+        EFI_CHECK_STATUS(status, EFI_SUCCESS);                                      /* decompresses the ELF while reading it */
+    }
+
+    UINT64 kernel_addr = 0, kernel_size = 0, kernel_entry = 0;
+    status = kernel_load_elf(SystemTable, &image, &kernel_addr, &kernel_size, &kernel_entry);
+    EFI_CHECK_STATUS(status, EFI_SUCCESS);                                          /* places every segment at its load address */
+
+    if (image.buffer != NULL) {
+        status = uefi_call_wrapper(SystemTable->BootServices->FreePages, 2,
+                                   (EFI_PHYSICAL_ADDRESS)image.buffer, KERNEL_PAGE_COUNT(image.size));
+        EFI_CHECK_STATUS(status, EFI_SUCCESS);                                      /* the segments are copied out */
+    }
+    boot_stamp(&boot_info, "kernel read");
 
-    status = uefi_call_wrapper(kernel->Read, 3, kernel, &file_info->FileSize, (VOID *)kernel_addr);
-    EFI_CHECK_STATUS(status, EFI_SUCCESS);                                          /* reads kernel executable to memory */
-    
     status = uefi_call_wrapper(kernel->Close, 1, kernel);
     EFI_CHECK_STATUS(status, EFI_SUCCESS);                                          /* closes the kernel executable file */
 
@@ -126,20 +417,15 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable
     EFI_CHECK_STATUS(status, EFI_SUCCESS);                                          /* closes the root directory */
 
     struct nickel_boot_header *header = (struct nickel_boot_header *)(kernel_addr + NICKEL_HEADER_OFFSET);
-    // Print(L"Kernel Magic: 0x%lx\n", header->magic);
-    // Print(L"Kernel Version: 0x%lx\n", header->kernel_version);
-    // Print(L"Kernel Size: 0x%lx\n", header->kernel_size);
-    // Print(L"Kernel Entry: 0x%lx\n", header->kernel_entry);
     if (header->magic != NICKEL_BOOT_MAGIC || header->kernel_version != NICKEL_VERSION) {
         Print(L"Invalid kernel header!\n");
         while (1);                                                                  /* halt the CPU if the header is invalid */
     }
 
-    struct nickel_boot_info boot_info = {
-        .header = *header,
-        .base_address = kernel_addr,
-        // .acpi_rsdp = boot_info.acpi_xsdp
-    };
+    boot_info.header = *header;
+    boot_info.base_address = kernel_addr;
+    boot_info.header.kernel_size = kernel_size;                                     /* as the segments laid it out */
+    boot_info.header.kernel_entry = kernel_entry;
 
     EFI_GUID gEfiAcpi20TableGuid = ACPI_20_TABLE_GUID;                              /* ACPI 2.0 table GUID */
     for (UINTN i = 0; i < SystemTable->NumberOfTableEntries; i++) {
@@ -150,6 +436,8 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable
         }
     }
 
+    boot_stamp(&boot_info, "boot info");
+
     // Print(L"Boot Info: 0x%lx\n", &boot_info);
     // Print(L"  Kernel Base Address: 0x%lx\n", boot_info.base_address);
     // Print(L"  ACPI RSDP Address: 0x%lx\n", boot_info.acpi_rsdp);
@@ -157,19 +445,27 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable
     /* **************************************************
      * *                Exit EFI Service                *
      * ************************************************** */
+    memory_map_size = memory_map_capacity;                                          /* the previous call shrank it to the old map */
     status = uefi_call_wrapper(SystemTable->BootServices->GetMemoryMap, 5,
         &memory_map_size, memory_map, &map_key,
         &descriptor_size, &descriptor_version);
-    // EFI_CHECK_STATUS(status, EFI_BUFFER_TOO_SMALL);                                 /* get real-time map key to exit boot service*/
+    EFI_CHECK_STATUS(status, EFI_SUCCESS);                                          /* get real-time map key to exit boot service*/
+    boot_stamp(&boot_info, "final map");
+
+    boot_info.memory_map = (UINT64)memory_map;                                      /* no allocation from now on, so the map stays valid */
+    boot_info.memory_map_size = memory_map_size;
+    boot_info.descriptor_size = descriptor_size;
+    boot_info.descriptor_version = descriptor_version;
 
     status = uefi_call_wrapper(SystemTable->BootServices->ExitBootServices, 2, 
                                ImageHandle, map_key);
     EFI_CHECK_STATUS(status, EFI_SUCCESS);                                          /* we can no longer call any UEFI routines */
+    boot_stamp(&boot_info, "exit boot");
 
     /* **************************************************
      * *                 Jump to Kernel                 *
      * ************************************************** */
-    ((void (*)(struct nickel_boot_info *))header->kernel_entry)(&boot_info);        /* jumps to the kernel */
+    ((void (*)(struct nickel_boot_info *))kernel_entry)(&boot_info);                /* jumps to `e_entry` of the kernel */
 
     while (1);                                                                      /* should not reach here */
     return status;
@@ -0,0 +1,118 @@
+#include <stdint.h>
+
+#include "lz4.h"
+
+static inline uint32_t lz4_read32(const uint8_t *src) {
+    return (uint32_t)src[0] | ((uint32_t)src[1] << 8) | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+/**
+ * @brief Parses the frame header at `src`. The header checksum is not verified, the block
+ *        and content checksums are only skipped.
+ *
+ * @param size At least `LZ4_FRAME_HEADER_MIN`; `frame->header_size` tells how much it was.
+ * @return `LZ4_SUCCESS` on success, `LZ4_INVALID_FRAME` otherwise.
+ */
+int32_t lz4_parse_frame(const uint8_t *src, uint64_t size, struct lz4_frame *frame) {
+    uint8_t flags, descriptor;
+    uint32_t position = 6, i;
+
+    if (size < LZ4_FRAME_HEADER_MIN || lz4_read32(src) != LZ4_FRAME_MAGIC) {
+        return LZ4_INVALID_FRAME;
+    }
+
+    flags = src[4];
+    descriptor = src[5];
+    if ((flags & LZ4_FRAME_VERSION_MASK) != LZ4_FRAME_VERSION) {
+        return LZ4_INVALID_FRAME;
+    }
+
+    frame->block_max_size = 1U << (8 + 2 * ((descriptor >> LZ4_BLOCK_MAX_SIZE_SHIFT) & 7)); /* 4 is 64KB, 7 is 4MB */
+    if (frame->block_max_size < (64U << 10)) {
+        return LZ4_INVALID_FRAME;
+    }
+    frame->block_checksum = !!(flags & LZ4_FLAG_BLOCK_CHECKSUM);
+    frame->content_checksum = !!(flags & LZ4_FLAG_CONTENT_CHECKSUM);
+    frame->content_size = 0;
+    if (flags & LZ4_FLAG_CONTENT_SIZE) {
+        if (size < position + 8 + 1) {
+            return LZ4_INVALID_FRAME;
+        }
+        for (i = 0; i < 8; ++i) {
+            frame->content_size |= (uint64_t)src[position + i] << (8 * i);
+        }
+        position += 8;
+    }
+    if (flags & LZ4_FLAG_DICTIONARY_ID) {
+        position += 4;                                                              /* no dictionaries, the kernel is one frame */
+    }
+    frame->header_size = position + 1;                                              /* the header checksum byte */
+    return frame->header_size <= size ? LZ4_SUCCESS : LZ4_INVALID_FRAME;
+}
+
+/**
+ * @brief Decompresses one block to `dst + offset`. Matches may reach back into `dst`, so
+ *        linked blocks work as long as all of them go to the same buffer.
+ *
+ * @param capacity Size of `dst`, including the `offset` bytes of earlier blocks.
+ * @return The number of bytes produced, or `LZ4_CORRUPT_BLOCK` or `LZ4_OUTPUT_OVERFLOW`.
+ */
+int64_t lz4_decompress_block(const uint8_t *src, uint64_t size, uint8_t *dst, uint64_t offset, uint64_t capacity) {
+    const uint8_t *in = src, *in_end = src + size;
+    uint64_t out = offset, length, distance;
+    uint8_t token, byte;
+
+    while (in < in_end) {
+        token = *in++;
+
+        length = token >> 4;                                                        /* literals first */
+        if (length == 15) {
+            do {
+                if (in >= in_end) {
+                    return LZ4_CORRUPT_BLOCK;
+                }
+                byte = *in++;
+                length += byte;
+            } while (byte == 255);
+        }
+        if (length > (uint64_t)(in_end - in)) {
+            return LZ4_CORRUPT_BLOCK;
+        } else if (length > capacity - out) {
+            return LZ4_OUTPUT_OVERFLOW;
+        }
+        for (; length > 0; --length) {
+            dst[out++] = *in++;
+        }
+        if (in == in_end) {
+            break;                                                                  /* the last sequence has no match */
+        }
+
+        if (in_end - in < 2) {
+            return LZ4_CORRUPT_BLOCK;
+        }
+        distance = (uint64_t)in[0] | ((uint64_t)in[1] << 8);
+        in += 2;
+        if (distance == 0 || distance > out) {
+            return LZ4_CORRUPT_BLOCK;
+        }
+
+        length = token & 15;
+        if (length == 15) {
+            do {
+                if (in >= in_end) {
+                    return LZ4_CORRUPT_BLOCK;
+                }
+                byte = *in++;
+                length += byte;
+            } while (byte == 255);
+        }
+        length += LZ4_MIN_MATCH;
+        if (length > capacity - out) {
+            return LZ4_OUTPUT_OVERFLOW;
+        }
+        for (; length > 0; --length, ++out) {                                       /* byte by byte, the match may overlap */
+            dst[out] = dst[out - distance];
+        }
+    }
+    return (int64_t)(out - offset);
+}
@@ -0,0 +1,55 @@
+#ifndef __NICKEL_EFI_LZ4_H__
+#define __NICKEL_EFI_LZ4_H__
+
+#include <stdint.h>
+
+#define LZ4_FRAME_MAGIC                 0x184D2204
+#define LZ4_FRAME_VERSION               0x40                                        /* bits 7-6 of FLG */
+#define LZ4_FRAME_VERSION_MASK          0xC0
+#define LZ4_FLAG_BLOCK_CHECKSUM         0x10
+#define LZ4_FLAG_CONTENT_SIZE           0x08
+#define LZ4_FLAG_CONTENT_CHECKSUM       0x04
+#define LZ4_FLAG_DICTIONARY_ID          0x01
+#define LZ4_BLOCK_MAX_SIZE_SHIFT        4                                           /* bits 6-4 of BD */
+#define LZ4_BLOCK_UNCOMPRESSED          0x80000000U                                 /* in the size word of a block */
+
+#define LZ4_FRAME_HEADER_MIN            7                                           /* magic, FLG, BD and the header checksum */
+#define LZ4_FRAME_HEADER_MAX            19                                          /* with content size and dictionary ID */
+#define LZ4_MIN_MATCH                   4
+
+#define LZ4_SUCCESS                     0
+#define LZ4_FAILURE                     0x80000000
+#define LZ4_INVALID_FRAME               (LZ4_FAILURE | 1)
+#define LZ4_CORRUPT_BLOCK               (LZ4_FAILURE | 2)
+#define LZ4_OUTPUT_OVERFLOW             (LZ4_FAILURE | 3)
+
+/**
+ * @brief What the header of an LZ4 frame says about the blocks that follow.
+ */
+struct lz4_frame {
+    uint64_t content_size;                                                          /* 0 if the frame does not record it */
+    uint32_t block_max_size;
+    uint32_t header_size;
+    uint32_t block_checksum;                                                        /* each block is followed by 4 bytes */
+    uint32_t content_checksum;                                                      /* the end mark is followed by 4 bytes */
+};
+
+/**
+ * @brief Parses the frame header at `src`. The header checksum is not verified, the block
+ *        and content checksums are only skipped.
+ *
+ * @param size At least `LZ4_FRAME_HEADER_MIN`; `frame->header_size` tells how much it was.
+ * @return `LZ4_SUCCESS` on success, `LZ4_INVALID_FRAME` otherwise.
+ */
+int32_t lz4_parse_frame(const uint8_t *src, uint64_t size, struct lz4_frame *frame);
+
+/**
+ * @brief Decompresses one block to `dst + offset`. Matches may reach back into `dst`, so
+ *        linked blocks work as long as all of them go to the same buffer.
+ *
+ * @param capacity Size of `dst`, including the `offset` bytes of earlier blocks.
+ * @return The number of bytes produced, or `LZ4_CORRUPT_BLOCK` or `LZ4_OUTPUT_OVERFLOW`.
+ */
+int64_t lz4_decompress_block(const uint8_t *src, uint64_t size, uint8_t *dst, uint64_t offset, uint64_t capacity);
+
+#endif
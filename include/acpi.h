@@ -4,8 +4,13 @@
 #include <stdint.h>
 
 #define ACPI_RSDP_SIGNATURE                     "RSD PTR "
+#define ACPI_RSDT_SIGNATURE                     "RSDT"
 #define ACPI_XSDT_SIGNATURE                     "XSDT"
 #define ACPI_MADT_SIGNATURE                     "APIC"
+#define ACPI_FADT_SIGNATURE                     "FACP"
+#define ACPI_HPET_SIGNATURE                     "HPET"
+#define ACPI_SRAT_SIGNATURE                     "SRAT"
+#define ACPI_SLIT_SIGNATURE                     "SLIT"
 
 #define ACPI_RSDP_REVISION_1                    0
 #define ACPI_RSDP_REVISION_2                    2
@@ -32,6 +37,19 @@
 #define ACPI_PROCESSOR_LOCAL_ENABLED            0x01
 #define ACPI_PROCESSOR_LOCAL_ONLINE_CABLE       0x02
 
+#define ACPI_SRAT_TYPE_PROCESSOR                0
+#define ACPI_SRAT_TYPE_MEMORY                   1
+#define ACPI_SRAT_TYPE_PROCESSOR_X2             2
+
+#define ACPI_SRAT_FLAG_ENABLED                  0x01                                /* ignore the entry otherwise */
+#define ACPI_SRAT_MEMORY_FLAG_HOT_PLUGGABLE     0x02
+
+#define ACPI_FADT_FLAG_TMR_VAL_EXT              (1U << 8)                           /* the PM timer is 32 bits wide, not 24 */
+#define ACPI_PM_TIMER_FREQUENCY                 3579545                             /* in Hz */
+
+#define ACPI_ADDRESS_SPACE_MEMORY               0
+#define ACPI_ADDRESS_SPACE_IO                   1
+
 #define ACPI_MPS_INTI_FLAG_POLARITY_MASK        0x03
 #define ACPI_MPS_INTI_FLAG_POLARITY_CONFIRM     0x00
 #define ACPI_MPS_INTI_FLAG_POLARITY_ACTIVE_HIGH 0x01
@@ -155,6 +173,13 @@ struct acpi_processor_local_apic {
     uint32_t flags;
 } __attribute__((packed));
 
+struct acpi_processor_local_x2apic {
+    uint16_t reserved;                                                              /* reserved, must be 0 */
+    uint32_t apic_id;                                                               /* 32-bit x2APIC ID of the processor */
+    uint32_t flags;                                                                 /* same as in `acpi_processor_local_apic` */
+    uint32_t uid;                                                                   /* matches the _UID of the processor object */
+} __attribute__((packed));
+
 struct acpi_io_apic {
     uint8_t apic_id;                                                                /* APIC ID of the I/O APIC */
     uint8_t reserved;                                                               /* reserved byte, must be 0 */
@@ -162,6 +187,13 @@ struct acpi_io_apic {
     uint32_t global_interrupt_base;                                                 /* base of the global interrupt number */
 } __attribute__((packed));
 
+struct acpi_interrupt_override {
+    uint8_t bus;                                                                    /* 0, i.e. ISA */
+    uint8_t source;                                                                 /* ISA IRQ */
+    uint32_t global_interrupt;                                                      /* GSI the IRQ is wired to */
+    uint16_t flags;                                                                 /* `ACPI_MPS_INTI_FLAG_*` */
+} __attribute__((packed));
+
 struct acpi_intr_ctrl_desc {
     uint8_t type;
     uint8_t length;
@@ -169,15 +201,233 @@ struct acpi_intr_ctrl_desc {
     union {
         struct acpi_processor_local_apic processor;                                 /* type = 0 */
         struct acpi_io_apic io_apic;                                                /* type = 1 */
+        struct acpi_interrupt_override override;                                    /* type = 2 */
+        struct acpi_processor_local_x2apic processor_x2;                            /* type = 9 */
+    };
+} __attribute__((packed));
+
+/**
+ * @brief This structure aligns with the Generic Address Structure (GAS) the ACPI specification
+ *        uses to describe registers in memory or I/O space.
+ */
+struct acpi_generic_address {
+    uint8_t space_id;                                                               /* `ACPI_ADDRESS_SPACE_*` */
+    uint8_t bit_width;
+    uint8_t bit_offset;
+    uint8_t access_size;
+    uint64_t address;
+} __attribute__((packed));
+
+/**
+ * @brief This structure aligns with the beginning of the FADT (Fixed ACPI Description Table),
+ *        up to the flags. We only need it for the PM timer.
+ */
+struct acpi_fadt_desc {
+    struct acpi_desc_header header;
+    uint32_t firmware_ctrl;
+    uint32_t dsdt;
+    uint8_t reserved0;
+    uint8_t preferred_pm_profile;
+    uint16_t sci_interrupt;
+    uint32_t smi_command;
+    uint8_t acpi_enable;
+    uint8_t acpi_disable;
+    uint8_t s4bios_request;
+    uint8_t pstate_control;
+    uint32_t pm1a_event_block;
+    uint32_t pm1b_event_block;
+    uint32_t pm1a_control_block;
+    uint32_t pm1b_control_block;
+    uint32_t pm2_control_block;
+    uint32_t pm_timer_block;                                                        /* I/O port of the PM timer, 0 if there is none */
+    uint32_t gpe0_block;
+    uint32_t gpe1_block;
+    uint8_t pm1_event_length;
+    uint8_t pm1_control_length;
+    uint8_t pm2_control_length;
+    uint8_t pm_timer_length;
+    uint8_t gpe0_block_length;
+    uint8_t gpe1_block_length;
+    uint8_t gpe1_base;
+    uint8_t cstate_control;
+    uint16_t c2_latency;
+    uint16_t c3_latency;
+    uint16_t flush_size;
+    uint16_t flush_stride;
+    uint8_t duty_offset;
+    uint8_t duty_width;
+    uint8_t day_alarm;
+    uint8_t month_alarm;
+    uint8_t century;
+    uint16_t iapc_boot_arch;
+    uint8_t reserved1;
+    uint32_t flags;
+} __attribute__((packed));
+
+/**
+ * @brief This structure aligns with the HPET (High Precision Event Timer) description table.
+ */
+struct acpi_hpet_desc {
+    struct acpi_desc_header header;
+    uint32_t event_timer_block_id;
+    struct acpi_generic_address address;                                            /* base of the HPET registers */
+    uint8_t hpet_number;
+    uint16_t minimum_tick;
+    uint8_t page_protection;
+} __attribute__((packed));
+
+/**
+ * @brief This structure aligns with the SRAT (System Resource Affinity Table), which assigns
+ *        processors and memory ranges to proximity domains, i.e. NUMA nodes.
+ */
+struct acpi_srat_desc {
+    struct acpi_desc_header header;
+    uint32_t reserved0;                                                             /* must be 1 */
+    uint64_t reserved1;
+    // struct acpi_srat_entry entries[0];                                          /* variable length entries, but not pointers */
+} __attribute__((packed));
+
+struct acpi_srat_processor {
+    uint8_t proximity_domain_low;                                                   /* bits 0-7 of the domain */
+    uint8_t apic_id;
+    uint32_t flags;
+    uint8_t sapic_eid;
+    uint8_t proximity_domain_high[3];                                               /* bits 8-31 of the domain */
+    uint32_t clock_domain;
+} __attribute__((packed));
+
+struct acpi_srat_memory {
+    uint32_t proximity_domain;
+    uint16_t reserved0;
+    uint64_t base_address;
+    uint64_t length;
+    uint32_t reserved1;
+    uint32_t flags;
+    uint64_t reserved2;
+} __attribute__((packed));
+
+struct acpi_srat_processor_x2 {
+    uint16_t reserved0;
+    uint32_t proximity_domain;
+    uint32_t apic_id;                                                               /* 32-bit x2APIC ID of the processor */
+    uint32_t flags;
+    uint32_t clock_domain;
+    uint32_t reserved1;
+} __attribute__((packed));
+
+struct acpi_srat_entry {
+    uint8_t type;
+    uint8_t length;
+
+    union {
+        struct acpi_srat_processor processor;                                       /* type = 0 */
+        struct acpi_srat_memory memory;                                             /* type = 1 */
+        struct acpi_srat_processor_x2 processor_x2;                                 /* type = 2 */
     };
 } __attribute__((packed));
 
 /**
- * @brief Initializes the ACPI subsystem.
+ * @brief This structure aligns with the SLIT (System Locality Information Table), a matrix of
+ *        relative distances between proximity domains. 10 is the distance of a domain to
+ *        itself.
+ */
+struct acpi_slit_desc {
+    struct acpi_desc_header header;
+    uint64_t locality_count;
+    uint8_t entries[0];                                                             /* `locality_count` squared, row by row */
+} __attribute__((packed));
+
+#define ACPI_MAX_PROCESSORS                     256
+#define ACPI_MAX_IO_APICS                       16
+#define ACPI_MAX_OVERRIDES                      16                                  /* one per ISA IRQ */
+#define ACPI_MAX_TABLES                         64
+
+/**
+ * @brief Reads a 4-byte table signature as one 32-bit value, so matching a signature is a
+ *        single compare. Constant for string literals.
+ */
+static inline uint32_t acpi_signature(const char *signature) {
+    uint32_t value;
+
+    __builtin_memcpy(&value, signature, sizeof(value));
+    return value;
+}
+
+/**
+ * @brief A processor found in the MADT, either as a local APIC or as a local x2APIC entry.
+ */
+struct acpi_processor {
+    uint32_t uid;
+    uint32_t apic_id;                                                               /* 8-bit for local APIC entries */
+    uint32_t flags;
+};
+
+extern volatile uint32_t cores, enabled_cores;                                      /* filled by the MADT parser */
+extern volatile struct acpi_processor processors[ACPI_MAX_PROCESSORS];
+
+/**
+ * @brief An I/O APIC found in the MADT. Its inputs are GSIs `gsi_base` and up.
+ */
+struct acpi_ioapic {
+    uint32_t id;
+    uint32_t address;
+    uint32_t gsi_base;
+};
+
+/**
+ * @brief An ISA IRQ the MADT wires to another GSI or with other polarity or trigger than the
+ *        ISA default of edge triggered, active high.
+ */
+struct acpi_override {
+    uint8_t source;
+    uint16_t flags;                                                                 /* `ACPI_MPS_INTI_FLAG_*` */
+    uint32_t gsi;
+};
+
+extern struct acpi_ioapic acpi_ioapics[ACPI_MAX_IO_APICS];
+extern uint32_t acpi_ioapic_count;
+extern struct acpi_override acpi_overrides[ACPI_MAX_OVERRIDES];
+extern uint32_t acpi_override_count;
+
+/**
+ * @brief Timer hardware found in the FADT and the HPET table, 0 when absent.
+ */
+extern uint64_t acpi_hpet_address;
+extern uint16_t acpi_pm_timer_port;
+extern int acpi_pm_timer_32bit;
+
+extern uint32_t acpi_table_count;                                                   /* tables in the index */
+
+/**
+ * @brief Looks up the first table with `signature`, e.g. `acpi_find_table("HPET")`.
+ *
+ * @return The table, or `NULL` if the firmware has none.
+ */
+const struct acpi_desc_header *acpi_find_table(const char *signature);
+
+/**
+ * @brief Looks up the `index`-th table with `signature`, e.g. `acpi_find_table_index("SSDT", 1)`.
+ *        The index is built once by `acpi_init()` and every table in it passed its checksum.
+ *
+ * @return The table, or `NULL` if there are not that many.
+ */
+const struct acpi_desc_header *acpi_find_table_index(const char *signature, uint32_t index);
+
+/**
+ * @brief Initializes the ACPI subsystem. Validates every table the XSDT, or the RSDT before
+ *        ACPI 2.0, lists and indexes it by signature in a single pass.
  * 
  * @param rsdp Pointer to the RSDP descriptor.
  * @return 0 on success, non-zero on failure.
  */
 int32_t acpi_init(struct acpi_xsdp_desc *rsdp);
 
+#if defined(NICKEL_BENCH)
+/**
+ * @brief Validates the indexed tables with the word-wide and with a byte-wise checksum and
+ *        measures `acpi_find_table()`.
+ */
+void acpi_bench(void);
+#endif
+
 #endif
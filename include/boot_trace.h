@@ -0,0 +1,29 @@
+#ifndef __NICKEL_BOOT_TRACE_H__
+#define __NICKEL_BOOT_TRACE_H__
+
+#include <stdint.h>
+
+#include <bootproto/bootinfo.h>
+
+#define BOOT_TRACE_MAX_STAMPS           48                                          /* loader and kernel phases */
+#define BOOT_TRACE_EXIT_PORT            0xF4                                        /* QEMU `isa-debug-exit`, see `make bootbench` */
+
+/**
+ * @brief Takes over the phases the loader recorded and ends the jump into the kernel at
+ *        `entry_tsc`, read first thing in `NickelMain()`.
+ */
+void boot_trace_init(const struct nickel_boot_info *info, uint64_t entry_tsc);
+
+/**
+ * @brief Records the end of the kernel boot phase `name`, which began at the previous mark.
+ *        Boot CPU only.
+ */
+void boot_trace_mark(const char *name);
+
+/**
+ * @brief Prints the phases as a table, and again as `boottrace:` lines that
+ *        scripts/boot_trace.py turns into a Chrome trace or medians over several boots.
+ */
+void boot_trace_report(void);
+
+#endif
@@ -5,7 +5,35 @@
 
 #define NICKEL_BOOT_MAGIC                       0x4573636170697374                  /* "Escapist" in ASCII */
 #define NICKEL_VERSION                          0xDEADBEEFECEBCAFE                  /* placeholder */
-#define NICKEL_HEADER_OFFSET                    0xECEB                              /* offset of the header in the kernel binary */
+#define NICKEL_HEADER_OFFSET                    0x0                                 /* offset of the header from the lowest load address */
+
+/* memory types of the firmware memory map, numbered as EFI_MEMORY_TYPE */
+#define NICKEL_MEMORY_RESERVED                  0
+#define NICKEL_MEMORY_LOADER_CODE               1
+#define NICKEL_MEMORY_LOADER_DATA               2
+#define NICKEL_MEMORY_BOOT_SERVICES_CODE        3
+#define NICKEL_MEMORY_BOOT_SERVICES_DATA        4
+#define NICKEL_MEMORY_RUNTIME_SERVICES_CODE     5
+#define NICKEL_MEMORY_RUNTIME_SERVICES_DATA     6
+#define NICKEL_MEMORY_CONVENTIONAL              7
+#define NICKEL_MEMORY_UNUSABLE                  8
+#define NICKEL_MEMORY_ACPI_RECLAIM              9
+#define NICKEL_MEMORY_ACPI_NVS                  10
+#define NICKEL_MEMORY_MAPPED_IO                 11
+#define NICKEL_MEMORY_MAPPED_IO_PORT_SPACE      12
+#define NICKEL_MEMORY_PAL_CODE                  13
+#define NICKEL_MEMORY_PERSISTENT                14
+
+#define NICKEL_MEMORY_PAGE_SIZE                 4096                                /* `number_of_pages` is always in 4KB pages */
+
+/* pixel layouts of the framebuffer, numbered as EFI_GRAPHICS_PIXEL_FORMAT */
+#define NICKEL_PIXEL_RGBX                       0                                   /* 32 bits, red in the lowest byte */
+#define NICKEL_PIXEL_BGRX                       1                                   /* 32 bits, blue in the lowest byte */
+#define NICKEL_PIXEL_BITMASK                    2                                   /* 32 bits, as `framebuffer_*_mask` say */
+#define NICKEL_PIXEL_BLT_ONLY                   3                                   /* no linear framebuffer */
+
+#define NICKEL_BOOT_MAX_STAMPS                  16                                  /* loader phases, the kernel keeps its own */
+#define NICKEL_BOOT_STAMP_NAME                  16
 
 /**
  * @brief Boot header structure contained in the kernel binary.
@@ -13,10 +41,33 @@
 struct nickel_boot_header {
     uint64_t magic;                                                                 /* magic number to verify, must equal to `NICKEL_BOOT_MAGIC` */
     uint64_t kernel_version;
-    uint64_t kernel_size;
+    uint64_t kernel_size;                                                           /* size of the loaded image in memory, including .bss */
     uint64_t kernel_entry;                                                          /* the location the bootloader should jump to */
 } __attribute__((packed));
 
+/**
+ * @brief Memory descriptor of the firmware memory map. It aligns with `EFI_MEMORY_DESCRIPTOR`,
+ *        but the bootloader reports `descriptor_size` separately, because firmware is allowed
+ *        to append fields. Always step through the map with `descriptor_size`.
+ */
+struct nickel_memory_descriptor {
+    uint32_t type;                                                                  /* one of `NICKEL_MEMORY_*` */
+    uint32_t padding;
+    uint64_t physical_start;
+    uint64_t virtual_start;
+    uint64_t number_of_pages;                                                       /* in 4KB pages */
+    uint64_t attribute;
+} __attribute__((packed));
+
+/**
+ * @brief End of a boot phase. The phase began at the previous stamp, the first one at reset,
+ *        when the time stamp counter started from 0.
+ */
+struct nickel_boot_stamp {
+    char name[NICKEL_BOOT_STAMP_NAME];                                              /* NUL terminated */
+    uint64_t tsc;
+} __attribute__((packed));
+
 /**
  * @brief Boot information structure passed to the kernel. This contains the header and
  *        some additional information.
@@ -28,6 +79,24 @@ struct nickel_boot_info {
     // uint64_t boot_type;
 
     uint64_t acpi_rsdp;
+
+    uint64_t memory_map;                                                            /* physical address of the first memory descriptor */
+    uint64_t memory_map_size;                                                       /* size of the whole map in bytes */
+    uint64_t descriptor_size;                                                       /* stride between two descriptors in bytes */
+    uint32_t descriptor_version;
+
+    uint64_t framebuffer_base;                                                      /* physical address, 0 without a linear framebuffer */
+    uint64_t framebuffer_size;                                                      /* in bytes */
+    uint32_t framebuffer_width;                                                     /* visible pixels */
+    uint32_t framebuffer_height;
+    uint32_t framebuffer_stride;                                                    /* pixels per scan line, at least the width */
+    uint32_t framebuffer_format;                                                    /* one of `NICKEL_PIXEL_*` */
+    uint32_t framebuffer_red_mask;                                                  /* only for `NICKEL_PIXEL_BITMASK` */
+    uint32_t framebuffer_green_mask;
+    uint32_t framebuffer_blue_mask;
+
+    uint32_t boot_stamp_count;
+    struct nickel_boot_stamp boot_stamps[NICKEL_BOOT_MAX_STAMPS];                   /* phases of the loader, in order */
 };
 
 #endif
@@ -0,0 +1,56 @@
+#ifndef __NICKEL_FBCON_H__
+#define __NICKEL_FBCON_H__
+
+#include <stdint.h>
+
+#include <bootproto/bootinfo.h>
+
+#define FBCON_FONT_FIRST                0x20                                        /* printable ASCII only */
+#define FBCON_FONT_GLYPHS               95
+#define FBCON_FONT_ROWS                 8
+#define FBCON_GLYPH_WIDTH               8
+#define FBCON_GLYPH_HEIGHT              16                                          /* every font row drawn twice */
+#define FBCON_TAB_WIDTH                 8
+
+#define FBCON_FOREGROUND                0xAAAAAA                                    /* 0xRRGGBB */
+#define FBCON_BACKGROUND                0x000000
+
+#define FBCON_SUCCESS                   0
+#define FBCON_FAILURE                   0x80000000
+#define FBCON_NOT_PRESENT               (FBCON_FAILURE | 1)
+#define FBCON_UNSUPPORTED               (FBCON_FAILURE | 2)
+#define FBCON_NO_MEMORY                 (FBCON_FAILURE | 3)
+
+extern const uint8_t fbcon_font[FBCON_FONT_GLYPHS][FBCON_FONT_ROWS];
+
+/**
+ * @brief Maps the framebuffer the bootloader found write-combining and allocates the back
+ *        buffer text is drawn into. Must run after `pmm_init()`.
+ *
+ * @return `FBCON_SUCCESS` on success, one of `FBCON_*` errors otherwise; output then goes to
+ *         the UART alone.
+ */
+int32_t fbcon_init(struct nickel_boot_info *boot_info);
+
+/**
+ * @brief Draws `length` characters into the back buffer and widens the dirty rectangle. Nothing
+ *        reaches the screen until `fbcon_flush()`. The caller serializes, as for the UART.
+ */
+void fbcon_write(const char *buffer, uint64_t length);
+
+/**
+ * @brief Copies the dirty rectangle of the back buffer to the framebuffer with non-temporal
+ *        stores, which never read the framebuffer and fill whole write-combining lines.
+ */
+void fbcon_flush(void);
+
+#if defined(NICKEL_BENCH)
+/**
+ * @brief Writes lines to the console in bursts the size of a printk drain, flushing after
+ *        each, and prints the throughput in lines per second for half and full width lines.
+ *        Every run scrolls the whole screen many times over.
+ */
+void fbcon_bench(void);
+#endif
+
+#endif
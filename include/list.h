@@ -0,0 +1,83 @@
+#ifndef __NICKEL_LIST_H__
+#define __NICKEL_LIST_H__
+
+#include <stddef.h>
+
+/**
+ * @brief Gets the structure that embeds `ptr` as its `member`.
+ */
+#define container_of(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+
+/**
+ * @brief Intrusive circular doubly-linked list. An empty list is a head pointing to itself.
+ */
+struct list_head {
+    struct list_head *next;
+    struct list_head *prev;
+};
+
+#define LIST_HEAD_INIT(name)            { &(name), &(name) }
+
+static inline void list_init(struct list_head *head) {
+    head->next = head;
+    head->prev = head;
+}
+
+static inline void __list_insert(struct list_head *node, struct list_head *prev, struct list_head *next) {
+    next->prev = node;
+    node->next = next;
+    node->prev = prev;
+    prev->next = node;
+}
+
+/**
+ * @brief Inserts `node` right after `head`, i.e. at the front of the list.
+ */
+static inline void list_add(struct list_head *node, struct list_head *head) {
+    __list_insert(node, head, head->next);
+}
+
+/**
+ * @brief Inserts `node` right before `head`, i.e. at the back of the list.
+ */
+static inline void list_add_tail(struct list_head *node, struct list_head *head) {
+    __list_insert(node, head->prev, head);
+}
+
+static inline void list_del(struct list_head *node) {
+    node->next->prev = node->prev;
+    node->prev->next = node->next;
+    node->next = node;
+    node->prev = node;
+}
+
+static inline int list_empty(const struct list_head *head) {
+    return head->next == head;
+}
+
+/**
+ * @brief Moves every node of `old` to `head`, which is overwritten, and leaves `old` empty.
+ */
+static inline void list_replace_init(struct list_head *old, struct list_head *head) {
+    if (list_empty(old)) {
+        list_init(head);
+        return;
+    }
+    head->next = old->next;
+    head->prev = old->prev;
+    head->next->prev = head;
+    head->prev->next = head;
+    list_init(old);
+}
+
+#define list_entry(ptr, type, member)   container_of(ptr, type, member)
+#define list_first_entry(head, type, member) list_entry((head)->next, type, member)
+
+#define list_for_each(pos, head)        \
+    for (pos = (head)->next; pos != (head); pos = pos->next)
+
+#define list_for_each_safe(pos, tmp, head) \
+    for (pos = (head)->next, tmp = pos->next; pos != (head); pos = tmp, tmp = pos->next)
+
+#endif
@@ -0,0 +1,255 @@
+#ifndef __NICKEL_LOCK_H__
+#define __NICKEL_LOCK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <lock_stat.h>
+#include <smp.h>
+#include <spinlock.h>
+
+#include <arch/cpu.h>
+
+/**
+ * @brief FIFO spinlock. Arrivals take a ticket and wait until it is served, so no CPU can be
+ *        starved, but every waiter spins on the same line and every release invalidates it
+ *        on all of them.
+ */
+struct ticket_lock {
+    volatile uint32_t next;                                                         /* ticket handed to the next arrival */
+    volatile uint32_t owner;                                                        /* ticket being served */
+    LOCK_STAT_FIELDS
+};
+
+#define TICKET_LOCK_INIT                { 0 }
+#define TICKET_LOCK_INIT_CLASS(class)   { .next = 0, .owner = 0 LOCK_STAT_INIT(class) }
+
+static inline void ticket_lock_init(struct ticket_lock *lock) {
+    lock->next = 0;
+    lock->owner = 0;
+    lock_stat_set_class(lock, NULL);
+}
+
+static inline void ticket_lock(struct ticket_lock *lock) {
+    uint32_t ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+    int contended = 0;
+
+    while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+        contended = 1;
+        cpu_relax();
+    }
+    lock_stat_acquired(lock, contended);
+}
+
+static inline int ticket_trylock(struct ticket_lock *lock) {
+    uint32_t owner = __atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE), next = owner;
+
+    if (!__atomic_compare_exchange_n(&lock->next, &next, owner + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    lock_stat_acquired(lock, 0);
+    return 1;
+}
+
+static inline void ticket_unlock(struct ticket_lock *lock) {
+    lock_stat_released(lock);
+    __atomic_store_n(&lock->owner, lock->owner + 1, __ATOMIC_RELEASE);              /* only the holder writes it */
+}
+
+/**
+ * @brief Queue node of an MCS lock waiter, usually on its stack. It has a cache line of its
+ *        own, so a waiter spins on a line nobody else touches until its predecessor hands
+ *        the lock over.
+ */
+struct mcs_node {
+    struct mcs_node *volatile next;
+    volatile uint32_t locked;
+} __cacheline_aligned;
+
+/**
+ * @brief FIFO queue lock. A release touches only the line of the next waiter, so the cost of
+ *        a handover does not grow with the number of waiters. The node passed to
+ *        `mcs_lock()` must stay valid until the matching `mcs_unlock()`.
+ */
+struct mcs_lock {
+    struct mcs_node *volatile tail;                                                 /* last waiter, `NULL` if free */
+    LOCK_STAT_FIELDS
+};
+
+#define MCS_LOCK_INIT                   { NULL }
+#define MCS_LOCK_INIT_CLASS(class)      { .tail = NULL LOCK_STAT_INIT(class) }
+
+static inline void mcs_lock_init(struct mcs_lock *lock) {
+    lock->tail = NULL;
+    lock_stat_set_class(lock, NULL);
+}
+
+static inline void mcs_lock(struct mcs_lock *lock, struct mcs_node *node) {
+    struct mcs_node *prev;
+
+    node->next = NULL;
+    node->locked = 1;
+    prev = __atomic_exchange_n(&lock->tail, node, __ATOMIC_ACQ_REL);
+    if (prev != NULL) {
+        __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+        while (__atomic_load_n(&node->locked, __ATOMIC_ACQUIRE)) {
+            cpu_relax();
+        }
+    }
+    lock_stat_acquired(lock, prev != NULL);
+}
+
+static inline int mcs_trylock(struct mcs_lock *lock, struct mcs_node *node) {
+    struct mcs_node *expected = NULL;
+
+    node->next = NULL;
+    node->locked = 0;
+    if (!__atomic_compare_exchange_n(&lock->tail, &expected, node, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    lock_stat_acquired(lock, 0);
+    return 1;
+}
+
+static inline void mcs_unlock(struct mcs_lock *lock, struct mcs_node *node) {
+    struct mcs_node *next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE), *expected = node;
+
+    lock_stat_released(lock);
+    if (next == NULL) {
+        if (__atomic_compare_exchange_n(&lock->tail, &expected, NULL, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return;                                                                 /* nobody queued behind us */
+        }
+        while ((next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) == NULL) {   /* a waiter is linking itself in */
+            cpu_relax();
+        }
+    }
+    __atomic_store_n(&next->locked, 0, __ATOMIC_RELEASE);
+}
+
+#define RWLOCK_WRITER                   0x80000000U                                 /* held by a writer */
+#define RWLOCK_WRITER_WAITING           0x40000000U                                 /* keeps new readers out */
+#define RWLOCK_READERS                  0x3FFFFFFFU
+
+/**
+ * @brief Reader-writer spinlock. Readers share it, writers exclude everybody. A waiting
+ *        writer stops new readers, so a steady stream of them cannot starve it; for the same
+ *        reason a CPU must not take the read side again while it already holds it.
+ */
+struct rwlock {
+    volatile uint32_t value;
+    LOCK_STAT_FIELDS
+};
+
+#define RWLOCK_INIT                     { 0 }
+#define RWLOCK_INIT_CLASS(class)        { .value = 0 LOCK_STAT_INIT(class) }
+
+static inline void rwlock_init(struct rwlock *lock) {
+    lock->value = 0;
+    lock_stat_set_class(lock, NULL);
+}
+
+static inline void read_lock(struct rwlock *lock) {
+    uint32_t value = __atomic_load_n(&lock->value, __ATOMIC_RELAXED);
+    int contended = 0;
+
+    while ((value & (RWLOCK_WRITER | RWLOCK_WRITER_WAITING)) ||
+           !__atomic_compare_exchange_n(&lock->value, &value, value + 1, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        if (value & (RWLOCK_WRITER | RWLOCK_WRITER_WAITING)) {
+            contended = 1;
+            cpu_relax();
+            value = __atomic_load_n(&lock->value, __ATOMIC_RELAXED);
+        }
+    }
+    lock_stat_acquired_shared(lock, contended);
+}
+
+static inline void read_unlock(struct rwlock *lock) {
+    __atomic_fetch_sub(&lock->value, 1, __ATOMIC_RELEASE);
+}
+
+static inline void write_lock(struct rwlock *lock) {
+    uint32_t value;
+    int contended = 0;
+
+    while (1) {
+        value = __atomic_load_n(&lock->value, __ATOMIC_RELAXED);
+        if ((value & ~RWLOCK_WRITER_WAITING) == 0) {
+            if (__atomic_compare_exchange_n(&lock->value, &value, RWLOCK_WRITER, 0, __ATOMIC_ACQUIRE,
+                                            __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (!(value & RWLOCK_WRITER_WAITING)) {
+            __atomic_fetch_or(&lock->value, RWLOCK_WRITER_WAITING, __ATOMIC_RELAXED);
+        }
+        contended = 1;
+        cpu_relax();
+    }
+    lock_stat_acquired(lock, contended);
+}
+
+static inline void write_unlock(struct rwlock *lock) {
+    lock_stat_released(lock);
+    __atomic_fetch_and(&lock->value, ~RWLOCK_WRITER, __ATOMIC_RELEASE);             /* keeps the mark of other waiting writers */
+}
+
+/**
+ * @brief IRQ-safe variants. Locks taken by interrupt handlers must be taken with these
+ *        everywhere else, or a handler may spin on a lock its own CPU holds.
+ */
+#define ticket_lock_irqsave(lock, flags)    \
+    do {                                    \
+        (flags) = arch_irq_save();          \
+        ticket_lock(lock);                  \
+    } while (0)
+
+#define ticket_unlock_irqrestore(lock, flags) \
+    do {                                    \
+        ticket_unlock(lock);                \
+        arch_irq_restore(flags);            \
+    } while (0)
+
+#define mcs_lock_irqsave(lock, node, flags) \
+    do {                                    \
+        (flags) = arch_irq_save();          \
+        mcs_lock(lock, node);               \
+    } while (0)
+
+#define mcs_unlock_irqrestore(lock, node, flags) \
+    do {                                    \
+        mcs_unlock(lock, node);             \
+        arch_irq_restore(flags);            \
+    } while (0)
+
+#define read_lock_irqsave(lock, flags)      \
+    do {                                    \
+        (flags) = arch_irq_save();          \
+        read_lock(lock);                    \
+    } while (0)
+
+#define read_unlock_irqrestore(lock, flags) \
+    do {                                    \
+        read_unlock(lock);                  \
+        arch_irq_restore(flags);            \
+    } while (0)
+
+#define write_lock_irqsave(lock, flags)     \
+    do {                                    \
+        (flags) = arch_irq_save();          \
+        write_lock(lock);                   \
+    } while (0)
+
+#define write_unlock_irqrestore(lock, flags) \
+    do {                                    \
+        write_unlock(lock);                 \
+        arch_irq_restore(flags);            \
+    } while (0)
+
+#if defined(NICKEL_BENCH)
+/**
+ * @brief Runs 1 to 8 CPUs against one lock of every kind and prints the throughput and how
+ *        evenly the acquisitions were spread over the CPUs.
+ */
+void lock_bench(void);
+#endif
+
+#endif
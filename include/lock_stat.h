@@ -0,0 +1,80 @@
+#ifndef __NICKEL_LOCK_STAT_H__
+#define __NICKEL_LOCK_STAT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <arch/cpu.h>
+
+/**
+ * @brief Statistics shared by every lock of one kind, e.g. all run queue locks. Only kept if
+ *        the kernel is built with `NICKEL_LOCK_STATS`; a class registers itself on its first
+ *        acquisition and `lock_stat_print()` reports it.
+ */
+struct lock_class {
+    const char *name;
+    volatile uint64_t acquired;
+    volatile uint64_t contended;                                                    /* acquisitions that had to wait */
+    volatile uint64_t max_hold;                                                     /* longest exclusive hold in TSC cycles */
+    struct lock_class *next;
+    volatile uint32_t registered;
+};
+
+#define LOCK_CLASS_INIT(class_name)     { .name = (class_name) }
+
+#if defined(NICKEL_LOCK_STATS)
+#define LOCK_STAT_FIELDS                \
+    struct lock_class *class;           \
+    uint64_t acquired_at;
+#define LOCK_STAT_INIT(lock_class)      , .class = &(lock_class)
+
+void lock_stat_register(struct lock_class *class);
+
+static inline void __lock_stat_acquired(struct lock_class *class, uint64_t *acquired_at, int contended) {
+    if (class == NULL) {
+        return;
+    }
+    if (!class->registered) {
+        lock_stat_register(class);
+    }
+    __atomic_fetch_add(&class->acquired, 1, __ATOMIC_RELAXED);
+    if (contended) {
+        __atomic_fetch_add(&class->contended, 1, __ATOMIC_RELAXED);
+    }
+    if (acquired_at != NULL) {
+        *acquired_at = rdtsc();
+    }
+}
+
+static inline void __lock_stat_released(struct lock_class *class, uint64_t acquired_at) {
+    uint64_t held, max;
+
+    if (class == NULL) {
+        return;
+    }
+    held = rdtsc() - acquired_at;
+    max = __atomic_load_n(&class->max_hold, __ATOMIC_RELAXED);
+    while (held > max && !__atomic_compare_exchange_n(&class->max_hold, &max, held, 0, __ATOMIC_RELAXED,
+                                                      __ATOMIC_RELAXED));
+}
+
+#define lock_stat_set_class(lock, lock_class)   ((lock)->class = (lock_class))
+#define lock_stat_acquired(lock, contended)     __lock_stat_acquired((lock)->class, &(lock)->acquired_at, contended)
+#define lock_stat_acquired_shared(lock, contended) __lock_stat_acquired((lock)->class, NULL, contended)
+#define lock_stat_released(lock)                __lock_stat_released((lock)->class, (lock)->acquired_at)
+
+/**
+ * @brief Prints the statistics of every class that was acquired at least once.
+ */
+void lock_stat_print(void);
+#else
+#define LOCK_STAT_FIELDS
+#define LOCK_STAT_INIT(lock_class)
+
+#define lock_stat_set_class(lock, lock_class)   ((void)(lock_class))
+#define lock_stat_acquired(lock, contended)     ((void)(contended))
+#define lock_stat_acquired_shared(lock, contended) ((void)(contended))
+#define lock_stat_released(lock)                ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef __NICKEL_MM_PMM_H__
+#define __NICKEL_MM_PMM_H__
+
+#include <stdint.h>
+
+#include <list.h>
+#include <bootproto/bootinfo.h>
+#include <arch/paging.h>
+
+#define PMM_MAX_ORDER                   18                                          /* 4KB << 18 = 1GB */
+#define PMM_ORDER_COUNT                 (PMM_MAX_ORDER + 1)
+#define PMM_MAX_MEMORY_DESCRIPTORS      512
+#define PMM_LOW_MEMORY_LIMIT            0x100000                                    /* below 1MB is kept for real-mode trampolines */
+
+#define PMM_PCP_LOW                     0                                           /* per-CPU cache watermarks, in pages */
+#define PMM_PCP_HIGH                    96
+#define PMM_PCP_BATCH                   32
+
+#define PAGE_FLAG_RESERVED              0x01                                        /* not owned by the allocator */
+#define PAGE_FLAG_PINNED                0x02                                        /* must never be handed to the allocator */
+#define PAGE_FLAG_FREE                  0x04                                        /* head of a free block of `order` */
+#define PAGE_FLAG_SLAB                  0x08                                        /* part of a slab, `private` is the slab */
+
+#define PMM_SUCCESS                     0
+#define PMM_FAILURE                     0x80000000
+#define PMM_INVALID_PARAMETER           (PMM_FAILURE | 1)
+#define PMM_NO_MEMORY                   (PMM_FAILURE | 2)
+#define PMM_MAP_TOO_LARGE               (PMM_FAILURE | 3)
+
+/**
+ * @brief Descriptor of a single physical 4KB frame. There is one for every frame below the
+ *        highest usable address, including holes, so that the buddy of a block is found by
+ *        index arithmetic alone.
+ */
+struct page {
+    struct list_head list;                                                          /* links the head page into a free list */
+    uint32_t flags;
+    uint8_t order;                                                                  /* valid for the head of a free or allocated block */
+    uint8_t node;                                                                   /* NUMA node of the frame, blocks never span two */
+    uint8_t reserved[2];
+    void *private;                                                                  /* owned by whoever allocated the page */
+};
+
+extern struct page *mem_map;
+extern uint64_t max_pfn;
+
+static inline uint64_t page_to_pfn(const struct page *page) {
+    return (uint64_t)(page - mem_map);
+}
+
+static inline struct page *pfn_to_page(uint64_t pfn) {
+    return &mem_map[pfn];
+}
+
+static inline uint64_t page_to_phys(const struct page *page) {
+    return page_to_pfn(page) << PAGE_SHIFT;
+}
+
+static inline struct page *phys_to_page(uint64_t phys) {
+    return pfn_to_page(phys >> PAGE_SHIFT);
+}
+
+/**
+ * @brief Builds the buddy allocator from the firmware memory map. Only conventional memory
+ *        is handed out at this point; loader and boot services memory stays reserved until
+ *        `pmm_reclaim_boot_memory()`.
+ *
+ * @param boot_info Boot information passed from the bootloader.
+ * @return `PMM_SUCCESS` on success, one of `PMM_*` errors otherwise.
+ */
+int32_t pmm_init(const struct nickel_boot_info *boot_info);
+
+/**
+ * @brief Hands loader and boot services memory to the allocator. Call it only after the kernel
+ *        copied out everything it needs from the boot information and firmware tables. The
+ *        kernel image, the current stack and the active page tables stay reserved.
+ */
+void pmm_reclaim_boot_memory(void);
+
+/**
+ * @brief Moves every free block to the lists of its NUMA node, splitting blocks that span
+ *        two. Called by `numa_init()` once the memory ranges of the nodes are known.
+ */
+void pmm_numa_init(void);
+
+/**
+ * @brief Puts a per-CPU cache of single pages in front of the buddy lists for every CPU in the
+ *        MADT. Must run after `smp_init()`.
+ */
+void pmm_pcp_init(void);
+
+/**
+ * @brief Returns every page cached by the calling CPU to the buddy lists, e.g. before it goes
+ *        offline or when a large block cannot be found.
+ */
+void pmm_pcp_drain_local(void);
+
+/**
+ * @brief Allocates `2^order` physically contiguous frames, aligned to their size, from the
+ *        node of the calling CPU or else from the nearest node that has a block.
+ *
+ * @return The head page of the block, or `NULL` if no block is large enough.
+ */
+struct page *pmm_alloc_pages(uint32_t order);
+
+/**
+ * @brief Like `pmm_alloc_pages()`, but prefers `node` over the node of the calling CPU. Single
+ *        pages bypass the per-CPU cache.
+ */
+struct page *pmm_alloc_pages_node(uint32_t order, uint32_t node);
+
+/**
+ * @brief Returns a block to the allocator, merging it with its free buddies.
+ */
+void pmm_free_pages(struct page *page, uint32_t order);
+
+/**
+ * @brief Allocates `2^order` frames and returns the physical address, or 0 on failure. The
+ *        first megabyte is never managed, so 0 is never a valid block.
+ */
+uint64_t pmm_alloc(uint32_t order);
+
+void pmm_free(uint64_t phys, uint32_t order);
+
+/**
+ * @brief Like `pmm_alloc()`, but prefers `node` over the node of the calling CPU.
+ */
+uint64_t pmm_alloc_node(uint32_t order, uint32_t node);
+
+/**
+ * @brief Gets the number of free 4KB frames in the buddy lists. Pages parked in the per-CPU
+ *        caches are not included.
+ */
+uint64_t pmm_free_page_count(void);
+
+/**
+ * @brief Gets the number of free 4KB frames of one NUMA node in the buddy lists.
+ */
+uint64_t pmm_node_free_page_count(uint32_t node);
+
+/**
+ * @brief Gets the firmware memory map as copied by `pmm_init()`.
+ *
+ * @param count Receives the number of descriptors.
+ */
+const struct nickel_memory_descriptor *pmm_memory_map(uint32_t *count);
+
+#if defined(NICKEL_BENCH)
+/**
+ * @brief Measures the latency of allocating and freeing blocks of every order and prints a
+ *        table over the serial console.
+ */
+void pmm_bench(void);
+
+/**
+ * @brief Lets 1 to all online CPUs allocate and free single pages in a loop and prints the
+ *        aggregate throughput for each CPU count.
+ */
+void pmm_pcp_bench(void);
+#endif
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef __NICKEL_MM_SLAB_H__
+#define __NICKEL_MM_SLAB_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <list.h>
+#include <smp.h>
+#include <spinlock.h>
+
+#define SLAB_MAX_ORDER                  3                                           /* slabs span at most 32KB */
+#define SLAB_MIN_OBJECTS                8                                           /* preferred objects per slab */
+#define SLAB_MAX_EMPTY                  1                                           /* empty slabs kept per cache */
+#define SLAB_CPU_CACHE_SIZE             30                                          /* capacity of a per-CPU object cache */
+#define SLAB_NAME_LENGTH                24
+
+#define KMALLOC_MIN_SIZE                8
+#define KMALLOC_MAX_SIZE                8192
+#define KMALLOC_CLASSES                 13
+
+/**
+ * @brief Slab header. It is placed at the start of the slab's own pages, followed by the
+ *        color offset and the objects. A free object stores the next free object in its first
+ *        eight bytes.
+ */
+struct slab {
+    struct list_head list;                                                          /* in the partial, full or empty list */
+    struct kmem_cache *cache;
+    void *freelist;
+    uint32_t inuse;
+    uint32_t color;                                                                 /* offset of the first object, in color steps */
+};
+
+/**
+ * @brief Per-CPU stack of free objects. The fast path of alloc and free touches only this, with
+ *        interrupts off; the slab lists are visited in batches of `batch` objects.
+ */
+struct kmem_cpu_cache {
+    uint32_t count;
+    uint32_t limit;                                                                 /* flush when full, at most `SLAB_CPU_CACHE_SIZE` */
+    uint32_t batch;
+    uint32_t reserved;
+    uint64_t allocs;
+    uint64_t frees;
+    void *objects[SLAB_CPU_CACHE_SIZE];
+} __cacheline_aligned;
+
+/**
+ * @brief A named cache of equally sized objects.
+ */
+struct kmem_cache {
+    char name[SLAB_NAME_LENGTH];
+    uint32_t object_size;                                                           /* size requested by the creator */
+    uint32_t size;                                                                  /* stride between two objects */
+    uint32_t align;
+    uint32_t order;                                                                 /* each slab is `2^order` pages */
+    uint32_t objects_per_slab;
+    uint32_t header_size;                                                           /* `struct slab` rounded up to `align` */
+    uint32_t color_step;
+    uint32_t colors;                                                                /* distinct offsets the leftover space allows */
+    uint32_t color_next;
+
+    struct spinlock lock;                                                           /* protects the slab lists and counters below */
+    struct list_head partial;
+    struct list_head full;
+    struct list_head empty;
+    uint64_t slabs;
+    uint64_t empty_slabs;
+
+    uint64_t last_allocs;                                                           /* snapshot of the last stats dump */
+    uint64_t last_tsc;
+
+    struct kmem_cpu_cache *cpu_caches;                                              /* one per CPU in the MADT */
+    uint32_t cpu_caches_order;
+    struct list_head caches;                                                        /* in the list of all caches */
+};
+
+/**
+ * @brief Creates the cache of caches and the kmalloc size classes. Must run after
+ *        `smp_init()`, since every cache has one object cache per CPU.
+ */
+void slab_init(void);
+
+/**
+ * @brief Creates a cache of objects of `size` bytes.
+ *
+ * @param name Name shown by `kmem_cache_dump()`.
+ * @param size Object size in bytes.
+ * @param align Object alignment, 0 for the natural 8 bytes. Must be a power of two.
+ * @return The new cache, or `NULL` on failure.
+ */
+struct kmem_cache *kmem_cache_create(const char *name, uint32_t size, uint32_t align);
+
+void *kmem_cache_alloc(struct kmem_cache *cache);
+
+void kmem_cache_free(struct kmem_cache *cache, void *object);
+
+/**
+ * @brief Allocates `size` bytes from the smallest fitting size class. Larger requests are
+ *        served with whole pages from the physical allocator.
+ */
+void *kmalloc(size_t size);
+
+/**
+ * @brief Frees memory returned by `kmalloc()` or `kmem_cache_alloc()`.
+ */
+void kfree(void *object);
+
+/**
+ * @brief Prints active objects, slabs and the allocation rate since the last dump for every
+ *        cache.
+ */
+void kmem_cache_dump(void);
+
+#if defined(NICKEL_BENCH)
+/**
+ * @brief Compares kmalloc/kfree against a naive first-fit heap on the same request stream.
+ */
+void slab_bench(void);
+#endif
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef __NICKEL_NUMA_H__
+#define __NICKEL_NUMA_H__
+
+#include <stdint.h>
+
+#include <smp.h>
+
+#define NUMA_MAX_NODES                  8
+#define NUMA_MAX_MEMORY_RANGES          32
+#define NUMA_LOCAL_DISTANCE             10                                          /* SLIT distance of a node to itself */
+#define NUMA_REMOTE_DISTANCE            20                                          /* assumed between nodes without a SLIT */
+
+#define NUMA_SUCCESS                    0
+#define NUMA_FAILURE                    0x80000000
+#define NUMA_INVALID_TABLE              (NUMA_FAILURE | 1)
+#define NUMA_TOO_MANY_NODES             (NUMA_FAILURE | 2)
+
+/**
+ * @brief A physical address range the SRAT assigns to a node.
+ */
+struct numa_memory_range {
+    uint64_t start;
+    uint64_t end;                                                                   /* exclusive */
+    uint32_t node;
+};
+
+/**
+ * @brief Topology found in the SRAT and SLIT. Without an SRAT there is a single node 0 that
+ *        holds every CPU and all memory.
+ */
+extern uint32_t numa_node_count;
+extern uint8_t numa_cpu_nodes[SMP_MAX_CPUS];
+extern uint8_t numa_distances[NUMA_MAX_NODES][NUMA_MAX_NODES];
+extern uint8_t numa_fallback[NUMA_MAX_NODES][NUMA_MAX_NODES];                       /* nodes ordered by distance, the own first */
+extern struct numa_memory_range numa_memory_ranges[NUMA_MAX_MEMORY_RANGES];
+extern uint32_t numa_memory_range_count;
+
+static inline uint32_t numa_cpu_to_node(uint32_t cpu) {
+    return numa_cpu_nodes[cpu];
+}
+
+/**
+ * @brief Gets the node of the calling CPU.
+ */
+static inline uint32_t numa_node_id(void) {
+    return numa_cpu_nodes[smp_processor_id()];
+}
+
+/**
+ * @brief Gets the node `phys` belongs to, node 0 if the SRAT does not list it.
+ */
+uint32_t numa_phys_to_node(uint64_t phys);
+
+/**
+ * @brief Reads the SRAT and SLIT, builds the CPU and memory maps and the fallback order of
+ *        every node and moves the free pages to the lists of their nodes. Must run after
+ *        `acpi_init()`, `pmm_init()` and `smp_init()` and before anything is allocated per CPU.
+ *
+ * @return `NUMA_SUCCESS` on success, one of `NUMA_*` errors otherwise; the kernel then keeps
+ *         running as a single node.
+ */
+int32_t numa_init(void);
+
+#if defined(NICKEL_BENCH)
+/**
+ * @brief Checks that single pages come from the node of the allocating CPU and compares the
+ *        bandwidth of local and remote memory from the first CPU of every node.
+ */
+void numa_bench(void);
+#endif
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef __NICKEL_PERCPU_H__
+#define __NICKEL_PERCPU_H__
+
+#include <stdint.h>
+
+#include <arch/percpu.h>
+
+#define PERCPU_SUCCESS                  0
+#define PERCPU_FAILURE                  0x80000000
+#define PERCPU_NO_MEMORY                (PERCPU_FAILURE | 1)
+
+/**
+ * @brief Defines a variable of which every CPU has its own copy. Its address is only an
+ *        offset; use the `this_cpu_*` accessors or `per_cpu()` to reach a copy.
+ */
+#define DEFINE_PER_CPU(type, name)      __attribute__((section(".percpu"))) type name
+#define DECLARE_PER_CPU(type, name)     extern type name
+
+/**
+ * @brief Base of the per-CPU area of every CPU, 0 for CPUs that have none.
+ */
+extern uint64_t percpu_bases[];
+
+DECLARE_PER_CPU(uint64_t, percpu_base);                                             /* base of the area it is in */
+
+#define per_cpu_ptr(var, cpu)           ((__typeof__(var) *)(percpu_bases[cpu] + (uint64_t)&(var)))
+#define per_cpu(var, cpu)               (*per_cpu_ptr(var, cpu))
+#define this_cpu_ptr(var)               ((__typeof__(var) *)(this_cpu_read(percpu_base) + (uint64_t)&(var)))
+
+/**
+ * @brief Lets the boot CPU use the per-CPU template in the kernel image until `percpu_init()`
+ *        copied it. Anything written to per-CPU variables before then is copied to every CPU.
+ */
+void percpu_early_init(void);
+
+/**
+ * @brief Allocates a copy of the per-CPU template for every CPU in the MADT on the node of the
+ *        CPU and switches the boot CPU to its own. Must run after `smp_init()`, `pmm_init()`
+ *        and `numa_init()`.
+ *
+ * @return `PERCPU_SUCCESS` on success, `PERCPU_NO_MEMORY` if some CPUs got no area; those
+ *         are not started.
+ */
+int32_t percpu_init(void);
+
+/**
+ * @brief Points GS at the per-CPU area of the calling CPU, found through its APIC ID. APs
+ *        call it before anything that uses `smp_processor_id()`.
+ */
+void percpu_cpu_init(void);
+
+#if defined(NICKEL_BENCH)
+/**
+ * @brief Compares increments of a per-CPU counter with those of a shared atomic counter on
+ *        up to 8 CPUs at once.
+ */
+void percpu_bench(void);
+#endif
+
+#endif
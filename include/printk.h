@@ -0,0 +1,128 @@
+#ifndef __NICKEL_PRINTK_H__
+#define __NICKEL_PRINTK_H__
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PRINTK_BUFFER_SIZE              256                                         /* longest single message, longer ones are cut */
+#define PRINTK_RING_ORDER               4                                           /* 64KB of records per CPU */
+#define PRINTK_RING_SIZE                (4096UL << PRINTK_RING_ORDER)
+#define PRINTK_RECORD_ALIGN             16
+#define PRINTK_RECORD_MAX               (16 + PRINTK_BUFFER_SIZE)                   /* header and the longest text */
+#define PRINTK_DRAIN_BATCH              64                                          /* records per `printk_drain()` */
+
+#define PRINTK_RECORD_CONTINUED         0x01                                        /* the previous record did not end its line */
+#define PRINTK_RECORD_WRAP              0x02                                        /* pads the ring up to its end */
+
+#define PRINTK_EMERG                    0
+#define PRINTK_ERR                      3
+#define PRINTK_WARN                     4
+#define PRINTK_INFO                     6
+#define PRINTK_DEBUG                    7
+
+#if !defined(PRINTK_LEVEL)
+#define PRINTK_LEVEL                    PRINTK_INFO                                 /* `pr_*()` above it compile to nothing */
+#endif
+
+#define PRINTK_SUCCESS                  0
+#define PRINTK_FAILURE                  0x80000000
+#define PRINTK_NO_MEMORY                (PRINTK_FAILURE | 1)
+
+#define pr_log(level, ...)                                                          \
+    do {                                                                            \
+        if ((level) <= PRINTK_LEVEL) {                                              \
+            printk_log(level, __VA_ARGS__);                                         \
+        }                                                                           \
+    } while (0)
+
+#define pr_err(...)                     pr_log(PRINTK_ERR, __VA_ARGS__)
+#define pr_warn(...)                    pr_log(PRINTK_WARN, __VA_ARGS__)
+#define pr_info(...)                    pr_log(PRINTK_INFO, __VA_ARGS__)
+#define pr_debug(...)                   pr_log(PRINTK_DEBUG, __VA_ARGS__)
+
+/**
+ * @brief Records of a level above it are dropped by the console instead of printed. They are
+ *        still logged, it only saves the UART time.
+ */
+extern volatile uint32_t printk_console_level;
+
+/**
+ * @brief Formats a string into `buffer`. Supports `%d %i %u %x %X %p %s %c %%`, the `l`,
+ *        `ll` and `z` length modifiers, a field width, and the `0` and `-` flags.
+ * 
+ * @return The number of characters written, excluding the terminating NUL.
+ */
+int vsnprintf(char *buffer, size_t size, const char *format, va_list args);
+
+__attribute__((format(printf, 3, 4)))
+int snprintf(char *buffer, size_t size, const char *format, ...);
+
+/**
+ * @brief Prints a formatted message to the serial console at `PRINTK_INFO`. Once
+ *        `printk_init()` ran, the message only goes into the ring of the calling CPU.
+ */
+__attribute__((format(printf, 1, 2)))
+int printk(const char *format, ...);
+
+/**
+ * @brief Logs a formatted message at `level`. Prefer the `pr_*()` macros, which filter at
+ *        compile time.
+ */
+__attribute__((format(printf, 2, 3)))
+int printk_log(uint32_t level, const char *format, ...);
+
+/**
+ * @brief Gives every CPU a log ring on its node and switches `printk()` from writing the UART
+ *        to appending there. Must run after `percpu_init()`.
+ *
+ * @return `PRINTK_SUCCESS` on success, `PRINTK_NO_MEMORY` otherwise; `printk()` then keeps
+ *         writing the UART directly.
+ */
+int32_t printk_init(void);
+
+/**
+ * @brief Writes the records of all rings to the UART in time stamp order, unless another CPU is
+ *        already doing so. Called from the idle loop, so no producer waits for the UART.
+ */
+void printk_drain(void);
+
+/**
+ * @brief Whether any ring holds records that `printk_drain()` on the calling CPU would write
+ *        out if it got the UART. The idle loop does not halt while there are.
+ */
+int printk_drain_pending(void);
+
+/**
+ * @brief Whether the ring of the calling CPU holds records that are not on the UART yet.
+ */
+int printk_cpu_pending(void);
+
+/**
+ * @brief Waits until all records logged so far are on the UART.
+ */
+void printk_flush(void);
+
+/**
+ * @brief Takes the consoles away from `printk()` once the rings are written out, so the caller
+ *        can draw to them directly. Interrupts stay disabled until `printk_console_unlock()`.
+ */
+uint64_t printk_console_lock(void);
+
+void printk_console_unlock(uint64_t flags);
+
+/**
+ * @brief Makes `printk()` stop taking its lock, so that a CPU that crashed while holding it,
+ *        or an NMI that interrupted the holder, can still report. What the rings hold is
+ *        written out first, and later messages bypass them. Lines may interleave.
+ */
+void printk_emergency(void);
+
+#if defined(NICKEL_BENCH)
+/**
+ * @brief Floods the rings from all online CPUs and measures what a message costs its producer.
+ */
+void printk_bench(void);
+#endif
+
+#endif
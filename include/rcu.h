@@ -0,0 +1,94 @@
+#ifndef __NICKEL_RCU_H__
+#define __NICKEL_RCU_H__
+
+#include <stdint.h>
+
+#include <sched.h>
+
+/**
+ * @brief Callback queued by `call_rcu()`, embedded in the object it frees.
+ */
+struct rcu_head {
+    struct rcu_head *next;
+    void (*fn)(struct rcu_head *head);
+};
+
+/**
+ * @brief Callbacks of one CPU. New ones collect in `next` until the CPU asks for a grace
+ *        period for all of them at once; they then wait in `wait` until it completed.
+ */
+struct rcu_data {
+    uint64_t gp_seen;                                                               /* last grace period this CPU passed a quiescent state in */
+    struct rcu_head *next_head;
+    struct rcu_head *next_tail;
+    struct rcu_head *wait_head;
+    struct rcu_head *wait_tail;
+    uint64_t wait_gp;                                                               /* grace period `wait` is due after */
+    uint64_t invoked;
+};
+
+/**
+ * @brief Marks a read-side critical section. It only disables preemption of the calling
+ *        thread, so it writes nothing but the thread itself. Code that runs with interrupts
+ *        disabled, interrupt handlers included, is a read-side critical section already.
+ */
+static inline void rcu_read_lock(void) {
+    preempt_disable();
+}
+
+static inline void rcu_read_unlock(void) {
+    preempt_enable();
+}
+
+/**
+ * @brief Loads a pointer published with `rcu_assign_pointer()`. Only valid until the
+ *        enclosing `rcu_read_unlock()`.
+ */
+#define rcu_dereference(p)              __atomic_load_n(&(p), __ATOMIC_CONSUME)
+
+/**
+ * @brief Publishes `value` in `p`, ordered after the stores that initialized it.
+ */
+#define rcu_assign_pointer(p, value)    __atomic_store_n(&(p), (value), __ATOMIC_RELEASE)
+
+/**
+ * @brief Runs `fn(head)` once every CPU passed a quiescent state, i.e. once no reader can
+ *        still see what was unpublished before the call. It runs on the calling CPU with
+ *        interrupts disabled, from the idle loop or the next `schedule()`.
+ */
+void call_rcu(struct rcu_head *head, void (*fn)(struct rcu_head *head));
+
+/**
+ * @brief Waits for a full grace period. Must be called from a thread outside any read-side
+ *        critical section.
+ */
+void synchronize_rcu(void);
+
+/**
+ * @brief Reports a quiescent state of the calling CPU. The scheduler tick calls it when the
+ *        interrupted thread can be preempted; it is cheap unless a grace period waits for
+ *        this CPU.
+ */
+void rcu_quiescent(void);
+
+/**
+ * @brief Reports a quiescent state and runs the callbacks whose grace period completed. Called
+ *        by `schedule()` and the idle loop, outside any lock.
+ */
+void rcu_poll(void);
+
+/**
+ * @brief Whether the calling CPU still has callbacks or owes the running grace period a
+ *        quiescent state, in which case its idle loop must not halt.
+ */
+int rcu_pending(void);
+
+#if defined(NICKEL_BENCH)
+/**
+ * @brief Compares RCU readers with rwlock readers on 1 to 8 CPUs and measures the latency of
+ *        `synchronize_rcu()`.
+ */
+void rcu_bench(void);
+#endif
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef __NICKEL_SCHED_H__
+#define __NICKEL_SCHED_H__
+
+#include <stdint.h>
+
+#include <list.h>
+#include <smp.h>
+#include <spinlock.h>
+#include <timer.h>
+
+#define SCHED_SLICE_NS                  4000000UL                                   /* preemption interval while others wait */
+#define SCHED_STACK_ORDER               2                                           /* 16KB kernel stacks */
+#define SCHED_NAME_LENGTH               16
+#define SCHED_MIGRATION_COST_NS         500000UL                                    /* a thread that ran this recently is cache-warm */
+
+#define THREAD_RUNNING                  0                                           /* running or in a run queue */
+#define THREAD_BLOCKED                  1
+#define THREAD_DEAD                     2
+
+#define THREAD_PINNED                   0x0001                                      /* never stolen or woken elsewhere */
+#define THREAD_IDLE                     0x0002
+
+struct fpu;
+
+#define SCHED_SUCCESS                   0
+#define SCHED_FAILURE                   0x80000000
+#define SCHED_NO_MEMORY                 (SCHED_FAILURE | 1)
+
+/**
+ * @brief A kernel thread. `sp` is where `arch_context_switch()` left its callee-saved
+ *        registers while it is not running.
+ */
+struct thread {
+    uint64_t sp;
+    struct list_head run;                                                           /* in a run queue while runnable and waiting */
+    volatile uint32_t state;
+    volatile uint32_t on_cpu;                                                       /* set until its context is fully saved */
+    uint32_t cpu;                                                                   /* run queue it is queued on or ran on last */
+    uint32_t flags;
+    uint32_t preempt_count;                                                         /* preemption is off while non-zero */
+    uint32_t reserved;
+    uint64_t id;
+    uint64_t last_ran;                                                              /* `clock_monotonic_ns()` it was switched out */
+    uint64_t stack;                                                                 /* top of its guarded stack, 0 for boot stacks */
+    struct fpu *fpu;                                                                /* vector state, `NULL` until its first `kernel_fpu_begin()` */
+    void (*fn)(void *arg);
+    void *arg;
+    char name[SCHED_NAME_LENGTH];
+};
+
+/**
+ * @brief Run queue of one CPU. Only its own CPU runs threads from it; idle CPUs steal from
+ *        the tail under its lock, and wakeups append under its lock.
+ */
+struct run_queue {
+    struct spinlock lock;
+    volatile uint32_t nr_queued;                                                    /* read without the lock to pick victims */
+    volatile uint32_t need_resched;
+    struct list_head queue;
+    struct thread *current;
+    struct thread *idle;
+    struct thread *prev;                                                            /* finished by the thread switched to */
+    struct timer tick;                                                              /* preempts `current` after a slice */
+    volatile uint32_t halted;                                                       /* in `hlt` in `sched_idle()`, woken by `sched_kick()` */
+    uint64_t switches;
+    uint64_t steals;
+    uint64_t ran;                                                                   /* threads switched in, the idle one excepted */
+} __cacheline_aligned;
+
+/**
+ * @brief Creates the thread cache and turns the calling context into the idle thread of the
+ *        boot CPU. Must run after `slab_init()` and `timer_init()`.
+ *
+ * @return `SCHED_SUCCESS` on success, `SCHED_NO_MEMORY` otherwise.
+ */
+int32_t sched_init(void);
+
+/**
+ * @brief Turns the calling context into the idle thread of an AP.
+ */
+void sched_cpu_init(void);
+
+/**
+ * @brief Runs queued threads, steals from the busiest CPU when there are none and serves
+ *        `smp_poll_work()`, RCU and the log rings in between. Halts once none of them has
+ *        anything left for it. Never returns.
+ */
+__attribute__((noreturn))
+void sched_idle(void);
+
+/**
+ * @brief Sends `APIC_VECTOR_RESCHEDULE` to `cpu` if it halted in `sched_idle()`, so that it
+ *        looks for work again. The caller publishes the work first.
+ */
+void sched_kick(uint32_t cpu);
+
+/**
+ * @brief Handler of `APIC_VECTOR_RESCHEDULE`. Ending the `hlt` is all it is for.
+ */
+void sched_resched_interrupt(void);
+
+/**
+ * @brief Creates a thread running `fn(arg)` and makes it runnable. It exits when `fn` returns.
+ *
+ * @return The new thread, or `NULL` if it cannot be allocated.
+ */
+struct thread *thread_create(const char *name, void (*fn)(void *arg), void *arg, uint32_t flags);
+
+/**
+ * @brief Makes a blocked thread runnable, preferably on the CPU it last ran on while its
+ *        cache is still warm.
+ */
+void thread_wake(struct thread *thread);
+
+/**
+ * @brief Terminates the calling thread.
+ */
+__attribute__((noreturn))
+void thread_exit(void);
+
+/**
+ * @brief Gets the thread running on the calling CPU.
+ */
+struct thread *thread_current(void);
+
+/**
+ * @brief Switches to the next runnable thread of the calling CPU. A running caller stays
+ *        runnable; one that set itself `THREAD_BLOCKED` sleeps until `thread_wake()`.
+ */
+void schedule(void);
+
+/**
+ * @brief Gives the CPU to the next queued thread, if any.
+ */
+void sched_yield(void);
+
+static inline void preempt_disable(void) {
+    ++thread_current()->preempt_count;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void preempt_enable(void) {
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    --thread_current()->preempt_count;
+}
+
+/**
+ * @brief Preempts the interrupted thread if its slice ran out. Called by the interrupt stubs
+ *        after the handler, with interrupts disabled.
+ */
+void sched_irq_exit(void);
+
+#if defined(NICKEL_BENCH)
+/**
+ * @brief Measures context switches per second and how many short CPU-bound threads every CPU
+ *        ran. Runs in a thread of its own and prints when it is done.
+ */
+void sched_bench(void);
+#endif
+
+#endif
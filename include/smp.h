@@ -0,0 +1,91 @@
+#ifndef __NICKEL_SMP_H__
+#define __NICKEL_SMP_H__
+
+#include <stdint.h>
+
+#include <acpi.h>
+#include <percpu.h>
+
+#define SMP_MAX_CPUS                    ACPI_MAX_PROCESSORS
+#define SMP_CACHE_LINE                  64
+
+#define __cacheline_aligned             __attribute__((aligned(SMP_CACHE_LINE)))
+
+/**
+ * @brief A set of CPU indices. Updates are atomic, so CPUs may add and remove themselves
+ *        concurrently.
+ */
+struct cpumask {
+    uint64_t bits[SMP_MAX_CPUS / 64];
+};
+
+static inline void cpumask_set(struct cpumask *mask, uint32_t cpu) {
+    __atomic_fetch_or(&mask->bits[cpu / 64], 1ULL << (cpu % 64), __ATOMIC_SEQ_CST);
+}
+
+static inline void cpumask_clear(struct cpumask *mask, uint32_t cpu) {
+    __atomic_fetch_and(&mask->bits[cpu / 64], ~(1ULL << (cpu % 64)), __ATOMIC_SEQ_CST);
+}
+
+static inline int cpumask_test(const struct cpumask *mask, uint32_t cpu) {
+    return !!(__atomic_load_n(&mask->bits[cpu / 64], __ATOMIC_RELAXED) & (1ULL << (cpu % 64)));
+}
+
+/**
+ * @brief Number of CPUs listed in the MADT. A CPU index is its position in `processors[]`.
+ */
+extern uint32_t smp_cpu_count;
+
+/**
+ * @brief Number of CPUs that are running kernel code, the BSP included.
+ */
+extern volatile uint32_t smp_online_count;
+extern struct cpumask smp_online_mask;
+
+/**
+ * @brief Builds the APIC ID to CPU index map from the processors found in the MADT. Must run
+ *        after `acpi_init()`; until `percpu_init()` every CPU reports index 0.
+ */
+void smp_init(void);
+
+/**
+ * @brief Marks the calling AP online. From here on it is counted by `smp_run_on_cpus()` and
+ *        receives TLB shootdowns, so it must poll for work with interrupts enabled.
+ */
+void smp_cpu_online(void);
+
+DECLARE_PER_CPU(uint32_t, cpu_number);
+
+/**
+ * @brief Gets the index of the calling CPU in `processors[]`.
+ */
+static inline uint32_t smp_processor_id(void) {
+    return this_cpu_read(cpu_number);
+}
+
+/**
+ * @brief Looks the calling CPU up by its APIC ID. It executes CPUID, which traps in a guest,
+ *        so it is only used to find the per-CPU area that `smp_processor_id()` reads.
+ */
+uint32_t smp_cpu_from_apic(void);
+
+/**
+ * @brief Runs `fn(arg)` on `count` online CPUs, at most all of them, and returns once all of
+ *        them finished: the caller and the first `count - 1` APs to pick the work up in
+ *        `smp_poll_work()`. Which APs those are is not fixed, so `fn` must find its CPU with
+ *        `smp_processor_id()` rather than assume indexes below `count`.
+ */
+void smp_run_on_cpus(void (*fn)(void *arg), void *arg, uint32_t count);
+
+/**
+ * @brief Runs the work published by `smp_run_on_cpus()`, if there is any for this CPU. Idle
+ *        APs call it in their wait loop.
+ */
+void smp_poll_work(void);
+
+/**
+ * @brief Whether `smp_run_on_cpus()` published work the calling CPU did not look at yet.
+ */
+int smp_work_pending(void);
+
+#endif
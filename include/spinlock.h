@@ -0,0 +1,68 @@
+#ifndef __NICKEL_SPINLOCK_H__
+#define __NICKEL_SPINLOCK_H__
+
+#include <stdint.h>
+
+#include <lock_stat.h>
+
+#include <arch/cpu.h>
+
+/**
+ * @brief Test-and-test-and-set spinlock. Waiters spin on a plain load so that the cache line
+ *        stays shared until the owner releases it.
+ */
+struct spinlock {
+    volatile uint32_t locked;
+    LOCK_STAT_FIELDS
+};
+
+#define SPINLOCK_INIT                   { 0 }
+#define SPINLOCK_INIT_CLASS(class)      { .locked = 0 LOCK_STAT_INIT(class) }
+
+static inline void spin_lock_init(struct spinlock *lock) {
+    lock->locked = 0;
+    lock_stat_set_class(lock, NULL);
+}
+
+static inline void spin_lock(struct spinlock *lock) {
+    int contended = 0;
+
+    while (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE)) {
+        contended = 1;
+        while (__atomic_load_n(&lock->locked, __ATOMIC_RELAXED)) {
+            cpu_relax();
+        }
+    }
+    lock_stat_acquired(lock, contended);
+}
+
+static inline int spin_trylock(struct spinlock *lock) {
+    if (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    lock_stat_acquired(lock, 0);
+    return 1;
+}
+
+static inline void spin_unlock(struct spinlock *lock) {
+    lock_stat_released(lock);
+    __atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Disables local interrupts before taking the lock, so that an interrupt handler on the
+ *        same CPU cannot deadlock against the holder.
+ */
+#define spin_lock_irqsave(lock, flags)  \
+    do {                                \
+        (flags) = arch_irq_save();      \
+        spin_lock(lock);                \
+    } while (0)
+
+#define spin_unlock_irqrestore(lock, flags) \
+    do {                                \
+        spin_unlock(lock);              \
+        arch_irq_restore(flags);        \
+    } while (0)
+
+#endif
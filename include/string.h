@@ -0,0 +1,18 @@
+#ifndef __NICKEL_STRING_H__
+#define __NICKEL_STRING_H__
+
+#include <stddef.h>
+
+/**
+ * @brief The memory functions the compiler expects even of a freestanding program. Each
+ *        architecture implements them, picking the fastest variant for the CPU at boot.
+ */
+void *memcpy(void *dst, const void *src, size_t size);
+
+void *memmove(void *dst, const void *src, size_t size);
+
+void *memset(void *dst, int value, size_t size);
+
+int memcmp(const void *a, const void *b, size_t size);
+
+#endif
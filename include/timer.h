@@ -0,0 +1,115 @@
+#ifndef __NICKEL_TIMER_H__
+#define __NICKEL_TIMER_H__
+
+#include <stdint.h>
+
+#include <list.h>
+#include <smp.h>
+#include <spinlock.h>
+
+#define TIMER_TICK_SHIFT                20                                          /* a tick is 2^20 ns, about 1ms */
+#define TIMER_TICK_NS                   (1ULL << TIMER_TICK_SHIFT)
+#define TIMER_WHEEL_BITS                6
+#define TIMER_WHEEL_SLOTS               (1U << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK                (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS              5                                           /* 2^30 ticks, about 13 days */
+#define TIMER_WHEEL_RANGE               (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+#define TIMER_NO_EVENT                  (~0ULL)
+
+#define TIMER_PINNED                    0x0001                                      /* never migrated off its CPU */
+
+#define TIMER_SUCCESS                   0
+#define TIMER_FAILURE                   0x80000000
+#define TIMER_NO_MEMORY                 (TIMER_FAILURE | 1)
+
+/**
+ * @brief A one-shot software timer. It is embedded in its owner, which `fn` finds with
+ *        `container_of()`. `entry` is empty while the timer is not queued.
+ */
+struct timer {
+    struct list_head entry;
+    uint64_t expires;                                                               /* in `clock_monotonic_ns()` time */
+    void (*fn)(struct timer *timer);
+    volatile uint32_t cpu;                                                          /* base the timer is queued on */
+    uint16_t flags;
+    uint16_t slot;                                                                  /* `level * TIMER_WHEEL_SLOTS + index` */
+};
+
+/**
+ * @brief Hierarchical timing wheel of one CPU. Level `l` has `TIMER_WHEEL_SLOTS` slots of
+ *        `2^(l * TIMER_WHEEL_BITS)` ticks each and holds timers due less than
+ *        `2^((l + 1) * TIMER_WHEEL_BITS)` ticks after `clk`. A slot of a higher level is
+ *        cascaded into the lower ones when `clk` reaches it, so insert and cancel are O(1)
+ *        and a timer moves at most `TIMER_WHEEL_LEVELS - 1` times before it fires.
+ */
+struct timer_base {
+    struct spinlock lock;
+    uint64_t clk;                                                                   /* next tick to expire */
+    uint64_t next_event;                                                            /* tick the clock event is armed for */
+    uint64_t count;
+    uint64_t occupied[TIMER_WHEEL_LEVELS];                                          /* bitmap of non-empty slots per level */
+    struct list_head slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} __cacheline_aligned;
+
+/**
+ * @brief Sets up one timer base per CPU in the MADT and takes over the clock events. Must run
+ *        after `clock_init()`, `smp_init()` and `pmm_init()`.
+ *
+ * @return `TIMER_SUCCESS` on success, `TIMER_NO_MEMORY` if the bases cannot be allocated.
+ */
+int32_t timer_init(void);
+
+/**
+ * @brief Initializes `timer` to call `fn` when it expires.
+ */
+void timer_setup(struct timer *timer, void (*fn)(struct timer *timer), uint16_t flags);
+
+/**
+ * @brief Queues `timer` on the calling CPU to fire at `expires`, rounded up to the next tick.
+ *        A pending timer is moved. The hardware is only reprogrammed if this is now the
+ *        earliest timer of the CPU.
+ */
+void timer_add(struct timer *timer, uint64_t expires);
+
+/**
+ * @brief Dequeues `timer`. It does not wait for a callback that is already running.
+ *
+ * @return 1 if the timer was pending, 0 otherwise.
+ */
+int timer_cancel(struct timer *timer);
+
+static inline int timer_pending(const struct timer *timer) {
+    return !list_empty(&timer->entry);
+}
+
+/**
+ * @brief Runs the expired timers of the calling CPU and arms the clock event for the next
+ *        one. Called from the clock event interrupt.
+ */
+void timer_run(void);
+
+/**
+ * @brief Marks the calling CPU idle and moves its timers that are not `TIMER_PINNED` to a
+ *        busy CPU, so that the idle one stops taking timer interrupts for them.
+ */
+void timer_cpu_idle(void);
+
+/**
+ * @brief Marks the calling CPU busy again. Timers added from now on stay on it.
+ */
+void timer_cpu_busy(void);
+
+/**
+ * @brief Handler of `APIC_VECTOR_TIMER_KICK`, sent to a CPU that was handed timers earlier
+ *        than its armed clock event.
+ */
+void timer_kick_interrupt(void);
+
+#if defined(NICKEL_BENCH)
+/**
+ * @brief Measures insert, cancel and expire throughput with 10^3 to 10^6 pending timers.
+ */
+void timer_bench(void);
+#endif
+
+#endif
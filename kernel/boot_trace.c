@@ -0,0 +1,79 @@
+#include <stdint.h>
+
+#include <boot_trace.h>
+#include <printk.h>
+
+#include <arch/cpu.h>
+#include <arch/tsc.h>
+
+/**
+ * @brief End of a boot phase. The phase began at the previous stamp, the first one at reset.
+ */
+struct boot_trace_stamp {
+    const char *name;
+    uint64_t tsc;
+    uint32_t kernel;                                                                /* recorded by the kernel, not the loader */
+};
+
+static struct boot_trace_stamp boot_trace_stamps[BOOT_TRACE_MAX_STAMPS];
+static uint32_t boot_trace_count = 0;
+static char boot_trace_loader_names[NICKEL_BOOT_MAX_STAMPS][NICKEL_BOOT_STAMP_NAME]; /* the boot info is not kept */
+
+static void boot_trace_add(const char *name, uint64_t tsc, uint32_t kernel) {
+    if (boot_trace_count < BOOT_TRACE_MAX_STAMPS) {
+        boot_trace_stamps[boot_trace_count].name = name;
+        boot_trace_stamps[boot_trace_count].tsc = tsc;
+        boot_trace_stamps[boot_trace_count].kernel = kernel;
+        ++boot_trace_count;
+    }
+}
+
+/**
+ * @brief Takes over the phases the loader recorded and ends the jump into the kernel at
+ *        `entry_tsc`, read first thing in `NickelMain()`.
+ */
+void boot_trace_init(const struct nickel_boot_info *info, uint64_t entry_tsc) {
+    uint32_t i, j, count = info->boot_stamp_count;
+
+    count = count < NICKEL_BOOT_MAX_STAMPS ? count : NICKEL_BOOT_MAX_STAMPS;
+    for (i = 0; i < count; ++i) {
+        for (j = 0; j + 1 < NICKEL_BOOT_STAMP_NAME && info->boot_stamps[i].name[j] != '\0'; ++j) {
+            boot_trace_loader_names[i][j] = info->boot_stamps[i].name[j];
+        }
+        boot_trace_loader_names[i][j] = '\0';
+        boot_trace_add(boot_trace_loader_names[i], info->boot_stamps[i].tsc, 0);
+    }
+    boot_trace_add("kernel entry", entry_tsc, 1);
+}
+
+/**
+ * @brief Records the end of the kernel boot phase `name`, which began at the previous mark.
+ *        Boot CPU only.
+ */
+void boot_trace_mark(const char *name) {
+    boot_trace_add(name, rdtsc(), 1);
+}
+
+/**
+ * @brief Prints the phases as a table, and again as `boottrace:` lines that
+ *        scripts/boot_trace.py turns into a Chrome trace or medians over several boots.
+ */
+void boot_trace_report(void) {
+    uint64_t start, end = 0;
+    uint32_t i;
+
+    printk("boot: %-16s %10s %10s\n", "phase", "us", "end us");
+    for (i = 0; i < boot_trace_count; ++i) {
+        start = end;
+        end = tsc_to_ns(boot_trace_stamps[i].tsc);
+        printk("boot: %-16s %10lu %10lu\n", boot_trace_stamps[i].name, (end - start) / 1000, end / 1000);
+    }
+    printk("boot: %-16s %10lu\n", "total", end / 1000);
+
+    for (i = 0, end = 0; i < boot_trace_count; ++i) {
+        start = end;
+        end = tsc_to_ns(boot_trace_stamps[i].tsc);
+        printk("boottrace: %lu %lu %s %s\n", start, end, boot_trace_stamps[i].kernel ? "kernel" : "loader",
+               boot_trace_stamps[i].name);
+    }
+}
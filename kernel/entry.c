@@ -3,86 +3,40 @@
 
 #include <bootproto/bootinfo.h>
 #include <acpi.h>
+#include <boot_trace.h>
+#include <fbcon.h>
+#include <lock.h>
+#include <numa.h>
+#include <percpu.h>
+#include <printk.h>
+#include <rcu.h>
+#include <sched.h>
+#include <smp.h>
+#include <timer.h>
+#include <mm/pmm.h>
+#include <mm/slab.h>
+#include <arch/address_space.h>
+#include <arch/clock.h>
+#include <arch/context.h>
 #include <arch/flat_gdt.h>
+#include <arch/fpu.h>
+#include <arch/interrupt.h>
+#include <arch/io.h>
+#include <arch/irq.h>
 #include <arch/default_idt.h>
-
-#include <arch/apic/registers.h>
+#include <arch/paging.h>
+#include <arch/serial.h>
+#include <arch/smpboot.h>
+#include <arch/stack.h>
+#include <arch/string.h>
+#include <arch/tlb.h>
+#include <arch/tss.h>
+#include <arch/tsc.h>
+
+#include <arch/apic/apic.h>
 #include <arch/apic/ipi.h>
 
 #if defined(NICKEL_X86_64)
-volatile uint64_t apic_base;
-
-void temp_timer_handler(void);
-
-void temp_timer_handler(void) {
-    // send eoi
-    apic_write_reg(apic_base, APIC_REG_EOI, uint32_t, 0xECEBCAFE);
-
-    asm volatile ("iretq");
-}
-
-static void apic_test(void) {
-    volatile union apic_base_msr base_msr;
-    volatile uint32_t eax, ebx, ecx, edx;
-
-    asm volatile (
-        "cpuid\n"
-        : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
-        : "a"(0)
-    );
-
-    asm volatile (
-        "cpuid\n"
-        : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
-        : "a"(1)
-    );
-
-    apic_read_base_msr(base_msr);
-    if (!base_msr.apic_enable) {
-        base_msr.apic_enable = 1;  /* enable the APIC */
-        apic_write_base_msr(base_msr);
-    }
-
-    apic_base = base_msr.apic_base << 12;
-
-    extern volatile uint8_t ap_startup[], ap_startup_end[];
-
-    // for debug
-    static volatile uint8_t *ap_startup_code = (uint8_t *)0x8000;
-    *ap_startup_code = 0xEB;
-
-    for (volatile uint8_t *src = ap_startup, *dst = ap_startup_code; src < ap_startup_end; src++, dst++) {
-        *dst = *src;
-    }
-
-    // extern volatile uint32_t cores = 0, enabled_cores = 0;
-    // extern volatile struct acpi_processor_local_apic processors[256];
-
-    // apic_send_init_ipi(processors[1].apic_id);
-    
-    // for (volatile int i = 0; i < 20000000; i++) {
-    //     __asm__ volatile("pause");
-    // }
-    
-    // apic_send_startup_ipi(processors[1].apic_id, (uint8_t *)ap_startup_code);
-
-    apic_write_reg(apic_base, APIC_REG_LVT_TIMER, uint32_t,
-        APIC_VECTOR(234)
-        | APIC_MASK_UNMASKED
-        | APIC_TIMER_MODE_PERIODIC
-    );
-
-    apic_write_reg(apic_base, APIC_REG_TIMER_DIVIDE_CONFIG, uint32_t,
-        APIC_DIVIDE_CONFIG_1
-    );
-
-    apic_write_reg(apic_base, APIC_REG_TIMER_INITIAL_COUNT, uint32_t,
-        0x400
-    );
-
-    while (1);
-}
-
 static void arch_test(void) {
     /**
      * @note The following snippet of code performs data section initialization (LMA). `__ld_data_start`, `__ld_data_end`,
@@ -151,23 +105,75 @@ static void arch_test(void) {
     //     "ud2\n"                                                                     /* triggers invalid opcode exception */
     //     "int3\n"                                                                    /* triggers breakpoint exception */
     // );
-
-    volatile union pml_entry *pml4e;
-    asm volatile (
-        "movq %%cr3, %0\n"
-        : "=r"(pml4e)
-        :
-        : "memory"
-    );
-
-    pml4e = (union pml_entry *)((uint64_t)pml4e & 0xFFFFFFFFFFFFF000);
-
-    apic_test();
 }
 #elif defined(NICKEL_AARCH64)
 #elif defined(NICKEL_RISCV64)
 #endif
 
+/**
+ * @brief Second half of `NickelMain()`, on a guarded stack that later becomes the stack of the
+ *        idle thread of the boot CPU.
+ */
+__attribute__((noreturn))
+static void NickelRun(void *arg) {
+    int32_t ret;
+
+    pmm_pcp_init();
+    slab_init();
+    ret = fpu_init();
+    if (ret < 0) {
+        pr_err("nickel: fpu_init failed (0x%x)\n", ret);                            /* `kernel_fpu_begin()` fails */
+    }
+    ret = timer_init();
+    if (ret < 0) {
+        pr_err("nickel: timer_init failed (0x%x)\n", ret);
+    }
+    ret = sched_init();
+    if (ret < 0) {
+        pr_err("nickel: sched_init failed (0x%x)\n", ret);
+    }
+    boot_trace_mark("sched");
+    smp_boot_aps();
+    boot_trace_mark("ap startup");
+
+    pmm_reclaim_boot_memory();                                                      /* firmware tables and boot info are no longer used */
+    boot_trace_mark("reclaim");
+    boot_trace_report();
+#if defined(NICKEL_BOOTBENCH)
+    printk_flush();
+    outb(BOOT_TRACE_EXIT_PORT, 0);                                                  /* ends QEMU, the timeline is all `make bootbench` wants */
+#endif
+
+#if defined(NICKEL_BENCH)
+    printk_bench();
+    string_bench();
+    fbcon_bench();
+    acpi_bench();
+    interrupt_bench();
+    irq_bench();
+    lock_bench();
+    percpu_bench();
+    paging_bench();
+    address_space_bench();
+    tlb_bench();
+    apic_bench();
+    clock_bench();
+    timer_bench();
+    sched_bench();
+    fpu_bench();
+    rcu_bench();
+    pmm_bench();
+    pmm_pcp_bench();
+    numa_bench();
+    slab_bench();
+#endif
+
+    sched_idle();                                                                   /* the boot context becomes the idle thread */
+}
+
+__attribute__((noreturn))
+void NickelMain(struct nickel_boot_info *param);                                    /* global, so that `ENTRY()` makes it `e_entry` */
+
 /**
  * @brief This function is the main entry point for the kernel. It is called from the bootloader
  *        after the CPU has been set up. It will diverge into different echosystems based on the
@@ -177,21 +183,82 @@ static void arch_test(void) {
  * @param param the pointer to the parameter passed from the bootloader.
  */
 __attribute__((noreturn))
-static void NickelMain(struct nickel_boot_info *boot_info) {
+void NickelMain(struct nickel_boot_info *param) {
+    static struct nickel_boot_info boot_info;                                       /* the original lives on the firmware stack */
+    uint64_t entry_tsc = rdtsc(), stack;
     int32_t ret;
     
-    if (boot_info->header.magic != NICKEL_BOOT_MAGIC) {
+    if (param->header.magic != NICKEL_BOOT_MAGIC) {
         goto halt;  /* halt the CPU if the magic number is incorrect */
-    } else if (boot_info->header.kernel_version != NICKEL_VERSION) {
+    } else if (param->header.kernel_version != NICKEL_VERSION) {
         goto halt;  /* halt the CPU if the kernel version is incorrect */
     }
+    boot_info = *param;
+    boot_trace_init(&boot_info, entry_tsc);
+
+    serial_init();
+    printk("nickel: booting, kernel at 0x%lx\n", boot_info.base_address);
+    printk("nickel: tsc %lu kHz\n", tsc_init() / 1000);
+    boot_trace_mark("tsc calibrate");
+
+    arch_test();                                                                    /* the firmware GDT and IDT are not mapped by our tables */
+    percpu_early_init();                                                            /* loading the segments above cleared the GS base */
+    fpu_early_init();
+    string_init();                                                                  /* before the page tables are cleared, after XCR0 is set */
+    ret = paging_init(&boot_info);
+    if (ret < 0) {
+        pr_err("nickel: paging_init failed (0x%x)\n", ret);
+        goto halt;  /* halt the CPU if the kernel page tables cannot be built */
+    }
+    address_space_init();
+    apic_init();
+    tlb_init();
+    boot_trace_mark("paging");
 
-    ret = acpi_init((struct acpi_xsdp_desc *)boot_info->acpi_rsdp);
+    ret = pmm_init(&boot_info);
     if (ret < 0) {
-        goto halt;  /* halt the CPU if ACPI initialization fails */
+        pr_err("nickel: pmm_init failed (0x%x)\n", ret);
+        goto halt;  /* halt the CPU if there is no usable memory map */
     }
+    boot_trace_mark("pmm");
+    ret = fbcon_init(&boot_info);
+    if (ret < 0 && ret != (int32_t)FBCON_NOT_PRESENT) {
+        pr_warn("nickel: fbcon_init failed (0x%x)\n", ret);                         /* the UART still has everything */
+    }
+    boot_trace_mark("console");
 
-    arch_test();
+    ret = acpi_init(phys_to_virt(boot_info.acpi_rsdp));
+    if (ret < 0) {
+        goto halt;  /* halt the CPU if ACPI initialization fails */
+    }
+    boot_trace_mark("acpi");
+    clock_init();
+    boot_trace_mark("clock");
+    smp_init();
+    ret = numa_init();
+    if (ret < 0) {
+        pr_err("nickel: numa_init failed (0x%x)\n", ret);                          /* everything stays on node 0 */
+    }
+    ret = percpu_init();
+    if (ret < 0) {
+        pr_err("nickel: percpu_init failed (0x%x)\n", ret);
+    }
+    ret = printk_init();
+    if (ret < 0) {
+        pr_err("nickel: printk_init failed (0x%x)\n", ret);
+    }
+    boot_trace_mark("cpu topology");
+    ret = tss_init();
+    if (ret < 0) {
+        pr_err("nickel: tss_init failed (0x%x)\n", ret);
+    }
+    irq_init();
+    boot_trace_mark("interrupts");
+    stack = stack_alloc(SCHED_STACK_ORDER);
+    if (stack != 0) {
+        arch_call_on_stack(stack, NickelRun, NULL);                                 /* the firmware stack has no guard page */
+    }
+    NickelRun(NULL);
 halt:
     while (1);
 }
@@ -201,10 +268,12 @@ halt:
  * @note The `__attribute__((used))` is used to ensure that the linker does not remove this
  *       symbol due to optimization.
  */
+extern uint8_t __kernel_size[];                                                     /* defined by linker.ld */
+
 __attribute__((used, section(".boot_header"), aligned(1)))
 static struct nickel_boot_header header = {
     .magic = NICKEL_BOOT_MAGIC,
     .kernel_version = NICKEL_VERSION,
-    .kernel_size = 0,
+    .kernel_size = (uint64_t)__kernel_size,
     .kernel_entry = (uint64_t)NickelMain
 };
@@ -0,0 +1,299 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <fbcon.h>
+#include <printk.h>
+#include <mm/pmm.h>
+
+#include <arch/cpu.h>
+#include <arch/paging.h>
+#include <arch/tsc.h>
+
+static volatile uint32_t *fbcon_vram = NULL;                                        /* write-combining, never read */
+static uint32_t *fbcon_back = NULL;                                                 /* text area only, `fbcon_width` pixels per line */
+static uint32_t fbcon_width, fbcon_height;                                          /* of the text area, whole glyphs */
+static uint32_t fbcon_pitch;                                                        /* pixels per framebuffer line */
+static uint32_t fbcon_columns, fbcon_rows;
+static uint32_t fbcon_column, fbcon_row;                                            /* where the next glyph goes */
+static uint32_t fbcon_foreground, fbcon_background;                                 /* in the pixel format of the framebuffer */
+
+/* dirty rectangle in pixels, end exclusive, empty while `fbcon_dirty_top >= fbcon_dirty_bottom` */
+static uint32_t fbcon_dirty_left, fbcon_dirty_top, fbcon_dirty_right, fbcon_dirty_bottom;
+
+/**
+ * @brief Scales an 8-bit channel into the bits `mask` selects.
+ */
+static uint32_t fbcon_channel(uint32_t value, uint32_t mask) {
+    uint32_t shift;
+
+    if (mask == 0) {
+        return 0;
+    }
+    shift = __builtin_ctz(mask);
+    return ((value * (mask >> shift) + 127) / 255) << shift;
+}
+
+/**
+ * @brief Converts a 0xRRGGBB color into a pixel of the framebuffer.
+ */
+static uint32_t fbcon_pixel(const struct nickel_boot_info *boot_info, uint32_t rgb) {
+    uint32_t red = (rgb >> 16) & 0xFF, green = (rgb >> 8) & 0xFF, blue = rgb & 0xFF;
+
+    switch (boot_info->framebuffer_format) {
+    case NICKEL_PIXEL_RGBX:
+        return red | (green << 8) | (blue << 16);
+    case NICKEL_PIXEL_BGRX:
+        return blue | (green << 8) | (red << 16);
+    default:
+        return fbcon_channel(red, boot_info->framebuffer_red_mask) |
+               fbcon_channel(green, boot_info->framebuffer_green_mask) |
+               fbcon_channel(blue, boot_info->framebuffer_blue_mask);
+    }
+}
+
+static void fbcon_damage(uint32_t left, uint32_t top, uint32_t right, uint32_t bottom) {
+    if (fbcon_dirty_top >= fbcon_dirty_bottom) {
+        fbcon_dirty_left = left;
+        fbcon_dirty_top = top;
+        fbcon_dirty_right = right;
+        fbcon_dirty_bottom = bottom;
+        return;
+    }
+
+    fbcon_dirty_left = left < fbcon_dirty_left ? left : fbcon_dirty_left;
+    fbcon_dirty_top = top < fbcon_dirty_top ? top : fbcon_dirty_top;
+    fbcon_dirty_right = right > fbcon_dirty_right ? right : fbcon_dirty_right;
+    fbcon_dirty_bottom = bottom > fbcon_dirty_bottom ? bottom : fbcon_dirty_bottom;
+}
+
+static void fbcon_fill(uint32_t *pixels, uint64_t count, uint32_t value) {
+    uint64_t i;
+
+    for (i = 0; i < count; ++i) {
+        pixels[i] = value;
+    }
+}
+
+static void fbcon_draw(uint32_t column, uint32_t row, char c) {
+    uint32_t *line = fbcon_back + (uint64_t)row * FBCON_GLYPH_HEIGHT * fbcon_width + column * FBCON_GLYPH_WIDTH;
+    uint32_t index = (uint8_t)c - FBCON_FONT_FIRST, y, x, bits;
+
+    if (index >= FBCON_FONT_GLYPHS) {
+        index = '?' - FBCON_FONT_FIRST;
+    }
+
+    for (y = 0; y < FBCON_GLYPH_HEIGHT; ++y, line += fbcon_width) {
+        bits = fbcon_font[index][y * FBCON_FONT_ROWS / FBCON_GLYPH_HEIGHT];
+        for (x = 0; x < FBCON_GLYPH_WIDTH; ++x) {
+            line[x] = (bits >> x) & 1 ? fbcon_foreground : fbcon_background;
+        }
+    }
+    fbcon_damage(column * FBCON_GLYPH_WIDTH, row * FBCON_GLYPH_HEIGHT, (column + 1) * FBCON_GLYPH_WIDTH,
+                 (row + 1) * FBCON_GLYPH_HEIGHT);
+}
+
+/**
+ * @brief Moves the back buffer up by one row of text and clears the last one. The framebuffer
+ *        is never read, the next flush rewrites all of it instead.
+ */
+static void fbcon_scroll(void) {
+    uint64_t row = (uint64_t)FBCON_GLYPH_HEIGHT * fbcon_width, count = row * (fbcon_rows - 1);
+
+    memmove(fbcon_back, fbcon_back + row, count * sizeof(uint32_t));
+    fbcon_fill(fbcon_back + count, row, fbcon_background);
+    fbcon_damage(0, 0, fbcon_width, fbcon_height);
+}
+
+static void fbcon_newline(void) {
+    fbcon_column = 0;
+    if (++fbcon_row == fbcon_rows) {
+        fbcon_scroll();
+        fbcon_row = fbcon_rows - 1;
+    }
+}
+
+/**
+ * @brief Maps the framebuffer the bootloader found write-combining and allocates the back
+ *        buffer text is drawn into. Must run after `pmm_init()`.
+ *
+ * @return `FBCON_SUCCESS` on success, one of `FBCON_*` errors otherwise; output then goes to
+ *         the UART alone.
+ */
+int32_t fbcon_init(struct nickel_boot_info *boot_info) {
+    uint64_t size, back;
+    uint32_t order = 0;
+
+    if (boot_info->framebuffer_base == 0 || boot_info->framebuffer_format >= NICKEL_PIXEL_BLT_ONLY) {
+        return FBCON_NOT_PRESENT;
+    } else if (boot_info->framebuffer_width < FBCON_GLYPH_WIDTH || boot_info->framebuffer_height < FBCON_GLYPH_HEIGHT ||
+               boot_info->framebuffer_stride < boot_info->framebuffer_width) {
+        return FBCON_UNSUPPORTED;
+    }
+
+    fbcon_columns = boot_info->framebuffer_width / FBCON_GLYPH_WIDTH;
+    fbcon_rows = boot_info->framebuffer_height / FBCON_GLYPH_HEIGHT;
+    fbcon_width = fbcon_columns * FBCON_GLYPH_WIDTH;
+    fbcon_height = fbcon_rows * FBCON_GLYPH_HEIGHT;
+    fbcon_pitch = boot_info->framebuffer_stride;
+
+    size = (uint64_t)fbcon_width * fbcon_height * sizeof(uint32_t);
+    while ((PAGE_SIZE << order) < size) {
+        ++order;
+    }
+    if (order > PMM_MAX_ORDER || (back = pmm_alloc(order)) == 0) {
+        return FBCON_NO_MEMORY;
+    }
+    fbcon_vram = paging_map_wc(boot_info->framebuffer_base, (uint64_t)fbcon_pitch * fbcon_height * sizeof(uint32_t));
+    if (fbcon_vram == NULL) {
+        pmm_free(back, order);
+        return FBCON_NO_MEMORY;
+    }
+
+    fbcon_back = phys_to_virt(back);
+    fbcon_foreground = fbcon_pixel(boot_info, FBCON_FOREGROUND);
+    fbcon_background = fbcon_pixel(boot_info, FBCON_BACKGROUND);
+    fbcon_fill(fbcon_back, size / sizeof(uint32_t), fbcon_background);
+    fbcon_column = fbcon_row = 0;
+    fbcon_damage(0, 0, fbcon_width, fbcon_height);                                  /* wipes whatever the firmware left */
+
+    printk("fbcon: %ux%u at 0x%lx, %ux%u characters, %lu KB back buffer\n", boot_info->framebuffer_width,
+           boot_info->framebuffer_height, boot_info->framebuffer_base, fbcon_columns, fbcon_rows,
+           (uint64_t)(PAGE_SIZE << order) >> 10);
+    return FBCON_SUCCESS;
+}
+
+/**
+ * @brief Draws `length` characters into the back buffer and widens the dirty rectangle. Nothing
+ *        reaches the screen until `fbcon_flush()`. The caller serializes, as for the UART.
+ */
+void fbcon_write(const char *buffer, uint64_t length) {
+    uint64_t i;
+
+    if (fbcon_back == NULL) {
+        return;
+    }
+
+    for (i = 0; i < length; ++i) {
+        switch (buffer[i]) {
+        case '\n':
+            fbcon_newline();
+            break;
+        case '\r':
+            fbcon_column = 0;
+            break;
+        case '\t':
+            fbcon_column = (fbcon_column + FBCON_TAB_WIDTH) & ~(FBCON_TAB_WIDTH - 1);
+            fbcon_column = fbcon_column < fbcon_columns ? fbcon_column : fbcon_columns;
+            break;
+        case '\b':
+            fbcon_column -= fbcon_column > 0;
+            break;
+        default:
+            if (fbcon_column == fbcon_columns) {                                    /* wraps only when there is more to draw */
+                fbcon_newline();
+            }
+            fbcon_draw(fbcon_column++, fbcon_row, buffer[i]);
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Copies `pixels` pixels, a multiple of `FBCON_GLYPH_WIDTH`, with `movnti`. Four 8-byte
+ *        stores fill half a write-combining buffer, the next four flush it whole.
+ */
+static void fbcon_copy_nt(volatile uint32_t *dst, const uint32_t *src, uint32_t pixels) {
+    volatile uint64_t *to = (volatile uint64_t *)dst;
+    const uint64_t *from = (const uint64_t *)src;
+    uint32_t i;
+
+    for (i = 0; i < pixels / 2; i += 4) {
+        asm volatile ("movnti %1, %0\n" : "=m"(to[i + 0]) : "r"(from[i + 0]));
+        asm volatile ("movnti %1, %0\n" : "=m"(to[i + 1]) : "r"(from[i + 1]));
+        asm volatile ("movnti %1, %0\n" : "=m"(to[i + 2]) : "r"(from[i + 2]));
+        asm volatile ("movnti %1, %0\n" : "=m"(to[i + 3]) : "r"(from[i + 3]));
+    }
+}
+
+/**
+ * @brief Copies the dirty rectangle of the back buffer to the framebuffer with non-temporal
+ *        stores, which never read the framebuffer and fill whole write-combining lines.
+ */
+void fbcon_flush(void) {
+    uint32_t y;
+
+    if (fbcon_vram == NULL || fbcon_dirty_top >= fbcon_dirty_bottom) {
+        return;
+    }
+
+    for (y = fbcon_dirty_top; y < fbcon_dirty_bottom; ++y) {
+        fbcon_copy_nt(fbcon_vram + (uint64_t)y * fbcon_pitch + fbcon_dirty_left,
+                      fbcon_back + (uint64_t)y * fbcon_width + fbcon_dirty_left, fbcon_dirty_right - fbcon_dirty_left);
+    }
+    asm volatile ("sfence\n" : : : "memory");                                       /* drains the write-combining buffers */
+    fbcon_dirty_top = fbcon_dirty_bottom = 0;
+}
+
+#if defined(NICKEL_BENCH)
+#define FBCON_BENCH_LINES               4096
+
+/**
+ * @brief Writes `FBCON_BENCH_LINES` lines of `length` characters, flushing after every
+ *        `PRINTK_DRAIN_BATCH` lines as the printk drain does.
+ *
+ * @return The time taken in TSC cycles.
+ */
+static uint64_t fbcon_bench_lines(uint32_t length) {
+    char line[PRINTK_BUFFER_SIZE];
+    uint64_t start;
+    uint32_t i;
+
+    for (i = 0; i < length; ++i) {
+        line[i] = (char)(FBCON_FONT_FIRST + i % FBCON_FONT_GLYPHS);
+    }
+    line[length] = '\n';
+
+    start = rdtsc();
+    for (i = 0; i < FBCON_BENCH_LINES; ++i) {
+        fbcon_write(line, length + 1);
+        if ((i + 1) % PRINTK_DRAIN_BATCH == 0) {
+            fbcon_flush();
+        }
+    }
+    fbcon_flush();
+    return rdtsc() - start;
+}
+
+/**
+ * @brief Writes lines to the console in bursts the size of a printk drain, flushing after
+ *        each, and prints the throughput in lines per second for half and full width lines.
+ *        Every run scrolls the whole screen many times over.
+ */
+void fbcon_bench(void) {
+    uint64_t flags, lines, full, start, screen;
+    uint32_t length;
+
+    if (fbcon_vram == NULL) {
+        printk("fbcon: no framebuffer\n");
+        return;
+    }
+
+    length = fbcon_columns < PRINTK_BUFFER_SIZE - 1 ? fbcon_columns : PRINTK_BUFFER_SIZE - 1;
+    flags = printk_console_lock();
+    lines = tsc_to_ns(fbcon_bench_lines(length / 2));
+    full = tsc_to_ns(fbcon_bench_lines(length - 1));
+    fbcon_damage(0, 0, fbcon_width, fbcon_height);
+    start = rdtsc();
+    fbcon_flush();
+    screen = tsc_to_ns(rdtsc() - start);
+    printk_console_unlock(flags);
+
+    printk("fbcon: %u lines of %u chars, %lu lines/s\n", FBCON_BENCH_LINES, length / 2,
+           FBCON_BENCH_LINES * 1000000000UL / (lines ? lines : 1));
+    printk("fbcon: %u lines of %u chars, %lu lines/s\n", FBCON_BENCH_LINES, length - 1,
+           FBCON_BENCH_LINES * 1000000000UL / (full ? full : 1));
+    printk("fbcon: full screen flush %lu us, %lu MB/s\n", screen / 1000,
+           (uint64_t)fbcon_width * fbcon_height * sizeof(uint32_t) * 1000 / (screen ? screen : 1));
+}
+#endif
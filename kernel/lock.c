@@ -0,0 +1,158 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include <lock.h>
+#include <lock_stat.h>
+#include <printk.h>
+#include <smp.h>
+#include <spinlock.h>
+
+#include <arch/cpu.h>
+#include <arch/tsc.h>
+
+#if defined(NICKEL_LOCK_STATS)
+static struct lock_class *lock_classes = NULL;
+
+/**
+ * @brief Adds `class` to the list `lock_stat_print()` walks. Lock-free, since it is called
+ *        from the acquisition path of every lock kind.
+ */
+void lock_stat_register(struct lock_class *class) {
+    if (__atomic_exchange_n(&class->registered, 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    class->next = __atomic_load_n(&lock_classes, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&lock_classes, &class->next, class, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/**
+ * @brief Prints the statistics of every class that was acquired at least once.
+ */
+void lock_stat_print(void) {
+    struct lock_class *class;
+
+    for (class = __atomic_load_n(&lock_classes, __ATOMIC_ACQUIRE); class != NULL; class = class->next) {
+        printk("lock: %-16s %lu acquired, %lu contended, longest hold %lu ns\n", class->name, class->acquired,
+               class->contended, tsc_to_ns(class->max_hold));
+    }
+}
+#endif
+
+#if defined(NICKEL_BENCH)
+#define LOCK_BENCH_MS                   20
+#define LOCK_BENCH_MAX_CPUS             8
+#define LOCK_BENCH_IDLE                 (~0ULL)                                     /* count of a CPU that did not take part */
+
+enum lock_bench_kind {
+    LOCK_BENCH_SPINLOCK,
+    LOCK_BENCH_TICKET,
+    LOCK_BENCH_MCS,
+    LOCK_BENCH_WRITE,
+    LOCK_BENCH_READ,
+    LOCK_BENCH_KINDS
+};
+
+static const char *const lock_bench_names[LOCK_BENCH_KINDS] = {
+    "spinlock", "ticket", "mcs", "rwlock write", "rwlock read"
+};
+
+static struct lock_class lock_bench_class = LOCK_CLASS_INIT("lock_bench");
+static struct spinlock lock_bench_spinlock __cacheline_aligned = SPINLOCK_INIT_CLASS(lock_bench_class);
+static struct ticket_lock lock_bench_ticket __cacheline_aligned = TICKET_LOCK_INIT_CLASS(lock_bench_class);
+static struct mcs_lock lock_bench_mcs __cacheline_aligned = MCS_LOCK_INIT_CLASS(lock_bench_class);
+static struct rwlock lock_bench_rwlock __cacheline_aligned = RWLOCK_INIT_CLASS(lock_bench_class);
+static volatile uint64_t lock_bench_shared __cacheline_aligned;                     /* what the critical sections update */
+static uint32_t lock_bench_cpus;
+static volatile uint32_t lock_bench_ready;
+static volatile uint64_t lock_bench_deadline;                                       /* 0 until the last CPU arrived */
+static uint64_t lock_bench_counts[SMP_MAX_CPUS];
+
+/**
+ * @brief Takes and releases the lock of `kind` until the deadline, updating a shared line in
+ *        the critical section. Every CPU starts at the same moment once all have arrived.
+ */
+static void lock_bench_worker(void *arg) {
+    enum lock_bench_kind kind = (enum lock_bench_kind)(uint64_t)arg;
+    struct mcs_node node;
+    uint64_t count = 0, deadline;
+
+    if (__atomic_add_fetch(&lock_bench_ready, 1, __ATOMIC_ACQ_REL) == lock_bench_cpus) {
+        __atomic_store_n(&lock_bench_deadline, rdtsc() + tsc_frequency / 1000 * LOCK_BENCH_MS, __ATOMIC_RELEASE);
+    }
+    while ((deadline = __atomic_load_n(&lock_bench_deadline, __ATOMIC_ACQUIRE)) == 0) {
+        cpu_relax();
+    }
+
+    while (rdtsc() < deadline) {
+        switch (kind) {
+        case LOCK_BENCH_SPINLOCK:
+            spin_lock(&lock_bench_spinlock);
+            ++lock_bench_shared;
+            spin_unlock(&lock_bench_spinlock);
+            break;
+        case LOCK_BENCH_TICKET:
+            ticket_lock(&lock_bench_ticket);
+            ++lock_bench_shared;
+            ticket_unlock(&lock_bench_ticket);
+            break;
+        case LOCK_BENCH_MCS:
+            mcs_lock(&lock_bench_mcs, &node);
+            ++lock_bench_shared;
+            mcs_unlock(&lock_bench_mcs, &node);
+            break;
+        case LOCK_BENCH_WRITE:
+            write_lock(&lock_bench_rwlock);
+            ++lock_bench_shared;
+            write_unlock(&lock_bench_rwlock);
+            break;
+        case LOCK_BENCH_READ:
+        default:
+            read_lock(&lock_bench_rwlock);
+            (void)lock_bench_shared;
+            read_unlock(&lock_bench_rwlock);
+            break;
+        }
+        ++count;
+    }
+    lock_bench_counts[smp_processor_id()] = count;
+}
+
+/**
+ * @brief Runs 1 to 8 CPUs against one lock of every kind and prints the throughput and how
+ *        evenly the acquisitions were spread over the CPUs.
+ */
+void lock_bench(void) {
+    uint64_t total, min, max;
+    uint32_t kind, count, cpu;
+
+    for (kind = 0; kind < LOCK_BENCH_KINDS; ++kind) {
+        for (count = 1; count <= LOCK_BENCH_MAX_CPUS && count <= smp_online_count; count <<= 1) {
+            for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+                lock_bench_counts[cpu] = LOCK_BENCH_IDLE;
+            }
+            lock_bench_cpus = count;
+            lock_bench_ready = 0;
+            lock_bench_deadline = 0;
+            smp_run_on_cpus(lock_bench_worker, (void *)(uint64_t)kind, count);
+
+            total = 0;
+            min = LOCK_BENCH_IDLE;
+            max = 0;
+            for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+                if (lock_bench_counts[cpu] == LOCK_BENCH_IDLE) {
+                    continue;
+                }
+                total += lock_bench_counts[cpu];
+                min = lock_bench_counts[cpu] < min ? lock_bench_counts[cpu] : min;
+                max = lock_bench_counts[cpu] > max ? lock_bench_counts[cpu] : max;
+            }
+            printk("lock: %-12s %u cpus, %lu k/s, fairness %lu%% (min/max)\n", lock_bench_names[kind], count,
+                   total / LOCK_BENCH_MS, max ? min * 100 / max : 0);
+        }
+    }
+
+#if defined(NICKEL_LOCK_STATS)
+    lock_stat_print();
+#endif
+}
+#endif
@@ -0,0 +1,758 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mm/pmm.h>
+#include <numa.h>
+#include <printk.h>
+#include <smp.h>
+#include <spinlock.h>
+
+#include <arch/cpu.h>
+#include <arch/paging.h>
+#include <arch/tsc.h>
+
+/**
+ * @brief Free list of a single order. `count` is in blocks, not pages.
+ */
+struct pmm_free_area {
+    struct list_head list;
+    uint64_t count;
+};
+
+/**
+ * @brief Buddy allocator of one NUMA node. A block never spans two nodes, so buddies only
+ *        merge within one.
+ */
+struct pmm_node {
+    struct spinlock lock;
+    struct pmm_free_area free_areas[PMM_ORDER_COUNT];
+    uint32_t free_mask;                                                             /* bit n is set iff free_areas[n] is not empty */
+    uint64_t free_pages;
+    uint64_t managed_pages;
+} __cacheline_aligned;
+
+struct page *mem_map = NULL;
+uint64_t max_pfn = 0;
+
+static struct pmm_node pmm_nodes[NUMA_MAX_NODES];
+static struct lock_class pmm_lock_class = LOCK_CLASS_INIT("pmm");
+
+/**
+ * @brief Per-CPU cache of hot single pages. Only its own CPU touches it, with interrupts off,
+ *        so it needs no lock; it refills from and drains to the buddy lists in batches.
+ */
+struct pmm_pcp {
+    struct list_head list;                                                          /* LIFO, so the last freed page is the hottest */
+    uint32_t count;
+    uint32_t low;                                                                   /* refill when `count` drops to this */
+    uint32_t high;                                                                  /* drain when `count` reaches this */
+    uint32_t batch;                                                                 /* pages moved per refill or drain */
+    uint64_t refills;
+    uint64_t drains;
+} __cacheline_aligned;
+
+static struct pmm_pcp pcps[SMP_MAX_CPUS];
+static int pcp_enabled = 0;
+
+static struct nickel_memory_descriptor memory_map[PMM_MAX_MEMORY_DESCRIPTORS];
+static uint32_t memory_map_count = 0;
+
+extern uint8_t __kernel_start[], __kernel_end[];
+
+static inline int pmm_is_boot_memory(uint32_t type) {
+    return type == NICKEL_MEMORY_LOADER_CODE
+        || type == NICKEL_MEMORY_LOADER_DATA
+        || type == NICKEL_MEMORY_BOOT_SERVICES_CODE
+        || type == NICKEL_MEMORY_BOOT_SERVICES_DATA;
+}
+
+static inline uint64_t pmm_descriptor_end(const struct nickel_memory_descriptor *desc) {
+    return desc->physical_start + desc->number_of_pages * NICKEL_MEMORY_PAGE_SIZE;
+}
+
+static void pmm_free_area_add(struct pmm_node *node, struct page *page, uint32_t order) {
+    page->flags |= PAGE_FLAG_FREE;
+    page->order = order;
+    list_add(&page->list, &node->free_areas[order].list);
+    ++node->free_areas[order].count;
+    node->free_mask |= 1U << order;
+}
+
+static void pmm_free_area_del(struct pmm_node *node, struct page *page, uint32_t order) {
+    list_del(&page->list);
+    page->flags &= ~PAGE_FLAG_FREE;
+    if (--node->free_areas[order].count == 0) {
+        node->free_mask &= ~(1U << order);
+    }
+}
+
+static inline struct pmm_node *pmm_page_node(const struct page *page) {
+    return &pmm_nodes[page->node];
+}
+
+/**
+ * @brief Inserts a block into the free lists of its node, merging it with its buddy as long
+ *        as the buddy is free, of the same order and on the same node. The caller must hold
+ *        the lock of that node.
+ */
+static void __pmm_free_block(uint64_t pfn, uint32_t order) {
+    struct pmm_node *node = pmm_page_node(pfn_to_page(pfn));
+    uint64_t buddy_pfn;
+    struct page *buddy;
+
+    node->free_pages += 1ULL << order;
+    for (; order < PMM_MAX_ORDER; ++order) {
+        buddy_pfn = pfn ^ (1ULL << order);
+        if (buddy_pfn >= max_pfn) {
+            break;
+        }
+
+        buddy = pfn_to_page(buddy_pfn);
+        if (!(buddy->flags & PAGE_FLAG_FREE) || buddy->order != order || pmm_page_node(buddy) != node) {
+            break;                                                                  /* only a head page carries the free flag */
+        }
+
+        pmm_free_area_del(node, buddy, order);
+        pfn &= ~(1ULL << order);
+    }
+
+    pmm_free_area_add(node, pfn_to_page(pfn), order);
+}
+
+static void pmm_lock_all(void) {
+    uint32_t node;
+
+    for (node = 0; node < NUMA_MAX_NODES; ++node) {                                 /* always in node order */
+        spin_lock(&pmm_nodes[node].lock);
+    }
+}
+
+static uint64_t pmm_managed_page_count(void) {
+    uint64_t count = 0;
+    uint32_t node;
+
+    for (node = 0; node < NUMA_MAX_NODES; ++node) {
+        count += pmm_nodes[node].managed_pages;
+    }
+    return count;
+}
+
+static void pmm_unlock_all(void) {
+    uint32_t node;
+
+    for (node = NUMA_MAX_NODES; node-- > 0;) {
+        spin_unlock(&pmm_nodes[node].lock);
+    }
+}
+
+/**
+ * @brief Releases `[start, end)`, which lies on one node, as the largest naturally aligned
+ *        blocks that fit.
+ */
+static void pmm_release_run(uint64_t start, uint64_t end) {
+    uint32_t order;
+
+    while (start < end) {
+        order = start ? (uint32_t)__builtin_ctzll(start) : PMM_MAX_ORDER;
+        order = order > PMM_MAX_ORDER ? PMM_MAX_ORDER : order;
+        while ((1ULL << order) > end - start) {
+            --order;
+        }
+
+        __pmm_free_block(start, order);
+        start += 1ULL << order;
+    }
+}
+
+/**
+ * @brief Hands the frames in `[start_pfn, end_pfn)` to the allocator, skipping pinned frames
+ *        and frames that are already managed. The caller must hold the lock of every node.
+ */
+static void pmm_add_range(uint64_t start_pfn, uint64_t end_pfn) {
+    uint64_t pfn, run_start = 0;
+    int in_run = 0;
+    struct page *page;
+
+    end_pfn = end_pfn > max_pfn ? max_pfn : end_pfn;
+    for (pfn = start_pfn; pfn < end_pfn; ++pfn) {
+        page = pfn_to_page(pfn);
+        if (in_run && page->node != pfn_to_page(run_start)->node) {                 /* runs end at node boundaries */
+            pmm_release_run(run_start, pfn);
+            in_run = 0;
+        }
+        if ((page->flags & PAGE_FLAG_PINNED) || !(page->flags & PAGE_FLAG_RESERVED)) {
+            if (in_run) {
+                pmm_release_run(run_start, pfn);
+                in_run = 0;
+            }
+            continue;
+        }
+
+        page->flags &= ~PAGE_FLAG_RESERVED;
+        ++pmm_page_node(page)->managed_pages;
+        if (!in_run) {
+            run_start = pfn;
+            in_run = 1;
+        }
+    }
+
+    if (in_run) {
+        pmm_release_run(run_start, end_pfn);
+    }
+}
+
+/**
+ * @brief Takes a block of `order` out of the free lists of `node`, splitting a larger one if
+ *        needed. The caller must hold the lock of `node`.
+ */
+static struct page *__pmm_alloc_block(struct pmm_node *node, uint32_t order) {
+    struct page *page;
+    uint32_t current, mask;
+
+    mask = node->free_mask & ~((1U << order) - 1);
+    if (mask == 0) {
+        return NULL;
+    }
+
+    current = (uint32_t)__builtin_ctz(mask);                                        /* smallest order that can satisfy us */
+    page = list_first_entry(&node->free_areas[current].list, struct page, list);
+    pmm_free_area_del(node, page, current);
+    while (current > order) {                                                       /* returns the upper halves while splitting */
+        --current;
+        pmm_free_area_add(node, page + (1ULL << current), current);
+    }
+
+    page->order = order;
+    node->free_pages -= 1ULL << order;
+    return page;
+}
+
+/**
+ * @brief Moves up to `pcp->batch` single pages from the buddy lists into the cache, from the
+ *        node of the calling CPU first and from the others by distance, under one acquisition
+ *        of each node lock. Interrupts must be off.
+ */
+static void pmm_pcp_refill(struct pmm_pcp *pcp) {
+    const uint8_t *fallback = numa_fallback[numa_node_id()];
+    struct pmm_node *node;
+    struct page *page;
+    uint32_t i = 0, n;
+
+    for (n = 0; n < numa_node_count && i < pcp->batch; ++n) {
+        node = &pmm_nodes[fallback[n]];
+        spin_lock(&node->lock);
+        for (; i < pcp->batch; ++i) {
+            if ((page = __pmm_alloc_block(node, 0)) == NULL) {
+                break;
+            }
+            list_add_tail(&page->list, &pcp->list);                                 /* the hot end stays at the head */
+        }
+        spin_unlock(&node->lock);
+    }
+
+    pcp->count += i;
+    ++pcp->refills;
+}
+
+/**
+ * @brief Returns up to `count` of the coldest pages to the buddy lists of their nodes, taking
+ *        a node lock only when the node changes. Interrupts must be off.
+ */
+static void pmm_pcp_drain(struct pmm_pcp *pcp, uint32_t count) {
+    struct pmm_node *node, *locked = NULL;
+    struct page *page;
+
+    for (; count > 0 && pcp->count > 0; --count, --pcp->count) {
+        page = list_entry(pcp->list.prev, struct page, list);
+        node = pmm_page_node(page);
+        if (node != locked) {
+            if (locked != NULL) {
+                spin_unlock(&locked->lock);
+            }
+            spin_lock(&node->lock);
+            locked = node;
+        }
+        list_del(&page->list);
+        __pmm_free_block(page_to_pfn(page), 0);
+    }
+    if (locked != NULL) {
+        spin_unlock(&locked->lock);
+    }
+
+    ++pcp->drains;
+}
+
+static struct page *pmm_pcp_alloc(void) {
+    struct pmm_pcp *pcp;
+    struct page *page = NULL;
+    uint64_t flags;
+
+    flags = arch_irq_save();                                                        /* pins us to this CPU's cache */
+    pcp = &pcps[smp_processor_id()];
+    if (pcp->count <= pcp->low) {
+        pmm_pcp_refill(pcp);
+    }
+
+    if (pcp->count > 0) {
+        page = list_first_entry(&pcp->list, struct page, list);
+        list_del(&page->list);
+        page->order = 0;
+        --pcp->count;
+    }
+    arch_irq_restore(flags);
+    return page;
+}
+
+/**
+ * @brief Caches a freed single page on the calling CPU. A page of another node goes straight
+ *        back to its buddy lists, or `pmm_pcp_alloc()` would hand it out as a local one.
+ */
+static void pmm_pcp_free(struct page *page) {
+    struct pmm_node *node;
+    struct pmm_pcp *pcp;
+    uint64_t flags;
+
+    flags = arch_irq_save();
+    if (page->node != numa_node_id()) {
+        node = pmm_page_node(page);
+        spin_lock(&node->lock);
+        __pmm_free_block(page_to_pfn(page), 0);
+        spin_unlock(&node->lock);
+        arch_irq_restore(flags);
+        return;
+    }
+
+    pcp = &pcps[smp_processor_id()];
+    list_add(&page->list, &pcp->list);
+    if (++pcp->count >= pcp->high) {
+        pmm_pcp_drain(pcp, pcp->batch);
+    }
+    arch_irq_restore(flags);
+}
+
+static void pmm_pin_range(uint64_t start, uint64_t end) {
+    uint64_t pfn = start >> PAGE_SHIFT, end_pfn = (end + PAGE_SIZE - 1) >> PAGE_SHIFT;
+
+    for (end_pfn = end_pfn > max_pfn ? max_pfn : end_pfn; pfn < end_pfn; ++pfn) {
+        mem_map[pfn].flags |= PAGE_FLAG_PINNED | PAGE_FLAG_RESERVED;
+    }
+}
+
+/**
+ * @brief Builds the buddy allocator from the firmware memory map. Only conventional memory
+ *        is handed out at this point; loader and boot services memory stays reserved until
+ *        `pmm_reclaim_boot_memory()`.
+ *
+ * @param boot_info Boot information passed from the bootloader.
+ * @return `PMM_SUCCESS` on success, one of `PMM_*` errors otherwise.
+ */
+int32_t pmm_init(const struct nickel_boot_info *boot_info) {
+    const struct nickel_memory_descriptor *desc, *best = NULL;
+    uint64_t i, count, end, mem_map_bytes, mem_map_start, rsp;
+    uint32_t node;
+
+    if (boot_info->memory_map == 0 || boot_info->descriptor_size < sizeof(struct nickel_memory_descriptor)) {
+        return PMM_INVALID_PARAMETER;
+    }
+
+    count = boot_info->memory_map_size / boot_info->descriptor_size;
+    if (count > PMM_MAX_MEMORY_DESCRIPTORS) {
+        return PMM_MAP_TOO_LARGE;
+    }
+
+    for (i = 0; i < count; ++i) {                                                   /* the map lives in loader data, copy it out */
+        desc = phys_to_virt(boot_info->memory_map + i * boot_info->descriptor_size);
+        memory_map[i] = *desc;
+
+        if (desc->type == NICKEL_MEMORY_CONVENTIONAL || pmm_is_boot_memory(desc->type)) {
+            end = pmm_descriptor_end(desc) >> PAGE_SHIFT;
+            max_pfn = end > max_pfn ? end : max_pfn;
+        }
+    }
+    memory_map_count = (uint32_t)count;
+
+    mem_map_bytes = (max_pfn * sizeof(struct page) + PAGE_SIZE - 1) & PAGE_MASK;
+    for (i = 0; i < memory_map_count; ++i) {                                        /* places `mem_map` in the largest free region */
+        desc = &memory_map[i];
+        if (desc->type != NICKEL_MEMORY_CONVENTIONAL || desc->physical_start < PMM_LOW_MEMORY_LIMIT) {
+            continue;
+        } else if (desc->number_of_pages * NICKEL_MEMORY_PAGE_SIZE < mem_map_bytes) {
+            continue;
+        } else if (best == NULL || desc->number_of_pages > best->number_of_pages) {
+            best = desc;
+        }
+    }
+    if (best == NULL) {
+        return PMM_NO_MEMORY;
+    }
+
+    mem_map_start = best->physical_start;
+    mem_map = phys_to_virt(mem_map_start);
+    for (i = 0; i < max_pfn; ++i) {
+        mem_map[i].flags = PAGE_FLAG_RESERVED;
+        mem_map[i].order = 0;
+        mem_map[i].node = 0;                                                        /* until `numa_init()` knows better */
+        mem_map[i].private = NULL;
+        list_init(&mem_map[i].list);
+    }
+
+    for (node = 0; node < NUMA_MAX_NODES; ++node) {
+        spin_lock_init(&pmm_nodes[node].lock);
+        lock_stat_set_class(&pmm_nodes[node].lock, &pmm_lock_class);
+        for (i = 0; i < PMM_ORDER_COUNT; ++i) {
+            list_init(&pmm_nodes[node].free_areas[i].list);
+        }
+    }
+
+    pmm_pin_range(0, PMM_LOW_MEMORY_LIMIT);
+    pmm_pin_range(virt_to_phys(__kernel_start), virt_to_phys(__kernel_end));
+    pmm_pin_range(mem_map_start, mem_map_start + mem_map_bytes);
+
+    rsp = virt_to_phys((void *)read_rsp());                                         /* we are still running on the firmware stack */
+    for (i = 0; i < memory_map_count; ++i) {
+        desc = &memory_map[i];
+        if (rsp >= desc->physical_start && rsp < pmm_descriptor_end(desc)) {
+            pmm_pin_range(desc->physical_start, pmm_descriptor_end(desc));
+        }
+    }
+
+    pmm_lock_all();
+    for (i = 0; i < memory_map_count; ++i) {
+        desc = &memory_map[i];
+        if (desc->type == NICKEL_MEMORY_CONVENTIONAL) {
+            pmm_add_range(desc->physical_start >> PAGE_SHIFT, pmm_descriptor_end(desc) >> PAGE_SHIFT);
+        }
+    }
+    pmm_unlock_all();
+
+    printk("pmm: %lu descriptors, max pfn 0x%lx, mem_map %lu KB at 0x%lx\n",
+           count, max_pfn, mem_map_bytes >> 10, mem_map_start);
+    printk("pmm: %lu MB free of %lu MB managed\n", pmm_free_page_count() >> (20 - PAGE_SHIFT),
+           pmm_managed_page_count() >> (20 - PAGE_SHIFT));
+    return PMM_SUCCESS;
+}
+
+/**
+ * @brief Moves every free block to the lists of its NUMA node, splitting blocks that span
+ *        two. Called by `numa_init()` once the memory ranges of the nodes are known.
+ */
+void pmm_numa_init(void) {
+    struct list_head blocks;
+    struct pmm_node *node;
+    struct page *page;
+    uint64_t pfn, end, start, flags;
+    uint32_t i, order;
+
+    flags = arch_irq_save();
+    pmm_lock_all();
+    for (i = 0; i < numa_memory_range_count; ++i) {
+        end = numa_memory_ranges[i].end >> PAGE_SHIFT;
+        for (pfn = numa_memory_ranges[i].start >> PAGE_SHIFT; pfn < end && pfn < max_pfn; ++pfn) {
+            mem_map[pfn].node = (uint8_t)numa_memory_ranges[i].node;
+        }
+    }
+
+    list_init(&blocks);                                                             /* unhooks every free block first, so none */
+    for (pfn = 0; pfn < max_pfn; ++pfn) {                                           /* merges with one still on an old list */
+        page = pfn_to_page(pfn);
+        if (page->flags & PAGE_FLAG_FREE) {
+            page->flags &= ~PAGE_FLAG_FREE;
+            list_add_tail(&page->list, &blocks);
+            pfn += (1ULL << page->order) - 1;
+        }
+    }
+    for (i = 0; i < NUMA_MAX_NODES; ++i) {
+        node = &pmm_nodes[i];
+        for (order = 0; order < PMM_ORDER_COUNT; ++order) {
+            list_init(&node->free_areas[order].list);
+            node->free_areas[order].count = 0;
+        }
+        node->free_mask = 0;
+        node->free_pages = node->managed_pages = 0;
+    }
+
+    for (pfn = 0; pfn < max_pfn; ++pfn) {
+        page = pfn_to_page(pfn);
+        if (!(page->flags & PAGE_FLAG_RESERVED)) {
+            ++pmm_page_node(page)->managed_pages;
+        }
+    }
+    while (!list_empty(&blocks)) {
+        page = list_first_entry(&blocks, struct page, list);
+        list_del(&page->list);
+        start = page_to_pfn(page);
+        end = start + (1ULL << page->order);
+        for (pfn = start; pfn < end; ++pfn) {
+            if (pfn_to_page(pfn)->node != pfn_to_page(start)->node) {
+                pmm_release_run(start, pfn);
+                start = pfn;
+            }
+        }
+        pmm_release_run(start, end);
+    }
+    pmm_unlock_all();
+    arch_irq_restore(flags);
+}
+
+/**
+ * @brief Hands loader and boot services memory to the allocator. Call it only after the kernel
+ *        copied out everything it needs from the boot information and firmware tables. The
+ *        kernel image, the current stack and the active page tables stay reserved.
+ */
+void pmm_reclaim_boot_memory(void) {
+    uint64_t flags, before;
+    uint32_t i;
+
+    flags = arch_irq_save();
+    pmm_lock_all();
+    before = pmm_managed_page_count();
+    for (i = 0; i < memory_map_count; ++i) {
+        if (pmm_is_boot_memory(memory_map[i].type)) {
+            pmm_add_range(memory_map[i].physical_start >> PAGE_SHIFT, pmm_descriptor_end(&memory_map[i]) >> PAGE_SHIFT);
+        }
+    }
+    before = pmm_managed_page_count() - before;
+    pmm_unlock_all();
+    arch_irq_restore(flags);
+
+    printk("pmm: reclaimed %lu KB of boot memory\n", before << (PAGE_SHIFT - 10));
+}
+
+/**
+ * @brief Puts a per-CPU cache of single pages in front of the buddy lists for every CPU in the
+ *        MADT. Must run after `smp_init()`.
+ */
+void pmm_pcp_init(void) {
+    uint32_t cpu;
+
+    for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+        list_init(&pcps[cpu].list);
+        pcps[cpu].count = 0;
+        pcps[cpu].low = PMM_PCP_LOW;
+        pcps[cpu].high = PMM_PCP_HIGH;
+        pcps[cpu].batch = PMM_PCP_BATCH;
+        pcps[cpu].refills = pcps[cpu].drains = 0;
+    }
+    __atomic_store_n(&pcp_enabled, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Returns every page cached by the calling CPU to the buddy lists, e.g. before it goes
+ *        offline or when a large block cannot be found.
+ */
+void pmm_pcp_drain_local(void) {
+    struct pmm_pcp *pcp;
+    uint64_t flags;
+
+    if (!pcp_enabled) {
+        return;
+    }
+
+    flags = arch_irq_save();
+    pcp = &pcps[smp_processor_id()];
+    pmm_pcp_drain(pcp, pcp->count);
+    arch_irq_restore(flags);
+}
+
+/**
+ * @brief Like `pmm_alloc_pages()`, but prefers `node` over the node of the calling CPU. Single
+ *        pages bypass the per-CPU cache.
+ */
+struct page *pmm_alloc_pages_node(uint32_t order, uint32_t node) {
+    struct pmm_node *pmm_node;
+    struct page *page = NULL;
+    uint64_t flags;
+    uint32_t n;
+
+    if (order > PMM_MAX_ORDER || node >= numa_node_count) {
+        return NULL;
+    }
+
+    for (n = 0; n < numa_node_count && page == NULL; ++n) {
+        pmm_node = &pmm_nodes[numa_fallback[node][n]];
+        spin_lock_irqsave(&pmm_node->lock, flags);
+        page = __pmm_alloc_block(pmm_node, order);
+        spin_unlock_irqrestore(&pmm_node->lock, flags);
+    }
+    return page;
+}
+
+/**
+ * @brief Allocates `2^order` physically contiguous frames, aligned to their size, from the
+ *        node of the calling CPU or else from the nearest node that has a block.
+ *
+ * @return The head page of the block, or `NULL` if no block is large enough.
+ */
+struct page *pmm_alloc_pages(uint32_t order) {
+    if (order == 0 && pcp_enabled) {
+        return pmm_pcp_alloc();
+    }
+    return pmm_alloc_pages_node(order, numa_node_id());
+}
+
+/**
+ * @brief Returns a block to the allocator, merging it with its free buddies.
+ */
+void pmm_free_pages(struct page *page, uint32_t order) {
+    struct pmm_node *node;
+    uint64_t flags;
+
+    if (page == NULL || order > PMM_MAX_ORDER) {
+        return;
+    } else if (order == 0 && pcp_enabled) {
+        pmm_pcp_free(page);
+        return;
+    }
+
+    node = pmm_page_node(page);
+    spin_lock_irqsave(&node->lock, flags);
+    __pmm_free_block(page_to_pfn(page), order);
+    spin_unlock_irqrestore(&node->lock, flags);
+}
+
+uint64_t pmm_alloc(uint32_t order) {
+    struct page *page = pmm_alloc_pages(order);
+    return page ? page_to_phys(page) : 0;
+}
+
+void pmm_free(uint64_t phys, uint32_t order) {
+    if (phys != 0) {
+        pmm_free_pages(phys_to_page(phys), order);
+    }
+}
+
+/**
+ * @brief Like `pmm_alloc()`, but prefers `node` over the node of the calling CPU.
+ */
+uint64_t pmm_alloc_node(uint32_t order, uint32_t node) {
+    struct page *page = pmm_alloc_pages_node(order, node);
+    return page ? page_to_phys(page) : 0;
+}
+
+/**
+ * @brief Gets the number of free 4KB frames in the buddy lists. Pages parked in the per-CPU
+ *        caches are not included.
+ */
+uint64_t pmm_free_page_count(void) {
+    uint64_t count = 0;
+    uint32_t node;
+
+    for (node = 0; node < NUMA_MAX_NODES; ++node) {
+        count += __atomic_load_n(&pmm_nodes[node].free_pages, __ATOMIC_RELAXED);
+    }
+    return count;
+}
+
+/**
+ * @brief Gets the number of free 4KB frames of one NUMA node in the buddy lists.
+ */
+uint64_t pmm_node_free_page_count(uint32_t node) {
+    return node < NUMA_MAX_NODES ? __atomic_load_n(&pmm_nodes[node].free_pages, __ATOMIC_RELAXED) : 0;
+}
+
+/**
+ * @brief Gets the firmware memory map as copied by `pmm_init()`.
+ *
+ * @param count Receives the number of descriptors.
+ */
+const struct nickel_memory_descriptor *pmm_memory_map(uint32_t *count) {
+    *count = memory_map_count;
+    return memory_map;
+}
+
+#if defined(NICKEL_BENCH)
+#define PMM_BENCH_BLOCKS                64
+
+/**
+ * @brief Measures the latency of allocating and freeing blocks of every order and prints a
+ *        table over the serial console.
+ */
+void pmm_bench(void) {
+    static uint64_t blocks[PMM_BENCH_BLOCKS];
+    uint64_t start, alloc_cycles, free_cycles, size_kb;
+    uint32_t order, n, i;
+
+    printk("pmm: bench %u blocks per order\n", PMM_BENCH_BLOCKS);
+    printk("pmm: order     size  blocks  alloc(ns)   free(ns)\n");
+    for (order = 0; order <= PMM_MAX_ORDER; ++order) {
+        start = rdtsc();
+        for (n = 0; n < PMM_BENCH_BLOCKS; ++n) {
+            if ((blocks[n] = pmm_alloc(order)) == 0) {
+                break;
+            }
+        }
+        alloc_cycles = rdtsc() - start;
+
+        start = rdtsc();
+        for (i = 0; i < n; ++i) {
+            pmm_free(blocks[i], order);
+        }
+        free_cycles = rdtsc() - start;
+
+        size_kb = (PAGE_SIZE >> 10) << order;
+        if (n == 0) {
+            printk("pmm: %5u %7luK       0          -          -\n", order, size_kb);
+            continue;
+        }
+        printk("pmm: %5u %7luK %7u %10lu %10lu\n", order, size_kb, n,
+               tsc_to_ns(alloc_cycles) / n, tsc_to_ns(free_cycles) / n);
+    }
+}
+
+#define PMM_PCP_BENCH_MS                200
+#define PMM_PCP_BENCH_DEPTH             16                                          /* pages held per iteration */
+
+struct pmm_pcp_bench_arg {
+    uint64_t deadline;
+    volatile uint64_t pages;
+};
+
+static void pmm_pcp_bench_worker(void *param) {
+    struct pmm_pcp_bench_arg *arg = param;
+    struct page *pages[PMM_PCP_BENCH_DEPTH];
+    uint64_t count = 0;
+    uint32_t i, n;
+
+    while (rdtsc() < arg->deadline) {
+        for (n = 0; n < PMM_PCP_BENCH_DEPTH; ++n) {
+            if ((pages[n] = pmm_alloc_pages(0)) == NULL) {
+                break;
+            }
+        }
+        for (i = 0; i < n; ++i) {
+            pmm_free_pages(pages[i], 0);
+        }
+        count += n;
+    }
+    __atomic_fetch_add(&arg->pages, count, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Lets 1 to all online CPUs allocate and free single pages in a loop and prints the
+ *        aggregate throughput for each CPU count.
+ */
+void pmm_pcp_bench(void) {
+    struct pmm_pcp_bench_arg arg;
+    uint64_t refills, drains;
+    uint32_t n, cpu;
+
+    printk("pmm: pcp bench %u ms per run, %u pages deep\n", PMM_PCP_BENCH_MS, PMM_PCP_BENCH_DEPTH);
+    printk("pmm:  cpus   pages/sec   refills    drains\n");
+    for (n = 1; n <= smp_online_count; ++n) {
+        for (cpu = 0, refills = drains = 0; cpu < smp_cpu_count; ++cpu) {
+            refills -= pcps[cpu].refills;
+            drains -= pcps[cpu].drains;
+        }
+
+        arg.pages = 0;
+        arg.deadline = rdtsc() + tsc_frequency / 1000 * PMM_PCP_BENCH_MS;
+        smp_run_on_cpus(pmm_pcp_bench_worker, &arg, n);
+
+        for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+            refills += pcps[cpu].refills;
+            drains += pcps[cpu].drains;
+        }
+        printk("pmm: %5u %11lu %9lu %9lu\n", n, arg.pages * 1000 / PMM_PCP_BENCH_MS, refills, drains);
+    }
+}
+#endif
@@ -0,0 +1,554 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mm/pmm.h>
+#include <mm/slab.h>
+#include <printk.h>
+#include <smp.h>
+#include <spinlock.h>
+
+#include <arch/cpu.h>
+#include <arch/paging.h>
+#include <arch/tsc.h>
+
+static const uint32_t kmalloc_sizes[KMALLOC_CLASSES] = {
+    8, 16, 32, 64, 96, 128, 192, 256, 512, 1024, 2048, 4096, 8192
+};
+
+static const char *const kmalloc_names[KMALLOC_CLASSES] = {
+    "kmalloc-8", "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-96", "kmalloc-128", "kmalloc-192",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1k", "kmalloc-2k", "kmalloc-4k", "kmalloc-8k"
+};
+
+static struct kmem_cache kmem_cache_cache;                                          /* the cache that `struct kmem_cache` comes from */
+static struct kmem_cache *kmalloc_caches[KMALLOC_CLASSES];
+static struct list_head cache_list = LIST_HEAD_INIT(cache_list);
+static struct spinlock cache_list_lock = SPINLOCK_INIT;
+
+static inline uint32_t slab_round_up(uint32_t value, uint32_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+static inline struct page *slab_virt_to_page(const void *address) {
+    return phys_to_page(virt_to_phys(address));
+}
+
+/**
+ * @brief Maps a size to its kmalloc class in constant time: sizes up to 192 bytes go through
+ *        a table indexed in 8-byte steps, larger ones through their highest bit.
+ */
+static inline int32_t kmalloc_index(size_t size) {
+    static const uint8_t small[24] = {
+        0, 1, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 6
+    };
+
+    if (size == 0 || size > KMALLOC_MAX_SIZE) {
+        return -1;
+    } else if (size <= 192) {
+        return small[(size - 1) >> 3];
+    }
+    return 63 - __builtin_clzll(size - 1);                                          /* 256 -> 7, ..., 8192 -> 12 */
+}
+
+static void slab_name_copy(char *dest, const char *src) {
+    uint32_t i;
+
+    for (i = 0; i + 1 < SLAB_NAME_LENGTH && src[i]; ++i) {
+        dest[i] = src[i];
+    }
+    dest[i] = '\0';
+}
+
+/**
+ * @brief Computes the object stride, the slab order and the number of colors. The smallest
+ *        order that holds `SLAB_MIN_OBJECTS` objects, or wastes at most an eighth of the slab,
+ *        wins.
+ */
+static int32_t kmem_cache_setup(struct kmem_cache *cache, const char *name, uint32_t size, uint32_t align) {
+    uint32_t order, usable, count, leftover, bytes;
+
+    align = align < sizeof(void *) ? sizeof(void *) : align;
+    if (align & (align - 1)) {
+        return -1;
+    }
+
+    slab_name_copy(cache->name, name);
+    cache->object_size = size;
+    cache->align = align;
+    cache->size = slab_round_up(size < sizeof(void *) ? sizeof(void *) : size, align);
+    cache->header_size = slab_round_up(sizeof(struct slab), align);
+    cache->color_step = align > SMP_CACHE_LINE ? align : SMP_CACHE_LINE;
+
+    for (order = 0; order <= SLAB_MAX_ORDER; ++order) {
+        bytes = (uint32_t)(PAGE_SIZE << order);
+        if (bytes < cache->header_size + cache->size) {
+            continue;
+        }
+
+        usable = bytes - cache->header_size;
+        count = usable / cache->size;
+        leftover = usable - count * cache->size;
+        if (count >= SLAB_MIN_OBJECTS || leftover <= bytes / 8 || order == SLAB_MAX_ORDER) {
+            break;
+        }
+    }
+    if (order > SLAB_MAX_ORDER) {
+        return -1;
+    }
+
+    cache->order = order;
+    cache->objects_per_slab = count;
+    cache->colors = leftover / cache->color_step + 1;                               /* shifts the first object of each slab */
+    cache->color_next = 0;
+
+    spin_lock_init(&cache->lock);
+    list_init(&cache->partial);
+    list_init(&cache->full);
+    list_init(&cache->empty);
+    cache->slabs = cache->empty_slabs = 0;
+    cache->last_allocs = 0;
+    cache->last_tsc = rdtsc();
+    return 0;
+}
+
+/**
+ * @brief Allocates the per-CPU object caches of `cache` from whole pages, one cache line
+ *        aligned entry per CPU in the MADT.
+ */
+static int32_t kmem_cache_setup_cpu_caches(struct kmem_cache *cache) {
+    uint64_t bytes = (uint64_t)smp_cpu_count * sizeof(struct kmem_cpu_cache);
+    uint32_t order = 0, cpu, limit;
+    struct page *page;
+
+    while ((PAGE_SIZE << order) < bytes) {
+        ++order;
+    }
+    if ((page = pmm_alloc_pages(order)) == NULL) {
+        return -1;
+    }
+
+    limit = cache->size >= 2048 ? 8 : (cache->size >= 512 ? 16 : SLAB_CPU_CACHE_SIZE);
+    cache->cpu_caches = phys_to_virt(page_to_phys(page));
+    cache->cpu_caches_order = order;
+    for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+        cache->cpu_caches[cpu].count = 0;
+        cache->cpu_caches[cpu].limit = limit;
+        cache->cpu_caches[cpu].batch = (limit + 1) / 2;
+        cache->cpu_caches[cpu].allocs = 0;
+        cache->cpu_caches[cpu].frees = 0;
+    }
+    return 0;
+}
+
+static void kmem_cache_register(struct kmem_cache *cache) {
+    uint64_t flags;
+
+    spin_lock_irqsave(&cache_list_lock, flags);
+    list_add_tail(&cache->caches, &cache_list);
+    spin_unlock_irqrestore(&cache_list_lock, flags);
+}
+
+/**
+ * @brief Allocates a new slab, colors it, and threads its objects into the freelist. Called
+ *        with `cache->lock` held.
+ */
+static struct slab *kmem_cache_grow(struct kmem_cache *cache) {
+    struct page *page;
+    struct slab *slab;
+    uint8_t *object;
+    uint32_t i;
+
+    if ((page = pmm_alloc_pages(cache->order)) == NULL) {
+        return NULL;
+    }
+
+    slab = phys_to_virt(page_to_phys(page));
+    for (i = 0; i < (1U << cache->order); ++i) {
+        page[i].flags |= PAGE_FLAG_SLAB;
+        page[i].private = slab;
+    }
+
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->color = cache->color_next;
+    cache->color_next = (cache->color_next + 1) % cache->colors;
+
+    object = (uint8_t *)slab + cache->header_size + slab->color * cache->color_step;
+    slab->freelist = object;
+    for (i = 0; i + 1 < cache->objects_per_slab; ++i, object += cache->size) {
+        *(void **)object = object + cache->size;
+    }
+    *(void **)object = NULL;
+
+    list_add(&slab->list, &cache->empty);
+    ++cache->slabs;
+    ++cache->empty_slabs;
+    return slab;
+}
+
+static void kmem_cache_shrink_slab(struct kmem_cache *cache, struct slab *slab) {
+    struct page *page = slab_virt_to_page(slab);
+    uint32_t i;
+
+    list_del(&slab->list);
+    for (i = 0; i < (1U << cache->order); ++i) {
+        page[i].flags &= ~PAGE_FLAG_SLAB;
+        page[i].private = NULL;
+    }
+    --cache->slabs;
+    pmm_free_pages(page, cache->order);
+}
+
+/**
+ * @brief Moves up to `cc->batch` objects from the slabs into the per-CPU cache, preferring
+ *        partial slabs so that empty ones can be given back.
+ */
+static void kmem_cache_refill(struct kmem_cache *cache, struct kmem_cpu_cache *cc) {
+    struct slab *slab;
+
+    spin_lock(&cache->lock);
+    while (cc->count < cc->batch) {
+        if (!list_empty(&cache->partial)) {
+            slab = list_first_entry(&cache->partial, struct slab, list);
+        } else if (!list_empty(&cache->empty)) {
+            slab = list_first_entry(&cache->empty, struct slab, list);
+        } else if ((slab = kmem_cache_grow(cache)) == NULL) {
+            break;
+        }
+
+        if (slab->inuse == 0) {
+            --cache->empty_slabs;
+        }
+        while (slab->freelist != NULL && cc->count < cc->batch) {
+            cc->objects[cc->count++] = slab->freelist;
+            slab->freelist = *(void **)slab->freelist;
+            ++slab->inuse;
+        }
+
+        list_del(&slab->list);
+        list_add(&slab->list, slab->freelist ? &cache->partial : &cache->full);
+    }
+    spin_unlock(&cache->lock);
+}
+
+/**
+ * @brief Returns the `count` oldest objects of the per-CPU cache to their slabs.
+ */
+static void kmem_cache_flush(struct kmem_cache *cache, struct kmem_cpu_cache *cc, uint32_t count) {
+    struct slab *slab;
+    void *object;
+    uint32_t i;
+
+    spin_lock(&cache->lock);
+    for (i = 0; i < count; ++i) {
+        object = cc->objects[i];
+        slab = slab_virt_to_page(object)->private;
+
+        *(void **)object = slab->freelist;
+        slab->freelist = object;
+        list_del(&slab->list);
+        if (--slab->inuse == 0) {
+            list_add(&slab->list, &cache->empty);
+            if (++cache->empty_slabs > SLAB_MAX_EMPTY) {
+                --cache->empty_slabs;
+                kmem_cache_shrink_slab(cache, slab);
+            }
+        } else {
+            list_add(&slab->list, &cache->partial);
+        }
+    }
+    spin_unlock(&cache->lock);
+
+    for (i = count; i < cc->count; ++i) {                                           /* keeps the hot end at the top */
+        cc->objects[i - count] = cc->objects[i];
+    }
+    cc->count -= count;
+}
+
+/**
+ * @brief Creates the cache of caches and the kmalloc size classes. Must run after
+ *        `smp_init()`, since every cache has one object cache per CPU.
+ */
+void slab_init(void) {
+    uint32_t i;
+
+    kmem_cache_setup(&kmem_cache_cache, "kmem_cache", sizeof(struct kmem_cache), SMP_CACHE_LINE);
+    if (kmem_cache_setup_cpu_caches(&kmem_cache_cache) < 0) {
+        printk("slab: no memory for the cache of caches\n");
+        return;
+    }
+    kmem_cache_register(&kmem_cache_cache);
+
+    for (i = 0; i < KMALLOC_CLASSES; ++i) {
+        kmalloc_caches[i] = kmem_cache_create(kmalloc_names[i], kmalloc_sizes[i], 0);
+    }
+}
+
+/**
+ * @brief Creates a cache of objects of `size` bytes.
+ *
+ * @param name Name shown by `kmem_cache_dump()`.
+ * @param size Object size in bytes.
+ * @param align Object alignment, 0 for the natural 8 bytes. Must be a power of two.
+ * @return The new cache, or `NULL` on failure.
+ */
+struct kmem_cache *kmem_cache_create(const char *name, uint32_t size, uint32_t align) {
+    struct kmem_cache *cache;
+
+    if (size == 0 || size > (PAGE_SIZE << SLAB_MAX_ORDER) / 2) {
+        return NULL;
+    } else if ((cache = kmem_cache_alloc(&kmem_cache_cache)) == NULL) {
+        return NULL;
+    }
+
+    if (kmem_cache_setup(cache, name, size, align) < 0 || kmem_cache_setup_cpu_caches(cache) < 0) {
+        kmem_cache_free(&kmem_cache_cache, cache);
+        return NULL;
+    }
+
+    kmem_cache_register(cache);
+    return cache;
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cache) {
+    struct kmem_cpu_cache *cc;
+    void *object = NULL;
+    uint64_t flags;
+
+    flags = arch_irq_save();
+    cc = &cache->cpu_caches[smp_processor_id()];
+    if (cc->count == 0) {
+        kmem_cache_refill(cache, cc);
+    }
+
+    if (cc->count > 0) {
+        object = cc->objects[--cc->count];
+        ++cc->allocs;
+    }
+    arch_irq_restore(flags);
+    return object;
+}
+
+void kmem_cache_free(struct kmem_cache *cache, void *object) {
+    struct kmem_cpu_cache *cc;
+    uint64_t flags;
+
+    if (object == NULL) {
+        return;
+    }
+
+    flags = arch_irq_save();
+    cc = &cache->cpu_caches[smp_processor_id()];
+    if (cc->count == cc->limit) {
+        kmem_cache_flush(cache, cc, cc->batch);
+    }
+    cc->objects[cc->count++] = object;
+    ++cc->frees;
+    arch_irq_restore(flags);
+}
+
+/**
+ * @brief Allocates `size` bytes from the smallest fitting size class. Larger requests are
+ *        served with whole pages from the physical allocator.
+ */
+void *kmalloc(size_t size) {
+    int32_t index = kmalloc_index(size);
+    struct page *page;
+    uint32_t order = 0;
+
+    if (index >= 0) {
+        return kmalloc_caches[index] ? kmem_cache_alloc(kmalloc_caches[index]) : NULL;
+    }
+
+    while ((PAGE_SIZE << order) < size) {
+        ++order;
+    }
+    page = pmm_alloc_pages(order);                                                  /* `page->order` tells kfree() the size */
+    return page ? phys_to_virt(page_to_phys(page)) : NULL;
+}
+
+/**
+ * @brief Frees memory returned by `kmalloc()` or `kmem_cache_alloc()`.
+ */
+void kfree(void *object) {
+    struct page *page;
+
+    if (object == NULL) {
+        return;
+    }
+
+    page = slab_virt_to_page(object);
+    if (page->flags & PAGE_FLAG_SLAB) {
+        kmem_cache_free(((struct slab *)page->private)->cache, object);
+    } else {
+        pmm_free_pages(page, page->order);
+    }
+}
+
+/**
+ * @brief Prints active objects, slabs and the allocation rate since the last dump for every
+ *        cache.
+ */
+void kmem_cache_dump(void) {
+    struct kmem_cache *cache;
+    struct list_head *pos;
+    uint64_t flags, allocs, frees, now, rate;
+    uint32_t cpu;
+
+    printk("slab: %-16s %7s %9s %9s %7s %12s %10s\n",
+           "name", "objsize", "active", "total", "slabs", "allocs", "allocs/s");
+
+    spin_lock_irqsave(&cache_list_lock, flags);
+    list_for_each(pos, &cache_list) {
+        cache = list_entry(pos, struct kmem_cache, caches);
+        for (cpu = 0, allocs = frees = 0; cpu < smp_cpu_count; ++cpu) {
+            allocs += __atomic_load_n(&cache->cpu_caches[cpu].allocs, __ATOMIC_RELAXED);
+            frees += __atomic_load_n(&cache->cpu_caches[cpu].frees, __ATOMIC_RELAXED);
+        }
+
+        now = rdtsc();
+        rate = tsc_to_ns(now - cache->last_tsc);
+        rate = rate ? (allocs - cache->last_allocs) * 1000000000ULL / rate : 0;
+        cache->last_allocs = allocs;
+        cache->last_tsc = now;
+
+        printk("slab: %-16s %7u %9lu %9lu %7lu %12lu %10lu\n", cache->name, cache->object_size,
+               allocs - frees, cache->slabs * cache->objects_per_slab, cache->slabs, allocs, rate);
+    }
+    spin_unlock_irqrestore(&cache_list_lock, flags);
+}
+
+#if defined(NICKEL_BENCH)
+#define SLAB_BENCH_OBJECTS              2048
+#define SLAB_BENCH_ROUNDS               16
+#define SLAB_BENCH_HEAP_ORDER           12                                          /* 16MB first-fit arena */
+
+/**
+ * @brief Block header of the naive first-fit heap used as the baseline. Blocks are laid out
+ *        back to back, and allocation scans them from the start of the arena.
+ */
+struct ff_block {
+    uint64_t size;                                                                  /* payload size in bytes */
+    uint64_t free;
+};
+
+static struct ff_block *ff_arena;
+static uint64_t ff_arena_size;
+
+static void ff_init(void *arena, uint64_t size) {
+    ff_arena = arena;
+    ff_arena_size = size;
+    ff_arena->size = size - sizeof(struct ff_block);
+    ff_arena->free = 1;
+}
+
+static void *ff_alloc(uint64_t size) {
+    uint8_t *cursor = (uint8_t *)ff_arena, *end = cursor + ff_arena_size;
+    struct ff_block *block, *rest;
+
+    size = (size + 15) & ~15ULL;
+    for (; cursor < end; cursor += sizeof(struct ff_block) + block->size) {
+        block = (struct ff_block *)cursor;
+        if (!block->free || block->size < size) {
+            continue;
+        }
+
+        if (block->size >= size + sizeof(struct ff_block) + 16) {                   /* splits off the tail */
+            rest = (struct ff_block *)(cursor + sizeof(struct ff_block) + size);
+            rest->size = block->size - size - sizeof(struct ff_block);
+            rest->free = 1;
+            block->size = size;
+        }
+        block->free = 0;
+        return block + 1;
+    }
+    return NULL;
+}
+
+static void ff_free(void *object) {
+    struct ff_block *block = (struct ff_block *)object - 1, *next;
+    uint8_t *end = (uint8_t *)ff_arena + ff_arena_size;
+
+    block->free = 1;
+    next = (struct ff_block *)((uint8_t *)(block + 1) + block->size);
+    while ((uint8_t *)next < end && next->free) {                                   /* merges forward only */
+        block->size += sizeof(struct ff_block) + next->size;
+        next = (struct ff_block *)((uint8_t *)(block + 1) + block->size);
+    }
+}
+
+static uint32_t slab_bench_size(uint64_t *seed) {
+    *seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (uint32_t)(KMALLOC_MIN_SIZE << ((*seed >> 33) % 8)) + (uint32_t)((*seed >> 45) % 64); /* 8B to ~1KB, skewed small */
+}
+
+/**
+ * @brief Fills `SLAB_BENCH_OBJECTS` slots, then replaces every other slot for a few rounds,
+ *        and finally frees everything. Returns total alloc and free cycles.
+ */
+static void slab_bench_run(void *(*alloc)(uint64_t), void (*release)(void *), uint64_t *alloc_cycles,
+                           uint64_t *free_cycles, uint64_t *ops) {
+    static void *slots[SLAB_BENCH_OBJECTS];
+    uint64_t seed = 0xECEBCAFE, start;
+    uint32_t i, round;
+
+    *alloc_cycles = *free_cycles = *ops = 0;
+    start = rdtsc();
+    for (i = 0; i < SLAB_BENCH_OBJECTS; ++i) {
+        slots[i] = alloc(slab_bench_size(&seed));
+    }
+    *alloc_cycles += rdtsc() - start;
+    *ops += SLAB_BENCH_OBJECTS;
+
+    for (round = 0; round < SLAB_BENCH_ROUNDS; ++round) {
+        start = rdtsc();
+        for (i = round & 1; i < SLAB_BENCH_OBJECTS; i += 2) {
+            release(slots[i]);
+        }
+        *free_cycles += rdtsc() - start;
+
+        start = rdtsc();
+        for (i = round & 1; i < SLAB_BENCH_OBJECTS; i += 2) {
+            slots[i] = alloc(slab_bench_size(&seed));
+        }
+        *alloc_cycles += rdtsc() - start;
+        *ops += SLAB_BENCH_OBJECTS / 2;
+    }
+
+    start = rdtsc();
+    for (i = 0; i < SLAB_BENCH_OBJECTS; ++i) {
+        release(slots[i]);
+    }
+    *free_cycles += rdtsc() - start;
+}
+
+static void *slab_bench_kmalloc(uint64_t size) {
+    return kmalloc(size);
+}
+
+/**
+ * @brief Compares kmalloc/kfree against a naive first-fit heap on the same request stream.
+ */
+void slab_bench(void) {
+    uint64_t alloc_cycles, free_cycles, ops;
+    struct page *arena;
+
+    printk("slab: bench %u live objects, %u churn rounds\n", SLAB_BENCH_OBJECTS, SLAB_BENCH_ROUNDS);
+
+    slab_bench_run(slab_bench_kmalloc, kfree, &alloc_cycles, &free_cycles, &ops);
+    printk("slab: %-10s alloc %6lu ns  free %6lu ns\n", "kmalloc",
+           tsc_to_ns(alloc_cycles) / ops, tsc_to_ns(free_cycles) / ops);
+
+    if ((arena = pmm_alloc_pages(SLAB_BENCH_HEAP_ORDER)) == NULL) {
+        printk("slab: no memory for the first-fit arena\n");
+        return;
+    }
+    ff_init(phys_to_virt(page_to_phys(arena)), PAGE_SIZE << SLAB_BENCH_HEAP_ORDER);
+    slab_bench_run(ff_alloc, ff_free, &alloc_cycles, &free_cycles, &ops);
+    printk("slab: %-10s alloc %6lu ns  free %6lu ns\n", "first-fit",
+           tsc_to_ns(alloc_cycles) / ops, tsc_to_ns(free_cycles) / ops);
+    pmm_free_pages(arena, SLAB_BENCH_HEAP_ORDER);
+
+    kmem_cache_dump();
+}
+#endif
@@ -0,0 +1,336 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include <acpi.h>
+#include <numa.h>
+#include <printk.h>
+#include <smp.h>
+#include <mm/pmm.h>
+
+#include <arch/cpu.h>
+#include <arch/paging.h>
+#include <arch/tsc.h>
+
+#define NUMA_SRAT_ENTRY_HEADER          2                                           /* type and length */
+#define NUMA_SRAT_ENTRY_SIZE(member)    (NUMA_SRAT_ENTRY_HEADER + sizeof(((struct acpi_srat_entry *)0)->member))
+
+uint32_t numa_node_count = 1;
+uint8_t numa_cpu_nodes[SMP_MAX_CPUS];
+uint8_t numa_distances[NUMA_MAX_NODES][NUMA_MAX_NODES] = { { NUMA_LOCAL_DISTANCE } };
+uint8_t numa_fallback[NUMA_MAX_NODES][NUMA_MAX_NODES];
+struct numa_memory_range numa_memory_ranges[NUMA_MAX_MEMORY_RANGES];
+uint32_t numa_memory_range_count = 0;
+
+static uint32_t numa_node_domains[NUMA_MAX_NODES];                                  /* proximity domain of every node */
+
+/**
+ * @brief Gets the node of a proximity domain, giving it the next free node number the first
+ *        time. Domains are 32-bit and need not be dense, nodes are.
+ *
+ * @return The node, or -1 if there are more than `NUMA_MAX_NODES` domains.
+ */
+static int32_t numa_domain_to_node(uint32_t domain) {
+    uint32_t node;
+
+    for (node = 0; node < numa_node_count; ++node) {
+        if (numa_node_domains[node] == domain) {
+            return (int32_t)node;
+        }
+    }
+    if (numa_node_count >= NUMA_MAX_NODES) {
+        return -1;
+    }
+    numa_node_domains[numa_node_count] = domain;
+    return (int32_t)numa_node_count++;
+}
+
+/**
+ * @brief Puts the CPU with `apic_id` on the node of `domain`.
+ *
+ * @return `NUMA_SUCCESS`, or `NUMA_TOO_MANY_NODES` if the domain got no node; the CPU then
+ *         stays on node 0.
+ */
+static int32_t numa_add_cpu(uint32_t apic_id, uint32_t domain) {
+    int32_t node = numa_domain_to_node(domain);
+    uint32_t cpu;
+
+    if (node < 0) {
+        return NUMA_TOO_MANY_NODES;
+    }
+    for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+        if (processors[cpu].apic_id == apic_id) {
+            numa_cpu_nodes[cpu] = (uint8_t)node;
+            break;
+        }
+    }
+    return NUMA_SUCCESS;
+}
+
+/**
+ * @brief Records a memory range of `domain` for `pmm_numa_init()`.
+ *
+ * @return `NUMA_SUCCESS`, or `NUMA_TOO_MANY_NODES` if the domain got no node; the range then
+ *         stays on node 0.
+ */
+static int32_t numa_add_memory(uint64_t base, uint64_t length, uint32_t domain) {
+    int32_t node = numa_domain_to_node(domain);
+
+    if (node < 0) {
+        return NUMA_TOO_MANY_NODES;
+    }
+    if (length == 0 || numa_memory_range_count >= NUMA_MAX_MEMORY_RANGES) {
+        return NUMA_SUCCESS;
+    }
+    numa_memory_ranges[numa_memory_range_count].start = base;
+    numa_memory_ranges[numa_memory_range_count].end = base + length;
+    numa_memory_ranges[numa_memory_range_count].node = (uint32_t)node;
+    ++numa_memory_range_count;
+    return NUMA_SUCCESS;
+}
+
+static int32_t numa_parse_srat(const struct acpi_srat_desc *srat) {
+    const struct acpi_srat_entry *entry;
+    uint32_t offset, domain;
+    int32_t ret = NUMA_SUCCESS;
+
+    if (srat->header.length < sizeof(struct acpi_srat_desc)) {
+        return NUMA_INVALID_TABLE;
+    }
+
+    numa_node_count = 0;
+    for (
+        offset = sizeof(struct acpi_srat_desc);
+        offset + NUMA_SRAT_ENTRY_HEADER <= srat->header.length;
+        offset += entry->length
+    ) {
+        entry = (const struct acpi_srat_entry *)((size_t)srat + offset);
+        if (entry->length < NUMA_SRAT_ENTRY_HEADER || entry->length > srat->header.length - offset) {
+            break;                                                                  /* truncated, keep what was read */
+        }
+
+        if (entry->type == ACPI_SRAT_TYPE_PROCESSOR && entry->length >= NUMA_SRAT_ENTRY_SIZE(processor)
+            && (entry->processor.flags & ACPI_SRAT_FLAG_ENABLED)) {
+            domain = entry->processor.proximity_domain_low | (uint32_t)entry->processor.proximity_domain_high[0] << 8 |
+                     (uint32_t)entry->processor.proximity_domain_high[1] << 16 |
+                     (uint32_t)entry->processor.proximity_domain_high[2] << 24;
+            if (numa_add_cpu(entry->processor.apic_id, domain) != NUMA_SUCCESS) {
+                ret = NUMA_TOO_MANY_NODES;
+            }
+        } else if (entry->type == ACPI_SRAT_TYPE_PROCESSOR_X2 && entry->length >= NUMA_SRAT_ENTRY_SIZE(processor_x2)
+                   && (entry->processor_x2.flags & ACPI_SRAT_FLAG_ENABLED)) {
+            if (numa_add_cpu(entry->processor_x2.apic_id, entry->processor_x2.proximity_domain) != NUMA_SUCCESS) {
+                ret = NUMA_TOO_MANY_NODES;
+            }
+        } else if (entry->type == ACPI_SRAT_TYPE_MEMORY && entry->length >= NUMA_SRAT_ENTRY_SIZE(memory)
+                   && (entry->memory.flags & ACPI_SRAT_FLAG_ENABLED)) {
+            if (numa_add_memory(entry->memory.base_address, entry->memory.length, entry->memory.proximity_domain)
+                != NUMA_SUCCESS) {
+                ret = NUMA_TOO_MANY_NODES;
+            }
+        }
+    }
+
+    if (numa_node_count == 0) {
+        numa_node_count = 1;
+        return NUMA_INVALID_TABLE;
+    }
+    return ret;
+}
+
+/**
+ * @brief Fills the distance matrix from the SLIT, which is indexed by proximity domain. Pairs
+ *        it does not cover keep the default distances.
+ */
+static void numa_parse_slit(const struct acpi_slit_desc *slit) {
+    uint64_t count = slit->locality_count;
+    uint32_t from, to, a, b;
+
+    if (slit->header.length < sizeof(struct acpi_slit_desc) + count * count) {
+        return;
+    }
+    for (from = 0; from < numa_node_count; ++from) {
+        for (to = 0; to < numa_node_count; ++to) {
+            a = numa_node_domains[from];
+            b = numa_node_domains[to];
+            if (a < count && b < count && slit->entries[a * count + b] != 0xFF) {   /* 0xFF marks unreachable */
+                numa_distances[from][to] = slit->entries[a * count + b];
+            }
+        }
+    }
+}
+
+/**
+ * @brief Orders the nodes of every fallback list by distance; ties keep the node order, so
+ *        the own node stays first.
+ */
+static void numa_build_fallback(void) {
+    uint32_t node, i, j;
+    uint8_t other;
+
+    for (node = 0; node < numa_node_count; ++node) {
+        numa_fallback[node][0] = (uint8_t)node;
+        for (i = 1, j = 0; j < numa_node_count; ++j) {
+            if (j != node) {
+                numa_fallback[node][i++] = (uint8_t)j;
+            }
+        }
+        for (i = 2; i < numa_node_count; ++i) {                                     /* insertion sort, at most 8 nodes */
+            other = numa_fallback[node][i];
+            for (j = i; j > 1 && numa_distances[node][numa_fallback[node][j - 1]] > numa_distances[node][other]; --j) {
+                numa_fallback[node][j] = numa_fallback[node][j - 1];
+            }
+            numa_fallback[node][j] = other;
+        }
+    }
+}
+
+/**
+ * @brief Gets the node `phys` belongs to, node 0 if the SRAT does not list it.
+ */
+uint32_t numa_phys_to_node(uint64_t phys) {
+    uint32_t i;
+
+    for (i = 0; i < numa_memory_range_count; ++i) {
+        if (phys >= numa_memory_ranges[i].start && phys < numa_memory_ranges[i].end) {
+            return numa_memory_ranges[i].node;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads the SRAT and SLIT, builds the CPU and memory maps and the fallback order of
+ *        every node and moves the free pages to the lists of their nodes. Must run after
+ *        `acpi_init()`, `pmm_init()` and `smp_init()` and before anything is allocated per CPU.
+ *
+ * @return `NUMA_SUCCESS` on success, one of `NUMA_*` errors otherwise; the kernel then keeps
+ *         running as a single node.
+ */
+int32_t numa_init(void) {
+    const struct acpi_srat_desc *srat = (const struct acpi_srat_desc *)acpi_find_table(ACPI_SRAT_SIGNATURE);
+    const struct acpi_slit_desc *slit = (const struct acpi_slit_desc *)acpi_find_table(ACPI_SLIT_SIGNATURE);
+    uint32_t node, other, cpu;
+    int32_t ret;
+
+    if (srat == NULL) {
+        printk("numa: no SRAT, 1 node\n");
+        return NUMA_SUCCESS;
+    }
+
+    ret = numa_parse_srat(srat);
+    if (ret == (int32_t)NUMA_INVALID_TABLE) {
+        return ret;
+    }
+    for (node = 0; node < numa_node_count; ++node) {
+        for (other = 0; other < numa_node_count; ++other) {
+            numa_distances[node][other] = node == other ? NUMA_LOCAL_DISTANCE : NUMA_REMOTE_DISTANCE;
+        }
+    }
+    if (slit != NULL) {
+        numa_parse_slit(slit);
+    }
+    numa_build_fallback();
+    pmm_numa_init();
+
+    for (node = 0; node < numa_node_count; ++node) {
+        for (cpu = 0, other = 0; cpu < smp_cpu_count; ++cpu) {
+            other += numa_cpu_nodes[cpu] == node;
+        }
+        printk("numa: node %u (domain %u), %u cpus, %lu MB free, distances", node, numa_node_domains[node], other,
+               pmm_node_free_page_count(node) >> (20 - PAGE_SHIFT));
+        for (other = 0; other < numa_node_count; ++other) {
+            printk(" %u", numa_distances[node][other]);
+        }
+        printk("\n");
+    }
+    return ret;
+}
+
+#if defined(NICKEL_BENCH)
+#define NUMA_BENCH_PAGES                256                                         /* single pages checked for locality */
+#define NUMA_BENCH_ORDER                12                                          /* 16MB, larger than the LLC */
+#define NUMA_BENCH_PASSES               4
+
+static uint32_t numa_bench_cpu;
+static uint32_t numa_bench_local[NUMA_MAX_NODES];
+static uint64_t numa_bench_bandwidth[NUMA_MAX_NODES][NUMA_MAX_NODES];               /* MB/s, 0 if it could not be measured */
+static volatile uint64_t numa_bench_sink;
+
+/**
+ * @brief Writes and then reads a block of every node from the CPU `numa_bench_cpu` and
+ *        records the bandwidth; the other CPUs return at once.
+ */
+static void numa_bench_worker(void *arg) {
+    static struct page *pages[NUMA_BENCH_PAGES];
+    uint32_t node = numa_node_id(), target, pass, i;
+    uint64_t start, cycles, words, sum = 0;
+    volatile uint64_t *block;
+    struct page *page;
+
+    if (smp_processor_id() != numa_bench_cpu) {
+        return;
+    }
+
+    for (i = 0; i < NUMA_BENCH_PAGES; ++i) {
+        pages[i] = pmm_alloc_pages(0);
+        numa_bench_local[node] += pages[i] != NULL && pages[i]->node == node;
+    }
+    for (i = 0; i < NUMA_BENCH_PAGES; ++i) {
+        pmm_free_pages(pages[i], 0);
+    }
+
+    words = (PAGE_SIZE << NUMA_BENCH_ORDER) / sizeof(uint64_t);
+    for (target = 0; target < numa_node_count; ++target) {
+        page = pmm_alloc_pages_node(NUMA_BENCH_ORDER, target);
+        if (page == NULL || page->node != target) {                                 /* fell back to another node */
+            pmm_free_pages(page, NUMA_BENCH_ORDER);
+            continue;
+        }
+
+        block = phys_to_virt(page_to_phys(page));
+        start = rdtsc();
+        for (pass = 0; pass < NUMA_BENCH_PASSES; ++pass) {
+            for (i = 0; i < words; ++i) {
+                block[i] = i;
+            }
+            for (i = 0; i < words; ++i) {
+                sum += block[i];
+            }
+        }
+        cycles = rdtsc() - start;
+        numa_bench_bandwidth[node][target] = 2 * NUMA_BENCH_PASSES * words * sizeof(uint64_t) * 1000 /
+                                             (tsc_to_ns(cycles) + 1);
+        pmm_free_pages(page, NUMA_BENCH_ORDER);
+    }
+    numa_bench_sink = sum;
+}
+
+/**
+ * @brief Checks that single pages come from the node of the allocating CPU and compares the
+ *        bandwidth of local and remote memory from the first CPU of every node.
+ */
+void numa_bench(void) {
+    uint32_t node, target, cpu;
+
+    for (node = 0; node < numa_node_count; ++node) {
+        for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+            if (numa_cpu_nodes[cpu] == node && cpumask_test(&smp_online_mask, cpu)) {
+                break;
+            }
+        }
+        if (cpu == smp_cpu_count) {
+            printk("numa: node %u has no online cpu\n", node);
+            continue;
+        }
+
+        numa_bench_cpu = cpu;
+        numa_bench_local[node] = 0;
+        smp_run_on_cpus(numa_bench_worker, NULL, smp_online_count);
+        printk("numa: cpu %u, %u of %u pages local, MB/s to node", cpu, numa_bench_local[node], NUMA_BENCH_PAGES);
+        for (target = 0; target < numa_node_count; ++target) {
+            printk(" %u: %lu", target, numa_bench_bandwidth[node][target]);
+        }
+        printk("\n");
+    }
+}
+#endif
@@ -0,0 +1,144 @@
+#include <stdint.h>
+
+#include <numa.h>
+#include <percpu.h>
+#include <printk.h>
+#include <smp.h>
+#include <mm/pmm.h>
+
+#include <arch/paging.h>
+#include <arch/percpu.h>
+#include <arch/tsc.h>
+
+extern uint8_t __percpu_start[], __percpu_end[], __percpu_load[];                   /* defined by linker.ld */
+
+uint64_t percpu_bases[SMP_MAX_CPUS];
+
+DEFINE_PER_CPU(uint64_t, percpu_base);
+
+/**
+ * @brief Lets the boot CPU use the per-CPU template in the kernel image until `percpu_init()`
+ *        copied it. Anything written to per-CPU variables before then is copied to every CPU.
+ */
+void percpu_early_init(void) {
+    uint64_t base = (uint64_t)__percpu_load;
+
+    arch_percpu_set_base(base);
+    this_cpu_write(percpu_base, base);
+}
+
+/**
+ * @brief Allocates a copy of the per-CPU template for every CPU in the MADT on the node of the
+ *        CPU and switches the boot CPU to its own. Must run after `smp_init()`, `pmm_init()`
+ *        and `numa_init()`.
+ *
+ * @return `PERCPU_SUCCESS` on success, `PERCPU_NO_MEMORY` if some CPUs got no area; those
+ *         are not started.
+ */
+int32_t percpu_init(void) {
+    uint64_t size = (uint64_t)(__percpu_end - __percpu_start), phys, i;
+    uint32_t cpu, order = 0, missing = 0;
+    uint8_t *area;
+
+    while ((PAGE_SIZE << order) < size) {
+        ++order;
+    }
+
+    for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+        phys = pmm_alloc_node(order, numa_cpu_to_node(cpu));                        /* only its own CPU touches it */
+        if (phys == 0) {
+            ++missing;
+            continue;
+        }
+
+        area = phys_to_virt(phys);
+        for (i = 0; i < size; ++i) {
+            area[i] = __percpu_load[i];
+        }
+        percpu_bases[cpu] = (uint64_t)area;
+        per_cpu(percpu_base, cpu) = (uint64_t)area;
+        per_cpu(cpu_number, cpu) = cpu;
+    }
+
+    percpu_cpu_init();
+    printk("percpu: %lu bytes per cpu, %u of %u areas\n", size, smp_cpu_count - missing, smp_cpu_count);
+    return missing ? PERCPU_NO_MEMORY : PERCPU_SUCCESS;
+}
+
+/**
+ * @brief Points GS at the per-CPU area of the calling CPU, found through its APIC ID. APs
+ *        call it before anything that uses `smp_processor_id()`.
+ */
+void percpu_cpu_init(void) {
+    uint64_t base = percpu_bases[smp_cpu_from_apic()];
+
+    if (base != 0) {
+        arch_percpu_set_base(base);                                                 /* the boot CPU stays on the template otherwise */
+    }
+}
+
+#if defined(NICKEL_BENCH)
+#define PERCPU_BENCH_CPUS               8
+#define PERCPU_BENCH_ROUNDS             1000000
+
+static DEFINE_PER_CPU(uint64_t, percpu_bench_counter);
+static uint64_t percpu_bench_shared __cacheline_aligned;
+static uint64_t percpu_bench_cycles[SMP_MAX_CPUS];
+
+static void percpu_bench_local(void *arg) {
+    uint64_t start = rdtsc();
+    uint32_t i;
+
+    for (i = 0; i < PERCPU_BENCH_ROUNDS; ++i) {
+        this_cpu_inc(percpu_bench_counter);
+    }
+    percpu_bench_cycles[smp_processor_id()] = rdtsc() - start;
+}
+
+static void percpu_bench_atomic(void *arg) {
+    uint64_t start = rdtsc();
+    uint32_t i;
+
+    for (i = 0; i < PERCPU_BENCH_ROUNDS; ++i) {
+        __atomic_fetch_add(&percpu_bench_shared, 1, __ATOMIC_RELAXED);
+    }
+    percpu_bench_cycles[smp_processor_id()] = rdtsc() - start;
+}
+
+/**
+ * @brief Runs `fn` on `count` CPUs and gets the average cycles per increment.
+ */
+static uint64_t percpu_bench_run(void (*fn)(void *arg), uint32_t count) {
+    uint64_t total = 0;
+    uint32_t cpu;
+
+    for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+        percpu_bench_cycles[cpu] = 0;
+    }
+    smp_run_on_cpus(fn, NULL, count);
+    for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+        total += percpu_bench_cycles[cpu];
+    }
+    return total / ((uint64_t)count * PERCPU_BENCH_ROUNDS);
+}
+
+/**
+ * @brief Compares increments of a per-CPU counter with those of a shared atomic counter on
+ *        up to 8 CPUs at once.
+ */
+void percpu_bench(void) {
+    uint32_t count = smp_online_count < PERCPU_BENCH_CPUS ? smp_online_count : PERCPU_BENCH_CPUS, cpu;
+    uint64_t local, atomic, sum = 0;
+
+    local = percpu_bench_run(percpu_bench_local, count);
+    atomic = percpu_bench_run(percpu_bench_atomic, count);
+    for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+        if (percpu_bases[cpu] != 0) {
+            sum += per_cpu(percpu_bench_counter, cpu);
+        }
+    }
+
+    printk("percpu: %u cpus, per-cpu increment %lu cycles, shared atomic %lu cycles (%lu and %lu counted)\n",
+           count, local, atomic, sum, percpu_bench_shared);
+}
+#endif
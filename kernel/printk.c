@@ -0,0 +1,627 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fbcon.h>
+#include <numa.h>
+#include <percpu.h>
+#include <printk.h>
+#include <smp.h>
+#include <spinlock.h>
+#include <mm/pmm.h>
+
+#include <arch/cpu.h>
+#include <arch/paging.h>
+#include <arch/serial.h>
+#include <arch/tsc.h>
+
+/**
+ * @brief A logged message. `size` covers the header, the text and the padding up to the next
+ *        record, so the text is not NUL terminated.
+ */
+struct printk_record {
+    uint64_t tsc;
+    uint16_t size;
+    uint16_t length;
+    uint8_t level;
+    uint8_t flags;
+    uint16_t reserved;
+    char text[];
+};
+
+/**
+ * @brief Log ring of one CPU. Only its own CPU appends, with interrupts disabled, and only the
+ *        holder of `printk_lock` consumes, so `head` and `tail` are all the two share.
+ */
+struct printk_ring {
+    volatile uint64_t head __cacheline_aligned;                                     /* free running byte offsets */
+    uint8_t *data;
+    volatile uint64_t dropped;
+    uint32_t line_open;                                                             /* the last record did not end its line */
+    uint32_t busy;                                                                  /* an NMI that finds it set drops its message */
+    volatile uint64_t tail __cacheline_aligned;
+    uint64_t dropped_reported;
+};
+
+static DEFINE_PER_CPU(struct printk_ring, printk_ring);
+
+static struct spinlock printk_lock = SPINLOCK_INIT;                                 /* owns the UART and the framebuffer console */
+static volatile int printk_unlocked = 0;
+static volatile int printk_ring_ready = 0;
+static uint32_t printk_open_cpu = SMP_MAX_CPUS;                                     /* whose line the UART is in the middle of */
+
+volatile uint32_t printk_console_level = PRINTK_LEVEL;
+
+struct printk_sink {
+    char *buffer;
+    size_t size;
+    size_t length;                                                                  /* characters produced so far, may exceed size */
+};
+
+static void printk_putc(struct printk_sink *sink, char c) {
+    if (sink->length + 1 < sink->size) {
+        sink->buffer[sink->length] = c;
+    }
+    ++sink->length;
+}
+
+static void printk_number(struct printk_sink *sink, uint64_t value, uint32_t base, int negative,
+                          int upper, int width, int zero_pad, int left_align) {
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char temp[24];
+    int count = 0, padding;
+
+    do {
+        temp[count++] = digits[value % base];
+        value /= base;
+    } while (value != 0);
+
+    padding = width - count - negative;
+    if (negative && zero_pad) {
+        printk_putc(sink, '-');
+    }
+    for (; !left_align && padding > 0; --padding) {
+        printk_putc(sink, zero_pad ? '0' : ' ');
+    }
+    if (negative && !zero_pad) {
+        printk_putc(sink, '-');
+    }
+    while (count > 0) {
+        printk_putc(sink, temp[--count]);
+    }
+    for (; left_align && padding > 0; --padding) {
+        printk_putc(sink, ' ');
+    }
+}
+
+/**
+ * @brief Formats a string into `buffer`. Supports `%d %i %u %x %X %p %s %c %%`, the `l`,
+ *        `ll` and `z` length modifiers, a field width, and the `0` and `-` flags.
+ * 
+ * @return The number of characters written, excluding the terminating NUL.
+ */
+int vsnprintf(char *buffer, size_t size, const char *format, va_list args) {
+    struct printk_sink sink = { .buffer = buffer, .size = size, .length = 0 };
+    int width, zero_pad, left_align, longs, padding;
+    const char *string;
+    uint64_t value;
+    int64_t signed_value;
+
+    for (; *format; ++format) {
+        if (*format != '%') {
+            printk_putc(&sink, *format);
+            continue;
+        }
+
+        ++format;
+        zero_pad = left_align = width = longs = 0;
+        for (;; ++format) {
+            if (*format == '0') {
+                zero_pad = 1;
+            } else if (*format == '-') {
+                left_align = 1;
+            } else {
+                break;
+            }
+        }
+        for (; *format >= '0' && *format <= '9'; ++format) {
+            width = width * 10 + (*format - '0');
+        }
+        for (; *format == 'l' || *format == 'z'; ++format) {
+            ++longs;
+        }
+        zero_pad &= !left_align;
+
+        switch (*format) {
+        case 'd':
+        case 'i':
+            signed_value = longs ? va_arg(args, int64_t) : va_arg(args, int32_t);
+            value = signed_value < 0 ? -(uint64_t)signed_value : (uint64_t)signed_value;
+            printk_number(&sink, value, 10, signed_value < 0, 0, width, zero_pad, left_align);
+            break;
+        case 'u':
+        case 'x':
+        case 'X':
+            value = longs ? va_arg(args, uint64_t) : va_arg(args, uint32_t);
+            printk_number(&sink, value, *format == 'u' ? 10 : 16, 0, *format == 'X', width, zero_pad, left_align);
+            break;
+        case 'p':
+            printk_putc(&sink, '0');
+            printk_putc(&sink, 'x');
+            printk_number(&sink, (uint64_t)va_arg(args, void *), 16, 0, 0, 16, 1, 0);
+            break;
+        case 'c':
+            printk_putc(&sink, (char)va_arg(args, int));
+            break;
+        case 's':
+            string = va_arg(args, const char *);
+            string = string ? string : "(null)";
+            for (padding = width; string[width - padding] && padding > 0; --padding);
+            for (; !left_align && padding > 0; --padding) {
+                printk_putc(&sink, ' ');
+            }
+            for (; *string; ++string) {
+                printk_putc(&sink, *string);
+            }
+            for (; padding > 0; --padding) {
+                printk_putc(&sink, ' ');
+            }
+            break;
+        case '%':
+            printk_putc(&sink, '%');
+            break;
+        case '\0':
+            --format;                                                               /* let the loop see the terminator */
+            break;
+        default:
+            printk_putc(&sink, '%');
+            printk_putc(&sink, *format);
+            break;
+        }
+    }
+
+    if (size > 0) {
+        buffer[sink.length < size ? sink.length : size - 1] = '\0';
+    }
+    return (int)(sink.length < size ? sink.length : (size > 0 ? size - 1 : 0));
+}
+
+int snprintf(char *buffer, size_t size, const char *format, ...) {
+    va_list args;
+    int length;
+
+    va_start(args, format);
+    length = vsnprintf(buffer, size, format, args);
+    va_end(args);
+    return length;
+}
+
+/**
+ * @brief Writes to every console. The framebuffer only shows it after `fbcon_flush()`.
+ */
+static void printk_write(const char *buffer, uint64_t length) {
+    serial_write(buffer, length);
+    fbcon_write(buffer, length);
+}
+
+/**
+ * @brief Writes a message straight to the UART. Used until the rings exist and once
+ *        `printk_emergency()` was called.
+ */
+static int printk_direct(const char *format, va_list args) {
+    char buffer[PRINTK_BUFFER_SIZE];
+    uint64_t flags;
+    int length;
+
+    length = vsnprintf(buffer, sizeof(buffer), format, args);
+    if (printk_unlocked) {
+        printk_write(buffer, length);
+        fbcon_flush();
+        return length;
+    }
+
+    spin_lock_irqsave(&printk_lock, flags);
+    printk_write(buffer, length);
+    fbcon_flush();
+    spin_unlock_irqrestore(&printk_lock, flags);
+    return length;
+}
+
+/**
+ * @brief Formats a message straight into the ring of the calling CPU, with interrupts disabled.
+ *        A message that may not fit is dropped and counted rather than waited for.
+ *
+ * @return The length of the message, 0 if it was dropped.
+ */
+static int printk_ring_append(struct printk_ring *ring, uint32_t level, const char *format, va_list args) {
+    struct printk_record *record;
+    uint64_t head = ring->head, tail, offset, wrap;
+    int length;
+
+    tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);                          /* the drainer is done with what is before */
+    offset = head & (PRINTK_RING_SIZE - 1);
+    wrap = PRINTK_RING_SIZE - offset < PRINTK_RECORD_MAX ? PRINTK_RING_SIZE - offset : 0;
+    if (head + wrap + PRINTK_RECORD_MAX - tail > PRINTK_RING_SIZE) {
+        ++ring->dropped;
+        return 0;
+    }
+
+    if (wrap != 0) {                                                                /* records never straddle the end */
+        record = (struct printk_record *)(ring->data + offset);
+        record->size = (uint16_t)wrap;
+        record->flags = PRINTK_RECORD_WRAP;
+        head += wrap;
+        offset = 0;
+    }
+
+    record = (struct printk_record *)(ring->data + offset);
+    record->tsc = rdtsc();
+    length = vsnprintf(record->text, PRINTK_BUFFER_SIZE, format, args);
+    record->size = (uint16_t)((sizeof(*record) + length + PRINTK_RECORD_ALIGN - 1) & ~(PRINTK_RECORD_ALIGN - 1));
+    record->length = (uint16_t)length;
+    record->level = (uint8_t)level;
+    record->flags = ring->line_open ? PRINTK_RECORD_CONTINUED : 0;
+    if (length > 0) {
+        ring->line_open = record->text[length - 1] != '\n';
+    }
+    __atomic_store_n(&ring->head, head + record->size, __ATOMIC_RELEASE);           /* publishes the record */
+    return length;
+}
+
+static int vprintk_log(uint32_t level, const char *format, va_list args) {
+    struct printk_ring *ring;
+    uint64_t flags;
+    int length;
+
+    if (!printk_ring_ready || printk_unlocked) {
+        return printk_direct(format, args);
+    }
+
+    flags = arch_irq_save();                                                        /* an interrupt must not append halfway */
+    ring = this_cpu_ptr(printk_ring);
+    if (ring->data == NULL) {
+        arch_irq_restore(flags);
+        return printk_direct(format, args);
+    } else if (ring->busy) {
+        ++ring->dropped;
+        arch_irq_restore(flags);
+        return 0;
+    }
+
+    ring->busy = 1;
+    length = printk_ring_append(ring, level, format, args);
+    ring->busy = 0;
+    arch_irq_restore(flags);
+    return length;
+}
+
+/**
+ * @brief Prints a formatted message to the serial console at `PRINTK_INFO`. Once
+ *        `printk_init()` ran, the message only goes into the ring of the calling CPU.
+ */
+int printk(const char *format, ...) {
+    va_list args;
+    int length;
+
+    va_start(args, format);
+    length = vprintk_log(PRINTK_INFO, format, args);
+    va_end(args);
+    return length;
+}
+
+/**
+ * @brief Logs a formatted message at `level`. Prefer the `pr_*()` macros, which filter at
+ *        compile time.
+ */
+int printk_log(uint32_t level, const char *format, ...) {
+    va_list args;
+    int length;
+
+    va_start(args, format);
+    length = vprintk_log(level, format, args);
+    va_end(args);
+    return length;
+}
+
+/**
+ * @brief Gives every CPU a log ring on its node and switches `printk()` from writing the UART
+ *        to appending there. Must run after `percpu_init()`.
+ *
+ * @return `PRINTK_SUCCESS` on success, `PRINTK_NO_MEMORY` otherwise; `printk()` then keeps
+ *         writing the UART directly.
+ */
+int32_t printk_init(void) {
+    uint32_t cpu, missing = 0;
+    uint64_t phys;
+
+    for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+        if (percpu_bases[cpu] == 0) {
+            continue;                                                               /* never started */
+        }
+
+        phys = pmm_alloc_node(PRINTK_RING_ORDER, numa_cpu_to_node(cpu));            /* mostly written by its own CPU */
+        if (phys == 0) {
+            ++missing;
+            continue;
+        }
+        per_cpu(printk_ring, cpu).data = phys_to_virt(phys);
+    }
+
+    __atomic_store_n(&printk_ring_ready, 1, __ATOMIC_RELEASE);
+    printk("printk: %lu KB ring per cpu, %u of %u rings\n", PRINTK_RING_SIZE / 1024, smp_cpu_count - missing,
+           smp_cpu_count);
+    return missing ? PRINTK_NO_MEMORY : PRINTK_SUCCESS;
+}
+
+/**
+ * @brief Gets the oldest record of `ring`, skipping the padding at the end.
+ */
+static struct printk_record *printk_ring_peek(struct printk_ring *ring) {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE), tail = ring->tail;
+    struct printk_record *record;
+
+    while (tail != head) {
+        record = (struct printk_record *)(ring->data + (tail & (PRINTK_RING_SIZE - 1)));
+        if (!(record->flags & PRINTK_RECORD_WRAP)) {
+            return record;
+        }
+        tail += record->size;
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Starts a new line on the UART, ending the one another CPU left open.
+ */
+static void printk_newline(uint64_t tsc) {
+    char prefix[24];
+    uint64_t ns = tsc_to_ns(tsc);
+    int length;
+
+    if (printk_open_cpu != SMP_MAX_CPUS) {
+        printk_write("\n", 1);
+    }
+    length = snprintf(prefix, sizeof(prefix), "[%5lu.%06lu] ", ns / 1000000000, ns / 1000 % 1000000);
+    printk_write(prefix, length);
+    printk_open_cpu = SMP_MAX_CPUS;
+}
+
+static void printk_emit(uint32_t cpu, const struct printk_record *record) {
+    if (record->level > printk_console_level || record->length == 0) {
+        return;
+    }
+
+    if (printk_open_cpu != cpu || !(record->flags & PRINTK_RECORD_CONTINUED)) {
+        printk_newline(record->tsc);
+    }
+    printk_write(record->text, record->length);
+    printk_open_cpu = record->text[record->length - 1] == '\n' ? SMP_MAX_CPUS : cpu;
+}
+
+static void printk_report_drops(uint32_t cpu, struct printk_ring *ring) {
+    char buffer[64];
+    uint64_t dropped = ring->dropped;
+    int length;
+
+    if (dropped == ring->dropped_reported) {
+        return;
+    }
+
+    printk_newline(rdtsc());
+    length = snprintf(buffer, sizeof(buffer), "printk: cpu %u dropped %lu messages\n", cpu,
+                      dropped - ring->dropped_reported);
+    printk_write(buffer, length);
+    ring->dropped_reported = dropped;
+}
+
+/**
+ * @brief Writes up to `budget` records to the UART, always the oldest one of all rings except
+ *        that a CPU that left its line open gets to finish it. The caller owns the UART.
+ *
+ * @return The number of records consumed.
+ */
+static uint32_t printk_drain_rings(uint32_t budget) {
+    struct printk_record *record, *next;
+    struct printk_ring *ring;
+    uint32_t cpu, next_cpu = 0, count;
+
+    for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+        if (percpu_bases[cpu] != 0 && per_cpu(printk_ring, cpu).data != NULL) {
+            printk_report_drops(cpu, per_cpu_ptr(printk_ring, cpu));
+        }
+    }
+
+    for (count = 0; count < budget; ++count) {
+        next = NULL;
+        for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+            if (percpu_bases[cpu] == 0 || (ring = per_cpu_ptr(printk_ring, cpu))->data == NULL) {
+                continue;
+            } else if ((record = printk_ring_peek(ring)) == NULL) {
+                continue;
+            }
+
+            if (cpu == printk_open_cpu && (record->flags & PRINTK_RECORD_CONTINUED)) {
+                next = record;
+                next_cpu = cpu;
+                break;
+            } else if (next == NULL || (int64_t)(record->tsc - next->tsc) < 0) {
+                next = record;
+                next_cpu = cpu;
+            }
+        }
+        if (next == NULL) {
+            break;
+        }
+
+        printk_emit(next_cpu, next);
+        ring = per_cpu_ptr(printk_ring, next_cpu);
+        __atomic_store_n(&ring->tail, ring->tail + next->size, __ATOMIC_RELEASE);   /* hands the space back */
+    }
+    fbcon_flush();                                                                  /* once per batch, however much scrolled */
+    return count;
+}
+
+static int printk_pending(void) {
+    struct printk_ring *ring;
+    uint32_t cpu;
+
+    for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+        if (percpu_bases[cpu] == 0 || (ring = per_cpu_ptr(printk_ring, cpu))->data == NULL) {
+            continue;
+        } else if (ring->head != ring->tail || ring->dropped != ring->dropped_reported) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Writes the records of all rings to the UART in time stamp order, unless another CPU is
+ *        already doing so. Called from the idle loop, so no producer waits for the UART.
+ */
+void printk_drain(void) {
+    if (!printk_ring_ready || printk_unlocked || this_cpu_ptr(printk_ring)->data == NULL) {
+        return;                                                                     /* without a ring, its `printk()` takes the lock */
+    } else if (!printk_pending() || !spin_trylock(&printk_lock)) {
+        return;
+    }
+
+    printk_drain_rings(PRINTK_DRAIN_BATCH);                                         /* back to the idle loop for queued threads */
+    spin_unlock(&printk_lock);
+}
+
+/**
+ * @brief Whether any ring holds records that `printk_drain()` on the calling CPU would write
+ *        out if it got the UART. The idle loop does not halt while there are.
+ */
+int printk_drain_pending(void) {
+    if (!printk_ring_ready || printk_unlocked || this_cpu_ptr(printk_ring)->data == NULL) {
+        return 0;
+    }
+    return printk_pending();
+}
+
+/**
+ * @brief Whether the ring of the calling CPU holds records that are not on the UART yet.
+ */
+int printk_cpu_pending(void) {
+    struct printk_ring *ring;
+
+    if (!printk_ring_ready || printk_unlocked) {
+        return 0;
+    }
+    ring = this_cpu_ptr(printk_ring);
+    return ring->data != NULL && ring->head != __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Waits until all records logged so far are on the UART.
+ */
+void printk_flush(void) {
+    uint64_t flags;
+
+    if (!printk_ring_ready || printk_unlocked) {
+        return;
+    }
+
+    while (printk_pending()) {
+        spin_lock_irqsave(&printk_lock, flags);
+        printk_drain_rings(PRINTK_DRAIN_BATCH);
+        spin_unlock_irqrestore(&printk_lock, flags);
+    }
+}
+
+/**
+ * @brief Takes the consoles away from `printk()` once the rings are written out, so the caller
+ *        can draw to them directly. Interrupts stay disabled until `printk_console_unlock()`.
+ */
+uint64_t printk_console_lock(void) {
+    uint64_t flags;
+
+    spin_lock_irqsave(&printk_lock, flags);
+    if (printk_ring_ready && !printk_unlocked) {
+        printk_drain_rings(~0U);
+    }
+    return flags;
+}
+
+void printk_console_unlock(uint64_t flags) {
+    spin_unlock_irqrestore(&printk_lock, flags);
+}
+
+/**
+ * @brief Makes `printk()` stop taking its lock, so that a CPU that crashed while holding it,
+ *        or an NMI that interrupted the holder, can still report. What the rings hold is
+ *        written out first, and later messages bypass them. Lines may interleave.
+ */
+void printk_emergency(void) {
+    printk_unlocked = 1;
+    if (printk_ring_ready) {
+        printk_drain_rings(~0U);
+    }
+}
+
+#if defined(NICKEL_BENCH)
+#define PRINTK_BENCH_MESSAGES           200                                         /* per CPU, fits a ring without draining */
+
+static uint64_t printk_bench_cycles[SMP_MAX_CPUS];
+static uint64_t printk_bench_max[SMP_MAX_CPUS];
+
+static void printk_bench_worker(void *arg) {
+    uint32_t cpu = smp_processor_id(), i;
+    uint64_t start, cycles, total = 0, max = 0;
+
+    (void)arg;
+    for (i = 0; i < PRINTK_BENCH_MESSAGES; ++i) {
+        start = rdtsc();
+        printk_log(PRINTK_DEBUG, "printk: bench cpu %u message %u\n", cpu, i);
+        cycles = rdtsc() - start;
+        total += cycles;
+        max = cycles > max ? cycles : max;
+    }
+    printk_bench_cycles[cpu] = total;
+    printk_bench_max[cpu] = max;
+}
+
+static uint64_t printk_bench_dropped(void) {
+    uint64_t dropped = 0;
+    uint32_t cpu;
+
+    for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+        if (percpu_bases[cpu] != 0) {
+            dropped += per_cpu(printk_ring, cpu).dropped;
+        }
+    }
+    return dropped;
+}
+
+/**
+ * @brief Floods the rings from all online CPUs and measures what a message costs its producer.
+ */
+void printk_bench(void) {
+    uint64_t total = 0, max = 0, dropped, start, drain;
+    uint32_t level = printk_console_level, count = smp_online_count, cpu;
+
+    printk_flush();
+    for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+        printk_bench_cycles[cpu] = printk_bench_max[cpu] = 0;
+    }
+    dropped = printk_bench_dropped();
+
+    printk_console_level = PRINTK_INFO;                                             /* logged at `PRINTK_DEBUG`, never printed */
+    smp_run_on_cpus(printk_bench_worker, NULL, count);
+    start = rdtsc();
+    printk_flush();
+    drain = rdtsc() - start;
+    printk_console_level = level;
+
+    for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+        total += printk_bench_cycles[cpu];
+        max = printk_bench_max[cpu] > max ? printk_bench_max[cpu] : max;
+    }
+    printk("printk: %u cpus x %u messages, %lu ns avg, %lu ns max per message, %lu dropped\n", count,
+           PRINTK_BENCH_MESSAGES, tsc_to_ns(total) / ((uint64_t)count * PRINTK_BENCH_MESSAGES), tsc_to_ns(max),
+           printk_bench_dropped() - dropped);
+    printk("printk: consumed in %lu us\n", tsc_to_ns(drain) / 1000);
+}
+#endif
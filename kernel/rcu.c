@@ -0,0 +1,291 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include <lock.h>
+#include <percpu.h>
+#include <printk.h>
+#include <rcu.h>
+#include <sched.h>
+#include <smp.h>
+#include <spinlock.h>
+
+#include <arch/cpu.h>
+#include <arch/tsc.h>
+
+/**
+ * @brief Global grace period state. Readers never touch it; CPUs read `gp_seq` at their
+ *        quiescent states and only take the lock to report one the current grace period
+ *        still waits for, which happens once per CPU and grace period.
+ */
+static struct {
+    struct spinlock lock;
+    volatile uint64_t gp_seq;                                                       /* last grace period started */
+    volatile uint64_t completed;                                                    /* last grace period completed */
+    uint64_t requested;                                                             /* last grace period somebody waits for */
+    struct cpumask pending;                                                         /* CPUs `gp_seq` still waits for */
+} rcu_state __cacheline_aligned;
+
+static DEFINE_PER_CPU(struct rcu_data, rcu_data);
+
+static int rcu_cpumask_empty(const struct cpumask *mask) {
+    uint32_t i;
+
+    for (i = 0; i < SMP_MAX_CPUS / 64; ++i) {
+        if (mask->bits[i] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Starts the next grace period, waiting for every CPU online now. CPUs that come
+ *        online later cannot hold references from before it. Idle CPUs that halted are woken
+ *        to report their quiescent state. Holds `rcu_state.lock`.
+ */
+static void rcu_gp_start(void) {
+    uint32_t i;
+
+    for (i = 0; i < SMP_MAX_CPUS / 64; ++i) {
+        rcu_state.pending.bits[i] = __atomic_load_n(&smp_online_mask.bits[i], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&rcu_state.gp_seq, rcu_state.gp_seq + 1, __ATOMIC_RELEASE);
+    for (i = 0; i < smp_cpu_count; ++i) {
+        if (cpumask_test(&rcu_state.pending, i)) {
+            sched_kick(i);
+        }
+    }
+}
+
+/**
+ * @brief Asks for a grace period that starts after now and starts it unless one is running.
+ *
+ * @return The number of that grace period.
+ */
+static uint64_t rcu_request(void) {
+    uint64_t target;
+
+    spin_lock(&rcu_state.lock);
+    target = rcu_state.gp_seq + 1;                                                  /* a running one may have started before our caller's update */
+    if (rcu_state.requested < target) {
+        rcu_state.requested = target;
+    }
+    if (rcu_state.gp_seq == rcu_state.completed) {
+        rcu_gp_start();
+    }
+    spin_unlock(&rcu_state.lock);
+    return target;
+}
+
+/**
+ * @brief Moves the callbacks collected in `next` to `wait` if nothing is waiting yet, so all
+ *        of them share one grace period. Interrupts are disabled.
+ */
+static void rcu_advance(struct rcu_data *rdp) {
+    if (rdp->wait_head != NULL || rdp->next_head == NULL) {
+        return;
+    }
+    rdp->wait_head = rdp->next_head;
+    rdp->wait_tail = rdp->next_tail;
+    rdp->next_head = rdp->next_tail = NULL;
+    rdp->wait_gp = rcu_request();
+}
+
+/**
+ * @brief Runs `fn(head)` once every CPU passed a quiescent state, i.e. once no reader can
+ *        still see what was unpublished before the call. It runs on the calling CPU with
+ *        interrupts disabled, from the idle loop or the next `schedule()`.
+ */
+void call_rcu(struct rcu_head *head, void (*fn)(struct rcu_head *head)) {
+    struct rcu_data *rdp;
+    uint64_t flags;
+
+    head->next = NULL;
+    head->fn = fn;
+
+    flags = arch_irq_save();
+    rdp = this_cpu_ptr(rcu_data);
+    if (rdp->next_head == NULL) {
+        rdp->next_head = head;
+    } else {
+        rdp->next_tail->next = head;
+    }
+    rdp->next_tail = head;
+    rcu_advance(rdp);
+    arch_irq_restore(flags);
+}
+
+/**
+ * @brief Reports a quiescent state of the calling CPU. The scheduler tick calls it when the
+ *        interrupted thread can be preempted; it is cheap unless a grace period waits for
+ *        this CPU.
+ */
+void rcu_quiescent(void) {
+    uint64_t gp = __atomic_load_n(&rcu_state.gp_seq, __ATOMIC_ACQUIRE), flags;
+    uint32_t cpu;
+
+    if (gp == this_cpu_read(rcu_data.gp_seen)) {
+        return;                                                                     /* the common case, nothing written */
+    }
+
+    flags = arch_irq_save();
+    cpu = smp_processor_id();
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);                                        /* our earlier reads are over before we report */
+    spin_lock(&rcu_state.lock);
+    if (gp == rcu_state.gp_seq && cpumask_test(&rcu_state.pending, cpu)) {
+        cpumask_clear(&rcu_state.pending, cpu);
+        if (rcu_cpumask_empty(&rcu_state.pending)) {
+            __atomic_store_n(&rcu_state.completed, gp, __ATOMIC_RELEASE);
+            if (rcu_state.requested > gp) {
+                rcu_gp_start();
+            }
+        }
+    }
+    spin_unlock(&rcu_state.lock);
+    this_cpu_write(rcu_data.gp_seen, gp);
+    arch_irq_restore(flags);
+}
+
+/**
+ * @brief Reports a quiescent state and runs the callbacks whose grace period completed. Called
+ *        by `schedule()` and the idle loop, outside any lock.
+ */
+void rcu_poll(void) {
+    struct rcu_data *rdp;
+    struct rcu_head *head, *next;
+    uint64_t flags;
+
+    rcu_quiescent();
+
+    flags = arch_irq_save();
+    rdp = this_cpu_ptr(rcu_data);
+    if (rdp->wait_head != NULL && __atomic_load_n(&rcu_state.completed, __ATOMIC_ACQUIRE) >= rdp->wait_gp) {
+        head = rdp->wait_head;
+        rdp->wait_head = rdp->wait_tail = NULL;
+        rcu_advance(rdp);                                                           /* the next batch starts waiting right away */
+        for (; head != NULL; head = next) {
+            next = head->next;
+            head->fn(head);
+            ++rdp->invoked;
+        }
+    }
+    arch_irq_restore(flags);
+}
+
+/**
+ * @brief Whether the calling CPU still has callbacks or owes the running grace period a
+ *        quiescent state, in which case its idle loop must not halt.
+ */
+int rcu_pending(void) {
+    struct rcu_data *rdp = this_cpu_ptr(rcu_data);
+
+    return rdp->next_head != NULL || rdp->wait_head != NULL
+           || __atomic_load_n(&rcu_state.gp_seq, __ATOMIC_ACQUIRE) != rdp->gp_seen;
+}
+
+struct rcu_synchronize {
+    struct rcu_head head;
+    volatile uint32_t done;
+};
+
+static void rcu_synchronize_done(struct rcu_head *head) {
+    __atomic_store_n(&container_of(head, struct rcu_synchronize, head)->done, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Waits for a full grace period. Must be called from a thread outside any read-side
+ *        critical section.
+ */
+void synchronize_rcu(void) {
+    struct rcu_synchronize sync;
+
+    sync.done = 0;
+    call_rcu(&sync.head, rcu_synchronize_done);
+    while (!__atomic_load_n(&sync.done, __ATOMIC_ACQUIRE)) {
+        rcu_poll();
+        sched_yield();
+    }
+}
+
+#if defined(NICKEL_BENCH)
+#define RCU_BENCH_MS                    20
+#define RCU_BENCH_MAX_CPUS              8
+#define RCU_BENCH_SYNCS                 16
+
+struct rcu_bench_data {
+    uint64_t value;
+};
+
+static struct rcu_bench_data rcu_bench_items[2];
+static struct rcu_bench_data *rcu_bench_current = &rcu_bench_items[0];
+static volatile uint64_t rcu_bench_sink;
+static struct rwlock rcu_bench_rwlock __cacheline_aligned = RWLOCK_INIT;
+static uint32_t rcu_bench_cpus;
+static volatile uint32_t rcu_bench_ready;
+static volatile uint64_t rcu_bench_deadline;                                        /* 0 until the last CPU arrived */
+static uint64_t rcu_bench_counts[SMP_MAX_CPUS];
+
+static void rcu_bench_reader(void *arg) {
+    int use_rcu = arg != NULL;
+    uint64_t count = 0, sum = 0, deadline;
+
+    if (__atomic_add_fetch(&rcu_bench_ready, 1, __ATOMIC_ACQ_REL) == rcu_bench_cpus) {
+        __atomic_store_n(&rcu_bench_deadline, rdtsc() + tsc_frequency / 1000 * RCU_BENCH_MS, __ATOMIC_RELEASE);
+    }
+    while ((deadline = __atomic_load_n(&rcu_bench_deadline, __ATOMIC_ACQUIRE)) == 0) {
+        cpu_relax();
+    }
+
+    while (rdtsc() < deadline) {
+        if (use_rcu) {
+            rcu_read_lock();
+            sum += rcu_dereference(rcu_bench_current)->value;
+            rcu_read_unlock();
+        } else {
+            read_lock(&rcu_bench_rwlock);
+            sum += rcu_bench_current->value;
+            read_unlock(&rcu_bench_rwlock);
+        }
+        ++count;
+    }
+    rcu_bench_counts[smp_processor_id()] = count;
+    rcu_bench_sink = sum;                                                           /* keeps the reads */
+}
+
+/**
+ * @brief Compares RCU readers with rwlock readers on 1 to 8 CPUs and measures the latency of
+ *        `synchronize_rcu()`.
+ */
+void rcu_bench(void) {
+    uint64_t totals[2], start;
+    uint32_t count, cpu, i;
+
+    for (count = 1; count <= RCU_BENCH_MAX_CPUS && count <= smp_online_count; count <<= 1) {
+        for (i = 0; i < 2; ++i) {
+            for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+                rcu_bench_counts[cpu] = 0;
+            }
+            rcu_bench_cpus = count;
+            rcu_bench_ready = 0;
+            rcu_bench_deadline = 0;
+            smp_run_on_cpus(rcu_bench_reader, i ? (void *)1 : NULL, count);
+
+            totals[i] = 0;
+            for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+                totals[i] += rcu_bench_counts[cpu];
+            }
+        }
+        printk("rcu: %u cpus, rwlock %lu k/s, rcu %lu k/s reads\n", count, totals[0] / RCU_BENCH_MS,
+               totals[1] / RCU_BENCH_MS);
+    }
+
+    start = rdtsc();
+    for (i = 0; i < RCU_BENCH_SYNCS; ++i) {
+        rcu_bench_items[(i + 1) & 1].value = i;
+        rcu_assign_pointer(rcu_bench_current, &rcu_bench_items[(i + 1) & 1]);
+        synchronize_rcu();                                                          /* the other item is free to reuse from here */
+    }
+    printk("rcu: synchronize_rcu %lu us on %u cpus\n", tsc_to_ns(rdtsc() - start) / RCU_BENCH_SYNCS / 1000,
+           smp_online_count);
+}
+#endif
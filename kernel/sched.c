@@ -0,0 +1,589 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include <list.h>
+#include <printk.h>
+#include <rcu.h>
+#include <sched.h>
+#include <smp.h>
+#include <spinlock.h>
+#include <timer.h>
+#include <mm/slab.h>
+
+#include <arch/clock.h>
+#include <arch/context.h>
+#include <arch/cpu.h>
+#include <arch/default_idt.h>
+#include <arch/fpu.h>
+#include <arch/stack.h>
+#include <arch/tsc.h>
+#include <arch/apic/apic.h>
+#include <arch/apic/ipi.h>
+
+extern void sched_resched_entry(void);
+
+static struct run_queue run_queues[SMP_MAX_CPUS];
+static struct lock_class run_queue_lock_class = LOCK_CLASS_INIT("run_queue");
+static struct thread idle_threads[SMP_MAX_CPUS];                                    /* the boot context of every CPU */
+static struct kmem_cache *thread_cache = NULL;
+static volatile uint64_t thread_next_id = 1;
+static volatile int sched_running = 0;
+
+void sched_thread_start(struct thread *thread);
+
+static void sched_set_name(struct thread *thread, const char *name) {
+    uint32_t i;
+
+    for (i = 0; i < SCHED_NAME_LENGTH - 1 && name[i]; ++i) {
+        thread->name[i] = name[i];
+    }
+    thread->name[i] = '\0';
+}
+
+static void sched_enqueue(struct run_queue *rq, struct thread *thread) {
+    list_add_tail(&thread->run, &rq->queue);
+    thread->cpu = (uint32_t)(rq - run_queues);
+    ++rq->nr_queued;
+}
+
+static struct thread *sched_pick_next(struct run_queue *rq) {
+    struct thread *thread;
+
+    if (list_empty(&rq->queue)) {
+        return rq->idle;
+    }
+    thread = list_first_entry(&rq->queue, struct thread, run);
+    list_del(&thread->run);
+    --rq->nr_queued;
+    return thread;
+}
+
+static int sched_cpu_is_idle(uint32_t cpu) {
+    return run_queues[cpu].current == run_queues[cpu].idle && run_queues[cpu].nr_queued == 0;
+}
+
+/**
+ * @brief Chooses the run queue for a thread that becomes runnable. The CPU it ran on last is
+ *        kept if it is idle, or if the thread ran recently enough to have a warm cache there
+ *        and that CPU is not much busier than ours. Otherwise the first idle CPU wins, and
+ *        the less loaded of the two otherwise.
+ */
+static uint32_t sched_select_cpu(const struct thread *thread) {
+    uint32_t self = smp_processor_id(), last = thread->cpu, cpu, i;
+
+    if (thread->flags & THREAD_PINNED) {
+        return last;
+    }
+    if (cpumask_test(&smp_online_mask, last)) {
+        if (sched_cpu_is_idle(last)) {
+            return last;
+        }
+        if (thread->last_ran != 0 && clock_monotonic_ns() - thread->last_ran < SCHED_MIGRATION_COST_NS
+            && run_queues[last].nr_queued <= run_queues[self].nr_queued + 1) {
+            return last;
+        }
+    } else {
+        last = self;
+    }
+
+    for (i = 0; i < smp_cpu_count; ++i) {
+        cpu = (last + i) % smp_cpu_count;
+        if (cpumask_test(&smp_online_mask, cpu) && sched_cpu_is_idle(cpu)) {
+            return cpu;
+        }
+    }
+    return run_queues[last].nr_queued <= run_queues[self].nr_queued ? last : self;
+}
+
+/**
+ * @brief Pulls about half of the queued threads of the busiest other CPU onto the idle one
+ *        calling it. Threads are taken from the tail, the ones that would wait longest there.
+ *
+ * @return The number of threads stolen.
+ */
+static uint32_t sched_steal(struct run_queue *rq) {
+    struct run_queue *victim = NULL, *first, *second;
+    struct list_head *pos, *tmp;
+    struct thread *thread;
+    uint32_t self = (uint32_t)(rq - run_queues), cpu, most = 0, want, stolen = 0;
+    uint64_t flags;
+
+    for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+        if (cpu != self && run_queues[cpu].nr_queued > most && cpumask_test(&smp_online_mask, cpu)) {
+            most = run_queues[cpu].nr_queued;
+            victim = &run_queues[cpu];
+        }
+    }
+    if (victim == NULL) {
+        return 0;
+    }
+
+    first = rq < victim ? rq : victim;                                              /* run queues are locked in CPU order */
+    second = rq < victim ? victim : rq;
+    flags = arch_irq_save();
+    spin_lock(&first->lock);
+    spin_lock(&second->lock);
+
+    want = (victim->nr_queued + 1) / 2;
+    for (pos = victim->queue.prev, tmp = pos->prev; pos != &victim->queue && stolen < want; pos = tmp, tmp = pos->prev) {
+        thread = list_entry(pos, struct thread, run);
+        if (thread->flags & THREAD_PINNED) {
+            continue;
+        }
+        list_del(&thread->run);
+        --victim->nr_queued;
+        sched_enqueue(rq, thread);
+        ++stolen;
+    }
+    rq->steals += stolen;
+
+    spin_unlock(&second->lock);
+    spin_unlock(&first->lock);
+    arch_irq_restore(flags);
+    return stolen;
+}
+
+/**
+ * @brief Sends `APIC_VECTOR_RESCHEDULE` to `cpu` if it halted in `sched_idle()`, so that it
+ *        looks for work again. The caller publishes the work first.
+ */
+void sched_kick(uint32_t cpu) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);                                        /* pairs with the one in `sched_idle()` */
+    if (cpu != smp_processor_id() && __atomic_load_n(&run_queues[cpu].halted, __ATOMIC_RELAXED)) {
+        apic_send_ipi(processors[cpu].apic_id, APIC_VECTOR_RESCHEDULE);
+    }
+}
+
+/**
+ * @brief Handler of `APIC_VECTOR_RESCHEDULE`. Ending the `hlt` is all it is for.
+ */
+void sched_resched_interrupt(void) {
+    apic_eoi();
+}
+
+/**
+ * @brief Wakes the first halted CPU to write out the log ring of the calling one, which stays
+ *        busy. Called from the tick, so records wait at most a slice.
+ */
+static void sched_kick_drainer(void) {
+    uint32_t cpu;
+
+    for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+        if (run_queues[cpu].halted && cpumask_test(&smp_online_mask, cpu)) {
+            sched_kick(cpu);
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Preempts `current` when its slice runs out and others are waiting. While it runs
+ *        alone the tick keeps coming but does nothing beyond waking a CPU to drain its log.
+ */
+static void sched_tick(struct timer *timer) {
+    struct run_queue *rq = container_of(timer, struct run_queue, tick);
+
+    if (rq->current->preempt_count == 0) {
+        rcu_quiescent();                                                            /* not inside `rcu_read_lock()` */
+    }
+    if (printk_cpu_pending()) {
+        sched_kick_drainer();
+    }
+    if (rq->nr_queued != 0) {
+        rq->need_resched = 1;
+    } else if (rq->current != rq->idle) {
+        timer_add(&rq->tick, clock_monotonic_ns() + SCHED_SLICE_NS);
+    }
+}
+
+/**
+ * @brief Completes a switch in the context of the thread switched to: lets `prev` be picked
+ *        by other CPUs, releases the run queue `schedule()` locked and frees `prev` if it
+ *        exited. Interrupts are still disabled.
+ */
+static void sched_finish_switch(struct run_queue *rq) {
+    struct thread *prev = rq->prev, *next = rq->current;
+
+    __atomic_store_n(&prev->on_cpu, 0, __ATOMIC_RELEASE);
+    spin_unlock(&rq->lock);
+
+    if (next == rq->idle) {
+        timer_cancel(&rq->tick);
+        timer_cpu_idle();
+    } else {
+        if (prev == rq->idle) {
+            timer_cpu_busy();
+        }
+        if (!timer_pending(&rq->tick)) {
+            timer_add(&rq->tick, clock_monotonic_ns() + SCHED_SLICE_NS);
+        }
+    }
+
+    if (prev->state == THREAD_DEAD) {
+        if (prev->fpu != NULL) {
+            fpu_free(prev->fpu);
+        }
+        stack_free(prev->stack, SCHED_STACK_ORDER);
+        kmem_cache_free(thread_cache, prev);
+    }
+}
+
+/**
+ * @brief Switches to the next runnable thread of the calling CPU. A running caller stays
+ *        runnable; one that set itself `THREAD_BLOCKED` sleeps until `thread_wake()`.
+ */
+void schedule(void) {
+    struct run_queue *rq;
+    struct thread *prev, *next;
+    uint64_t flags;
+
+    rcu_poll();                                                                     /* a switch point is a quiescent state */
+    flags = arch_irq_save();
+    rq = &run_queues[smp_processor_id()];
+    spin_lock(&rq->lock);
+    rq->need_resched = 0;
+    prev = rq->current;
+    if (prev->state == THREAD_RUNNING && prev != rq->idle) {
+        sched_enqueue(rq, prev);
+    }
+    next = sched_pick_next(rq);
+    if (next == prev) {
+        spin_unlock(&rq->lock);
+        arch_irq_restore(flags);
+        return;
+    }
+
+    while (__atomic_load_n(&next->on_cpu, __ATOMIC_ACQUIRE)) {
+        cpu_relax();                                                                /* woken here while its old CPU still saves it */
+    }
+    next->on_cpu = 1;
+    next->cpu = (uint32_t)(rq - run_queues);
+    rq->current = next;
+    rq->prev = prev;
+    ++rq->switches;
+    if (next != rq->idle) {
+        ++rq->ran;
+    }
+    prev->last_ran = clock_monotonic_ns();
+
+    fpu_switch(next->fpu);
+    arch_context_switch(&prev->sp, next->sp);
+    sched_finish_switch(&run_queues[smp_processor_id()]);                           /* prev may come back on another CPU */
+    arch_irq_restore(flags);
+}
+
+/**
+ * @brief Gives the CPU to the next queued thread, if any.
+ */
+void sched_yield(void) {
+    schedule();
+}
+
+/**
+ * @brief Gets the thread running on the calling CPU.
+ */
+struct thread *thread_current(void) {
+    return run_queues[smp_processor_id()].current;
+}
+
+/**
+ * @brief C entry of a new thread, reached through `arch_thread_start` the first time it is
+ *        switched to.
+ */
+__attribute__((noreturn))
+void sched_thread_start(struct thread *thread) {
+    sched_finish_switch(&run_queues[smp_processor_id()]);
+    arch_irq_enable();
+    thread->fn(thread->arg);
+    thread_exit();
+}
+
+/**
+ * @brief Creates a thread running `fn(arg)` and makes it runnable. It exits when `fn` returns.
+ *
+ * @return The new thread, or `NULL` if it cannot be allocated.
+ */
+struct thread *thread_create(const char *name, void (*fn)(void *arg), void *arg, uint32_t flags) {
+    struct thread *thread;
+    struct run_queue *rq;
+    uint64_t irq_flags;
+
+    if (thread_cache == NULL || (thread = kmem_cache_alloc(thread_cache)) == NULL) {
+        return NULL;
+    }
+    if ((thread->stack = stack_alloc(SCHED_STACK_ORDER)) == 0) {
+        kmem_cache_free(thread_cache, thread);
+        return NULL;
+    }
+
+    thread->sp = arch_thread_stack_init(thread->stack, thread);
+    list_init(&thread->run);
+    thread->state = THREAD_RUNNING;
+    thread->on_cpu = 0;
+    thread->cpu = smp_processor_id();
+    thread->flags = flags & THREAD_PINNED;
+    thread->preempt_count = 0;
+    thread->id = __atomic_fetch_add(&thread_next_id, 1, __ATOMIC_RELAXED);
+    thread->last_ran = 0;                                                           /* no warm cache anywhere */
+    thread->fpu = NULL;
+    thread->fn = fn;
+    thread->arg = arg;
+    sched_set_name(thread, name);
+
+    rq = &run_queues[sched_select_cpu(thread)];
+    spin_lock_irqsave(&rq->lock, irq_flags);
+    sched_enqueue(rq, thread);
+    spin_unlock_irqrestore(&rq->lock, irq_flags);
+    sched_kick((uint32_t)(rq - run_queues));
+    return thread;
+}
+
+/**
+ * @brief Makes a blocked thread runnable, preferably on the CPU it last ran on while its
+ *        cache is still warm.
+ */
+void thread_wake(struct thread *thread) {
+    struct run_queue *rq;
+    uint64_t flags;
+    uint32_t cpu;
+
+    while (1) {
+        cpu = thread->cpu;
+        rq = &run_queues[cpu];
+        spin_lock_irqsave(&rq->lock, flags);
+        if (thread->cpu == cpu) {
+            break;
+        }
+        spin_unlock_irqrestore(&rq->lock, flags);
+    }
+
+    if (thread->state != THREAD_BLOCKED) {
+        spin_unlock_irqrestore(&rq->lock, flags);
+        return;
+    }
+    thread->state = THREAD_RUNNING;
+    if (thread->on_cpu) {
+        spin_unlock_irqrestore(&rq->lock, flags);                                   /* not switched out yet, it keeps running */
+        return;
+    }
+    spin_unlock(&rq->lock);
+
+    rq = &run_queues[sched_select_cpu(thread)];
+    spin_lock(&rq->lock);
+    sched_enqueue(rq, thread);
+    spin_unlock_irqrestore(&rq->lock, flags);
+    sched_kick((uint32_t)(rq - run_queues));
+}
+
+/**
+ * @brief Terminates the calling thread.
+ */
+__attribute__((noreturn))
+void thread_exit(void) {
+    arch_irq_disable();
+    thread_current()->state = THREAD_DEAD;
+    schedule();
+    while (1);
+}
+
+/**
+ * @brief Preempts the interrupted thread if its slice ran out. Called by the interrupt stubs
+ *        after the handler, with interrupts disabled.
+ */
+void sched_irq_exit(void) {
+    struct run_queue *rq;
+
+    if (!sched_running) {
+        return;
+    }
+    rq = &run_queues[smp_processor_id()];
+    if (rq->need_resched && rq->current != rq->idle && rq->current->preempt_count == 0) {
+        schedule();
+    }
+}
+
+/**
+ * @brief Turns the calling context into the idle thread of an AP.
+ */
+void sched_cpu_init(void) {
+    uint32_t cpu = smp_processor_id();
+    struct thread *idle = &idle_threads[cpu];
+
+    list_init(&idle->run);
+    idle->state = THREAD_RUNNING;
+    idle->on_cpu = 1;
+    idle->cpu = cpu;
+    idle->flags = THREAD_IDLE | THREAD_PINNED;
+    idle->preempt_count = 0;
+    idle->id = 0;
+    idle->stack = 0;
+    idle->fpu = NULL;
+    sched_set_name(idle, "idle");
+    run_queues[cpu].idle = idle;
+    run_queues[cpu].current = idle;
+}
+
+/**
+ * @brief Creates the thread cache and turns the calling context into the idle thread of the
+ *        boot CPU. Must run after `slab_init()` and `timer_init()`.
+ *
+ * @return `SCHED_SUCCESS` on success, `SCHED_NO_MEMORY` otherwise.
+ */
+int32_t sched_init(void) {
+    struct run_queue *rq;
+    uint32_t cpu;
+
+    for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+        rq = &run_queues[cpu];
+        spin_lock_init(&rq->lock);
+        lock_stat_set_class(&rq->lock, &run_queue_lock_class);
+        list_init(&rq->queue);
+        rq->nr_queued = 0;
+        rq->need_resched = 0;
+        rq->halted = 0;
+        timer_setup(&rq->tick, sched_tick, TIMER_PINNED);
+    }
+    sched_cpu_init();
+    idt_set_gate(APIC_VECTOR_RESCHEDULE, sched_resched_entry);
+
+    thread_cache = kmem_cache_create("thread", sizeof(struct thread), SMP_CACHE_LINE);
+    if (thread_cache == NULL) {
+        return SCHED_NO_MEMORY;
+    }
+    sched_running = 1;
+    printk("sched: %u run queues, %lu ms slices\n", smp_cpu_count, SCHED_SLICE_NS / 1000000);
+    return SCHED_SUCCESS;
+}
+
+/**
+ * @brief Runs queued threads, steals from the busiest CPU when there are none and serves
+ *        `smp_poll_work()`, RCU and the log rings in between. Halts once none of them has
+ *        anything left for it. Never returns.
+ */
+__attribute__((noreturn))
+void sched_idle(void) {
+    struct run_queue *rq = &run_queues[smp_processor_id()];
+
+    arch_irq_enable();
+    while (1) {
+        smp_poll_work();
+        rcu_poll();
+        printk_drain();
+        if (rq->nr_queued != 0 || sched_steal(rq) != 0) {
+            schedule();
+            continue;
+        }
+
+        arch_irq_disable();
+        __atomic_store_n(&rq->halted, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);                                    /* a `sched_kick()` after the checks sees it */
+        if (rq->nr_queued == 0 && !smp_work_pending() && !rcu_pending() && !printk_drain_pending()) {
+            arch_irq_enable_and_halt();                                             /* the kick stays pending until `hlt` */
+        } else {
+            arch_irq_enable();
+        }
+        __atomic_store_n(&rq->halted, 0, __ATOMIC_RELAXED);
+    }
+}
+
+#if defined(NICKEL_BENCH)
+#define SCHED_BENCH_YIELDS              100000
+#define SCHED_BENCH_THREADS             1000
+#define SCHED_BENCH_WORK_US             100
+
+static struct {
+    struct thread *waiter;
+    volatile uint32_t done;
+    uint32_t expected;
+} sched_bench_state;
+
+static void sched_bench_finish(void) {
+    if (__atomic_add_fetch(&sched_bench_state.done, 1, __ATOMIC_ACQ_REL) == sched_bench_state.expected) {
+        thread_wake(sched_bench_state.waiter);
+    }
+}
+
+/**
+ * @brief Blocks the bench thread until `expected` workers called `sched_bench_finish()`.
+ */
+static void sched_bench_wait(void) {
+    struct thread *self = thread_current();
+
+    while (1) {
+        self->state = THREAD_BLOCKED;                                               /* before the check, so no wakeup is lost */
+        if (__atomic_load_n(&sched_bench_state.done, __ATOMIC_ACQUIRE) == sched_bench_state.expected) {
+            self->state = THREAD_RUNNING;
+            return;
+        }
+        schedule();
+    }
+}
+
+static void sched_bench_yielder(void *arg) {
+    uint32_t i;
+
+    for (i = 0; i < SCHED_BENCH_YIELDS; ++i) {
+        sched_yield();
+    }
+    sched_bench_finish();
+}
+
+static void sched_bench_worker(void *arg) {
+    tsc_delay_us(SCHED_BENCH_WORK_US);
+    sched_bench_finish();
+}
+
+static void sched_bench_thread(void *arg) {
+    static uint64_t ran[SMP_MAX_CPUS], steals[SMP_MAX_CPUS];
+    uint64_t start, elapsed, total = 0;
+    uint32_t cpu, i;
+
+    sched_bench_state.waiter = thread_current();
+    sched_bench_state.done = 0;
+    sched_bench_state.expected = 2;
+    start = rdtsc();
+    thread_create("yield0", sched_bench_yielder, NULL, THREAD_PINNED);
+    thread_create("yield1", sched_bench_yielder, NULL, THREAD_PINNED);
+    sched_bench_wait();
+    elapsed = tsc_to_ns(rdtsc() - start);
+    printk("sched: %u yields in two threads, %lu ns per switch, %lu switches/s\n", SCHED_BENCH_YIELDS,
+           elapsed / (2 * SCHED_BENCH_YIELDS), 2UL * SCHED_BENCH_YIELDS * 1000000000UL / (elapsed ? elapsed : 1));
+
+    for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+        ran[cpu] = run_queues[cpu].ran;
+        steals[cpu] = run_queues[cpu].steals;
+    }
+    sched_bench_state.done = 0;
+    sched_bench_state.expected = 0;
+    start = rdtsc();
+    for (i = 0; i < SCHED_BENCH_THREADS; ++i) {
+        if (thread_create("worker", sched_bench_worker, NULL, 0) != NULL) {
+            __atomic_add_fetch(&sched_bench_state.expected, 1, __ATOMIC_RELEASE);
+        }
+    }
+    sched_bench_wait();
+    elapsed = tsc_to_ns(rdtsc() - start);
+
+    printk("sched: %u threads of %u us on %u cpus in %lu us (ideal %lu us)\n", sched_bench_state.expected,
+           SCHED_BENCH_WORK_US, smp_online_count, elapsed / 1000,
+           (uint64_t)sched_bench_state.expected * SCHED_BENCH_WORK_US / smp_online_count);
+    for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+        if (cpumask_test(&smp_online_mask, cpu)) {
+            total += run_queues[cpu].ran - ran[cpu];
+            printk("sched: cpu %u ran %lu threads, stole %lu\n", cpu, run_queues[cpu].ran - ran[cpu],
+                   run_queues[cpu].steals - steals[cpu]);
+        }
+    }
+    printk("sched: %lu switches in, bench done\n", total);
+}
+
+/**
+ * @brief Measures context switches per second and how many short CPU-bound threads every CPU
+ *        ran. Runs in a thread of its own and prints when it is done.
+ */
+void sched_bench(void) {
+    if (thread_create("sched_bench", sched_bench_thread, NULL, THREAD_PINNED) == NULL) {
+        printk("sched: bench skipped, no memory\n");
+    }
+}
+#endif
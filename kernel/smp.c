@@ -0,0 +1,149 @@
+#include <acpi.h>
+#include <sched.h>
+#include <smp.h>
+
+#include <arch/cpu.h>
+#include <arch/apic/apic.h>
+
+#define SMP_APIC_MAP_SIZE               (2 * SMP_MAX_CPUS)                          /* power of two, at most half full */
+
+uint32_t smp_cpu_count = 1;
+volatile uint32_t smp_online_count = 1;
+struct cpumask smp_online_mask;
+
+DEFINE_PER_CPU(uint32_t, cpu_number);
+
+/**
+ * @brief APIC ID to CPU index map. x2APIC IDs are 32 bits wide, so this is an open-addressing
+ *        table; IDs are mostly dense, so the low bits make a good enough hash.
+ */
+static struct {
+    uint32_t apic_id;
+    uint16_t cpu;                                                                   /* CPU index + 1, 0 for a free slot */
+} apic_to_cpu[SMP_APIC_MAP_SIZE];
+
+/**
+ * @brief Work item of `smp_run_on_cpus()`. A new generation publishes new work; the first
+ *        `count - 1` APs to join run it. Every online AP acknowledges every generation through
+ *        `pending`, so no AP can still be looking at an old one when the next is published.
+ */
+static struct {
+    void (*fn)(void *arg);
+    void *arg;
+    uint32_t count;
+    volatile uint32_t joined;
+    volatile uint32_t pending;
+    volatile uint64_t generation;
+} smp_work __cacheline_aligned;
+
+static uint64_t smp_work_seen[SMP_MAX_CPUS];
+
+/**
+ * @brief Builds the APIC ID to CPU index map from the processors found in the MADT. Must run
+ *        after `acpi_init()`; until `percpu_init()` every CPU reports index 0.
+ */
+void smp_init(void) {
+    uint32_t i, slot;
+
+    smp_cpu_count = cores ? cores : 1;
+    for (i = 0; i < cores; ++i) {
+        slot = processors[i].apic_id & (SMP_APIC_MAP_SIZE - 1);
+        while (apic_to_cpu[slot].cpu != 0) {
+            slot = (slot + 1) & (SMP_APIC_MAP_SIZE - 1);
+        }
+        apic_to_cpu[slot].apic_id = processors[i].apic_id;
+        apic_to_cpu[slot].cpu = (uint16_t)(i + 1);
+    }
+    cpumask_set(&smp_online_mask, smp_cpu_from_apic());
+}
+
+/**
+ * @brief Marks the calling AP online. From here on it is counted by `smp_run_on_cpus()` and
+ *        receives TLB shootdowns, so it must poll for work with interrupts enabled.
+ */
+void smp_cpu_online(void) {
+    uint32_t cpu = smp_processor_id();
+
+    smp_work_seen[cpu] = __atomic_load_n(&smp_work.generation, __ATOMIC_ACQUIRE);   /* work published before now is not ours */
+    cpumask_set(&smp_online_mask, cpu);
+    __atomic_add_fetch(&smp_online_count, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Looks the calling CPU up by its APIC ID. It executes CPUID, which traps in a guest,
+ *        so it is only used to find the per-CPU area that `smp_processor_id()` reads.
+ */
+uint32_t smp_cpu_from_apic(void) {
+    uint32_t eax, ebx, ecx, edx, id, slot;
+
+    if (x2apic_enabled) {
+        cpuid(CPUID_TOPOLOGY, 0, eax, ebx, ecx, edx);
+        id = edx;                                                                   /* 32-bit x2APIC ID */
+    } else {
+        cpuid(CPUID_FEATURES, 0, eax, ebx, ecx, edx);
+        id = ebx >> 24;                                                             /* initial APIC ID */
+    }
+
+    for (slot = id & (SMP_APIC_MAP_SIZE - 1); apic_to_cpu[slot].cpu != 0; slot = (slot + 1) & (SMP_APIC_MAP_SIZE - 1)) {
+        if (apic_to_cpu[slot].apic_id == id) {
+            return apic_to_cpu[slot].cpu - 1U;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Runs `fn(arg)` on `count` online CPUs, at most all of them, and returns once all of
+ *        them finished: the caller and the first `count - 1` APs to pick the work up in
+ *        `smp_poll_work()`. Which APs those are is not fixed, so `fn` must find its CPU with
+ *        `smp_processor_id()` rather than assume indexes below `count`.
+ */
+void smp_run_on_cpus(void (*fn)(void *arg), void *arg, uint32_t count) {
+    uint32_t self = smp_processor_id(), cpu;
+
+    count = count > smp_online_count ? smp_online_count : count;
+    count = count ? count : 1;
+
+    smp_work.fn = fn;
+    smp_work.arg = arg;
+    smp_work.count = count;
+    __atomic_store_n(&smp_work.joined, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&smp_work.pending, smp_online_count - 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&smp_work.generation, 1, __ATOMIC_RELEASE);                  /* publishes the work */
+    for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+        if (cpu != self && cpumask_test(&smp_online_mask, cpu)) {
+            sched_kick(cpu);                                                        /* every AP acknowledges, halted ones too */
+        }
+    }
+
+    fn(arg);
+    while (__atomic_load_n(&smp_work.pending, __ATOMIC_ACQUIRE) != 0) {
+        cpu_relax();
+    }
+}
+
+/**
+ * @brief Runs the work published by `smp_run_on_cpus()`, if there is any for this CPU. Idle
+ *        APs call it in their wait loop.
+ */
+void smp_poll_work(void) {
+    uint32_t cpu = smp_processor_id();
+    uint64_t generation = __atomic_load_n(&smp_work.generation, __ATOMIC_ACQUIRE);
+
+    if (generation == smp_work_seen[cpu]) {
+        return;
+    }
+    smp_work_seen[cpu] = generation;
+
+    if (__atomic_fetch_add(&smp_work.joined, 1, __ATOMIC_RELAXED) < smp_work.count - 1) {
+        smp_work.fn(smp_work.arg);
+    }
+    __atomic_fetch_sub(&smp_work.pending, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Whether `smp_run_on_cpus()` published work the calling CPU did not look at yet.
+ */
+int smp_work_pending(void) {
+    return __atomic_load_n(&smp_work.generation, __ATOMIC_ACQUIRE) != smp_work_seen[smp_processor_id()];
+}
@@ -0,0 +1,509 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include <acpi.h>
+#include <list.h>
+#include <printk.h>
+#include <smp.h>
+#include <spinlock.h>
+#include <timer.h>
+#include <mm/pmm.h>
+
+#include <arch/clock.h>
+#include <arch/cpu.h>
+#include <arch/default_idt.h>
+#include <arch/paging.h>
+#include <arch/tsc.h>
+#include <arch/apic/apic.h>
+#include <arch/apic/ipi.h>
+
+extern void timer_kick_entry(void);
+
+static struct timer_base *timer_bases;
+static struct cpumask timer_idle_mask;
+
+static inline uint64_t timer_ror(uint64_t bits, uint32_t count) {
+    count &= 63;
+    return count ? (bits >> count) | (bits << (64 - count)) : bits;
+}
+
+static void timer_base_init(struct timer_base *base, uint64_t clk) {
+    uint32_t level, index;
+
+    spin_lock_init(&base->lock);
+    base->clk = clk;
+    base->next_event = TIMER_NO_EVENT;
+    base->count = 0;
+    for (level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+        base->occupied[level] = 0;
+        for (index = 0; index < TIMER_WHEEL_SLOTS; ++index) {
+            list_init(&base->slots[level][index]);
+        }
+    }
+}
+
+/**
+ * @brief Puts `timer` in the slot its expiry falls in, relative to `base->clk`. Overdue
+ *        timers go to the slot expired next and timers beyond the wheel to its last slot.
+ */
+static void timer_enqueue(struct timer_base *base, struct timer *timer) {
+    uint64_t tick = (timer->expires + TIMER_TICK_NS - 1) >> TIMER_TICK_SHIFT, delta;
+    uint32_t level = 0, index;
+
+    if (tick < base->clk) {
+        tick = base->clk;
+    }
+    delta = tick - base->clk;
+    if (delta >= TIMER_WHEEL_RANGE) {
+        delta = TIMER_WHEEL_RANGE - 1;                                              /* cascaded until it is in range */
+        tick = base->clk + delta;
+    }
+    while (delta >= (1ULL << (TIMER_WHEEL_BITS * (level + 1)))) {
+        ++level;
+    }
+
+    index = (tick >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+    timer->slot = (uint16_t)(level * TIMER_WHEEL_SLOTS + index);
+    list_add_tail(&timer->entry, &base->slots[level][index]);
+    base->occupied[level] |= 1ULL << index;
+}
+
+static void timer_dequeue(struct timer_base *base, struct timer *timer) {
+    uint32_t level = timer->slot / TIMER_WHEEL_SLOTS, index = timer->slot % TIMER_WHEEL_SLOTS;
+
+    list_del(&timer->entry);
+    if (list_empty(&base->slots[level][index])) {
+        base->occupied[level] &= ~(1ULL << index);
+    }
+    --base->count;
+}
+
+/**
+ * @brief Re-sorts the slots of the higher levels that `base->clk` just entered. Called when
+ *        the level 0 index wraps to 0; a level is only cascaded if the one below wrapped too.
+ */
+static void timer_cascade(struct timer_base *base) {
+    struct list_head work, *pos, *tmp;
+    uint32_t level, index;
+
+    for (level = 1; level < TIMER_WHEEL_LEVELS; ++level) {
+        index = (base->clk >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+        if (base->occupied[level] & (1ULL << index)) {
+            list_replace_init(&base->slots[level][index], &work);                   /* timers may land in the same slot again */
+            base->occupied[level] &= ~(1ULL << index);
+            list_for_each_safe(pos, tmp, &work) {
+                list_del(pos);
+                timer_enqueue(base, list_entry(pos, struct timer, entry));
+            }
+        }
+        if (index != 0) {
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Gets the first tick at which `base` has work: a level 0 slot to expire or a higher
+ *        slot to cascade. Empty stretches of the wheel are skipped by bitmap, not by tick.
+ */
+static uint64_t timer_next_tick(const struct timer_base *base) {
+    uint64_t next = TIMER_NO_EVENT, bits, position, tick;
+    uint32_t level, shift;
+
+    if (base->count == 0) {
+        return TIMER_NO_EVENT;
+    }
+    bits = timer_ror(base->occupied[0], base->clk & TIMER_WHEEL_MASK);
+    if (bits) {
+        next = base->clk + __builtin_ctzll(bits);
+    }
+    for (level = 1; level < TIMER_WHEEL_LEVELS; ++level) {
+        shift = TIMER_WHEEL_BITS * level;
+        position = base->clk >> shift;
+        if (base->clk & ((1ULL << shift) - 1)) {
+            ++position;                                                             /* the current slot was cascaded already */
+        }
+        bits = timer_ror(base->occupied[level], position & TIMER_WHEEL_MASK);
+        if (bits) {
+            tick = (position + __builtin_ctzll(bits)) << shift;
+            next = tick < next ? tick : next;
+        }
+    }
+    return next;
+}
+
+/**
+ * @brief Expires every timer of `base` due at or before tick `now`. The lock is held on entry
+ *        and exit but dropped around each callback, which may add timers of its own.
+ *
+ * @return The number of timers that fired.
+ */
+static uint64_t timer_expire(struct timer_base *base, uint64_t now, uint64_t *flags) {
+    struct list_head work;
+    struct timer *timer;
+    uint64_t bits, step, fired = 0;
+    uint32_t index;
+
+    while (base->clk <= now) {
+        index = base->clk & TIMER_WHEEL_MASK;
+        if (index == 0) {
+            timer_cascade(base);
+        }
+
+        bits = base->occupied[0] >> index;
+        step = bits ? (uint64_t)__builtin_ctzll(bits) : TIMER_WHEEL_SLOTS - index;  /* never past the next cascade */
+        if (step != 0) {
+            base->clk += step <= now - base->clk ? step : now - base->clk + 1;
+            continue;
+        }
+
+        list_replace_init(&base->slots[0][index], &work);
+        base->occupied[0] &= ~(1ULL << index);
+        ++base->clk;                                                                /* timers re-added as due go to the next slot */
+        while (!list_empty(&work)) {
+            timer = list_first_entry(&work, struct timer, entry);
+            list_del(&timer->entry);
+            --base->count;
+            ++fired;
+
+            spin_unlock_irqrestore(&base->lock, *flags);
+            timer->fn(timer);
+            spin_lock_irqsave(&base->lock, *flags);
+        }
+    }
+    return fired;
+}
+
+/**
+ * @brief Arms the clock event of the calling CPU for the next tick `base` has work at, unless
+ *        it is already armed for it.
+ */
+static void timer_program(struct timer_base *base) {
+    uint64_t next = timer_next_tick(base);
+
+    if (next == base->next_event) {
+        return;
+    }
+    base->next_event = next;
+    if (next == TIMER_NO_EVENT) {
+        clock_event_cancel();
+    } else {
+        clock_event_program(next << TIMER_TICK_SHIFT);
+    }
+}
+
+/**
+ * @brief Locks the base `timer` is queued on. The timer may be migrated while we wait, so the
+ *        base is checked again under the lock.
+ */
+static struct timer_base *timer_lock_base(struct timer *timer, uint64_t *flags) {
+    struct timer_base *base;
+    uint32_t cpu;
+
+    while (1) {
+        cpu = timer->cpu;
+        base = &timer_bases[cpu];
+        spin_lock_irqsave(&base->lock, *flags);
+        if (timer->cpu == cpu) {
+            return base;
+        }
+        spin_unlock_irqrestore(&base->lock, *flags);
+    }
+}
+
+/**
+ * @brief Sets up one timer base per CPU in the MADT and takes over the clock events. Must run
+ *        after `clock_init()`, `smp_init()` and `pmm_init()`.
+ *
+ * @return `TIMER_SUCCESS` on success, `TIMER_NO_MEMORY` if the bases cannot be allocated.
+ */
+int32_t timer_init(void) {
+    uint64_t bytes = (uint64_t)smp_cpu_count * sizeof(struct timer_base), now;
+    uint32_t order = 0, cpu;
+    struct page *page;
+
+    while ((PAGE_SIZE << order) < bytes) {
+        ++order;
+    }
+    if ((page = pmm_alloc_pages(order)) == NULL) {
+        return TIMER_NO_MEMORY;
+    }
+
+    timer_bases = phys_to_virt(page_to_phys(page));
+    now = clock_monotonic_ns() >> TIMER_TICK_SHIFT;
+    for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+        timer_base_init(&timer_bases[cpu], now);
+    }
+
+    idt_set_gate(APIC_VECTOR_TIMER_KICK, timer_kick_entry);
+    clock_event_set_handler(timer_run);
+    printk("timer: %u levels of %u slots, tick %lu ns, %lu bytes per cpu\n", TIMER_WHEEL_LEVELS,
+           TIMER_WHEEL_SLOTS, (uint64_t)TIMER_TICK_NS, (uint64_t)sizeof(struct timer_base));
+    return TIMER_SUCCESS;
+}
+
+/**
+ * @brief Initializes `timer` to call `fn` when it expires.
+ */
+void timer_setup(struct timer *timer, void (*fn)(struct timer *timer), uint16_t flags) {
+    list_init(&timer->entry);
+    timer->expires = 0;
+    timer->fn = fn;
+    timer->cpu = 0;
+    timer->flags = flags;
+    timer->slot = 0;
+}
+
+/**
+ * @brief Queues `timer` on the calling CPU to fire at `expires`, rounded up to the next tick.
+ *        A pending timer is moved. The hardware is only reprogrammed if this is now the
+ *        earliest timer of the CPU.
+ */
+void timer_add(struct timer *timer, uint64_t expires) {
+    struct timer_base *base;
+    uint64_t flags;
+
+    timer_cancel(timer);
+
+    flags = arch_irq_save();
+    base = &timer_bases[smp_processor_id()];
+    spin_lock(&base->lock);
+    if (base->count == 0) {
+        base->clk = clock_monotonic_ns() >> TIMER_TICK_SHIFT;                       /* skip the ticks an empty wheel slept through */
+    }
+    timer->expires = expires;
+    timer->cpu = (uint32_t)(base - timer_bases);
+    timer_enqueue(base, timer);
+    ++base->count;
+    timer_program(base);
+    spin_unlock_irqrestore(&base->lock, flags);
+}
+
+/**
+ * @brief Dequeues `timer`. It does not wait for a callback that is already running.
+ *
+ * @return 1 if the timer was pending, 0 otherwise.
+ */
+int timer_cancel(struct timer *timer) {
+    struct timer_base *base;
+    uint64_t flags;
+    int pending;
+
+    base = timer_lock_base(timer, &flags);
+    pending = timer_pending(timer);
+    if (pending) {
+        timer_dequeue(base, timer);
+    }
+    spin_unlock_irqrestore(&base->lock, flags);
+    return pending;
+}
+
+/**
+ * @brief Runs the expired timers of the calling CPU and arms the clock event for the next
+ *        one. Called from the clock event interrupt.
+ */
+void timer_run(void) {
+    struct timer_base *base = &timer_bases[smp_processor_id()];
+    uint64_t flags;
+
+    spin_lock_irqsave(&base->lock, flags);
+    base->next_event = TIMER_NO_EVENT;                                              /* the armed event has fired */
+    timer_expire(base, clock_monotonic_ns() >> TIMER_TICK_SHIFT, &flags);
+    timer_program(base);
+    spin_unlock_irqrestore(&base->lock, flags);
+}
+
+/**
+ * @brief Finds an online CPU other than `self` that is not idle.
+ */
+static uint32_t timer_find_busy_cpu(uint32_t self) {
+    uint32_t cpu;
+
+    for (cpu = 0; cpu < smp_cpu_count; ++cpu) {
+        if (cpu != self && cpumask_test(&smp_online_mask, cpu) && !cpumask_test(&timer_idle_mask, cpu)) {
+            return cpu;
+        }
+    }
+    return self;
+}
+
+/**
+ * @brief Marks the calling CPU idle and moves its timers that are not `TIMER_PINNED` to a
+ *        busy CPU, so that the idle one stops taking timer interrupts for them.
+ */
+void timer_cpu_idle(void) {
+    struct timer_base *from, *to, *first, *second;
+    struct list_head work, *pos, *tmp;
+    struct timer *timer;
+    uint32_t self, target, level, index;
+    uint64_t flags, earliest = TIMER_NO_EVENT;
+    int kick;
+
+    if (timer_bases == NULL) {
+        return;                                                                     /* `timer_init()` failed */
+    }
+    flags = arch_irq_save();
+    self = smp_processor_id();
+    cpumask_set(&timer_idle_mask, self);
+    target = timer_find_busy_cpu(self);
+    if (target == self) {
+        arch_irq_restore(flags);
+        return;                                                                     /* nobody to hand the timers to */
+    }
+
+    from = &timer_bases[self];
+    to = &timer_bases[target];
+    first = self < target ? from : to;                                              /* bases are locked in CPU order */
+    second = self < target ? to : from;
+    spin_lock(&first->lock);
+    spin_lock(&second->lock);
+
+    for (level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+        for (index = 0; index < TIMER_WHEEL_SLOTS; ++index) {
+            if (!(from->occupied[level] & (1ULL << index))) {
+                continue;
+            }
+            list_replace_init(&from->slots[level][index], &work);
+            from->occupied[level] &= ~(1ULL << index);
+            list_for_each_safe(pos, tmp, &work) {
+                timer = list_entry(pos, struct timer, entry);
+                list_del(pos);
+                if (timer->flags & TIMER_PINNED) {
+                    timer_enqueue(from, timer);
+                    continue;
+                }
+                --from->count;
+                if (to->count == 0) {
+                    to->clk = clock_monotonic_ns() >> TIMER_TICK_SHIFT;
+                }
+                timer->cpu = target;
+                timer_enqueue(to, timer);
+                ++to->count;
+                earliest = timer->expires < earliest ? timer->expires : earliest;
+            }
+        }
+    }
+    kick = earliest != TIMER_NO_EVENT
+           && (earliest + TIMER_TICK_NS - 1) >> TIMER_TICK_SHIFT < to->next_event;
+    timer_program(from);
+
+    spin_unlock(&second->lock);
+    spin_unlock(&first->lock);
+    if (kick) {
+        apic_send_ipi(processors[target].apic_id, APIC_VECTOR_TIMER_KICK);          /* only the target can arm its own timer */
+    }
+    arch_irq_restore(flags);
+}
+
+/**
+ * @brief Marks the calling CPU busy again. Timers added from now on stay on it.
+ */
+void timer_cpu_busy(void) {
+    cpumask_clear(&timer_idle_mask, smp_processor_id());
+}
+
+/**
+ * @brief Handler of `APIC_VECTOR_TIMER_KICK`, sent to a CPU that was handed timers earlier
+ *        than its armed clock event.
+ */
+void timer_kick_interrupt(void) {
+    struct timer_base *base = &timer_bases[smp_processor_id()];
+
+    apic_eoi();
+    spin_lock(&base->lock);
+    timer_program(base);
+    spin_unlock(&base->lock);
+}
+
+#if defined(NICKEL_BENCH)
+#define TIMER_BENCH_MAX                 1000000
+#define TIMER_BENCH_SPAN                (1ULL << 24)                                /* expiries spread over ~4.7 hours of ticks */
+
+static uint64_t timer_bench_fired;
+
+static void timer_bench_fn(struct timer *timer) {
+    ++timer_bench_fired;
+}
+
+/**
+ * @brief Runs one round on a private base, so that the per-CPU wheels and the clock events
+ *        are left alone: inserts `count` timers at random expiries, cancels every other one
+ *        and expires the rest by advancing the wheel past the last of them.
+ */
+static void timer_bench_round(struct timer_base *base, struct timer *timers, uint32_t count) {
+    uint64_t seed = 0x9E3779B97F4A7C15ULL, start, insert, cancel, expire, flags, now;
+    uint32_t i;
+
+    now = clock_monotonic_ns();
+    timer_base_init(base, now >> TIMER_TICK_SHIFT);
+    for (i = 0; i < count; ++i) {
+        timer_setup(&timers[i], timer_bench_fn, 0);
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        timers[i].expires = now + ((seed >> 24) % TIMER_BENCH_SPAN) * TIMER_TICK_NS;
+    }
+
+    start = rdtsc();
+    for (i = 0; i < count; ++i) {
+        spin_lock_irqsave(&base->lock, flags);
+        timer_enqueue(base, &timers[i]);
+        ++base->count;
+        spin_unlock_irqrestore(&base->lock, flags);
+    }
+    insert = rdtsc() - start;
+
+    start = rdtsc();
+    for (i = 0; i < count; i += 2) {
+        spin_lock_irqsave(&base->lock, flags);
+        timer_dequeue(base, &timers[i]);
+        spin_unlock_irqrestore(&base->lock, flags);
+    }
+    cancel = rdtsc() - start;
+
+    timer_bench_fired = 0;
+    start = rdtsc();
+    spin_lock_irqsave(&base->lock, flags);
+    timer_expire(base, (now >> TIMER_TICK_SHIFT) + TIMER_BENCH_SPAN + 1, &flags);
+    spin_unlock_irqrestore(&base->lock, flags);
+    expire = rdtsc() - start;
+
+    printk("timer: %7u pending: insert %4lu ns, cancel %4lu ns, expire %4lu ns per timer (%lu fired)\n",
+           count, tsc_to_ns(insert) / count, tsc_to_ns(cancel) / ((count + 1) / 2),
+           tsc_to_ns(expire) / (timer_bench_fired ? timer_bench_fired : 1), timer_bench_fired);
+}
+
+/**
+ * @brief Measures insert, cancel and expire throughput with 10^3 to 10^6 pending timers.
+ */
+void timer_bench(void) {
+    uint64_t bytes = (uint64_t)TIMER_BENCH_MAX * sizeof(struct timer);
+    uint32_t order = 0, base_order = 0, count;
+    struct page *page, *base_page;
+
+    while ((PAGE_SIZE << base_order) < sizeof(struct timer_base)) {
+        ++base_order;
+    }
+    if ((base_page = pmm_alloc_pages(base_order)) == NULL) {
+        printk("timer: bench skipped, no memory\n");
+        return;
+    }
+    while ((PAGE_SIZE << order) < bytes) {
+        ++order;
+    }
+    while ((page = pmm_alloc_pages(order)) == NULL && order > 0) {
+        --order;                                                                    /* settle for fewer timers */
+    }
+
+    for (count = 1000; count <= TIMER_BENCH_MAX && page != NULL; count *= 10) {
+        if ((uint64_t)count * sizeof(struct timer) > (PAGE_SIZE << order)) {
+            printk("timer: %7u pending: skipped, no memory\n", count);
+            continue;
+        }
+        timer_bench_round(phys_to_virt(page_to_phys(base_page)), phys_to_virt(page_to_phys(page)), count);
+    }
+
+    if (page != NULL) {
+        pmm_free_pages(page, order);
+    }
+    pmm_free_pages(base_page, base_order);
+}
+#endif
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+"""Turns the `boottrace:` lines a kernel prints over serial into a Chrome trace, or into
+per-phase medians over several boots.
+
+    boot_trace.py trace serial.log > boot.json     # open in chrome://tracing or Perfetto
+    boot_trace.py median boot1.log boot2.log ...
+"""
+
+import json
+import re
+import statistics
+import sys
+
+LINE = re.compile(r"boottrace: (\d+) (\d+) (loader|kernel) (.+?)\s*$")
+
+
+def parse(path):
+    """Returns the phases of one boot as (name, source, start_ns, end_ns), in order."""
+    phases = []
+    with open(path, errors="replace") as log:
+        for line in log:
+            match = LINE.search(line)
+            if match:
+                start, end, source, name = match.groups()
+                phases.append((name, source, int(start), int(end)))
+    return phases
+
+
+def trace(path):
+    events = [{
+        "name": name,
+        "cat": source,
+        "ph": "X",
+        "ts": start / 1000.0,
+        "dur": (end - start) / 1000.0,
+        "pid": 1,
+        "tid": 1 if source == "loader" else 2,
+    } for name, source, start, end in parse(path)]
+    events += [{"name": "thread_name", "ph": "M", "pid": 1, "tid": tid, "args": {"name": name}}
+               for tid, name in ((1, "loader"), (2, "kernel"))]
+    json.dump({"traceEvents": events, "displayTimeUnit": "ms"}, sys.stdout, indent=1)
+    print()
+
+
+def median(paths):
+    boots = [phases for phases in map(parse, paths) if phases]
+    if not boots:
+        sys.exit("no boottrace lines found")
+
+    order, durations, totals = [], {}, []
+    for phases in boots:
+        for name, _, start, end in phases:
+            if name not in durations:
+                order.append(name)
+                durations[name] = []
+            durations[name].append(end - start)
+        totals.append(phases[-1][3])
+
+    print(f"{len(boots)} boots, median per phase")
+    print(f"{'phase':<16} {'us':>10} {'min us':>10} {'max us':>10}")
+    for name in order:
+        values = durations[name]
+        print(f"{name:<16} {statistics.median(values) / 1000:>10.0f} "
+              f"{min(values) / 1000:>10.0f} {max(values) / 1000:>10.0f}")
+    print(f"{'total':<16} {statistics.median(totals) / 1000:>10.0f} "
+          f"{min(totals) / 1000:>10.0f} {max(totals) / 1000:>10.0f}")
+
+
+def main():
+    if len(sys.argv) == 3 and sys.argv[1] == "trace":
+        trace(sys.argv[2])
+    elif len(sys.argv) >= 3 and sys.argv[1] == "median":
+        median(sys.argv[2:])
+    else:
+        sys.exit(__doc__)
+
+
+if __name__ == "__main__":
+    main()